@@ -1492,19 +1492,18 @@ static void arexx_readsave(struct RexxMsg *rxmsg, STRPTR args)
 			BPTR fh;
 			int ok = 0;
 
-			mail_decode(mail);
-
 			fh = Open(readsave_arg.filename,MODE_OLDFILE);
 			if (fh) Close(fh);
 			else ok = 1;
 
 			if (ok || readsave_arg.overwrite)
 			{
-				if ((fh = Open(readsave_arg.filename, MODE_NEWFILE)))
+				FILE *out;
+
+				if ((out = fopen(readsave_arg.filename, "wb")))
 				{
-					if (!mail->decoded_data) Write(fh,mail->text + mail->text_begin,mail->text_len);
-					Write(fh,mail->decoded_data,mail->decoded_len);
-					Close(fh);
+					mail_decoded_data_write(mail,out);
+					fclose(out);
 				}
 			}
 		}
@@ -936,7 +936,8 @@ static void compose_add_mail(struct Compose_Data *data, struct mail_complete *ma
 
 	for (i=0;i<num_multiparts; i++)
 	{
-		compose_add_mail(data,mail->multipart_array[i],treenode);
+		struct mail_complete *part = mail_get_part(mail,i);
+		if (part) compose_add_mail(data,part,treenode);
 	}
 }
 
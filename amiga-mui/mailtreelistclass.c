@@ -965,13 +965,13 @@ STATIC ULONG MailTreelist_Clear(struct IClass *cl, Object *obj, Msg msg)
 /******************************************************************
  Updates the mail trees with the mails in the given folder
 *******************************************************************/
-static void main_insert_mail_threaded(Object *obj, struct mail *mail, void *parentnode)
+static void main_insert_mail_threaded(Object *obj, struct folder *folder, struct mail *mail, void *parentnode)
 {
 	int mail_flags = 0;
 	struct mail *submail;
 	APTR newnode;
 
-	if ((submail = mail->sub_thread_mail))
+	if ((submail = folder_get_thread_first_child(folder, mail)))
 	{
 		mail_flags = TNF_LIST|TNF_OPEN;
 	}
@@ -981,8 +981,8 @@ static void main_insert_mail_threaded(Object *obj, struct mail *mail, void *pare
 
 	while (submail)
 	{
-		main_insert_mail_threaded(obj,submail,newnode);
-		submail = submail->next_thread_mail;
+		main_insert_mail_threaded(obj,folder,submail,newnode);
+		submail = folder_get_thread_next_sibling(folder, submail);
 	}
 }
 #endif
@@ -1081,8 +1081,8 @@ STATIC ULONG MailTreelist_SetFolderMails(struct IClass *cl, Object *obj, struct
 
 			while ((m = folder_next_mail(folder,&handle)))
 			{
-				if (!m->child_mail)
-					main_insert_mail_threaded(obj, m,(void*)MUIV_NListtree_Insert_ListNode_Root);
+				if (!folder_get_thread_parent(folder, m))
+					main_insert_mail_threaded(obj, folder, m,(void*)MUIV_NListtree_Insert_ListNode_Root);
 			}
 		}
 	}
@@ -554,7 +554,8 @@ static void messageview_append_as_mail(struct MessageView_Data *data, struct mai
 
 	for (i=0;i<mail->num_multiparts;i++)
 	{
-		messageview_append_as_mail(data,mail->multipart_array[i],str);
+		struct mail_complete *part = mail_get_part(mail,i);
+		if (part) messageview_append_as_mail(data,part,str);
 	}
 }
 
@@ -579,8 +580,9 @@ static void messageview_append_as_attachment(struct MessageView_Data *data, stru
 
 	for (i=0;i<mail->num_multiparts;i++)
 	{
-		struct mail_complete *m = mail->multipart_array[i];
+		struct mail_complete *m = mail_get_part(mail,i);
 
+		if (!m) continue;
 		if (initial_mail == m) mystrlcpy(content_name,_("Main Message"),sizeof(content_name));
 		else
 		{
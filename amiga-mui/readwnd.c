@@ -528,7 +528,8 @@ static void insert_mail(struct Read_Data *data, struct mail_complete *mail)
 
 	for (i=0;i<mail->num_multiparts;i++)
 	{
-		insert_mail(data,mail->multipart_array[i]);
+		struct mail_complete *part = mail_get_part(mail,i);
+		if (part) insert_mail(data,part);
 	}
 }
 
@@ -565,7 +566,6 @@ static int save_contents_to(struct Read_Data *data, struct mail_complete *mail,
 {
 	int rc = 0;
 	BPTR dlock;
-	mail_decode(mail);
 
 	if (!file) file = "Unnamed";
 
@@ -658,24 +658,21 @@ static int save_contents_to(struct Read_Data *data, struct mail_complete *mail,
 
     if (goon)
     {
-			if ((fh = Open(file, MODE_NEWFILE)))
+			FILE *out;
+
+			/* Attachments are decoded piece by piece while written */
+			if ((out = fopen(file, "wb")))
 			{
 				char *comment = mail_get_from_address(mail_get_root(mail)->info);
-				void *cont;
-				int cont_len;
 
-				mail_decoded_data(mail,&cont,&cont_len);
-
-				Write(fh,cont,cont_len);
-				Close(fh);
+				rc = mail_decoded_data_write(mail,out);
+				if (fclose(out)) rc = 0;
 
 				if (comment)
 				{
 					SetComment(file,comment);
 					free(comment);
 				}
-
-				rc = 1;
 			}
 		}
 
@@ -749,7 +746,8 @@ static int save_all_attachments_of_mail(struct Read_Data *data, struct mail_comp
 
 		for (i=0;i<mail->num_multiparts;i++)
 		{
-			if (!save_all_attachments_of_mail(data,mail->multipart_array[i],drawer))
+			struct mail_complete *part = mail_get_part(mail,i);
+			if (part && !save_all_attachments_of_mail(data,part,drawer))
 				return 0;
 		}
 
@@ -1200,7 +1198,7 @@ static int read_window_display_mail(struct Read_Data *data, struct mail_info *ma
 			mail_read_contents(NULL,data->mail); /* already cd'ed in correct dir */
 			mail_create_html_header(data->mail,0);
 
-			if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && !data->mail->multipart_array[0]->num_multiparts))
+			if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && (!mail_get_part(data->mail,0) || !mail_get_part(data->mail,0)->num_multiparts)))
 			{
 				/* mail has only one part */
 				set(data->attachments_group, MUIA_ShowMe, FALSE);
@@ -21,6 +21,7 @@
  */
 
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -427,6 +428,41 @@ int sm_match_pattern(char *pat, utf8 *utf8_str, int flags)
 
 /*****************************************************************************/
 
+void *sm_map_file(const char *filename, unsigned long *size_ptr)
+{
+	FILE *fh;
+	void *mem = NULL;
+	long size;
+
+	/* There is no memory mapping, so simply read the entire file */
+	if (!(fh = fopen(filename, "rb")))
+		return NULL;
+
+	if (fseek(fh, 0, SEEK_END) == 0 && (size = ftell(fh)) > 0 && fseek(fh, 0, SEEK_SET) == 0)
+	{
+		if ((mem = malloc(size)))
+		{
+			if (fread(mem, 1, size, fh) == size)
+			{
+				*size_ptr = size;
+			} else
+			{
+				free(mem);
+				mem = NULL;
+			}
+		}
+	}
+	fclose(fh);
+	return mem;
+}
+
+/*****************************************************************************/
+
+void sm_unmap_file(void *mem, unsigned long size)
+{
+	free(mem);
+}
+
 int sm_snprintf(char *buf, int n, const char *fmt, ...)
 {
   int r;
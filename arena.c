@@ -0,0 +1,168 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file arena.c
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** The alignment of all allocations */
+#define ARENA_ALIGN (sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double))
+
+struct arena_chunk
+{
+	struct arena_chunk *next;
+	unsigned int size; /* usable size */
+	unsigned int used;
+	double data[1]; /* for the alignment */
+};
+
+struct arena
+{
+	struct arena_chunk *chunks; /* the current chunk comes first */
+	unsigned int chunk_size;
+	unsigned long total_size;
+	int reference_count;
+};
+
+/*****************************************************************************/
+
+struct arena *arena_create(unsigned int chunk_size)
+{
+	struct arena *a;
+
+	if (!(a = (struct arena*)malloc(sizeof(*a))))
+		return NULL;
+
+	a->chunks = NULL;
+	a->chunk_size = chunk_size;
+	a->total_size = 0;
+	a->reference_count = 1;
+	return a;
+}
+
+/*****************************************************************************/
+
+/**
+ * Allocates a new chunk and links it into the given arena.
+ *
+ * @param a the arena.
+ * @param size the minimum usable size of the chunk.
+ * @param current whether the chunk shall become the current chunk.
+ * @return the chunk or NULL on failure.
+ */
+static struct arena_chunk *arena_add_chunk(struct arena *a, unsigned int size, int current)
+{
+	struct arena_chunk *c;
+
+	if (!(c = (struct arena_chunk*)malloc(sizeof(*c) - sizeof(c->data) + size)))
+		return NULL;
+
+	c->size = size;
+	c->used = 0;
+	a->total_size += size;
+
+	if (current || !a->chunks)
+	{
+		c->next = a->chunks;
+		a->chunks = c;
+	} else
+	{
+		/* Keep the current chunk as it may still have room */
+		c->next = a->chunks->next;
+		a->chunks->next = c;
+	}
+	return c;
+}
+
+/*****************************************************************************/
+
+void *arena_alloc(struct arena *a, unsigned int size)
+{
+	struct arena_chunk *c;
+	void *mem;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	c = a->chunks;
+	if (!c || c->size - c->used < size)
+	{
+		/* Large allocations get their own chunk */
+		if (size > a->chunk_size / 4)
+			c = arena_add_chunk(a, size, 0);
+		else
+			c = arena_add_chunk(a, a->chunk_size, 1);
+		if (!c)
+			return NULL;
+	}
+
+	mem = ((char*)c->data) + c->used;
+	c->used += size;
+	return mem;
+}
+
+/*****************************************************************************/
+
+char *arena_strdup(struct arena *a, const char *str)
+{
+	unsigned int len;
+	char *dup;
+
+	if (!str)
+		return NULL;
+
+	len = strlen(str) + 1;
+	if ((dup = (char*)arena_alloc(a, len)))
+		memcpy(dup, str, len);
+	return dup;
+}
+
+/*****************************************************************************/
+
+void arena_ref(struct arena *a)
+{
+	a->reference_count++;
+}
+
+/*****************************************************************************/
+
+void arena_unref(struct arena *a)
+{
+	struct arena_chunk *c;
+
+	if (!a) return;
+	if (--a->reference_count > 0) return;
+
+	while ((c = a->chunks))
+	{
+		a->chunks = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/*****************************************************************************/
+
+unsigned long arena_size(struct arena *a)
+{
+	return a->total_size;
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file arena.h
+ *
+ * A simple region allocator. Memory is handed out from large chunks and is
+ * never freed individually. All chunks are freed at once when the last
+ * reference to the arena is given up.
+ */
+
+#ifndef SM__ARENA_H
+#define SM__ARENA_H
+
+struct arena;
+
+/**
+ * Creates a new arena with a single reference.
+ *
+ * @param chunk_size the size of the chunks from which memory is taken.
+ * @return the arena or NULL on failure.
+ */
+struct arena *arena_create(unsigned int chunk_size);
+
+/**
+ * Allocates memory from the given arena. The memory is suitably aligned
+ * for any kind of object.
+ *
+ * @param a the arena.
+ * @param size the number of bytes to allocate.
+ * @return the memory or NULL on failure.
+ */
+void *arena_alloc(struct arena *a, unsigned int size);
+
+/**
+ * Duplicates the given string within the given arena.
+ *
+ * @param a the arena.
+ * @param str the string to duplicate. May be NULL.
+ * @return the duplicate or NULL if str was NULL or on failure.
+ */
+char *arena_strdup(struct arena *a, const char *str);
+
+/**
+ * Adds a reference to the given arena.
+ *
+ * @param a the arena.
+ */
+void arena_ref(struct arena *a);
+
+/**
+ * Gives up a reference to the given arena. The arena and all memory that
+ * has been allocated from it is freed when the last reference is gone.
+ *
+ * @param a the arena. May be NULL.
+ */
+void arena_unref(struct arena *a);
+
+/**
+ * @param a the arena.
+ * @return the number of bytes that have been allocated from the system for
+ *  the given arena.
+ */
+unsigned long arena_size(struct arena *a);
+
+#endif
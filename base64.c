@@ -0,0 +1,342 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file base64.c
+ *
+ * The vector implementations follow the lookup and shuffle approach of
+ * Wojciech Mula and Alfred Klomp. Each byte is split into its nibbles which
+ * select entries of small tables via pshufb. When decoding, the tables
+ * classify the characters, so a block that contains a character outside of
+ * the alphabet is detected and left to the scalar implementation. Thus, all
+ * implementations produce the same results. The sextets are then merged
+ * via multiply-add instructions and shuffled to their final positions.
+ */
+
+#include "base64.h"
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_HAVE_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned int (*base64_encode_groups_t)(const unsigned char *src, unsigned int len, char *dest);
+typedef unsigned int (*base64_decode_groups_t)(const unsigned char *src, unsigned int len, unsigned char *dest);
+
+/* encoding table for the base64 coding */
+static const char base64_encoding_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* decoding table for the base64 coding, -1 marks characters that are not
+ * part of the alphabet */
+static const signed char base64_decoding_table[256] =
+{
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+	52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+	15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+	-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+	41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+/*****************************************************************************/
+
+static unsigned int base64_encode_groups_scalar(const unsigned char *src, unsigned int len, char *dest)
+{
+	unsigned int pos;
+
+	for (pos = 0; len - pos >= 3; pos += 3)
+	{
+		unsigned int v = (src[pos] << 16) | (src[pos + 1] << 8) | src[pos + 2];
+
+		*dest++ = base64_encoding_table[v >> 18];
+		*dest++ = base64_encoding_table[(v >> 12) & 0x3f];
+		*dest++ = base64_encoding_table[(v >> 6) & 0x3f];
+		*dest++ = base64_encoding_table[v & 0x3f];
+	}
+	return pos;
+}
+
+/*****************************************************************************/
+
+static unsigned int base64_decode_groups_scalar(const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	unsigned int pos;
+
+	for (pos = 0; len - pos >= 4; pos += 4)
+	{
+		int a = base64_decoding_table[src[pos]];
+		int b = base64_decoding_table[src[pos + 1]];
+		int c = base64_decoding_table[src[pos + 2]];
+		int d = base64_decoding_table[src[pos + 3]];
+		unsigned int v;
+
+		if ((a | b | c | d) < 0)
+			break;
+
+		v = (a << 18) | (b << 12) | (c << 6) | d;
+		*dest++ = (unsigned char)(v >> 16);
+		*dest++ = (unsigned char)(v >> 8);
+		*dest++ = (unsigned char)v;
+	}
+	return pos;
+}
+
+/*****************************************************************************/
+
+#ifdef BASE64_HAVE_X86
+
+/* The 16 byte steps are always inlined so that they are VEX encoded when
+ * used by the AVX2 implementations. Calling legacy SSE code with dirty
+ * upper halves of the ymm registers is very expensive. */
+#define BASE64_INLINE_SSSE3 __attribute__((target("ssse3"), always_inline)) static inline
+
+/**
+ * Encodes 12 bytes to 16 characters.
+ *
+ * @param src the bytes, 16 bytes are loaded.
+ * @param dest where to store the 16 characters.
+ */
+BASE64_INLINE_SSSE3 void base64_encode_step_ssse3(const unsigned char *src, char *dest)
+{
+	const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	__m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);
+	__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	__m128i sextets = _mm_or_si128(t0, t1);
+
+	/* Map the sextets to the five ranges of the alphabet */
+	__m128i indices = _mm_sub_epi8(_mm_subs_epu8(sextets, _mm_set1_epi8(51)), _mm_cmpgt_epi8(sextets, _mm_set1_epi8(25)));
+
+	_mm_storeu_si128((__m128i *)dest, _mm_add_epi8(sextets, _mm_shuffle_epi8(lut, indices)));
+}
+
+/**
+ * Decodes 16 characters to 12 bytes if all of them are part of the alphabet.
+ *
+ * @param src the characters.
+ * @param dest where to store the bytes, 16 bytes are stored.
+ * @return 1 if the characters have been decoded, 0 if there was a character
+ *  that is not part of the alphabet.
+ */
+BASE64_INLINE_SSSE3 int base64_decode_step_ssse3(const unsigned char *src, unsigned char *dest)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	__m128i in = _mm_loadu_si128((const __m128i *)src);
+	__m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+	__m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+	__m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+	__m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+	__m128i sextets;
+
+	/* Characters outside of the alphabet have a common bit in both classes */
+	if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+		return 0;
+
+	sextets = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles)));
+	sextets = _mm_madd_epi16(_mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+
+	/* 16 bytes are stored, but only 12 are valid */
+	_mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(sextets, shuffle));
+	return 1;
+}
+
+/*****************************************************************************/
+
+__attribute__((target("ssse3")))
+static unsigned int base64_encode_groups_ssse3(const unsigned char *src, unsigned int len, char *dest)
+{
+	unsigned int pos = 0;
+
+	/* 16 bytes are loaded, but only 12 are encoded */
+	for (; len - pos >= 16; pos += 12, dest += 16)
+		base64_encode_step_ssse3(src + pos, dest);
+	return pos + base64_encode_groups_scalar(src + pos, len - pos, dest);
+}
+
+/*****************************************************************************/
+
+__attribute__((target("ssse3")))
+static unsigned int base64_decode_groups_ssse3(const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	unsigned int pos = 0;
+
+	for (; len - pos >= 16 && base64_decode_step_ssse3(src + pos, dest); pos += 16, dest += 12);
+	return pos + base64_decode_groups_scalar(src + pos, len - pos, dest);
+}
+
+/*****************************************************************************/
+
+__attribute__((target("avx2")))
+static unsigned int base64_encode_groups_avx2(const unsigned char *src, unsigned int len, char *dest)
+{
+	const __m256i lut = _mm256_broadcastsi128_si256(_mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0));
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	unsigned int pos = 0;
+
+	/* Each lane encodes 12 bytes, the second lane's are loaded from an
+	 * offset of 12, so 28 bytes must be available */
+	while (len - pos >= 28)
+	{
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + pos))),
+			_mm_loadu_si128((const __m128i *)(src + pos + 12)), 1);
+		__m256i t0, t1, sextets, indices;
+
+		in = _mm256_shuffle_epi8(in, shuffle);
+		t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		sextets = _mm256_or_si256(t0, t1);
+
+		indices = _mm256_sub_epi8(_mm256_subs_epu8(sextets, _mm256_set1_epi8(51)), _mm256_cmpgt_epi8(sextets, _mm256_set1_epi8(25)));
+
+		_mm256_storeu_si256((__m256i *)dest, _mm256_add_epi8(sextets, _mm256_shuffle_epi8(lut, indices)));
+		pos += 24;
+		dest += 32;
+	}
+	for (; len - pos >= 16; pos += 12, dest += 16)
+		base64_encode_step_ssse3(src + pos, dest);
+	return pos + base64_encode_groups_scalar(src + pos, len - pos, dest);
+}
+
+/*****************************************************************************/
+
+__attribute__((target("avx2")))
+static unsigned int base64_decode_groups_avx2(const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+	const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+	const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	unsigned int pos = 0;
+
+	while (len - pos >= 32)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i *)(src + pos));
+		__m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+		__m256i lo_nibbles = _mm256_and_si256(in, mask_2f);
+		__m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		__m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		__m256i sextets;
+
+		if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256())))
+			break;
+
+		sextets = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles)));
+		sextets = _mm256_madd_epi16(_mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+
+		/* Each lane holds 12 valid bytes, move them together. 32 bytes are
+		 * stored, but only 24 are valid */
+		sextets = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(sextets, shuffle), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+		_mm256_storeu_si256((__m256i *)dest, sextets);
+		pos += 32;
+		dest += 24;
+	}
+	for (; len - pos >= 16 && base64_decode_step_ssse3(src + pos, dest); pos += 16, dest += 12);
+	return pos + base64_decode_groups_scalar(src + pos, len - pos, dest);
+}
+
+#endif
+
+/*****************************************************************************/
+
+/**
+ * The implementations in use. They are changed only by base64_select(),
+ * which is called at startup before any other task exists.
+ */
+static base64_encode_groups_t base64_encode_groups_impl = base64_encode_groups_scalar;
+static base64_decode_groups_t base64_decode_groups_impl = base64_decode_groups_scalar;
+
+/*****************************************************************************/
+
+unsigned int base64_encode_groups(const unsigned char *src, unsigned int len, char *dest)
+{
+	return base64_encode_groups_impl(src, len, dest);
+}
+
+/*****************************************************************************/
+
+unsigned int base64_decode_groups(const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	return base64_decode_groups_impl(src, len, dest);
+}
+
+/*****************************************************************************/
+
+int base64_supported(int impl)
+{
+	switch (impl)
+	{
+		case	BASE64_IMPL_SCALAR:
+				return 1;
+#ifdef BASE64_HAVE_X86
+		case	BASE64_IMPL_SSSE3:
+				return !!__builtin_cpu_supports("ssse3");
+		case	BASE64_IMPL_AVX2:
+				return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("ssse3");
+#endif
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+
+int base64_select(int impl)
+{
+	if (impl < 0 || !base64_supported(impl))
+	{
+		impl = BASE64_IMPL_SCALAR;
+		if (base64_supported(BASE64_IMPL_SSSE3)) impl = BASE64_IMPL_SSSE3;
+		if (base64_supported(BASE64_IMPL_AVX2)) impl = BASE64_IMPL_AVX2;
+	}
+
+	switch (impl)
+	{
+#ifdef BASE64_HAVE_X86
+		case	BASE64_IMPL_SSSE3:
+				base64_encode_groups_impl = base64_encode_groups_ssse3;
+				base64_decode_groups_impl = base64_decode_groups_ssse3;
+				break;
+		case	BASE64_IMPL_AVX2:
+				base64_encode_groups_impl = base64_encode_groups_avx2;
+				base64_decode_groups_impl = base64_decode_groups_avx2;
+				break;
+#endif
+		default:
+				base64_encode_groups_impl = base64_encode_groups_scalar;
+				base64_decode_groups_impl = base64_decode_groups_scalar;
+				break;
+	}
+	return impl;
+}
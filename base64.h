@@ -0,0 +1,95 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file base64.h
+ *
+ * Kernels that encode and decode complete base64 groups. Depending on the
+ * processor, 12 or 24 bytes are processed at once. The best implementation
+ * is selected at runtime. Line breaks, padding and all other things that
+ * are not part of the alphabet are left to the callers in codecs.c.
+ */
+
+#ifndef SM__BASE64_H
+#define SM__BASE64_H
+
+/** Processes one group after another */
+#define BASE64_IMPL_SCALAR 0
+
+/** Processes 16 characters at once via SSSE3 */
+#define BASE64_IMPL_SSSE3 1
+
+/** Processes 32 characters at once via AVX2 */
+#define BASE64_IMPL_AVX2 2
+
+/**
+ * Number of bytes that base64_decode_groups() may write beyond the decoded
+ * data.
+ */
+#define BASE64_DECODE_OVERRUN 8
+
+/**
+ * Encodes complete groups of three bytes.
+ *
+ * @param src the data to encode.
+ * @param len the number of bytes in src. Only len / 3 * 3 bytes are encoded.
+ * @param dest where to store the characters, must provide space for
+ *  len / 3 * 4 characters. No 0-byte is written.
+ * @return the number of bytes of src that have been encoded.
+ */
+unsigned int base64_encode_groups(const unsigned char *src, unsigned int len, char *dest);
+
+/**
+ * Decodes complete groups of four characters of the base64 alphabet up to
+ * the first character that is not part of the alphabet, e.g., a line break
+ * or the padding.
+ *
+ * @param src the characters to decode.
+ * @param len the number of characters in src.
+ * @param dest where to store the decoded data, must provide space for
+ *  len / 4 * 3 + BASE64_DECODE_OVERRUN bytes.
+ * @return the number of characters that have been decoded, always a
+ *  multiple of four. The number of decoded bytes is three quarters of it.
+ */
+unsigned int base64_decode_groups(const unsigned char *src, unsigned int len, unsigned char *dest);
+
+/**
+ * Checks whether the given implementation is supported by this build and
+ * the processor.
+ *
+ * @param impl one of the BASE64_IMPL_xxx values.
+ * @return 1 if the implementation is supported, else 0.
+ */
+int base64_supported(int impl);
+
+/**
+ * Selects the implementation that is used by base64_encode_groups() and
+ * base64_decode_groups(). Until then, the scalar implementation is used.
+ * The selection is not synchronized, so this must be called before any
+ * other task that may use the functions has been created, as it is done
+ * with -1 at startup. Tests and benchmarks may call it to select a specific
+ * implementation.
+ *
+ * @param impl one of the BASE64_IMPL_xxx values or -1 for the best
+ *  supported one.
+ * @return the selected implementation, which may differ from the requested
+ *  one if it is not supported.
+ */
+int base64_select(int impl);
+
+#endif
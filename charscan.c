@@ -0,0 +1,163 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file charscan.c
+ *
+ * The vector implementations compare a block of bytes with both characters
+ * and turn the result into a bit mask whose lowest set bit denotes the
+ * occurrence. The remaining bytes that don't fill a block are examined by
+ * the scalar implementation. SSE2 is part of every x86-64 processor and is
+ * enabled at compile time, AVX2 is used only if the processor supports it.
+ */
+
+#include "charscan.h"
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define CHARSCAN_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CHARSCAN_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+typedef const char *(*charscan_find2_t)(const char *buf, const char *buf_end, char c1, char c2);
+
+/*****************************************************************************/
+
+static const char *charscan_find2_scalar(const char *buf, const char *buf_end, char c1, char c2)
+{
+	while (buf < buf_end)
+	{
+		char c = *buf;
+		if (c == c1 || c == c2)
+			break;
+		buf++;
+	}
+	return buf;
+}
+
+/*****************************************************************************/
+
+#ifdef CHARSCAN_HAVE_SSE2
+static const char *charscan_find2_sse2(const char *buf, const char *buf_end, char c1, char c2)
+{
+	__m128i v1 = _mm_set1_epi8(c1);
+	__m128i v2 = _mm_set1_epi8(c2);
+
+	while (buf_end - buf >= 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)buf);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(d, v1), _mm_cmpeq_epi8(d, v2)));
+		if (mask)
+			return buf + __builtin_ctz(mask);
+		buf += 16;
+	}
+	return charscan_find2_scalar(buf, buf_end, c1, c2);
+}
+#endif
+
+/*****************************************************************************/
+
+#ifdef CHARSCAN_HAVE_AVX2
+__attribute__((target("avx2")))
+static const char *charscan_find2_avx2(const char *buf, const char *buf_end, char c1, char c2)
+{
+	__m256i v1 = _mm256_set1_epi8(c1);
+	__m256i v2 = _mm256_set1_epi8(c2);
+
+	while (buf_end - buf >= 32)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)buf);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(d, v1), _mm256_cmpeq_epi8(d, v2)));
+		if (mask)
+			return buf + __builtin_ctz(mask);
+		buf += 32;
+	}
+	return charscan_find2_scalar(buf, buf_end, c1, c2);
+}
+#endif
+
+/*****************************************************************************/
+
+/**
+ * The implementation in use. It is changed only by charscan_select(), which
+ * is called at startup before any other task exists.
+ */
+static charscan_find2_t charscan_find2_impl = charscan_find2_scalar;
+
+/*****************************************************************************/
+
+const char *charscan_find2(const char *buf, const char *buf_end, char c1, char c2)
+{
+	return charscan_find2_impl(buf, buf_end, c1, c2);
+}
+
+/*****************************************************************************/
+
+int charscan_supported(int impl)
+{
+	switch (impl)
+	{
+		case	CHARSCAN_IMPL_SCALAR:
+				return 1;
+#ifdef CHARSCAN_HAVE_SSE2
+		case	CHARSCAN_IMPL_SSE2:
+				return 1;
+#endif
+#ifdef CHARSCAN_HAVE_AVX2
+		case	CHARSCAN_IMPL_AVX2:
+				return !!__builtin_cpu_supports("avx2");
+#endif
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+
+int charscan_select(int impl)
+{
+	if (impl < 0 || !charscan_supported(impl))
+	{
+		impl = CHARSCAN_IMPL_SCALAR;
+		if (charscan_supported(CHARSCAN_IMPL_SSE2)) impl = CHARSCAN_IMPL_SSE2;
+		if (charscan_supported(CHARSCAN_IMPL_AVX2)) impl = CHARSCAN_IMPL_AVX2;
+	}
+
+	switch (impl)
+	{
+#ifdef CHARSCAN_HAVE_SSE2
+		case	CHARSCAN_IMPL_SSE2:
+				charscan_find2_impl = charscan_find2_sse2;
+				break;
+#endif
+#ifdef CHARSCAN_HAVE_AVX2
+		case	CHARSCAN_IMPL_AVX2:
+				charscan_find2_impl = charscan_find2_avx2;
+				break;
+#endif
+		default:
+				charscan_find2_impl = charscan_find2_scalar;
+				break;
+	}
+	return impl;
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file charscan.h
+ *
+ * Finds characters within memory areas. Depending on the processor,
+ * 16 or 32 bytes are examined at once. The best implementation is selected
+ * at runtime.
+ */
+
+#ifndef SM__CHARSCAN_H
+#define SM__CHARSCAN_H
+
+/** Examines one byte after another */
+#define CHARSCAN_IMPL_SCALAR 0
+
+/** Examines 16 bytes at once via SSE2 */
+#define CHARSCAN_IMPL_SSE2 1
+
+/** Examines 32 bytes at once via AVX2 */
+#define CHARSCAN_IMPL_AVX2 2
+
+/**
+ * Finds the first occurrence of either of the given characters within the
+ * given memory area.
+ *
+ * @param buf the start of the area.
+ * @param buf_end the end of the area.
+ * @param c1 the first character.
+ * @param c2 the second character, may be the same as c1.
+ * @return the occurrence or buf_end if neither character occurs.
+ */
+const char *charscan_find2(const char *buf, const char *buf_end, char c1, char c2);
+
+/**
+ * Checks whether the given implementation is supported by this build and
+ * the processor.
+ *
+ * @param impl one of the CHARSCAN_IMPL_xxx values.
+ * @return 1 if the implementation is supported, else 0.
+ */
+int charscan_supported(int impl);
+
+/**
+ * Selects the implementation that is used by charscan_find2(). Until then,
+ * the scalar implementation is used. The selection is not synchronized, so
+ * this must be called before any other task that may use charscan_find2()
+ * has been created, as it is done with -1 at startup. Tests and benchmarks
+ * may call it to select a specific implementation.
+ *
+ * @param impl one of the CHARSCAN_IMPL_xxx values or -1 for the best
+ *  supported one.
+ * @return the selected implementation, which may differ from the requested
+ *  one if it is not supported.
+ */
+int charscan_select(int impl);
+
+#endif
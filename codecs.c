@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "addresslist.h"
+#include "base64.h"
 #include "codesets.h"
 #include "lists.h"
 #include "parse.h"
@@ -41,204 +42,419 @@ static const char encoding_table[] =
 	'0','1','2','3','4','5','6','7','8','9','+','/'
 };
 
+/* decoding table for the base64 coding, -1 marks characters that are
+ * skipped, -2 the padding */
+static const signed char decoding_table[128] =
+{
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+	52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+	15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+	-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+	41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1
+};
+
+#define IS_HEX(c)   ((((c) >= '0') && ((c) <= '9')) || \
+                     (((c) >= 'A') && ((c) <= 'F')) || \
+                     (((c) >= 'a') && ((c) <= 'f')))
+#define FROM_HEX(c) ((c) - (((c) > '9') ? \
+                           (((c) > 'F') ? 'a' - 10 : 'A' - 10 ) : '0'))
+
+#define IS_QP_SPACE(c) (((c) == ' ') || ((c) == '\t'))
+
 /*****************************************************************************/
 
-char *decode_base64(unsigned char *src, unsigned int len, unsigned int *ret_len)
+void transfer_decoder_init(struct transfer_decoder *dec, int encoding)
 {
-   static const signed char decoding_table[128] = {
-      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
-      52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,
-      -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
-      15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
-      -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
-      41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1
-   };
-
-   unsigned char *srcmax=src+len,*dest,*deststart;
-   unsigned int limit = *ret_len;
-   unsigned int real_len = 0;
+	memset(dec, 0, sizeof(*dec));
+	dec->encoding = encoding;
+}
 
-   *ret_len=0;
+/*****************************************************************************/
 
-   if(!(dest=(unsigned char*)malloc(len*3/4+1))) return NULL;
-   deststart=dest;
+/**
+ * Decodes the next piece of base64 encoded data. Characters that are not
+ * part of the alphabet are skipped, everything after the padding is ignored.
+ *
+ * @param dec the decoder
+ * @param src the encoded data
+ * @param len the number of bytes in src
+ * @param dest where to store the decoded data
+ * @return the number of decoded bytes
+ */
+static unsigned int transfer_decoder_feed_base64(struct transfer_decoder *dec, const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	const unsigned char *src_end = src + len;
+	unsigned char *dest_start = dest;
+	unsigned int bits = dec->bits;
+	int num_sextets = dec->num_sextets;
 
-   while (src + 3 < srcmax)
-   {
-      if(src[0] > 127) {src++; continue;};
-      if(-1 == decoding_table[src[0]])
-      {
-         src++;
-         continue;
-      } else {
-         unsigned char c1,c2,c3,c4;
+	if (dec->padded) return 0;
 
-         c1=decoding_table[src[0] & 0x7f];
-         c2=decoding_table[src[1] & 0x7f];
-         c3=decoding_table[src[2] & 0x7f];
-         c4=decoding_table[src[3] & 0x7f];
+	while (src < src_end)
+	{
+		unsigned char c;
+		int v;
 
-         *dest++ = (c1 << 2) | (c2 >> 4);
+		/* Complete groups up to the next line break are decoded at once */
+		if (!num_sextets && *src < 128 && decoding_table[*src] >= 0)
+		{
+			unsigned int n = base64_decode_groups(src, src_end - src, dest);
+			src += n;
+			dest += n / 4 * 3;
+			if (src == src_end) break;
+		}
 
-         if (src[2] == '=') break;
-         *dest++ = (c2 << 4) | (c3 >> 2);
+		c = *src++;
+		if (c > 127) continue;
+		if ((v = decoding_table[c]) < 0)
+		{
+			if (v == -2)
+			{
+				dec->padded = 1;
+				break;
+			}
+			continue;
+		}
 
-         if (src[3] == '=') break;
-         *dest++ = (c3 << 6) | c4;
+		bits = (bits << 6) | v;
+		if (++num_sextets == 4)
+		{
+			*dest++ = (unsigned char)(bits >> 16);
+			*dest++ = (unsigned char)(bits >> 8);
+			*dest++ = (unsigned char)bits;
+			bits = 0;
+			num_sextets = 0;
+		}
+	}
 
-         real_len += 3;
-         if (real_len >= limit) break;
+	dec->bits = bits;
+	dec->num_sextets = num_sextets;
+	return dest - dest_start;
+}
 
-         src += 4;
-      }
-   }
-   *dest=0;
+/*****************************************************************************/
 
-   *ret_len=dest-deststart;
-   return (char*)realloc(deststart,*ret_len+1);
+/**
+ * Checks whether the given quoted printable input would be removed if the
+ * line ended right after it, i.e., whether it consists of white space
+ * optionally followed by a single CR.
+ *
+ * @param buf the input
+ * @param len the number of bytes in buf
+ * @return 1 if the input may be removed, else 0.
+ */
+static int transfer_decoder_qp_is_trailing(const unsigned char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (IS_QP_SPACE(buf[i])) continue;
+		if (buf[i] == '\r' && i == len - 1) continue;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Decodes as much of the held back quoted printable input as possible
+ * without knowing the rest of the line.
+ *
+ * @param dec the decoder
+ * @param dest where to store the decoded data
+ * @return the number of decoded bytes
+ */
+static unsigned int transfer_decoder_qp_resolve(struct transfer_decoder *dec, unsigned char *dest)
+{
+	unsigned char *p = dec->pending;
+	unsigned char *dest_start = dest;
+	int n = dec->num_pending;
+
+	while (n)
+	{
+		unsigned char c = p[0];
+		int consumed = 1;
+
+		if (c == '=')
+		{
+			if (n < 2) break;
+			if (IS_HEX(p[1]))
+			{
+				if (n < 3) break;
+				if (IS_HEX(p[2]))
+				{
+					c = (FROM_HEX(p[1]) << 4) | FROM_HEX(p[2]);
+					consumed = 3;
+				}
+			} else if (IS_QP_SPACE(p[1]) || p[1] == '\r')
+			{
+				/* A soft line break if only white space follows */
+				if (transfer_decoder_qp_is_trailing(p + 1, n - 1)) break;
+			}
+		} else if (IS_QP_SPACE(c) || c == '\r')
+		{
+			/* Trailing white space is removed */
+			if (transfer_decoder_qp_is_trailing(p, n)) break;
+		}
+
+		*dest++ = c;
+		p += consumed;
+		n -= consumed;
+	}
+
+	if (n && p != dec->pending)
+		memmove(dec->pending, p, n);
+	dec->num_pending = n;
+	return dest - dest_start;
+}
+
+/**
+ * Decodes the held back quoted printable input at the end of a line.
+ *
+ * @param dec the decoder
+ * @param dest where to store the decoded data
+ * @param line_feed whether the line is terminated by a LF. Only then, a CR
+ *  at its end is removed.
+ * @param soft_break_ptr where to store whether the line ended with a soft
+ *  line break.
+ * @return the number of decoded bytes
+ */
+static unsigned int transfer_decoder_qp_end_line(struct transfer_decoder *dec, unsigned char *dest, int line_feed, int *soft_break_ptr)
+{
+	unsigned char *p = dec->pending;
+	unsigned char *dest_start = dest;
+	int n = dec->num_pending;
+	int i = 0;
+
+	*soft_break_ptr = 0;
+
+	/* Remove trailing white space from end of line */
+	if (line_feed && n && p[n - 1] == '\r') n--;
+	while (n && IS_QP_SPACE(p[n - 1])) n--;
+
+	while (i < n)
+	{
+		unsigned char c = p[i++];
+
+		if (c == '=')
+		{
+			if (i == n)
+			{
+				*soft_break_ptr = 1;
+				break;
+			}
+			if (i + 1 < n && IS_HEX(p[i]) && IS_HEX(p[i + 1]))
+			{
+				c = (FROM_HEX(p[i]) << 4) | FROM_HEX(p[i + 1]);
+				i += 2;
+			}
+			/* else the '=' was not followed by two hex digits. This is actually
+			 * a violation of the standard, we put the '=' into the decoded text */
+		}
+		*dest++ = c;
+	}
+
+	dec->num_pending = 0;
+	return dest - dest_start;
+}
+
+/**
+ * Decodes the next piece of quoted printable encoded data. Trailing white
+ * space of lines is removed and CR LF line endings are converted to LF.
+ *
+ * @param dec the decoder
+ * @param src the encoded data
+ * @param len the number of bytes in src
+ * @param dest where to store the decoded data
+ * @return the number of decoded bytes
+ */
+static unsigned int transfer_decoder_feed_qp(struct transfer_decoder *dec, const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	const unsigned char *src_end = src + len;
+	unsigned char *dest_start = dest;
+
+	while (src < src_end)
+	{
+		unsigned char c = *src++;
+
+		if (c == '\n')
+		{
+			int soft_break;
+
+			dest += transfer_decoder_qp_end_line(dec, dest, 1, &soft_break);
+			if (!soft_break) *dest++ = '\n';
+			continue;
+		}
+
+		/* Most characters don't depend on the rest of the line */
+		if (!dec->num_pending && c != '=' && c != '\r' && !IS_QP_SPACE(c))
+		{
+			*dest++ = c;
+			continue;
+		}
+
+		dec->pending[dec->num_pending++] = c;
+		dest += transfer_decoder_qp_resolve(dec, dest);
+
+		if (dec->num_pending == TRANSFER_DECODER_PENDING_SIZE)
+		{
+			/* The line is far too long, so the first held back character is
+			 * taken literally */
+			*dest++ = dec->pending[0];
+			memmove(dec->pending, dec->pending + 1, --dec->num_pending);
+			dest += transfer_decoder_qp_resolve(dec, dest);
+		}
+	}
+	return dest - dest_start;
+}
+
+/*****************************************************************************/
+
+unsigned int transfer_decoder_feed(struct transfer_decoder *dec, const unsigned char *src, unsigned int len, unsigned char *dest)
+{
+	if (dec->encoding == TRANSFER_ENCODING_BASE64)
+		return transfer_decoder_feed_base64(dec, src, len, dest);
+	return transfer_decoder_feed_qp(dec, src, len, dest);
+}
+
+/*****************************************************************************/
+
+unsigned int transfer_decoder_finish(struct transfer_decoder *dec, unsigned char *dest)
+{
+	unsigned char *dest_start = dest;
+
+	if (dec->encoding == TRANSFER_ENCODING_BASE64)
+	{
+		/* An incomplete group remains if it was padded or the padding is missing */
+		if (dec->num_sextets >= 2)
+		{
+			*dest++ = (unsigned char)(dec->bits >> (6 * dec->num_sextets - 8));
+			if (dec->num_sextets == 3)
+				*dest++ = (unsigned char)(dec->bits >> 2);
+		}
+		dec->bits = 0;
+		dec->num_sextets = 0;
+	} else
+	{
+		int soft_break;
+		dest += transfer_decoder_qp_end_line(dec, dest, 0, &soft_break);
+	}
+	return dest - dest_start;
+}
+
+/*****************************************************************************/
+
+/**
+ * Decodes the given buffer with the given transfer encoding into a newly
+ * allocated buffer.
+ *
+ * @param encoding the encoding
+ * @param src the encoded data
+ * @param len number of bytes in src
+ * @param ret_len points to the maximal number of bytes that should be
+ *  decoded. After return, it contains the number of decoded bytes.
+ * @return the malloc'ed buffer that is terminated with a 0-byte or NULL on
+ *  failure.
+ */
+static char *transfer_decode(int encoding, const unsigned char *src, unsigned int len, unsigned int *ret_len)
+{
+	struct transfer_decoder dec;
+	const unsigned char *src_end = src + len;
+	unsigned char *dest;
+	unsigned int limit = *ret_len;
+	unsigned int max_len, dest_len = 0;
+
+	*ret_len = 0;
+
+	/* Base64 decodes four bytes into three, quoted printable never expands.
+	 * If the decoding is limited, a single feed may exceed the limit by the
+	 * held back bytes. */
+	if (encoding == TRANSFER_ENCODING_BASE64) max_len = len / 4 * 3 + 3;
+	else max_len = len;
+	if (limit < max_len) max_len = limit + TRANSFER_DECODER_PENDING_SIZE;
+
+	/* The finish may also write the held back bytes */
+	if (!(dest = (unsigned char*)malloc(max_len + TRANSFER_DECODER_PENDING_SIZE + 1)))
+		return NULL;
+
+	transfer_decoder_init(&dec, encoding);
+
+	while (src < src_end && dest_len < limit)
+	{
+		unsigned int chunk = src_end - src;
+
+		if (chunk > limit - dest_len) chunk = limit - dest_len;
+		dest_len += transfer_decoder_feed(&dec, src, chunk, dest + dest_len);
+		src += chunk;
+	}
+
+	if (src == src_end)
+		dest_len += transfer_decoder_finish(&dec, dest + dest_len);
+	if (dest_len > limit)
+		dest_len = limit;
+	dest[dest_len] = 0;
+
+	*ret_len = dest_len;
+	return (char*)realloc(dest, dest_len + 1);
+}
+
+/*****************************************************************************/
+
+char *decode_base64(unsigned char *src, unsigned int len, unsigned int *ret_len)
+{
+	return transfer_decode(TRANSFER_ENCODING_BASE64, src, len, ret_len);
 }
 
-#define IS_HEX(c)   ((((c) >= '0') && ((c) <= '9')) || \
-                     (((c) >= 'A') && ((c) <= 'F')) || \
-                     (((c) >= 'a') && ((c) <= 'f')))
-#define FROM_HEX(c) ((c) - (((c) > '9') ? \
-                           (((c) > 'F') ? 'a' - 10 : 'A' - 10 ) : '0'))
 /*****************************************************************************/
 
 char *decode_quoted_printable(unsigned char *buf, unsigned int len, unsigned int *ret_len, int header)
 {
    unsigned char *dest,*deststart;
    unsigned int limit = *ret_len;
+   unsigned int real_len = 0;
+
+   if(!len)
+   {
+      *ret_len=0;
+      return NULL;
+   }
+
+   /* Bodies are decoded line by line, trailing white space is removed */
+   if(!header) return transfer_decode(TRANSFER_ENCODING_QUOTED_PRINTABLE,buf,len,ret_len);
 
    *ret_len=0;
-   if(!len) return NULL;
    if(!(dest=(unsigned char*)malloc(len+1))) return NULL;
    deststart=dest;
 
-   if(header)
+   while(len--)
    {
-      unsigned int real_len = 0;
+      unsigned char c=*buf++;
 
-      while(len--)
+      if('=' == c)
       {
-         unsigned char c=*buf++;
+         unsigned char c2;
 
-         if('=' == c)
-         {
-            unsigned char c2;
-
-            c=buf[0];
-            c2=buf[1];
-            if (IS_HEX(c) && IS_HEX(c2))
-            {
-               c = (FROM_HEX(c) << 4) | FROM_HEX(c2);
-               if(len) len--;
-               if(len) len--;
-               buf += 2;
-            } else c = '='; /* should never happen */
-         } else if('_' == c) c=' ';
-         *dest++ = c;
-
-         if (++real_len >= limit) break;
-      }
-      *dest = 0;
-
-      *ret_len=dest-deststart;
-      return (char*)realloc(deststart,*ret_len+1);
-   } else { /* body */
-      unsigned char *text,*textstart;
-
-      if(!(text=(unsigned char*)malloc(len+1))) {free(dest); return NULL;}
-      memcpy(text,buf,len);
-      text[len]=0;
-      textstart=text;
-
-      while(text)
-      {
-         unsigned char  c;
-         unsigned char *lp = text;
-
-         /* Remove trailing white space from end of line */
-         {
-            unsigned char *ep;
-
-            /* Look for end of line */
-            if ((ep = (unsigned char*)strchr((char*)lp, '\n')))
-            {
-               text = ep + 1;
-               ep--;
-
-						   /* If this check is omitted we could write in the last line of this scope
-							  * before the mallocation, if the first line has only a \n character */
-							 if (ep >= lp)
-							 {
-               	if('\r' == *ep) ep--;
-               }
-            } else {
-               ep   = lp + strlen((char*)lp) - 1;
-               text = NULL;   /* End of text reached */
-            }
-
-            /* Remove trailing white space */
-            while ((ep >= lp) && (((c = *ep) == ' ') || (c == '\t'))) ep--;
-
-            /* Set string terminator */
-            *(ep + 1) = '\0';
-         }
-
-         /* Scan line */
-         do
+         c=buf[0];
+         c2=buf[1];
+         if (IS_HEX(c) && IS_HEX(c2))
          {
-            switch (c = *lp++)
-            {
-               case '\0': /* Line end reached. Add line end (only while in text) */
-                  if (text) *dest++ = '\n';
-                  break;
-
-               case '=':  /* Encoded character */
-                  /* End of line reached? (-> soft line break!) */
-                  if ((c = *lp))
-                  {
-                     unsigned char d = *(lp + 1);
-
-                     /* Sanity check */
-                     if (IS_HEX(c) && IS_HEX(d))
-                     {
-                        /* Decode two hex digit to 8-Bit characters */
-                        *dest++ = (FROM_HEX(c) << 4) | FROM_HEX(d);
-
-                        /* Move line pointer */
-                        lp += 2;
-                     } else {
-                        /* The '=' was not followed by two hex digits. This is actually */
-                        /* a violation of the standard. We put the '=' into the decoded */
-                        /* text and continue decoding after the '�' character.          */
-                        *dest++ = '=';
-                     }
-                  }
-                  break;
-
-               default:   /* Normal character */
-                  *dest++ = c;
-                  break;
-            }
-            if ((unsigned int)(dest-deststart)>= limit)
-            {
-            	text = NULL;
-            	break;
-            }
-         } while (c);
-      }
-      /* Add string terminator */
-      *dest=0;
-
-      free(textstart);
-
-      *ret_len=dest-deststart;
-      return (char*)realloc(deststart,*ret_len+1);
+            c = (FROM_HEX(c) << 4) | FROM_HEX(c2);
+            if(len) len--;
+            if(len) len--;
+            buf += 2;
+         } else c = '='; /* should never happen */
+      } else if('_' == c) c=' ';
+      *dest++ = c;
+
+      if (++real_len >= limit) break;
    }
+   *dest = 0;
+
+   *ret_len=dest-deststart;
+   return (char*)realloc(deststart,*ret_len+1);
 }
 
 /*
@@ -966,6 +1182,27 @@ static void encode_body_quoted(FILE *fh, unsigned char *buf, unsigned int len)
 	}
 }
 
+/**
+ * Encodes the last group of the given buffer, which consists of one or
+ * two bytes, with padding.
+ *
+ * @param buf the bytes to encode
+ * @param len the number of bytes, 1 or 2
+ * @param dest where to store the four characters
+ */
+static void encode_base64_last_group(unsigned char *buf, unsigned int len, char *dest)
+{
+	unsigned char c1 = buf[0];
+	unsigned char c2 = len == 2 ? buf[1] : 0;
+
+	dest[0] = encoding_table[(c1 >> 2) & 0x3f];
+	dest[1] = encoding_table[((c1 << 4) & 0x30) | ((c2 >> 4) & 0x0f)];
+	dest[2] = len == 2 ? encoding_table[(c2 << 2) & 0x3c] : '=';
+	dest[3] = '=';
+}
+
+/*****************************************************************************/
+
 /**
  * Encodes the given body base64 and writes it into fh
  *
@@ -975,146 +1212,30 @@ static void encode_body_quoted(FILE *fh, unsigned char *buf, unsigned int len)
  */
 static void encode_body_base64(FILE *fh, unsigned char *buf, unsigned int len)
 {
-	int line_len = 0;
-	char line_buf[100];
-	while (len > 0)
-	{
-		if (len > 11)
-		{
-			/* could make problems with little endian */
-			unsigned long todecode1 = *((unsigned long*)buf);
-			unsigned long todecode2 = *(((unsigned long*)buf)+1);
-			unsigned long todecode3 = *(((unsigned long*)buf)+2);
-			buf += 12;
-			len -= 12;
-#ifdef __AROS__ /* TODO: byteswaping ,will currently break arosppc , will be fixed*/
-
-                        unsigned long ByteSwap1 (unsigned long nLongNumber)
-                        {
-                          union u {unsigned long vi; unsigned char c[sizeof(unsigned long)];};
-                          union v {unsigned long ni; unsigned char d[sizeof(unsigned long)];};
-                          union u un;
-                          union v vn;
-                          un.vi = nLongNumber;
-                          vn.d[0]=un.c[3];
-                          vn.d[1]=un.c[2];
-                          vn.d[2]=un.c[1];
-                          vn.d[3]=un.c[0];
-                          return (vn.ni);
-                        }
-
-                        todecode1 = ByteSwap1 (todecode1);
-                        todecode2 = ByteSwap1 (todecode2);
-                        todecode3 = ByteSwap1 (todecode3);
-
-#endif
-
-			if (line_len >= 76)
-			{
-				line_buf[line_len] = 0;
-				fprintf(fh,"%s\n",line_buf);
-				line_len = 0;
-			}
-
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000)) >> 26];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 6)) >> 20];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 12)) >> 14];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 18)) >> 8];
-
-			todecode1 = (todecode1 << 24)|((todecode2 & 0xffff0000) >> 8);
+	char line_buf[80];
 
-			if (line_len >= 76)
-			{
-				line_buf[line_len] = 0;
-				fprintf(fh,"%s\n",line_buf);
-				line_len = 0;
-			}
-
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000)) >> 26];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 6)) >> 20];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 12)) >> 14];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 18)) >> 8];
-
-			todecode1 = (todecode2 << 16) | ((todecode3 & 0xff000000)>>16);
-
-			if (line_len >= 76)
-			{
-				line_buf[line_len] = 0;
-				fprintf(fh,"%s\n",line_buf);
-				line_len = 0;
-			}
-
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000)) >> 26];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 6)) >> 20];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 12)) >> 14];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 18)) >> 8];
-
-			todecode1 = todecode3 << 8;
+	/* A line consists of 76 characters, which encode 57 bytes */
+	while (len >= 57)
+	{
+		base64_encode_groups(buf, 57, line_buf);
+		line_buf[76] = '\n';
+		fwrite(line_buf, 1, 77, fh);
+		buf += 57;
+		len -= 57;
+	}
 
-			if (line_len >= 76)
-			{
-				line_buf[line_len] = 0;
-				fprintf(fh,"%s\n",line_buf);
-				line_len = 0;
-			}
+	if (len)
+	{
+		unsigned int encoded = base64_encode_groups(buf, len, line_buf);
+		int line_len = encoded / 3 * 4;
 
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000)) >> 26];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 6)) >> 20];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 12)) >> 14];
-			line_buf[line_len++] = encoding_table[(todecode1 & (0xfc000000 >> 18)) >> 8];
-		} else
+		if (len > encoded)
 		{
-			int c1,c2,c3;
-
-			while (len > 0)
-			{
-				c1 = *buf++;
-				len--;
-
-				if (len) c2 = *buf++, len--;
-				else c2 = -1;
-
-				if (len) c3 = *buf++, len--;
-				else c3 = -1;
-
-				if (line_len >= 76)
-				{
-					line_buf[line_len] = 0;
-					fprintf(fh,"%s\n",line_buf);
-					line_len = 0;
-				}
-
-				if (c2 == -1)
-				{
-					line_buf[line_len++] = encoding_table[c1 >> 2];
-					line_buf[line_len++] = encoding_table[((c1 & 0x3) << 4)];
-					line_buf[line_len++] = '=';
-					line_buf[line_len++] = '=';
-				} else
-				{
-					if (c3 == -1)
-					{
-						line_buf[line_len++] = encoding_table[c1 >> 2];
-						line_buf[line_len++] = encoding_table[((c1 & 0x3) << 4) | ((c2 & 0xf0)>>4)];
-						line_buf[line_len++] = encoding_table[((c2 & 0xf) << 2)];
-						line_buf[line_len++] = '=';
-					} else
-					{
-						line_buf[line_len++] = encoding_table[c1 >> 2];
-						line_buf[line_len++] = encoding_table[((c1 & 0x3) << 4) | ((c2 & 0xf0)>>4)];
-						line_buf[line_len++] = encoding_table[((c2 & 0xf) << 2) | ((c3 & 0xc0)>>6)];
-						line_buf[line_len++] = encoding_table[c3 & 0x3F];
-					}
-				}
-			}
+			encode_base64_last_group(buf + encoded, len - encoded, line_buf + line_len);
+			line_len += 4;
 		}
-	}
-
-	if (line_len)
-	{
-		line_buf[line_len] = 0;
-		fprintf(fh,"%s\n",line_buf);
-		line_len = 0;
+		line_buf[line_len++] = '\n';
+		fwrite(line_buf, 1, line_len, fh);
 	}
 }
 
@@ -1208,38 +1329,19 @@ char *encode_base64(unsigned char *buf, unsigned int len)
 {
 	unsigned char *dest = (unsigned char*)malloc((len * 4)/3 + 8);
 	unsigned char *ptr;
+	unsigned int encoded;
 
 	if (!dest) return NULL;
-	ptr = dest;
 
-	while (len >= 3)
-	{
-		unsigned char c1 = *buf++;
-		unsigned char c2 = *buf++;
-		unsigned char c3 = *buf++;
-
-    *ptr++ = encoding_table[(c1 >> 2) & 0x3f];
-    *ptr++ = encoding_table[((c1 << 4) & 0x30) | ((c2 >> 4) & 0x0f)];
-    *ptr++ = encoding_table[((c2 << 2) & 0x3c) | ((c3 >> 6) & 0x03)];
-    *ptr++ = encoding_table[c3 & 0x3f];
-		len -= 3;
-	}
+	encoded = base64_encode_groups(buf, len, (char*)dest);
+	ptr = dest + encoded / 3 * 4;
 
-	if (len)
+	if (len > encoded)
 	{
-		unsigned char c1,c2;
-
-		c1 = *buf++;
-		if (len == 2) c2 = *buf;
-		else c2 = 0;
-
-    *ptr++ = encoding_table[(c1 >> 2) & 0x3f];
-    *ptr++ = encoding_table[((c1 << 4) & 0x30) | ((c2 >> 4) & 0x0f)];
-		if (len == 2) *ptr++ = encoding_table[(c2  << 2) & 0x3c];
-		else *ptr++ = '=';
-		*ptr++ = '=';
+		encode_base64_last_group(buf + encoded, len - encoded, (char*)ptr);
+		ptr += 4;
 	}
 
-  *ptr = 0;
+	*ptr = 0;
 	return (char*)dest;
 }
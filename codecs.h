@@ -30,7 +30,8 @@ struct address_list;
 
 /**
  * Decoding a given buffer using the base64 algorithm. *ret_len can be used
- * to cut the decoding, but the result might differ
+ * to cut the decoding, in which case not more than *ret_len bytes are
+ * allocated for the result
  *
  * @param src the source base64 encoded buffer
  * @param len number of source bytes to decode
@@ -55,6 +56,66 @@ char *decode_base64(unsigned char *buf, unsigned int len, unsigned int *ret_len)
   */
 char *decode_quoted_printable(unsigned char *buf, unsigned int len, unsigned int *ret_len, int header);
 
+/** Data is base64 encoded (RFC 2045) */
+#define TRANSFER_ENCODING_BASE64 1
+
+/** Data is quoted printable encoded (RFC 2045) */
+#define TRANSFER_ENCODING_QUOTED_PRINTABLE 2
+
+/** Maximum number of bytes that are held back by a transfer decoder */
+#define TRANSFER_DECODER_PENDING_SIZE 256
+
+/**
+ * The state of a decoder that decodes base64 or quoted printable encoded
+ * data piece by piece. Don't access the members directly.
+ */
+struct transfer_decoder
+{
+	int encoding;
+
+	/* base64 */
+	unsigned int bits; /* the collected but not yet decoded bits */
+	int num_sextets; /* number of sextets in bits */
+	int padded; /* the padding has been seen, ignore the rest */
+
+	/* quoted printable */
+	unsigned char pending[TRANSFER_DECODER_PENDING_SIZE]; /* the input that depends on the rest of the line */
+	int num_pending;
+};
+
+/**
+ * Initializes the given transfer decoder.
+ *
+ * @param dec the decoder to initialize.
+ * @param encoding the encoding, TRANSFER_ENCODING_BASE64 or
+ *  TRANSFER_ENCODING_QUOTED_PRINTABLE.
+ */
+void transfer_decoder_init(struct transfer_decoder *dec, int encoding);
+
+/**
+ * Decodes the next piece of the encoded data. Input that cannot be decoded
+ * before more input is known, e.g., trailing white space of quoted printable
+ * lines, is held back.
+ *
+ * @param dec the decoder.
+ * @param src the encoded data.
+ * @param len the number of bytes in src.
+ * @param dest where to store the decoded data. Must provide space for at
+ *  least len + TRANSFER_DECODER_PENDING_SIZE bytes.
+ * @return the number of bytes that have been written to dest.
+ */
+unsigned int transfer_decoder_feed(struct transfer_decoder *dec, const unsigned char *src, unsigned int len, unsigned char *dest);
+
+/**
+ * Decodes the input that has been held back after all data has been fed.
+ *
+ * @param dec the decoder.
+ * @param dest where to store the decoded data. Must provide space for at
+ *  least TRANSFER_DECODER_PENDING_SIZE bytes.
+ * @return the number of bytes that have been written to dest.
+ */
+unsigned int transfer_decoder_finish(struct transfer_decoder *dec, unsigned char *dest);
+
 /**
  * Creates a unstructured encoded header field (includes all rules of the
  * RFC 821 and RFC 2047)
@@ -5,9 +5,12 @@ NONARCHSRCS=\
 	account.c \
 	addressbook.c \
 	addresslist.c \
+	arena.c \
 	arrays.c \
 	atcleanup.c \
+	base64.c \
 	boyermoore.c \
+	charscan.c \
 	codecs.c \
 	codesets.c \
 	configuration.c \
@@ -18,7 +21,12 @@ NONARCHSRCS=\
 	estimate.c \
 	filter.c \
 	folder.c \
+	folder_index_file.c \
+	folder_rescan_pool.c \
+	folder_sort.c \
 	folder_search_thread.c \
+	folder_text_index.c \
+	folder_text_index_thread.c \
 	hash.c \
 	hmac_md5.c \
 	http.c \
@@ -27,12 +35,16 @@ NONARCHSRCS=\
 	imap_thread.c \
 	index.c \
 	index_external.c \
+	index_fm.c \
 	index_naive.c \
+	index_trigram.c \
 	lists.c \
 	logging.c \
 	mail.c \
+	mail_btree.c \
 	mail_context.c \
 	mail_support.c \
+	mail_thread.c \
 	mailinfo_extractor.c \
 	mbox.c \
 	md5.c \
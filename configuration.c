@@ -151,6 +151,9 @@ static int init_config(void)
 	/* defaults for Hidden options */
 	user.config.set_all_stati = 0;
 	user.config.min_classified_mails = 500;
+	user.config.rescan_threads = 4;
+	user.config.prefetch_folders = 0;
+	user.config.text_index = 0;
 	user.config.dont_show_shutdown_text = 0;
 	user.config.dont_use_thebar_mcc = 0;
 	user.config.dont_add_default_addresses = 0;
@@ -371,6 +374,12 @@ int load_config(void)
 							free(user.config.ssl_cypher_list);
 							user.config.ssl_cypher_list = mystrdup(result);
 						}
+						if ((result = get_key_value(buf,"Hidden.RescanThreads")))
+							user.config.rescan_threads = atoi(result);
+						if ((result = get_key_value(buf,"Hidden.PrefetchFolders")))
+							user.config.prefetch_folders = atoi(result);
+						if ((result = get_key_value(buf,"Hidden.TextIndex")))
+							user.config.text_index = CONFIG_BOOL_VAL(result);
 
 						if (!mystrnicmp(buf, "ACCOUNT",7))
 						{
@@ -832,6 +841,12 @@ void save_config(void)
 			}
 			if (user.config.ssl_cypher_list)
 				fprintf(fh,"Hidden.SSLCypherList=%s\n",user.config.ssl_cypher_list);
+			if (user.config.rescan_threads != 4)
+				fprintf(fh,"Hidden.RescanThreads=%d\n",user.config.rescan_threads);
+			if (user.config.prefetch_folders)
+				fprintf(fh,"Hidden.PrefetchFolders=%d\n",user.config.prefetch_folders);
+			if (user.config.text_index)
+				fprintf(fh,"Hidden.TextIndex=Y\n");
 
 			fclose(fh);
 		}
@@ -154,6 +154,9 @@ struct config
 	int row_background;              /* Row color */
 	int alt_row_background;          /* Color of alternative row */
 	char *ssl_cypher_list;           /* The cypher list used for ssl connections */
+	int rescan_threads;              /* Number of threads that read the mails when a folder is rescanned */
+	int prefetch_folders;            /* Number of folders whose index is loaded in the background at startup, -1 for all */
+	int text_index;                  /* Maintain a full text index of the mail bodies in the background */
 };
 
 struct user
@@ -33,16 +33,25 @@
 
 #include "account.h"
 #include "addresslist.h"
+#include "arena.h"
 #include "atcleanup.h"
 #include "codesets.h"
 #include "configuration.h"
 #include "debug.h"
 #include "filter.h"
+#include "folder_index_file.h"
+#include "folder_rescan_pool.h"
+#include "folder_sort.h"
+#include "folder_text_index_thread.h"
+#include "hash.h"
 #include "imap.h"
 #include "imap_helper.h"
 #include "lists.h"
+#include "logging.h"
+#include "mail_btree.h"
 #include "mail_context.h"
 #include "mail_support.h"
+#include "mail_thread.h"
 #include "parse.h"
 #include "progmon.h"
 #include "qsort.h"
@@ -61,19 +70,34 @@
 
 /*****************************************************************************/
 
+/** The version of the legacy index files that are still read */
 #define FOLDER_INDEX_VERSION 8
 
+/** The size in bytes above which the journal is folded into the index file */
+#define FOLDER_INDEX_JOURNAL_MAX_SIZE (128*1024)
+
+/** The size of the chunks of the arenas in which the mails of an index are allocated */
+#define FOLDER_ARENA_CHUNK_SIZE (64*1024)
+
 struct folder_index
 {
-	FILE *fh;
+	FILE *fh; /* only for legacy index files */
+	int ver;
 	int pending;
 	int num_mails;
 	int unread_mails;
 	char *string_pool_name;
+	struct folder_index_file *fif; /* the mapped index file, if ver is FOLDER_INDEX_FILE_VERSION */
+	time_t mtime; /* the modification time of the index file */
+	time_t saved; /* the time at which the index file was written or 0 if unknown */
 };
 
-static void folder_index_read_them_all(struct folder_index *fi, struct string_pool *sp, struct mail_info ***out_ptr);
+static int folder_index_read_them_all(struct folder_index *fi, mail_context *mc, struct string_pool *sp, struct mail_info ***out_ptr);
 static void folder_remove_mail_info(struct folder *folder, struct mail_info *mail);
+static void folder_sort_cache_clear(struct folder *f);
+static void folder_sorted_mails_free(struct folder *f);
+static int folder_mail_thread_ensure(struct folder *f);
+static void folder_mail_thread_free(struct folder *f);
 static struct folder_index *folder_index_open(struct folder *f);
 static void folder_index_close(struct folder_index *fi);
 
@@ -121,7 +145,7 @@ static int mail_compare_status(const struct mail_info *arg1, const struct mail_i
  */
 static int mail_compare_from(const struct mail_info *arg1, const struct mail_info *arg2, int reverse)
 {
-	int rc = utf8stricmp(mail_info_get_from(arg1),mail_info_get_from(arg2));
+	int rc = folder_sort_collate(mail_info_get_from(arg1),mail_info_get_from(arg2));
 	if (reverse) rc *= -1;
 	return rc;
 }
@@ -136,7 +160,7 @@ static int mail_compare_from(const struct mail_info *arg1, const struct mail_inf
  */
 static int mail_compare_to(const struct mail_info *arg1, const struct mail_info *arg2, int reverse)
 {
-	int rc = utf8stricmp(mail_info_get_to(arg1),mail_info_get_to(arg2));
+	int rc = folder_sort_collate(mail_info_get_to(arg1),mail_info_get_to(arg2));
 	if (reverse) rc *= -1;
 	return rc;
 }
@@ -151,7 +175,7 @@ static int mail_compare_to(const struct mail_info *arg1, const struct mail_info
  */
 static int mail_compare_subject(const struct mail_info *arg1, const struct mail_info *arg2, int reverse)
 {
-	int rc = utf8stricmp(mail_get_compare_subject(arg1->subject),mail_get_compare_subject(arg2->subject));
+	int rc = folder_sort_collate(mail_get_compare_subject(arg1->subject),mail_get_compare_subject(arg2->subject));
 	if (reverse) rc *= -1;
 	return rc;
 }
@@ -166,7 +190,7 @@ static int mail_compare_subject(const struct mail_info *arg1, const struct mail_
  */
 static int mail_compare_reply(const struct mail_info *arg1, const struct mail_info *arg2, int reverse)
 {
-	int rc = utf8stricmp(arg1->reply_addr, arg2->reply_addr);
+	int rc = folder_sort_collate(arg1->reply_addr, arg2->reply_addr);
 	if (reverse) rc *= -1;
 	return rc;
 }
@@ -371,58 +395,6 @@ static struct folder_node *find_folder_node_by_folder(struct folder *f)
 }
 
 
-/**
- * Writes a string into a filehandle. Returns 0 for an error else
- * the number of bytes which has been written (at least two).
- *
- * @param fh
- * @param str
- * @param sp the optional string pool that can be used to get the string id.
- * @return
- */
-static int fwrite_str(FILE *fh, char *str, struct string_pool *sp)
-{
-	if (str)
-	{
-		int sp_id;
-		int len;
-		unsigned char upper, lower;
-		int strl = strlen(str);
-
-		/* We only support up to 32767 characters */
-		if (strl > (1<<15))
-		{
-			return 0;
-		}
-
-		sp_id = sp?string_pool_get_id(sp, str):-1;
-		if (sp_id != -1)
-		{
-			upper = (sp_id >> 24) & 0x7f;
-			upper |= 1<<7; /* string pool ref mark */
-			lower = sp_id & 0xff;
-
-			if (fputc(upper,fh)==EOF) return 0;
-			if (fputc((sp_id >> 16) & 0xff, fh)==EOF) return 0;
-			if (fputc((sp_id >> 8) & 0xff, fh)==EOF) return 0;
-			if (fputc(lower,fh)==EOF) return 0;
-			return 4;
-		} else
-		{
-			upper = (strl/256)%256;
-			lower = strl%256;
-			if (fputc(upper,fh)==EOF) return 0;
-			if (fputc(lower,fh)==EOF) return 0;
-
-			len = fwrite(str,1,strl,fh);
-			if (len == strl) return len + 2;
-		}
-	}
-	fputc(0,fh);
-	fputc(0,fh);
-	return 2;
-}
-
 /**
  * Reads a string from a filehandle. It is allocated with malloc(), except
  * if sp_id is given and it filled with a meaningful value.
@@ -531,6 +503,24 @@ static char *folder_get_string_pool_name(struct folder *f)
 	return sp_name;
 }
 
+/**
+ * Returns the filename of the index file of the given folder.
+ *
+ * @param f
+ * @return the name of the index file that needs to be freed via free().
+ */
+static char *folder_get_index_name(struct folder *f)
+{
+	char *index_name;
+
+	if ((index_name = (char *)malloc(strlen(f->path) + 8)))
+	{
+		strcpy(index_name, f->path);
+		strcat(index_name, ".index");
+	}
+	return index_name;
+}
+
 /**
  * Opens the indexfile of the given folder and return the filehandle.
  *
@@ -596,6 +586,10 @@ static void folder_indexfile_delete(struct folder *f)
 	char cpath[256];
 
 	if (!f || !f->path) return;
+
+	/* A prefetched index is no longer valid */
+	f->prefetching = 0;
+
 	if (!(path = mystrdup(f->path))) return;
 
 	*sm_path_part(path) = 0;
@@ -622,6 +616,12 @@ static void folder_indexfile_delete(struct folder *f)
 	chdir(cpath);
 	free(index_name);
 	free(path);
+
+	if ((index_name = folder_get_index_name(f)))
+	{
+		folder_index_file_remove_journal(index_name);
+		free(index_name);
+	}
 }
 
 /**
@@ -639,6 +639,71 @@ static void folder_indexfile_invalidate(struct folder *folder)
 	}
 }
 
+/**
+ * Returns the position of the given mail within the mail array of the given
+ * folder.
+ *
+ * @param folder
+ * @param mail
+ * @return the position or -1 if the mail is not in the mail array.
+ */
+static int folder_mail_position(struct folder *folder, struct mail_info *mail)
+{
+	int pos = mail->folder_position;
+
+	if (pos >= 0 && pos < folder->num_mails && folder->mail_info_array[pos] == mail)
+		return pos;
+	return -1;
+}
+
+/**
+ * Records the current filename and flags of the given mail in the journal
+ * of the index file. The journal is folded into the index file if it has
+ * grown too large. If the change cannot be recorded, the index file is
+ * invalidated.
+ *
+ * @param folder the folder of the mail.
+ * @param mail the mail that has been changed.
+ * @param filename_changed whether the filename of the mail has been changed.
+ */
+static void folder_indexfile_journal_mail(struct folder *folder, struct mail_info *mail, int filename_changed)
+{
+	unsigned long journal_size = 0;
+	char *index_name;
+	int i;
+
+	if (!folder->index_uptodate)
+		return;
+
+	/* As long as the index file is uptodate, the mails are in the same
+	 * order as in the index file */
+	i = folder_mail_position(folder, mail);
+
+	if (i >= 0 && (!filename_changed || mail->filename) && (index_name = folder_get_index_name(folder)))
+	{
+		journal_size = folder_index_file_journal_append(index_name, i, filename_changed?mail->filename:NULL, mail->flags, folder->unread_mails);
+		free(index_name);
+	}
+
+	if (!journal_size)
+	{
+		folder_indexfile_invalidate(folder);
+		return;
+	}
+
+	if (journal_size > FOLDER_INDEX_JOURNAL_MAX_SIZE)
+	{
+		SM_DEBUGF(10,("Folding journal of folder \"%s\" into the index file\n",folder->name));
+
+		folder->index_uptodate = 0;
+		folder_save_index(folder);
+
+		/* Further changes couldn't be recorded otherwise */
+		if (!folder->index_uptodate)
+			folder_indexfile_delete(folder);
+	}
+}
+
 /*****************************************************************************/
 
 void folder_delete_all_indexfiles(void)
@@ -732,7 +797,15 @@ static int folder_set_pending_flag_in_indexfile(struct folder *folder)
 
 /*****************************************************************************/
 
-int folder_add_mail(struct folder *folder, struct mail_info *mail, int sort)
+/**
+ * Adds the given mail to the given folder without updating the text index.
+ *
+ * @param folder the folder to which the mail is added.
+ * @param mail the mail to be added.
+ * @param sort whether the mail should be inserted into the sorted array.
+ * @return the position of the mail or -1.
+ */
+static int folder_add_mail_info(struct folder *folder, struct mail_info *mail, int sort)
 {
 	int i,pos;
 
@@ -776,17 +849,17 @@ int folder_add_mail(struct folder *folder, struct mail_info *mail, int sort)
 		return -1;
 	}
 
-	/* free the sorted mail array */
-	if (folder->sorted_mail_info_array && !sort)
+	/* free the sorted mails */
+	if ((folder->sorted_mails || folder->sorted_mail_info_array) && !sort)
 	{
-		free(folder->sorted_mail_info_array);
-		folder->sorted_mail_info_array = NULL;
-	} else if (!folder->sorted_mail_info_array && sort)
+		folder_sorted_mails_free(folder);
+	} else if (!folder->sorted_mails && sort)
 	{
 		void *handle = NULL;
 		/* this should sort the folder */
 		folder_next_mail_info(folder, &handle);
 	}
+	folder_sort_cache_clear(folder);
 
 	/* delete the indexfile if not already done */
 	folder_indexfile_invalidate(folder);
@@ -795,9 +868,6 @@ int folder_add_mail(struct folder *folder, struct mail_info *mail, int sort)
 	{
 		folder->mail_info_array_allocated += 50;
 		folder->mail_info_array = (struct mail_info **)realloc(folder->mail_info_array,folder->mail_info_array_allocated*sizeof(struct mail_info *));
-
-		if (folder->sorted_mail_info_array)
-			folder->sorted_mail_info_array = (struct mail_info **)realloc(folder->sorted_mail_info_array,folder->mail_info_array_allocated*sizeof(struct mail_info *));
 	}
 
 	if (!folder->mail_info_array)
@@ -809,136 +879,76 @@ int folder_add_mail(struct folder *folder, struct mail_info *mail, int sort)
 	if (mail->message_id)
 	{
 		/* check if there is already an mail with the same message id, this would cause problems */
-		for (i=0;i<folder->num_mails;i++)
+		if (folder_mail_thread_ensure(folder))
+		{
+			if (mail_thread_lookup(folder->mail_thread, mail->message_id))
+				mail_info_set_message_id(mail, NULL);
+		} else
 		{
-			struct mail_info *fm = folder->mail_info_array[i];
-			if (!(mystricmp(mail->message_id,fm->message_id)))
+			for (i=0;i<folder->num_mails;i++)
 			{
-				if (mail->message_id)
+				struct mail_info *fm = folder->mail_info_array[i];
+				if (!(mystricmp(mail->message_id,fm->message_id)))
 				{
-					free(mail->message_id);
-					mail->message_id = NULL;
+					if (mail->message_id)
+					{
+						mail_info_set_message_id(mail, NULL);
+					}
 				}
 			}
 		}
 	}
 
-	if (folder->sorted_mail_info_array)
+	if (folder->sorted_mails && (folder->primary_sort & FOLDER_SORT_MODEMASK) == FOLDER_SORT_THREAD)
+	{
+		/* the threaded order is rebuilt when needed */
+		folder_sorted_mails_free(folder);
+		pos = folder->num_mails;
+	} else if (folder->sorted_mails)
 	{
 		mail_compare_set_sort_mode(folder);
 
-#if 0
-		/* this search routine has O(n) but should be improved to O(log n) with binary serach */
-		for (pos=0;pos<folder->num_mails;pos++)
+		/* The mail is placed behind all equal mails */
+		if ((pos = mail_btree_insert_sorted(folder->sorted_mails, mail, mail_compare)) < 0)
 		{
-			if (mail_compare(&folder->sorted_mail_info_array[pos],&mail) > 0) break;
-		}
-#else
-		/* here comes the binary search. because this is my (= bgol) first try in such an
-		   algorythmus I left the old code in. */
-		{
-			int low=0, high=folder->num_mails+1;
-
-			/* For the beginning, low must be (start-1) and high must be (end+1).
-			   As we are in C the array goes from start=0 to end=(n-1) but this code
-			   doesn't work with low < 0. So, I'm calculating the pos counter one to
-			   high and use for the mail_compare() [pos-1]. This has the advantage
-			   that the pos counter is allready correct after the calculation.
-			   The search also doesn't stop at a match (mail_compare==0) because the
-			   mail must be placed at the end of the list of same mails. */
-
-			pos = (low + high) / 2;
-			while (pos > low)
-			{
-				if (mail_compare(&folder->sorted_mail_info_array[pos-1],&mail) <= 0)
-					low = pos;
-				else
-					high = pos;
-				pos = (low + high) / 2;
-			}
+			folder_sorted_mails_free(folder);
+			pos = folder->num_mails;
 		}
-#endif
 
-/* G++ didn't compile the non-C++ (gcc 8.2) so workaround this problem */
-#ifdef __cplusplus
-		struct mail_info *mi = mail;
-#endif
-		memmove(&folder->sorted_mail_info_array[pos+1],&folder->sorted_mail_info_array[pos],(folder->num_mails - pos)*sizeof(struct mail*));
-#ifdef __cplusplus
-		folder->sorted_mail_info_array[pos] = mi;
-#else
-		folder->sorted_mail_info_array[pos] = mail;
-#endif
-	} else pos = folder->num_mails;
+		/* the flat copy is outdated now */
+		free(folder->sorted_mail_info_array);
+		folder->sorted_mail_info_array = NULL;
+	} else
+	{
+		/* a sorted flat copy without the tree cannot be updated */
+		folder_sorted_mails_free(folder);
+		pos = folder->num_mails;
+	}
 
+	mail->folder_position = folder->num_mails;
 	folder->mail_info_array[folder->num_mails++] = mail;
 	if (folder->num_mails > folder->num_index_mails) folder->num_index_mails = folder->num_mails;
 	if (mail_info_get_status_type(mail) == MAIL_STATUS_UNREAD) folder->unread_mails++;
 	if (mail->flags & MAIL_FLAGS_NEW) folder->new_mails++;
 	if (mail->flags & MAIL_FLAGS_PARTIAL) folder->partial_mails++;
 
-	/* Disabled because slow, buggy, and not really used */
-#if 0
-	/* sort the mails for threads */
-	if (mail->message_id)
-	{
-		for (i=0;i<folder->num_mails-1;i++) /* ignore the last mail since it is this mail */
-		{
-			struct mail_info *fm = folder->mail_info_array[i];
-			if (!(mystricmp(mail->message_id,fm->message_reply_id)))
-			{
-				if (!mail->sub_thread_mail)
-				{
-					mail->sub_thread_mail = fm;
-				} else
-				{
-					struct mail_info *m = mail->sub_thread_mail;
-					struct mail_info *next = m->next_thread_mail;
-					while (next)
-					{
-						m = next;
-						next = next->next_thread_mail;
-					}
-					m->next_thread_mail = fm;
-				}
-				fm->child_mail = 1;
-			}
-		}
-	}
-
-	if (mail->message_reply_id)
-	{
-		for (i=0;i<folder->num_mails-1;i++) /* ignore the last mail since it is this mail */
-		{
-			struct mail_info *fm = folder->mail_info_array[i];
-			if (!(mystricmp(mail->message_reply_id,fm->message_id)))
-			{
-				if (!fm->sub_thread_mail)
-				{
-					fm->sub_thread_mail = mail;
-				} else
-				{
-					struct mail_info *m = fm->sub_thread_mail;
-					struct mail_info *next = m->next_thread_mail;
-					while (next)
-					{
-						m = next;
-						next = next->next_thread_mail;
-					}
-					m->next_thread_mail = mail;
-				}
-				mail->child_mail = 1;
-				break;
-			}
-		}
-	}
-#endif
+	/* link the mail with the mails of its thread */
+	if (folder->mail_thread && !mail_thread_add(folder->mail_thread, mail))
+		folder_mail_thread_free(folder);
 
 	return pos;
 }
 
 /*****************************************************************************/
 
+int folder_add_mail(struct folder *folder, struct mail_info *mail, int sort)
+{
+	folder_text_index_thread_add_mail(folder, mail);
+	return folder_add_mail_info(folder, mail, sort);
+}
+
+/*****************************************************************************/
+
 static int folder_add_mails(struct folder *f, struct mail_info **mails, int num)
 {
 	int i;
@@ -953,7 +963,7 @@ static int folder_add_mails(struct folder *f, struct mail_info **mails, int num)
 	for (i = 0; i < num; i++)
 	{
 		if (!mails[i]) continue;
-		if (folder_add_mail(f, mails[i], 0) == -1)
+		if (folder_add_mail_info(f, mails[i], 0) == -1)
 		{
 			return 0;
 		}
@@ -970,9 +980,8 @@ static int folder_add_mails(struct folder *f, struct mail_info **mails, int num)
 static void folder_remove_mail_info(struct folder *folder, struct mail_info *mail)
 {
 	int i;
-#if 0
-	struct mail_info *submail;
-#endif
+
+	folder_text_index_thread_remove_mail(folder, mail);
 
 	/* lock the folder, because we are going to remove something */
 	folder_lock(folder);
@@ -983,51 +992,37 @@ static void folder_remove_mail_info(struct folder *folder, struct mail_info *mai
 		return;
 	}
 
-	/* free the sorted mail array */
-	if (folder->sorted_mail_info_array)
+	/* remove the mail from the sorted mails */
+	if (folder->sorted_mails && (folder->primary_sort & FOLDER_SORT_MODEMASK) == FOLDER_SORT_THREAD)
 	{
-		free(folder->sorted_mail_info_array);
-		folder->sorted_mail_info_array = NULL;
-	}
-
-	/* delete the indexfile if not already done */
-	folder_indexfile_invalidate(folder);
-
-#if 0
-	for (i=0; i < folder->num_mails; i++)
+		/* the replies of the mail may move, the threaded order is rebuilt when needed */
+		folder_sorted_mails_free(folder);
+	} else if (folder->sorted_mails)
 	{
-		if (folder->mail_info_array[i]->sub_thread_mail == mail)
-		{
-			folder->mail_info_array[i]->sub_thread_mail = mail->next_thread_mail;
-/*		struct mail *nm = mail->next_thread_mail;
-			folder->mail_array[i]->sub_thread_mail = NULL;
-			while (nm)
-			{
-				struct mail *save = nm;
-				nm = mail->next_thread_mail;
-				save->child_mail = 0;
-				save->next_thread_mail = NULL;
-			}*/
-		}
+		int pos;
 
-		if (folder->mail_info_array[i]->next_thread_mail == mail)
+		mail_compare_set_sort_mode(folder);
+		if ((pos = mail_btree_find_sorted(folder->sorted_mails, mail, mail_compare)) >= 0)
 		{
-			folder->mail_info_array[i]->next_thread_mail = mail->next_thread_mail;
-		}
-	}
+			mail_btree_remove_at(folder->sorted_mails, pos);
 
-	if ((submail = mail->sub_thread_mail))
-	{
-		while (submail)
+			free(folder->sorted_mail_info_array);
+			folder->sorted_mail_info_array = NULL;
+		} else
 		{
-			struct mail_info *next = submail->next_thread_mail;
-			submail->next_thread_mail = NULL;
-			submail = next;
+			folder_sorted_mails_free(folder);
 		}
+	} else
+	{
+		folder_sorted_mails_free(folder);
 	}
-	mail->sub_thread_mail = NULL;
-	mail->next_thread_mail = NULL;
-#endif
+	folder_sort_cache_clear(folder);
+
+	/* delete the indexfile if not already done */
+	folder_indexfile_invalidate(folder);
+
+	if (folder->mail_thread)
+		mail_thread_remove(folder->mail_thread, mail);
 
 	for (i=0; i < folder->num_mails; i++)
 	{
@@ -1038,6 +1033,7 @@ static void folder_remove_mail_info(struct folder *folder, struct mail_info *mai
 			for (; i < folder->num_mails; i++)
 			{
 				folder->mail_info_array[i] = folder->mail_info_array[i+1];
+				folder->mail_info_array[i]->folder_position = i;
 			}
 		}
 	}
@@ -1065,11 +1061,10 @@ void folder_mark_mail_as_deleted(struct folder *folder, struct mail_info *mail)
 	if ((*newfilename == 'u') || (*newfilename == 'U')) *newfilename = 'd';
 	if (!rename(mail->filename,newfilename))
 	{
-		free(mail->filename);
-		mail->filename = newfilename;
+		mail_info_set_filename(mail, newfilename);
+		folder_sort_cache_clear(folder);
 
-		/* delete the indexfile if not already done */
-		folder_indexfile_invalidate(folder);
+		folder_indexfile_journal_mail(folder, mail, 1);
 	}
 
 	chdir(buf);
@@ -1090,11 +1085,10 @@ void folder_mark_mail_as_undeleted(struct folder *folder, struct mail_info *mail
 	if ((*newfilename == 'd') || (*newfilename == 'D')) *newfilename = 'u';
 	if (!rename(mail->filename,newfilename))
 	{
-		free(mail->filename);
-		mail->filename = newfilename;
+		mail_info_set_filename(mail, newfilename);
+		folder_sort_cache_clear(folder);
 
-		/* delete the indexfile if not already done */
-		folder_indexfile_invalidate(folder);
+		folder_indexfile_journal_mail(folder, mail, 1);
 	}
 
 	chdir(buf);
@@ -1106,14 +1100,14 @@ void folder_replace_mail(struct folder *folder, struct mail_info *toreplace, str
 {
 	int i;
 
+	folder_text_index_thread_remove_mail(folder, toreplace);
+	folder_text_index_thread_add_mail(folder, newmail);
+
 	folder_lock(folder);
 
-	/* free the sorted mail array */
-	if (folder->sorted_mail_info_array)
-	{
-		free(folder->sorted_mail_info_array);
-		folder->sorted_mail_info_array = NULL;
-	}
+	/* free the sorted mails */
+	folder_sorted_mails_free(folder);
+	folder_sort_cache_clear(folder);
 
 	/* Delete the indexfile if not already done */
 	folder_indexfile_invalidate(folder);
@@ -1122,11 +1116,19 @@ void folder_replace_mail(struct folder *folder, struct mail_info *toreplace, str
 	{
 		if (folder->mail_info_array[i] == toreplace)
 		{
+			newmail->folder_position = i;
 			folder->mail_info_array[i] = newmail;
 			break;
 		}
 	}
 
+	if (folder->mail_thread)
+	{
+		mail_thread_remove(folder->mail_thread, toreplace);
+		if (!mail_thread_add(folder->mail_thread, newmail))
+			folder_mail_thread_free(folder);
+	}
+
 	/* update the mail statistics */
 	if ((mail_info_get_status_type(toreplace) == MAIL_STATUS_UNREAD) && folder->unread_mails) folder->unread_mails--;
 	if ((toreplace->flags & MAIL_FLAGS_NEW) && folder->new_mails) folder->new_mails--;
@@ -1233,14 +1235,7 @@ void folder_set_mail_status(struct folder *folder, struct mail_info *mail, mail_
 		if (!folder->mail_infos_loaded)
 			folder_read_mail_infos(folder,0);
 
-		for (i=0;i<folder->num_mails;i++)
-		{
-			if (folder->mail_info_array[i]==mail)
-			{
-				mail_found = 1;
-				break;
-			}
-		}
+		mail_found = folder_mail_position(folder, mail) >= 0;
 	}
 	if (mail_found)
 	{
@@ -1256,6 +1251,7 @@ void folder_set_mail_status(struct folder *folder, struct mail_info *mail, mail_
 		if ((status_new & MAIL_STATUS_MASK) == MAIL_STATUS_UNREAD) folder->unread_mails++;
 
 		mail->status = status_new;
+		folder_sort_cache_clear(folder);
 		if (!mail->filename) return;
 
 		filename = mail_get_status_filename(mail->filename, status_new);
@@ -1278,14 +1274,12 @@ void folder_set_mail_status(struct folder *folder, struct mail_info *mail, mail_
 
 			if (renamed)
 			{
-				free(mail->filename);
-				mail->filename = filename;
+				mail_info_set_filename(mail, filename);
 			}
 
 			chdir(buf);
 
-			/* Delete the indexfile if not already done */
-			folder_indexfile_invalidate(folder);
+			folder_indexfile_journal_mail(folder, mail, renamed);
 		}
 	}
 }
@@ -1306,9 +1300,9 @@ void folder_set_mail_flags(struct folder *folder, struct mail_info *mail, int fl
 	}
 
 	mail->flags = flags_new;
+	folder_sort_cache_clear(folder);
 
-	/* Delete the indexfile if not already done */
-	folder_indexfile_invalidate(folder);
+	folder_indexfile_journal_mail(folder, mail, 0);
 }
 
 /*****************************************************************************/
@@ -1398,6 +1392,9 @@ int folder_is_filename_mail(const char *fn)
 
 /*****************************************************************************/
 
+/** Number of mails that are read by the rescan pool at once */
+#define FOLDER_RESCAN_BATCH_SIZE 512
+
 struct folder_rescan_really_context
 {
 	struct coroutine_basic_context basic_context;
@@ -1408,6 +1405,13 @@ struct folder_rescan_really_context
 	const char *folder_name;
 	struct folder_index *folder_index; /* the opened index, if any */
 
+	/**
+	 * If set, the directory is compared against the opened index and only
+	 * mails that are not in the index or that have been changed since the
+	 * index has been written are read.
+	 */
+	int incremental;
+
 	/** Function to be called for a new mail. Returns 1 on success, 0 otherwise. */
 	int (*mail_callback)(struct mail_info *m, void *udata);
 	void *mail_callback_udata;
@@ -1429,70 +1433,226 @@ struct folder_rescan_really_context
 
 	int create;// = 1;
 
+	/* The mails of the index for an incremental rescan */
+	struct mail_info **index_mails;
+	int num_index_mails;
+	struct hash_table index_mails_table; /* maps filenames to positions in index_mails */
+	int index_mails_table_initialized;
+
+	/* The batch of mails that is currently read by the rescan pool */
+	struct folder_rescan_batch batch;
+	char *batch_filenames[FOLDER_RESCAN_BATCH_SIZE];
+	struct mail_info *batch_mails[FOLDER_RESCAN_BATCH_SIZE];
+
 	/* Output */
 	int index_read; /* Set to 1, if index has been read */
 };
 
 /**
- * Work horse for scanning a folder.
+ * Prepares the incremental rescan by reading the mails of the index.
  *
- * @return coroutine return status.
+ * @param c the context of the rescan.
+ * @return 1 on success, 0 if a full rescan is required.
  */
-static coroutine_return_t folder_rescan_really(struct coroutine_basic_context *ctx)
+static int folder_rescan_really_read_index(struct folder_rescan_really_context *c)
 {
-	struct folder_rescan_really_context *c = (struct folder_rescan_really_context*)ctx;
-	struct dirent *dptr; /* dir entry */
-	struct string_node *snode;
+	struct string_pool *sp = NULL;
+	int i;
 
-	COROUTINE_BEGIN(c);
+	if (!c->folder_index->fif && !(sp = string_pool_create_and_load(c->folder_index->string_pool_name)))
+		return 0;
+
+	c->num_index_mails = folder_index_read_them_all(c->folder_index, folder_mail_context, sp, &c->index_mails);
+	if (sp) string_pool_delete(sp);
 
-	if (c->folder_index)
+	if (!c->index_mails)
+		return 0;
+
+	if (!hash_table_init(&c->index_mails_table, 12, NULL))
+		return 0;
+	c->index_mails_table_initialized = 1;
+
+	for (i = 0; i < c->num_index_mails; i++)
 	{
-		struct string_pool *sp;
-		struct mail_info **mis = NULL;
+		char *filename;
 
-		if (!(sp = string_pool_create_and_load(c->folder_index->string_pool_name)))
-			goto out;
+		if (!(filename = mystrdup(c->index_mails[i]->filename)))
+			return 0;
 
-		folder_index_read_them_all(c->folder_index, sp, &mis);
-		if (c->folder_index->num_mails && mis)
+		if (!hash_table_insert(&c->index_mails_table, filename, i))
 		{
-			int i;
+			free(filename);
+			return 0;
+		}
+	}
+	return 1;
+}
 
-			for (i = 0; i < c->folder_index->num_mails && c->create; i++)
-			{
-				c->create = c->mail_callback(mis[i], c->mail_callback_udata);
-			}
-			free(mis);
+/**
+ * Returns the mail of the index that can be used for the file with the given
+ * name, i.e., the file was not changed since the index has been written.
+ * The returned mail is no longer owned by the context.
+ *
+ * @param c the context of the rescan.
+ * @param filename the name of the file relative to the current directory.
+ * @return the mail or NULL if the mail needs to be read.
+ */
+static struct mail_info *folder_rescan_really_take_index_mail(struct folder_rescan_really_context *c, const char *filename)
+{
+	struct hash_entry *entry;
+	struct mail_info *m;
+	struct stat st;
 
-			c->index_read = 1;
-		}
+	if (!(entry = hash_table_lookup(&c->index_mails_table, filename)))
+		return NULL;
 
-		string_pool_delete(sp);
+	if (!(m = c->index_mails[entry->data]))
+		return NULL;
 
-		goto out;
-	}
+	/* Files that have been modified in the second the index was written
+	 * are read again to be on the safe side. The modification time of the
+	 * index file itself is no indication as setting the pending flag alters
+	 * it. Legacy index files don't tell when they were written, so all mails
+	 * are read again. */
+	if (stat(filename, &st) != 0 || st.st_size != m->size || st.st_mtime >= c->folder_index->saved)
+		return NULL;
 
-	c->create = 1;
+	c->index_mails[entry->data] = NULL;
+	return m;
+}
 
-	getcwd(c->path, sizeof(c->path));
-	if (chdir(c->folder_path) == -1)
+/**
+ * Frees the resources of an incremental rescan including the mails of the
+ * index that have not been taken.
+ *
+ * @param c the context of the rescan.
+ */
+static void folder_rescan_really_free_index(struct folder_rescan_really_context *c)
+{
+	int i;
+
+	if (c->index_mails_table_initialized)
 	{
-		SM_DEBUGF(10, ("Failed to change directory to \"%s\" (current path is \"%s\")\n", c->folder_path, c->path));
-		goto out;
+		hash_table_clean(&c->index_mails_table);
+		c->index_mails_table_initialized = 0;
 	}
 
-	if (!(c->dfd = opendir(SM_CURRENT_DIR)))
+	if (c->index_mails)
 	{
-		SM_DEBUGF(10, ("Failed to open current directory)\n"));
-		chdir(c->path);
-		goto out;
+		for (i = 0; i < c->num_index_mails; i++)
+			mail_info_free(c->index_mails[i]);
+		free(c->index_mails);
+		c->index_mails = NULL;
 	}
+}
 
-	c->last_ticks = time_reference_ticks();
+/**
+ * Reports the progress of reading the mails, if enough time has been passed
+ * since the last report.
+ *
+ * @param c the context of the rescan.
+ * @param current_mail the number of mails that have been read so far.
+ */
+static void folder_rescan_really_report(struct folder_rescan_really_context *c, unsigned int current_mail)
+{
+	if (!c->status_callback && !c->pm)
+		return;
 
-	string_list_init(&c->mail_filename_list);
-	c->number_of_mails = 0;
+	if (time_ms_passed(c->last_ticks) <= 500)
+		return;
+
+	sm_snprintf(c->buf,sizeof(c->buf),_("Reading mail %ld of %ld"),current_mail,c->number_of_mails);
+	if (c->status_callback)
+	{
+		c->status_callback(c->buf);
+	}
+
+	if (c->pm)
+	{
+		int new_total_work_done;
+		int work;
+
+		new_total_work_done = current_mail * 100 / c->number_of_mails;
+		if ((work = new_total_work_done - c->total_work_done) > 0)
+		{
+			c->pm->working_on(c->pm, c->buf);
+			c->pm->work(c->pm, work);
+
+			c->total_work_done = new_total_work_done;
+		}
+	}
+	c->last_ticks = time_reference_ticks();
+}
+
+/**
+ * Work horse for scanning a folder.
+ *
+ * @return coroutine return status.
+ */
+static coroutine_return_t folder_rescan_really(struct coroutine_basic_context *ctx)
+{
+	struct folder_rescan_really_context *c = (struct folder_rescan_really_context*)ctx;
+	struct dirent *dptr; /* dir entry */
+	struct string_node *snode;
+
+	COROUTINE_BEGIN(c);
+
+	if (c->folder_index && !c->incremental)
+	{
+		struct string_pool *sp = NULL;
+		struct mail_info **mis = NULL;
+		int num_mails;
+
+		if (!c->folder_index->fif && !(sp = string_pool_create_and_load(c->folder_index->string_pool_name)))
+			goto out;
+
+		num_mails = folder_index_read_them_all(c->folder_index, folder_mail_context, sp, &mis);
+		if (num_mails && mis)
+		{
+			int i;
+
+			for (i = 0; i < num_mails && c->create; i++)
+			{
+				c->create = c->mail_callback(mis[i], c->mail_callback_udata);
+			}
+			free(mis);
+
+			c->index_read = 1;
+		}
+
+		if (sp) string_pool_delete(sp);
+
+		goto out;
+	}
+
+	c->create = 1;
+
+	if (c->folder_index && !folder_rescan_really_read_index(c))
+	{
+		SM_DEBUGF(10, ("Index of folder \"%s\" could not be used for an incremental rescan\n", c->folder_name));
+		folder_rescan_really_free_index(c);
+	}
+
+	getcwd(c->path, sizeof(c->path));
+	if (chdir(c->folder_path) == -1)
+	{
+		SM_DEBUGF(10, ("Failed to change directory to \"%s\" (current path is \"%s\")\n", c->folder_path, c->path));
+		folder_rescan_really_free_index(c);
+		goto out;
+	}
+
+	if (!(c->dfd = opendir(SM_CURRENT_DIR)))
+	{
+		SM_DEBUGF(10, ("Failed to open current directory)\n"));
+		chdir(c->path);
+		folder_rescan_really_free_index(c);
+		goto out;
+	}
+
+	c->last_ticks = time_reference_ticks();
+
+	string_list_init(&c->mail_filename_list);
+	c->number_of_mails = 0;
 
 	if (c->status_callback)
 	{
@@ -1511,68 +1671,108 @@ static coroutine_return_t folder_rescan_really(struct coroutine_basic_context *c
 		if (!folder_is_filename_mail(name))
 			continue;
 
+		if (c->index_mails)
+		{
+			struct mail_info *m;
+
+			/* Unchanged mails are taken from the index */
+			if ((m = folder_rescan_really_take_index_mail(c, name)))
+			{
+				if (c->create)
+					c->create = c->mail_callback(m, c->mail_callback_udata);
+				else
+					mail_info_free(m);
+				continue;
+			}
+		}
+
 		string_list_insert_tail(&c->mail_filename_list, name);
 		c->number_of_mails++;
 	}
 	closedir(c->dfd);
 
+	/* Mails of the index that remained have been removed from the folder */
+	folder_rescan_really_free_index(c);
+
 	if (c->pm)
 	{
 		c->pm->work(c->pm, 1);
 	}
 
+	/* The mails are read by the rescan pool, which uses full paths */
+	chdir(c->path);
+
+	c->batch.folder_path = c->folder_path;
+	c->batch.filenames = c->batch_filenames;
+	c->batch.mails = c->batch_mails;
+
 	c->current_mail = 0;
-	while ((snode = string_list_remove_head(&c->mail_filename_list)))
+	while (c->create && c->current_mail < c->number_of_mails)
 	{
-		struct mail_info *m;
+		int i;
+
+		c->batch.num_mails = 0;
+		while (c->batch.num_mails < FOLDER_RESCAN_BATCH_SIZE && (snode = string_list_remove_head(&c->mail_filename_list)))
+		{
+			c->batch_filenames[c->batch.num_mails] = snode->string;
+			c->batch_mails[c->batch.num_mails++] = NULL;
+			free(snode);
+		}
+
+		/* Take part in reading the mails and wait for the remaining ones */
+		folder_rescan_pool_submit(&c->batch);
+		while (folder_rescan_pool_help(&c->batch))
+		{
+			folder_rescan_really_report(c, c->current_mail + folder_rescan_pool_completed(&c->batch));
+		}
+		while (!folder_rescan_pool_finished(&c->batch))
+		{
+			COROUTINE_YIELD(c);
+			folder_rescan_really_report(c, c->current_mail + folder_rescan_pool_completed(&c->batch));
+		}
 
-		if (c->status_callback || c->pm)
+		/* Merge the mails in the order of the filenames */
+		for (i = 0; i < c->batch.num_mails; i++)
 		{
-			if (time_ms_passed(c->last_ticks) > 500)
+			struct mail_info *m = c->batch_mails[i];
+
+			if (!m && c->create)
 			{
-				sm_snprintf(c->buf,sizeof(c->buf),_("Reading mail %ld of %ld"),c->current_mail,c->number_of_mails);
-				if (c->status_callback)
+				char *path;
+
+				/* Give mails that couldn't be read by the pool a second try */
+				if ((path = mycombinepath(c->folder_path, c->batch_filenames[i])))
 				{
-					c->status_callback(c->buf);
+					m = mail_info_create_from_file(folder_mail_context, path);
+					free(path);
 				}
-
-				if (c->pm)
+				if (m)
 				{
-					int new_total_work_done;
-					int work;
-
-					new_total_work_done = c->current_mail * 100 / c->number_of_mails;;
-					if ((work = new_total_work_done - c->total_work_done) > 0)
-					{
-						c->pm->working_on(c->pm, c->buf);
-						c->pm->work(c->pm, work);
-
-						c->total_work_done = new_total_work_done;
-					}
+					free(m->filename);
+					m->filename = c->batch_filenames[i];
+					c->batch_filenames[i] = NULL;
+				} else
+				{
+					SM_DEBUGF(5, ("Failed to read mail \"%s\" of folder \"%s\"\n", c->batch_filenames[i], c->folder_name));
 				}
-				c->last_ticks = time_reference_ticks();
 			}
-		}
-
-		if (c->create && (m = mail_info_create_from_file(folder_mail_context, snode->string)))
-		{
-			c->create = c->mail_callback(m, c->mail_callback_udata);
-		}
 
-		free(snode->string);
-		free(snode);
-
-		c->current_mail++;
+			if (m)
+			{
+				mail_info_set_context(m, folder_mail_context);
 
-		if (!(c->current_mail % 512))
-		{
-			chdir(c->path);
-			COROUTINE_YIELD(c);
-			chdir(c->folder_path);
+				if (c->create)
+					c->create = c->mail_callback(m, c->mail_callback_udata);
+				else
+					mail_info_free(m);
+			}
+			free(c->batch_filenames[i]);
 		}
-	}
+		c->current_mail += c->batch.num_mails;
 
-	chdir(c->path);
+		COROUTINE_YIELD(c);
+	}
+	string_list_clear(&c->mail_filename_list);
 
 	if (c->status_callback || c->pm)
 	{
@@ -1607,9 +1807,11 @@ static void folder_dispose_mails(struct folder *f, int keep_pending)
 {
 	/* FIXME: We should also delete each mail */
 	free(f->mail_info_array);
-	free(f->sorted_mail_info_array);
+	folder_sorted_mails_free(f);
+	folder_sort_cache_clear(f);
+	folder_mail_thread_free(f);
 
-	f->mail_info_array = f->sorted_mail_info_array = f->pending_mail_info_array = NULL;
+	f->mail_info_array = f->pending_mail_info_array = NULL;
 	f->mail_info_array_allocated = 0;
 	f->num_mails = 0;
 	f->new_mails = 0;
@@ -1699,7 +1901,8 @@ enum index_mode
 {
 	DONT_TRY, /* Index shall not be tried */
 	TRY, /* Index shall be tried */
-	ONLY /* Try index, and if this fails, do not scan */
+	ONLY, /* Try index, and if this fails, do not scan */
+	INCREMENTAL /* Scan but take unchanged mails from the index */
 };
 
 struct folder_thread_rescan_context
@@ -1844,6 +2047,7 @@ static coroutine_return_t folder_thread_rescan_or_reread_index_coroutine(struct
 		rescan_ctx->folder_path = c->folder_path;
 		rescan_ctx->folder_name = c->folder_name;
 		rescan_ctx->folder_index = c->folder_index;
+		rescan_ctx->incremental = c->index_mode == INCREMENTAL;
 		rescan_ctx->mail_callback= folder_thread_mail_callback;
 		rescan_ctx->mail_callback_udata = &c->udata;
 		rescan_ctx->status_callback = c->status_callback;
@@ -1920,6 +2124,12 @@ static int folder_rescan_or_reread_index_async(struct folder *folder, enum index
 		return 0;
 	}
 
+	/* Failing to start the threads only slows down the rescan */
+	if (index_mode != ONLY)
+	{
+		folder_rescan_pool_start(user.config.rescan_threads);
+	}
+
 	if (!(ctx = (struct folder_thread_rescan_context*)malloc(sizeof(*ctx))))
 		return 0;
 	memset(ctx, 0, sizeof(*ctx));
@@ -1956,6 +2166,13 @@ int folder_rescan_async(struct folder *folder, void (*status_callback)(const cha
 	return folder_rescan_or_reread_index_async(folder, DONT_TRY, status_callback, completed, udata);
 }
 
+/*****************************************************************************/
+
+int folder_rescan_incremental_async(struct folder *folder, void (*status_callback)(const char *txt), void (*completed)(char *folder_path, void *udata), void *udata)
+{
+	return folder_rescan_or_reread_index_async(folder, INCREMENTAL, status_callback, completed, udata);
+}
+
 /**
  * Read the next mail info from the index.
  *
@@ -2056,7 +2273,7 @@ static struct mail_info *folder_read_mail_info_from_index(mail_context *mc, FILE
  * Check whether the given file handle is a proper indexfile.
  *
  * @param fh
- * @return
+ * @return the version of the indexfile or 0 if it is not a supported one.
  */
 static int folder_indexfile_check(FILE *fh)
 {
@@ -2069,12 +2286,12 @@ static int folder_indexfile_check(FILE *fh)
 		return 0;
 	}
 
-	if (magic.ver != FOLDER_INDEX_VERSION)
+	if (magic.ver != FOLDER_INDEX_VERSION && magic.ver != FOLDER_INDEX_FILE_VERSION)
 	{
 		return 0;
 	}
 
-	return 1;
+	return magic.ver;
 }
 
 /**
@@ -2098,11 +2315,29 @@ static struct folder_index *folder_index_open(struct folder *f)
 		goto bailout;
 	}
 
-	if (!folder_indexfile_check(fi->fh))
+	if (!(fi->ver = folder_indexfile_check(fi->fh)))
 	{
 		goto bailout;
 	}
 
+	{
+		struct stat st;
+		char *index_name;
+		int rc;
+
+		if (!(index_name = folder_get_index_name(f)))
+		{
+			goto bailout;
+		}
+		rc = stat(index_name, &st);
+		free(index_name);
+		if (rc != 0)
+		{
+			goto bailout;
+		}
+		fi->mtime = st.st_mtime;
+	}
+
 	if (!(fi->string_pool_name = folder_get_string_pool_name(f)))
 	{
 		goto bailout;
@@ -2121,6 +2356,29 @@ static struct folder_index *folder_index_open(struct folder *f)
 		goto bailout;
 	}
 
+	if (fi->ver == FOLDER_INDEX_FILE_VERSION)
+	{
+		char *index_name;
+
+		/* The records are accessed via the mapping */
+		fclose(fi->fh);
+		fi->fh = NULL;
+
+		if (!(index_name = folder_get_index_name(f)))
+		{
+			goto bailout;
+		}
+		fi->fif = folder_index_file_open(index_name);
+		free(index_name);
+		if (!fi->fif)
+		{
+			goto bailout;
+		}
+		fi->num_mails = folder_index_file_num_mails(fi->fif);
+		fi->unread_mails = folder_index_file_unread_mails(fi->fif);
+		fi->saved = folder_index_file_saved(fi->fif);
+	}
+
 	return fi;
 
 bailout:
@@ -2137,42 +2395,83 @@ static void folder_index_close(struct folder_index *fi)
 		return;
 	}
 	free(fi->string_pool_name);
-	fclose(fi->fh);
+	if (fi->fh) fclose(fi->fh);
+	folder_index_file_close(fi->fif);
 	free(fi);
 
 }
 
 /**
  * Read all mail info from the already opened index file to the given folder.
+ * The mails of mapped index files are allocated from a common arena, which
+ * is freed once the last of these mails has been freed.
  *
  * @param fi
- * @param sp
+ * @param mc the mail context that shall be used when creating the mails or NULL.
+ * @param sp the string pool of legacy index files. Not used otherwise.
  * @param out_ptr
+ * @return the number of mails that have been read into *out_ptr.
  */
-static void folder_index_read_them_all(struct folder_index *fi, struct string_pool *sp, struct mail_info ***out_ptr)
+static int folder_index_read_them_all(struct folder_index *fi, mail_context *mc, struct string_pool *sp, struct mail_info ***out_ptr)
 {
 	int i;
+	int num_read = 0;
 	int num_mails = fi->num_mails;
 	struct mail_info **out;
+	struct arena *arena = NULL;
 
-	if (!(out = (struct mail_info **)malloc(sizeof(struct mail_info *) * num_mails)))
+	if (!(out = (struct mail_info **)malloc(sizeof(struct mail_info *) * (num_mails + 1))))
 	{
 		*out_ptr = NULL;
-		return;
+		return 0;
 	}
 
-	for (i = 0; i < num_mails && !feof(fi->fh); i++)
+	/* Without an arena, the mails are allocated individually */
+	if (fi->fif)
+		arena = arena_create(FOLDER_ARENA_CHUNK_SIZE);
+
+	for (i = 0; i < num_mails; i++)
 	{
 		struct mail_info *m;
 
-		if ((m = folder_read_mail_info_from_index(folder_mail_context, fi->fh, sp)))
+		if (fi->fif)
+		{
+			m = folder_index_file_get_mail(fi->fif, mc, arena, i);
+		} else
+		{
+			if (feof(fi->fh)) break;
+			m = folder_read_mail_info_from_index(mc, fi->fh, sp);
+		}
+
+		if (m)
 		{
 			mail_identify_status(m);
 			m->flags &= ~MAIL_FLAGS_NEW;
-			out[i] = m;
+			out[num_read++] = m;
 		}
 	}
+	arena_unref(arena);
+
 	*out_ptr = out;
+	return num_read;
+}
+
+/**
+ * Adds the mails that have been read from the index to the given folder whose
+ * mail infos have not been loaded yet.
+ *
+ * @param folder
+ * @param mis the mails read from the index.
+ * @param num_mails the number of mails in mis.
+ */
+static void folder_add_index_mails(struct folder *folder, struct mail_info **mis, int num_mails)
+{
+	folder->mail_infos_loaded = 1; /* must happen before folder_add_mail() */
+	folder->unread_mails = 0;
+	folder->new_mails = 0;
+	folder_prepare_for_additional_mails(folder, num_mails + folder->num_pending_mails);
+
+	folder_add_mails(folder, mis, num_mails);
 }
 
 /**
@@ -2187,6 +2486,7 @@ static int folder_read_mail_infos(struct folder *folder, int only_num_mails)
 {
 	struct folder_index *fi;
 	int mail_infos_read = 0;
+	int rewrite_index = 0;
 
 	if (folder->special == FOLDER_SPECIAL_GROUP) return 0;
 
@@ -2197,6 +2497,7 @@ static int folder_read_mail_infos(struct folder *folder, int only_num_mails)
 
 		time_ref = time_reference_ticks();
 		pending = fi->pending;
+		rewrite_index = fi->ver != FOLDER_INDEX_FILE_VERSION;
 
 		/* Read in the mail info if index is not marked as having pending mails
 		   or if we know the pending mails. Also only do this if we do not
@@ -2209,10 +2510,10 @@ static int folder_read_mail_infos(struct folder *folder, int only_num_mails)
 
 			if (!only_num_mails)
 			{
-				struct string_pool *sp;
+				struct string_pool *sp = NULL;
 				struct mail_info **mis;
 
-				if (!(sp = string_pool_create_and_load(fi->string_pool_name)))
+				if (!fi->fif && !(sp = string_pool_create_and_load(fi->string_pool_name)))
 					goto nosp;
 
 				if (pending)
@@ -2220,58 +2521,327 @@ static int folder_read_mail_infos(struct folder *folder, int only_num_mails)
 					SM_DEBUGF(10,("%ld mails within indexfile. %ld are pending\n",num_mails,folder->num_pending_mails));
 				}
 
-				folder_index_read_them_all(fi, sp, &mis);
-				string_pool_delete(sp);
+				num_mails = folder_index_read_them_all(fi, folder_mail_context, sp, &mis);
+				if (sp) string_pool_delete(sp);
+
+				/* The journal requires that the mails are at the same
+				 * positions as in the index file */
+				if (num_mails != fi->num_mails)
+					rewrite_index = 1;
 
-				folder->mail_infos_loaded = 1; /* must happen before folder_add_mail() */
 				mail_infos_read = 1;
-				folder->unread_mails = 0;
-				folder->new_mails = 0;
-				folder_prepare_for_additional_mails(folder, num_mails + folder->num_pending_mails);
+				folder_add_index_mails(folder, mis, num_mails);
+
+				if (folder->num_pending_mails)
+				{
+					/* Add pending mails (i.e., mails that have been added
+					 * prior the loading of the folder) now */
+					folder_add_mails(folder, folder->pending_mail_info_array, folder->num_pending_mails);
+
+					folder->num_pending_mails = 0;
+
+					folder_index_close(fi);
+
+					/* Two possibilities: Either we mark the indexfile as not uptodate (so it get's completely rewritten
+					   if saving is requested or we append the pending stuff with the indexfile here. I chose
+					   the first because it means less to do for me */
+					folder_indexfile_delete(folder);
+					folder->index_uptodate = 0;
+					return 1;
+				}
+
+nosp:
+				(void)1;
+			} else
+			{
+				folder->num_index_mails = num_mails;
+				folder->unread_mails = fi->unread_mails;
+			}
+		}
+
+		SM_DEBUGF(10,("Index file of folder \"%s\" read after %d ms\n",folder->name,time_ms_passed(time_ref)));
+		folder_index_close(fi);
+	}
+
+	if (only_num_mails)
+		return 1;
+
+	/* Legacy or partly broken index files are rewritten the next time the
+	 * index is saved */
+	folder->index_uptodate = mail_infos_read && !rewrite_index;
+
+	if (!mail_infos_read && !folder->rescanning)
+	{
+		/* The index may still be usable for most of the mails, e.g., if
+		 * SimpleMail was not shut down properly */
+		folder_rescan_incremental_async(folder, NULL, callback_rescan_folder_completed, NULL);
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+/** Maximum number of threads that prefetch the indices at startup */
+#define FOLDER_PREFETCH_MAX_THREADS 4
+
+/**
+ * The index of a folder that is loaded in the background.
+ */
+struct folder_prefetch_job
+{
+	char *folder_path;
+	struct folder_index *fi; /* opened on the context of the main task */
+
+	/* Output, the mails have no context */
+	struct mail_info **mails;
+	int num_mails;
+	int applied;
+};
+
+/** The prefetch jobs, the next job to be taken is protected by prefetch_semaphore */
+static struct folder_prefetch_job *prefetch_jobs;
+static int prefetch_num_jobs;
+static int prefetch_next_job;
+static int prefetch_completed_jobs;
+static semaphore_t prefetch_semaphore;
+
+/** Reference ticks of the start of init_folders() for the startup metric */
+static unsigned int folder_init_ticks;
+
+/**
+ * Frees the resources of the given prefetch job that have not been taken
+ * over by a folder.
+ *
+ * @param job
+ */
+static void folder_prefetch_job_free(struct folder_prefetch_job *job)
+{
+	int i;
+
+	if (job->mails)
+	{
+		for (i = 0; i < job->num_mails; i++)
+			mail_info_free(job->mails[i]);
+		free(job->mails);
+		job->mails = NULL;
+	}
+	folder_index_close(job->fi);
+	job->fi = NULL;
+	free(job->folder_path);
+	job->folder_path = NULL;
+}
+
+/**
+ * Called on the context of the main task when the index of a folder has
+ * been loaded by a prefetch thread. The mails are added to the folder
+ * unless the folder has been loaded or its index has been changed in the
+ * meantime.
+ *
+ * @param job
+ */
+static void folder_prefetch_completed(struct folder_prefetch_job *job)
+{
+	struct folder *f;
+
+	folders_lock();
+	if ((f = folder_find_by_path(job->folder_path)))
+		folder_lock(f);
+	folders_unlock();
+
+	if (f)
+	{
+		if (f->prefetching && !f->mail_infos_loaded && !f->rescanning && !f->num_pending_mails && job->mails)
+		{
+			void *handle = NULL;
+			int i;
+
+			for (i = 0; i < job->num_mails; i++)
+				mail_info_set_context(job->mails[i], folder_mail_context);
+
+			folder_add_index_mails(f, job->mails, job->num_mails);
+			f->index_uptodate = job->num_mails == job->fi->num_mails;
+
+			/* Sort the mails now so they are ready when the folder is shown */
+			folder_next_mail_info(f, &handle);
+
+			free(job->mails);
+			job->mails = NULL;
+		}
+		f->prefetching = 0;
+		folder_unlock(f);
+	}
+
+	job->applied = 1;
+	folder_prefetch_job_free(job);
+
+	if (++prefetch_completed_jobs == prefetch_num_jobs)
+	{
+		char buf[120];
+
+		sm_snprintf(buf, sizeof(buf), "Indices of %d folders prefetched %u ms after the folders have been initialized",
+				prefetch_num_jobs, time_ms_passed(folder_init_ticks));
+		SM_DEBUGF(5, ("%s\n", buf));
+		SM_LOG_TEXT(INFO, buf);
+	}
+}
+
+/**
+ * Entry for the threads that prefetch the indices.
+ *
+ * @param udata
+ * @return
+ */
+static int folder_prefetch_entry(void *udata)
+{
+	thread_parent_task_can_contiue();
+
+	while (!thread_aborted())
+	{
+		struct folder_prefetch_job *job = NULL;
+
+		thread_lock_semaphore(prefetch_semaphore);
+		if (prefetch_next_job < prefetch_num_jobs)
+			job = &prefetch_jobs[prefetch_next_job++];
+		thread_unlock_semaphore(prefetch_semaphore);
+
+		if (!job)
+			break;
+
+		/* The string pool of the folder mail context is not thread-safe so
+		 * the mails are associated with it on the context of the main task */
+		job->num_mails = folder_index_read_them_all(job->fi, NULL, NULL, &job->mails);
+		thread_call_function_async(thread_get_main(), folder_prefetch_completed, 1, job);
+	}
+	return 1;
+}
+
+/**
+ * Compares two prefetch jobs such that the one with the more recently
+ * written index comes first.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int folder_prefetch_job_compare(const void *a, const void *b)
+{
+	const struct folder_prefetch_job *ja = (const struct folder_prefetch_job*)a;
+	const struct folder_prefetch_job *jb = (const struct folder_prefetch_job*)b;
+
+	if (ja->fi->mtime != jb->fi->mtime)
+		return ja->fi->mtime > jb->fi->mtime ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Starts loading the indices of the folders in the background. Only folders
+ * with an up-to-date index file of the current version are considered.
+ *
+ * @param max_folders the maximum number of folders whose indices should be
+ *  loaded. The folders whose index has been written most recently are
+ *  preferred. A negative value means all folders.
+ */
+static void folder_prefetch_indices(int max_folders)
+{
+	struct folder *f;
+	int num_folders = 0;
+	int num_threads;
+	int i;
+
+	for (f = folder_first(); f; f = folder_next(f))
+		num_folders++;
+
+	if (!num_folders || prefetch_jobs)
+		return;
+
+	if (!(prefetch_semaphore = thread_create_semaphore()))
+		return;
+
+	if (!(prefetch_jobs = (struct folder_prefetch_job*)malloc(num_folders * sizeof(prefetch_jobs[0]))))
+		return;
+
+	for (f = folder_first(); f; f = folder_next(f))
+	{
+		struct folder_prefetch_job *job;
+		struct folder_index *fi;
+
+		if (f->special == FOLDER_SPECIAL_GROUP || f->mail_infos_loaded || f->num_pending_mails)
+			continue;
+
+		if (!(fi = folder_index_open(f)))
+			continue;
+
+		if (fi->ver != FOLDER_INDEX_FILE_VERSION || fi->pending)
+		{
+			folder_index_close(fi);
+			continue;
+		}
+
+		job = &prefetch_jobs[prefetch_num_jobs];
+		memset(job, 0, sizeof(*job));
+		if (!(job->folder_path = mystrdup(f->path)))
+		{
+			folder_index_close(fi);
+			continue;
+		}
+		job->fi = fi;
+		prefetch_num_jobs++;
+	}
 
-				folder_add_mails(folder, mis, num_mails);
+	qsort(prefetch_jobs, prefetch_num_jobs, sizeof(prefetch_jobs[0]), folder_prefetch_job_compare);
 
-				if (folder->num_pending_mails)
-				{
-					/* Add pending mails (i.e., mails that have been added
-					 * prior the loading of the folder) now */
-					folder_add_mails(folder, folder->pending_mail_info_array, folder->num_pending_mails);
+	if (max_folders >= 0 && prefetch_num_jobs > max_folders)
+	{
+		for (i = max_folders; i < prefetch_num_jobs; i++)
+			folder_prefetch_job_free(&prefetch_jobs[i]);
+		prefetch_num_jobs = max_folders;
+	}
 
-					folder->num_pending_mails = 0;
+	for (i = 0; i < prefetch_num_jobs; i++)
+	{
+		if ((f = folder_find_by_path(prefetch_jobs[i].folder_path)))
+			f->prefetching = 1;
+	}
 
-					folder_index_close(fi);
+	num_threads = prefetch_num_jobs < FOLDER_PREFETCH_MAX_THREADS ? prefetch_num_jobs : FOLDER_PREFETCH_MAX_THREADS;
+	for (i = 0; i < num_threads; i++)
+	{
+		if (!thread_add("SimpleMail - Index prefetcher", folder_prefetch_entry, NULL))
+			break;
+	}
 
-					/* Two possibilities: Either we mark the indexfile as not uptodate (so it get's completely rewritten
-					   if saving is requested or we append the pending stuff with the indexfile here. I chose
-					   the first because it means less to do for me */
-					folder_indexfile_delete(folder);
-					folder->index_uptodate = 0;
-					return 1;
-				}
+	SM_DEBUGF(10, ("Prefetching indices of %d folders with %d threads\n", prefetch_num_jobs, i));
 
-nosp:
-				(void)1;
-			} else
-			{
-				folder->num_index_mails = num_mails;
-				folder->unread_mails = fi->unread_mails;
-			}
+	if (!i)
+	{
+		/* The indices are loaded on demand as usual */
+		for (i = 0; i < prefetch_num_jobs; i++)
+		{
+			if ((f = folder_find_by_path(prefetch_jobs[i].folder_path)))
+				f->prefetching = 0;
 		}
-
-		SM_DEBUGF(10,("Index file of folder \"%s\" read after %d ms\n",folder->name,time_ms_passed(time_ref)));
-		folder_index_close(fi);
 	}
+}
 
-	if (only_num_mails)
-		return 1;
-
-	folder->index_uptodate = mail_infos_read;
+/**
+ * Frees all resources of prefetch jobs that have not been completed. Must
+ * be called after the threads have been finished.
+ */
+static void folder_prefetch_cleanup(void)
+{
+	int i;
 
-	if (!mail_infos_read && !folder->rescanning)
+	for (i = 0; i < prefetch_num_jobs; i++)
 	{
-		folder_rescan_async(folder, NULL, callback_rescan_folder_completed, NULL);
+		if (!prefetch_jobs[i].applied)
+			folder_prefetch_job_free(&prefetch_jobs[i]);
 	}
-	return 1;
+	free(prefetch_jobs);
+	prefetch_jobs = NULL;
+	prefetch_num_jobs = prefetch_next_job = prefetch_completed_jobs = 0;
+
+	thread_dispose_semaphore(prefetch_semaphore);
+	prefetch_semaphore = NULL;
 }
 
 /**
@@ -2286,7 +2856,9 @@ static void folder_node_dispose(struct folder_node *node)
 	for (i = 0; i < node->folder.num_mails; i++)
 		mail_info_free(node->folder.mail_info_array[i]);
 	free(node->folder.mail_info_array);
-	free(node->folder.sorted_mail_info_array);
+	folder_sorted_mails_free(&node->folder);
+	folder_sort_cache_clear(&node->folder);
+	folder_mail_thread_free(&node->folder);
 	free(node->folder.pending_mail_info_array);
 	free(node->folder.imap_path);
 	free(node->folder.imap_server);
@@ -3086,12 +3658,10 @@ int folder_set(struct folder *f, char *newname, char *newpath, int newtype, char
 
 		/* free all kind of data */
 
-		/* free the sorted mail array */
-		if (f->sorted_mail_info_array)
-		{
-			free(f->sorted_mail_info_array);
-			f->sorted_mail_info_array = NULL;
-		}
+		/* free the sorted mails */
+		folder_sorted_mails_free(f);
+		folder_sort_cache_clear(f);
+		folder_mail_thread_free(f);
 
 		for (i=0;i < f->num_mails; i++)
 			mail_info_free(f->mail_info_array[i]);
@@ -3377,9 +3947,10 @@ struct folder *folder_find_by_mail(struct mail_info *mail)
 struct mail_info *folder_find_mail_by_position(struct folder *f, int position)
 {
 	void *handle = NULL;
-	if (!f->sorted_mail_info_array) return NULL;
+	if (!f->sorted_mails && !f->sorted_mail_info_array) return NULL;
 	if (position >= f->num_mails) return NULL;
 	folder_next_mail_info(f,&handle); /* sort the stuff */
+	if (f->sorted_mails) return mail_btree_get(f->sorted_mails, position);
 	if (f->sorted_mail_info_array) return f->sorted_mail_info_array[position];
 	return f->mail_info_array[position];
 }
@@ -3458,6 +4029,12 @@ int folder_get_index_of_mail(struct folder *f, struct mail_info *mail)
 	void *handle = 0;
 	struct mail_info *m;
 
+	if (f->sorted_mails && !f->ref_folder)
+	{
+		mail_compare_set_sort_mode(f);
+		return mail_btree_find_sorted(f->sorted_mails, mail, mail_compare);
+	}
+
 	while ((m = folder_next_mail_info(f, &handle)))
 	{
 		if (m == mail) return index;
@@ -3468,6 +4045,30 @@ int folder_get_index_of_mail(struct folder *f, struct mail_info *mail)
 
 /*****************************************************************************/
 
+struct mail_info *folder_get_thread_parent(struct folder *f, struct mail_info *mail)
+{
+	if (f->ref_folder || !folder_mail_thread_ensure(f)) return NULL;
+	return mail_thread_get_parent(f->mail_thread, mail);
+}
+
+/*****************************************************************************/
+
+struct mail_info *folder_get_thread_first_child(struct folder *f, struct mail_info *mail)
+{
+	if (f->ref_folder || !folder_mail_thread_ensure(f)) return NULL;
+	return mail_thread_get_first_child(f->mail_thread, mail);
+}
+
+/*****************************************************************************/
+
+struct mail_info *folder_get_thread_next_sibling(struct folder *f, struct mail_info *mail)
+{
+	if (f->ref_folder || !folder_mail_thread_ensure(f)) return NULL;
+	return mail_thread_get_next_sibling(f->mail_thread, mail);
+}
+
+/*****************************************************************************/
+
 int folder_size_of_mails(struct folder *f)
 {
 	int size = 0;
@@ -3537,6 +4138,10 @@ int folder_move_mail_array(struct folder *from_folder, struct folder *dest_folde
 	{
 		struct mail_info *mail = mail_info_array[i];
 
+		/* The mail might get a new name below, so drop it from the text index
+		 * while its old name is still known */
+		folder_text_index_thread_remove_mail(from_folder,mail);
+
 		sm_add_part(src_buf,mail->filename,512);
 
 		/* Change the status of mails if moved to outgoing and had formerly a sent flag set */
@@ -3548,8 +4153,7 @@ int folder_move_mail_array(struct folder *from_folder, struct folder *dest_folde
 
 			if ((newfilename = mail_get_status_filename(mail->filename, mail->status)))
 			{
-				if (mail->filename) free(mail->filename);
-				mail->filename = newfilename;
+				mail_info_set_filename(mail, newfilename);
 			}
 		}
 
@@ -3574,8 +4178,7 @@ int folder_move_mail_array(struct folder *from_folder, struct folder *dest_folde
 				if (rename(src_buf,new_name) == 0)
 				{
 					/* renaming was successfully */
-					free(mail->filename);
-					mail->filename = new_name;
+					mail_info_set_filename(mail, new_name);
 				} else
 				{
 					free(new_name);
@@ -3631,6 +4234,9 @@ static void folder_delete_mails(struct folder *folder)
 
 	if (!folder) return;
 
+	/* The text index refers to the removed mails only */
+	folder_text_index_thread_remove_folder(folder);
+
 	getcwd(path, sizeof(path));
 	if(chdir(folder->path) == -1) return;
 
@@ -3638,12 +4244,10 @@ static void folder_delete_mails(struct folder *folder)
 	if (!folder->mail_infos_loaded)
 		folder_read_mail_infos(folder,0);
 
-	/* free the sorted mail array */
-	if (folder->sorted_mail_info_array)
-	{
-		free(folder->sorted_mail_info_array);
-		folder->sorted_mail_info_array = NULL;
-	}
+	/* free the sorted mails */
+	folder_sorted_mails_free(folder);
+	folder_sort_cache_clear(folder);
+	folder_mail_thread_free(folder);
 
 	for (i=0;i<folder->num_mails;i++)
 	{
@@ -3687,49 +4291,10 @@ void folder_delete_deleted(void)
 	folder_unlock(f);
 }
 
-/**
- * Stores the header of the index file.
- *
- * @param f the folder for which the index file shall be written.
- * @param fh the file handle to write into.
- * @return 0 on failure, 1 on success
- */
-static int folder_save_index_header(struct folder *f, FILE *fh)
-{
-	int ver = FOLDER_INDEX_VERSION;
-	int pending = 0;
-
-	fwrite("SMFI",1,4,fh);
-	fwrite(&ver,1,4,fh);
-	fwrite(&pending,1,4,fh);
-	fwrite(&f->num_index_mails,1,4,fh);
-	fwrite(&f->unread_mails,1,4,fh);
-	return 1;
-}
-
-/*****************************************************************************/
-
-static int string_pool_put_address_list(struct string_pool *sp, struct address_list *al)
-{
-	struct address *addr;
-
-	addr = address_list_first(al);
-	while (addr)
-	{
-		string_pool_ref(sp, addr->email);
-		string_pool_ref(sp, addr->realname);
-		addr = address_next(addr);
-	}
-	return 1;
-}
-
-/*****************************************************************************/
-
 int folder_save_index(struct folder *f)
 {
-	FILE *fh;
-	int append;
-	struct string_pool *sp;
+	char *index_name;
+	char *sp_name;
 
 	if (!f->num_pending_mails && (!f->mail_infos_loaded || f->index_uptodate))
 		return 0;
@@ -3740,148 +4305,63 @@ int folder_save_index(struct folder *f)
 		return 0;
 	}
 
-	append = !!f->num_pending_mails;
-	sp = NULL;
-
-	if (!append && f->mail_info_array)
-	{
-		char *sp_name;
+	if (f->special == FOLDER_SPECIAL_GROUP)
+		return 1;
 
-		if ((sp_name = folder_get_string_pool_name(f)))
-		{
-			if ((sp = string_pool_create()))
-			{
-				int i;
+	/* A prefetched index is no longer valid */
+	f->prefetching = 0;
 
-				for (i=0; i < f->num_mails; i++)
-				{
-					struct mail_info *m = f->mail_info_array[i];
-					const char *pop3 = mail_get_pop3_server(m);
+	if (!(index_name = folder_get_index_name(f)))
+		return 0;
 
-					if (m->from_addr) string_pool_ref(sp, m->from_addr);
-					if (m->from_phrase) string_pool_ref(sp, m->from_phrase);
-					if (m->to_list) string_pool_put_address_list(sp, m->to_list);
-					if (m->cc_list) string_pool_put_address_list(sp, m->cc_list);
-					if (m->reply_addr) string_pool_ref(sp, m->reply_addr);
+	if (f->num_pending_mails)
+	{
+		struct folder_index_file *base;
+		int i;
+		int ok = 0;
 
-					if (pop3) string_pool_ref(sp, pop3);
-				}
-				string_pool_save(sp, sp_name);
-			}
-			free(sp_name);
+		/* Take over the records of the existing index file and append the
+		 * pending ones */
+		if ((base = folder_index_file_open(index_name)))
+		{
+			ok = folder_index_file_save(index_name, base, f->pending_mail_info_array, f->num_pending_mails, f->unread_mails);
+			folder_index_file_close(base);
 		}
-	}
 
-	if ((fh = folder_indexfile_open(f,append?"rb+":"wb")))
-	{
-		int i;
-		struct mail_info **mail_info_array;
-		int num_mails;
+		/* the pending mails are stored so we can free them */
+		for (i=0;i<f->num_pending_mails;i++)
+			mail_info_free(f->pending_mail_info_array[i]);
+		f->num_pending_mails = 0;
 
-		if (append)
+		if (ok)
 		{
-			fseek(fh,0,SEEK_END);
-			num_mails = f->num_pending_mails;
-			mail_info_array = f->pending_mail_info_array;
+			f->index_uptodate = 1;
 		} else
 		{
-			folder_save_index_header(f,fh);
-			num_mails = f->num_mails;
-			mail_info_array = f->mail_info_array;
+			/* A legacy index file cannot be appended, rescan the folder next time */
+			SM_DEBUGF(5,("Couldn't append to index file for folder at path \"%s\"\n",f->path));
+			remove(index_name);
+			f->index_uptodate = 0;
 		}
-
-		for (i=0; i < num_mails; i++)
+	} else
+	{
+		if (folder_index_file_save(index_name, NULL, f->mail_info_array, f->num_mails, f->unread_mails))
 		{
-			struct mail_info *m = mail_info_array[i];
-			int len = 0;
-			int len_add;
-			int num_to = 0;
-			int num_cc = 0;
-			struct address *to_addr = NULL;
-			struct address *cc_addr = NULL;
-
-			if (m->to_list)
-			{
-				num_to = address_list_length(m->to_list);
-				to_addr = address_list_first(m->to_list);
-			}
-
-			if (m->cc_list)
-			{
-				num_cc = address_list_length(m->cc_list);
-				cc_addr = address_list_first(m->cc_list);
-			}
-
-			fwrite(&num_to,1,4,fh);
-			fwrite(&num_cc,1,4,fh);
-
-			if (!(len_add = fwrite_str(fh, (char*)m->subject, NULL))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, m->filename, NULL))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, (char*)m->from_phrase, sp))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, m->from_addr, sp))) break;
-			len += len_add;
-
-			while (to_addr)
-			{
-				if (!(len_add = fwrite_str(fh, to_addr->realname, sp))) break;
-				len += len_add;
-				if (!(len_add = fwrite_str(fh, to_addr->email, sp))) break;
-				len += len_add;
-				to_addr = address_next(to_addr);
-			}
-
-			while (cc_addr)
-			{
-				if (!(len_add = fwrite_str(fh, cc_addr->realname, sp))) break;
-				len += len_add;
-				if (!(len_add = fwrite_str(fh, cc_addr->email, sp))) break;
-				len += len_add;
-				cc_addr = address_next(cc_addr);
-			}
-
-			if (!(len_add = fwrite_str(fh, mail_get_pop3_server(m), sp))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, m->message_id, NULL))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, m->message_reply_id, NULL))) break;
-			len += len_add;
-			if (!(len_add = fwrite_str(fh, m->reply_addr, sp))) break;
-			len += len_add;
-
-			/* so that integervars are aligned */
-			if (len % 2) fputc(0,fh);
-
-			fwrite(&m->size,1,sizeof(m->size),fh);
-			fwrite(&m->seconds,1,sizeof(m->seconds),fh);
-			fwrite(&m->received,1,sizeof(m->received),fh);
-			fwrite(&m->flags,1,sizeof(m->flags),fh);
+			f->index_uptodate = 1;
+		} else
+		{
+			SM_DEBUGF(5,("Couldn't write index file for folder at path \"%s\"\n",f->path));
 		}
 
-		if (append)
+		/* The string pool is needed only by legacy index files */
+		if ((sp_name = folder_get_string_pool_name(f)))
 		{
-			/* the pending mails are stored so we can free them */
-			for (i=0;i<num_mails;i++)
-				mail_info_free(mail_info_array[i]);
-
-			f->num_pending_mails = 0;
-			fseek(fh,0,SEEK_SET);
-			folder_save_index_header(f,fh);
+			remove(sp_name);
+			free(sp_name);
 		}
-		fclose(fh);
-		f->index_uptodate = 1;
-	} else
-	{
-		SM_DEBUGF(5,("Couldn't open index file for folder at path \"%s\" for writing\n",f->path));
-	}
-
-	if (sp)
-	{
-		string_pool_delete(sp);
 	}
 
+	free(index_name);
 	return 1;
 }
 
@@ -3918,15 +4398,161 @@ void folder_get_stats(int *total_msg_ptr, int *total_unread_ptr, int *total_new_
 	*total_new_ptr = total_new;
 }
 
+/**
+ * Frees the sorted mails of the given folder including the flat copy.
+ *
+ * @param f
+ */
+static void folder_sorted_mails_free(struct folder *f)
+{
+	mail_btree_free(f->sorted_mails);
+	f->sorted_mails = NULL;
+
+	free(f->sorted_mail_info_array);
+	f->sorted_mail_info_array = NULL;
+}
+
+/**
+ * Frees all sorted mails that are kept for the inactive sort modes of
+ * the given folder. Must be called whenever the mails of the folder change.
+ *
+ * @param f
+ */
+static void folder_sort_cache_clear(struct folder *f)
+{
+	int i;
+
+	for (i = 0; i < FOLDER_SORT_CACHE_SIZE; i++)
+	{
+		mail_btree_free(f->sort_cache[i].sorted_mails);
+		f->sort_cache[i].sorted_mails = NULL;
+	}
+}
+
+/**
+ * Removes the entry at the given position from the sort cache of the given
+ * folder. The sorted mail array of the entry is not freed.
+ *
+ * @param f
+ * @param pos
+ */
+static void folder_sort_cache_remove(struct folder *f, int pos)
+{
+	memmove(&f->sort_cache[pos], &f->sort_cache[pos+1], (FOLDER_SORT_CACHE_SIZE - pos - 1) * sizeof(f->sort_cache[0]));
+	f->sort_cache[FOLDER_SORT_CACHE_SIZE - 1].sorted_mails = NULL;
+}
+
+/**
+ * Moves the sorted mails of the given folder into the sort cache of
+ * the folder. This is called before the sort mode is changed. The least
+ * recently used entry is dropped if the cache is full.
+ *
+ * @param f
+ */
+static void folder_sort_cache_put(struct folder *f)
+{
+	int i;
+
+	if (!f->sorted_mails)
+	{
+		/* a sorted flat copy without the tree is not kept */
+		free(f->sorted_mail_info_array);
+		f->sorted_mail_info_array = NULL;
+		return;
+	}
+
+	/* Replace an outdated entry of the same sort mode or the oldest one */
+	for (i = 0; i < FOLDER_SORT_CACHE_SIZE - 1; i++)
+	{
+		if (f->sort_cache[i].sorted_mails && f->sort_cache[i].primary_sort == f->primary_sort && f->sort_cache[i].secondary_sort == f->secondary_sort)
+			break;
+	}
+	mail_btree_free(f->sort_cache[i].sorted_mails);
+	folder_sort_cache_remove(f, i);
+
+	memmove(&f->sort_cache[1], &f->sort_cache[0], (FOLDER_SORT_CACHE_SIZE - 1) * sizeof(f->sort_cache[0]));
+	f->sort_cache[0].primary_sort = f->primary_sort;
+	f->sort_cache[0].secondary_sort = f->secondary_sort;
+	f->sort_cache[0].sorted_mails = f->sorted_mails;
+	f->sorted_mails = NULL;
+
+	free(f->sorted_mail_info_array);
+	f->sorted_mail_info_array = NULL;
+}
+
+/**
+ * Takes the sorted mails for the current sort mode of the given folder
+ * from the sort cache of the folder.
+ *
+ * @param f
+ * @return 1 if the folder has got sorted mails, 0 if the mails have
+ *  not been sorted according to the current sort mode so far.
+ */
+static int folder_sort_cache_take(struct folder *f)
+{
+	int i;
+
+	for (i = 0; i < FOLDER_SORT_CACHE_SIZE; i++)
+	{
+		if (f->sort_cache[i].sorted_mails && f->sort_cache[i].primary_sort == f->primary_sort && f->sort_cache[i].secondary_sort == f->secondary_sort)
+		{
+			f->sorted_mails = f->sort_cache[i].sorted_mails;
+			folder_sort_cache_remove(f, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Ensures that the conversation threads of the mails of the given folder
+ * have been built. Afterwards they are updated whenever a mail is added
+ * or removed.
+ *
+ * @param f
+ * @return 1 if the threads are available, 0 on failure.
+ */
+static int folder_mail_thread_ensure(struct folder *f)
+{
+	int i;
+
+	if (f->mail_thread)
+		return 1;
+
+	if (!(f->mail_thread = mail_thread_create()))
+		return 0;
+
+	for (i = 0; i < f->num_mails; i++)
+	{
+		if (!mail_thread_add(f->mail_thread, f->mail_info_array[i]))
+		{
+			folder_mail_thread_free(f);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Frees the conversation threads of the given folder. They are built
+ * again when needed.
+ *
+ * @param f
+ */
+static void folder_mail_thread_free(struct folder *f)
+{
+	mail_thread_free(f->mail_thread);
+	f->mail_thread = NULL;
+}
 
 /**
- * Sorts sorted_mail_info_array of the given folder with the folder-set
- * sorting options. folder->sorted_mail_info_array must be already allocated
- * and filled with mails to be sorted.
+ * Sorts the given mails of the given folder with the folder-set
+ * sorting options.
  *
  * @param f
+ * @param mails the mails of the folder to be sorted.
  */
-static void folder_sort_mails(struct folder *f)
+static void folder_sort_mails(struct folder *f, struct mail_info **mails)
 {
 	/* set the correct search function */
 	mail_compare_set_sort_mode(f);
@@ -3934,20 +4560,27 @@ static void folder_sort_mails(struct folder *f)
 	if (compare_primary)
 	{
 		unsigned int time_ref = time_reference_ticks();
-		if (compare_primary == mail_compare_date)
+		if (folder_sort_mail_array(mails, f->num_mails, f->primary_sort, f->secondary_sort, f->type))
 		{
-			if (compare_primary_reverse) folder_sort_mails_by_date_rev(f->sorted_mail_info_array, f->num_mails);
-			else folder_sort_mails_by_date(f->sorted_mail_info_array, f->num_mails);
+			/* sorted with precomputed keys, the rest is the fallback on low memory */
+		} else if (compare_primary == mail_compare_date)
+		{
+			if (compare_primary_reverse) folder_sort_mails_by_date_rev(mails, f->num_mails);
+			else folder_sort_mails_by_date(mails, f->num_mails);
 		} else
 		{
-/*			struct mail_info **mails = f->sorted_mail_info_array;
-			int num_mails = f->num_mails;
+/*			int num_mails = f->num_mails;
 #define mail_compare_lt(a,b) (mail_compare(a,b) < 0)
 			QSORT(struct mail_info *, mails, num_mails, mail_compare_lt);
-*/			qsort(f->sorted_mail_info_array, f->num_mails, sizeof(struct mail*),mail_compare);
+*/			qsort(mails, f->num_mails, sizeof(struct mail*),mail_compare);
 		}
 
 		SM_DEBUGF(10,("Sorted mails in %d ms\n",time_ms_passed(time_ref)));
+	} else if ((f->primary_sort & FOLDER_SORT_MODEMASK) == FOLDER_SORT_THREAD)
+	{
+		/* the mails keep their order unless they can be arranged in threads */
+		if (folder_mail_thread_ensure(f))
+			mail_thread_sort(f->mail_thread, mails, f->num_mails);
 	}
 }
 /*****************************************************************************/
@@ -4005,23 +4638,30 @@ struct mail_info *folder_next_mail_info(struct folder *folder, void **handle)
 		folder_read_mail_infos(folder,0);
 
 	mail_info_array = folder->mail_info_array;
-	if (!folder->sorted_mail_info_array && /* *((int**)handle) == 0 && */ folder->num_mails && folder->mail_info_array_allocated)
+	if (!folder->sorted_mails && !folder->sorted_mail_info_array && /* *((int**)handle) == 0 && */ folder->num_mails && folder->mail_info_array_allocated)
 	{
-		/* the array is not sorted, so sort it now */
-		folder->sorted_mail_info_array = (struct mail_info**)malloc(sizeof(struct mail_info*)*folder->mail_info_array_allocated);
-		if (folder->sorted_mail_info_array)
+		/* the mails are not sorted, so sort them now unless they have been sorted before */
+		if (!folder_sort_cache_take(folder) && (mail_info_array = (struct mail_info**)malloc(sizeof(struct mail_info*)*(folder->num_mails+1))))
 		{
 			/* copy the mail pointers into the buffer */
-			memcpy(folder->sorted_mail_info_array, folder->mail_info_array, sizeof(struct mail*)*folder->num_mails);
+			memcpy(mail_info_array, folder->mail_info_array, sizeof(struct mail*)*folder->num_mails);
 
-			folder_sort_mails(folder);
+			folder_sort_mails(folder, mail_info_array);
 
-			mail_info_array = folder->sorted_mail_info_array;
+			/* If the tree cannot be created, the sorted array is kept as the
+			 * flat copy so that the mails are not sorted again on every call */
+			if ((folder->sorted_mails = mail_btree_create_from_array(mail_info_array, folder->num_mails)))
+				free(mail_info_array);
+			else
+				folder->sorted_mail_info_array = mail_info_array;
 		}
+		mail_info_array = folder->mail_info_array;
 	}
 
-	if (folder->sorted_mail_info_array) mail_info_array = folder->sorted_mail_info_array;
-	return (struct mail_info*)(((*((int*)handle))<folder->num_mails)?(mail_info_array[(*ihandle)++]):NULL);
+	if (*ihandle >= folder->num_mails) return NULL;
+	if (folder->sorted_mails) return mail_btree_get(folder->sorted_mails, (*ihandle)++);
+	if (folder->sorted_mail_info_array) return folder->sorted_mail_info_array[(*ihandle)++];
+	return mail_info_array[(*ihandle)++];
 }
 /* we define a macro for mail iterating, handle must be initialzed to NULL at start */
 /*#define folder_next_mail(folder,handle) ( ((*((int*)handle))<folder->num_mails)?(folder->mail_array[(*((int*)handle))++]):NULL)*/
@@ -4035,7 +4675,16 @@ struct mail_info **folder_get_mail_info_array(struct folder *folder)
 	/* start sort stuff */
 	folder_next_mail_info(folder,&handle);
 	if (folder->sorted_mail_info_array) return folder->sorted_mail_info_array;
-	return folder->mail_info_array;
+	if (!folder->sorted_mails) return folder->mail_info_array;
+
+	/* provide a flat copy of the sorted mails, which is kept until they change */
+	if (!folder->sorted_mail_info_array)
+	{
+		if (!(folder->sorted_mail_info_array = (struct mail_info**)malloc(sizeof(struct mail_info*)*(folder->num_mails+1))))
+			return NULL;
+		mail_btree_to_array(folder->sorted_mails, folder->sorted_mail_info_array);
+	}
+	return folder->sorted_mail_info_array;
 }
 
 /*****************************************************************************/
@@ -4119,14 +4768,9 @@ void folder_set_primary_sort(struct folder *folder, int sort_mode)
 {
 	if (folder->primary_sort != sort_mode)
 	{
+		/* keep the sorted mail array for switching back */
+		folder_sort_cache_put(folder);
 		folder->primary_sort = sort_mode;
-
-		/* free the sorted mail array */
-		if (folder->sorted_mail_info_array)
-		{
-			free(folder->sorted_mail_info_array);
-			folder->sorted_mail_info_array = NULL;
-		}
 	}
 }
 
@@ -4143,14 +4787,9 @@ void folder_set_secondary_sort(struct folder *folder, int sort_mode)
 {
 	if (folder->secondary_sort != sort_mode)
 	{
+		/* keep the sorted mail array for switching back */
+		folder_sort_cache_put(folder);
 		folder->secondary_sort = sort_mode;
-
-		/* free the sorted mail array */
-		if (folder->sorted_mail_info_array)
-		{
-			free(folder->sorted_mail_info_array);
-			folder->sorted_mail_info_array = NULL;
-		}
 	}
 }
 
@@ -4829,6 +5468,8 @@ int init_folders(void)
 	struct stat *st;
 	int write_order = 0;
 
+	folder_init_ticks = time_reference_ticks();
+
 	if (!(folders_semaphore = thread_create_semaphore()))
 		return 0;
 
@@ -4937,6 +5578,19 @@ int init_folders(void)
 	if (write_order)
 		folder_save_order();
 
+	{
+		char buf[80];
+
+		/* Startup metric, the time that has been spent for reading the
+		 * number of mails of the folders */
+		sm_snprintf(buf, sizeof(buf), "Folders initialized in %u ms", time_ms_passed(folder_init_ticks));
+		SM_DEBUGF(5, ("%s\n", buf));
+		SM_LOG_TEXT(INFO, buf);
+	}
+
+	if (user.config.prefetch_folders)
+		folder_prefetch_indices(user.config.prefetch_folders);
+
 	return 1;
 }
 
@@ -4946,6 +5600,7 @@ void del_folders(void)
 {
 	struct folder_node *node;
 
+	folder_prefetch_cleanup();
 	folder_save_all_indexfiles();
 	thread_dispose_semaphore(folders_semaphore);
 
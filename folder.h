@@ -38,6 +38,23 @@
 struct remote_folder;
 struct search_options;
 
+/** The number of sorted mail arrays that are kept for inactive sort modes */
+#define FOLDER_SORT_CACHE_SIZE 3
+
+struct mail_btree;
+struct mail_thread;
+
+/**
+ * Sorted mails that are kept after the sort mode of a folder has been
+ * changed, so switching back to the mode doesn't require sorting again.
+ */
+struct folder_sort_cache_entry
+{
+	int primary_sort;
+	int secondary_sort;
+	struct mail_btree *sorted_mails; /* NULL if the entry is unused */
+};
+
 struct folder
 {
 	char *name; /* the name like it is displayed */
@@ -63,14 +80,23 @@ struct folder
 	char *def_replyto; /* default replyto - " */
 	char *def_signature; /* default Signature */ 
 
-	struct mail_info **sorted_mail_info_array; /* the sorted mail array, NULL if not sorted, 
-																			the size of this array is always big as mail_array */
+	struct mail_btree *sorted_mails; /* the mails in sorted order, NULL if not sorted */
+	struct mail_info **sorted_mail_info_array; /* flat copy of sorted_mails as returned by
+																			folder_get_mail_info_array(), NULL if outdated.
+																			The only sorted mails if the tree couldn't be created */
+
+	/* sorted mails of recently used sort modes, most recent first. They
+	   are valid as long as the mails of the folder don't change */
+	struct folder_sort_cache_entry sort_cache[FOLDER_SORT_CACHE_SIZE];
+
+	struct mail_thread *mail_thread; /* the conversation threads of the mails, NULL if not built */
 
 	int index_uptodate; /* 1 if the indexfile is uptodate */
 	int mail_infos_loaded; /* 1 if the mailinfos has loaded */
 	int to_be_rescanned; /* 1 if the folder shall be rescanned */
 	int rescanning; /* 1, if the folder is currently being rescanned */
 	int to_be_saved; /* 1, if the index file should be saved but it couldn't be done */
+	int prefetching; /* 1, if the index is being loaded in the background */
 
 
 	int type; /* see below */
@@ -185,7 +211,8 @@ void del_folders(void);
  * end and the sorted order is destroyed if sort = 0. Else the mail is
  * correctly sorted in and the sorted array is not destroyed.
  * The position of the mail is returned if the array was sorted or
- * the number of mails if not else (-1) for an error.
+ * the number of mails if not else (-1) for an error. The mail is put
+ * into the text index of the folder in the background.
  *
  * @param folder the folder that should get the given mail added.
  * @param mail the mail to be added.
@@ -495,6 +522,38 @@ struct mail_info *folder_find_best_mail_info_to_select(struct folder *folder);
  */
 int folder_get_index_of_mail(struct folder *f, struct mail_info *mail);
 
+/**
+ * Returns the mail to which the given mail replies within the conversation
+ * threads of the folder. The threads are also used to arrange the mails
+ * if the folder is sorted by FOLDER_SORT_THREAD.
+ *
+ * @param f the folder that contains the mail.
+ * @param mail the mail.
+ * @return the parent or NULL if the mail is the root of a thread.
+ */
+struct mail_info *folder_get_thread_parent(struct folder *f, struct mail_info *mail);
+
+/**
+ * Returns the first reply to the given mail within the conversation threads
+ * of the folder.
+ *
+ * @param f the folder that contains the mail.
+ * @param mail the mail.
+ * @return the first reply or NULL if there is none.
+ */
+struct mail_info *folder_get_thread_first_child(struct folder *f, struct mail_info *mail);
+
+/**
+ * Returns the next reply to the parent of the given mail within the
+ * conversation threads of the folder.
+ *
+ * @param f the folder that contains the mail.
+ * @param mail the mail.
+ * @return the next reply or NULL if there is none or the mail is the root
+ *  of a thread.
+ */
+struct mail_info *folder_get_thread_next_sibling(struct folder *f, struct mail_info *mail);
+
 /**
  * Returns the size of the mails in this folder
  *
@@ -585,6 +644,19 @@ void folder_delete_all_indexfiles(void);
  */
 int folder_rescan_async(struct folder *folder, void (*status_callback)(const char *txt), void (*completed)(char *folder_path, void *udata), void *udata);
 
+/**
+ * Rescan the given folder in an asychronous manner like folder_rescan_async()
+ * but compare the contents of the folder against the index first. Only
+ * mails that are not in the index or that have been changed since the index
+ * has been written are read. Mails that are no longer present are dropped.
+ * If there is no usable index, this is the same as folder_rescan_async().
+ *
+ * @param folder the folder to be rescanned.
+ * @param status_callback defines the function that is called for staus updates.
+ * @return 0 on failure, everything else on success.
+ */
+int folder_rescan_incremental_async(struct folder *folder, void (*status_callback)(const char *txt), void (*completed)(char *folder_path, void *udata), void *udata);
+
 /**
  * Adds a new folder that stores messages in the given path
  * and has the given name.
@@ -695,7 +767,8 @@ struct mail_info *folder_next_mail(struct folder *folder, void **handle);
  * it rarely. It's better to use folder_next_mail() instead
  *
  * @param folder the folder whose mail infos shall be retrieved.
- * @return the array of mail_info elements.
+ * @return the array of mail_info elements. It stays valid until mails are
+ *  added to or removed from the folder.
  */
 struct mail_info **folder_get_mail_info_array(struct folder *folder);
 
@@ -0,0 +1,1263 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_index_file.c
+ */
+
+#include "folder_index_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "addresslist.h"
+#include "arena.h"
+#include "debug.h"
+#include "hash.h"
+#include "lists.h"
+#include "mail.h"
+#include "string_pools.h"
+#include "support_indep.h"
+
+#include "support.h"
+
+/*****************************************************************************/
+
+/** Denotes a string reference that is NULL */
+#define FOLDER_INDEX_FILE_NULL 0xffffffff
+
+/**
+ * The header of the index file. The first five members are shared with
+ * older index files.
+ */
+struct folder_index_file_header
+{
+	char magic[4];
+	int ver;
+	int pending;
+	int num_mails;
+	int unread_mails;
+
+	/** Size of a single record in bytes */
+	unsigned int record_size;
+
+	/** Offset of the first record in the file */
+	unsigned int records_offset;
+
+	/** Offset of the blob in the file */
+	unsigned int blob_offset;
+
+	/** Size of the blob in bytes */
+	unsigned int blob_size;
+
+	/**
+	 * The time at which the file has been written. Unlike the modification
+	 * time of the file, it is not affected by setting the pending flag.
+	 */
+	unsigned int saved;
+};
+
+/**
+ * A single record. All strings are given as offsets into the blob.
+ * Address lists are stored as arrays of realname/email offset pairs
+ * within the blob.
+ */
+struct folder_index_file_record
+{
+	unsigned int subject;
+	unsigned int filename;
+	unsigned int from_phrase;
+	unsigned int from_addr;
+	unsigned int reply_addr;
+	unsigned int pop3_server;
+	unsigned int message_id;
+	unsigned int message_reply_id;
+	unsigned int to_addrs;
+	unsigned int num_to;
+	unsigned int cc_addrs;
+	unsigned int num_cc;
+	unsigned int size;
+	unsigned int seconds;
+	unsigned int received;
+	unsigned int flags;
+};
+
+/** The version of the journal files */
+#define FOLDER_INDEX_FILE_JOURNAL_VERSION 1
+
+/**
+ * The header of a journal file. The journal belongs to the index file whose
+ * first num_records records have the given checksum.
+ */
+struct folder_index_file_journal_header
+{
+	char magic[4];
+	int ver;
+	unsigned int num_records;
+	unsigned int checksum;
+};
+
+/**
+ * A single journal entry. It is followed by filename_len bytes of the
+ * null-terminated new filename (if the filename has been changed) and
+ * padding to the next multiple of four.
+ */
+struct folder_index_file_journal_entry
+{
+	unsigned int idx;
+	unsigned int flags;
+	int unread_mails;
+	unsigned int filename_len;
+};
+
+/**
+ * The accumulated changes of a single record according to the journal.
+ */
+struct folder_index_file_change
+{
+	/** The new filename or NULL if it wasn't changed. Points into the journal */
+	const char *filename;
+
+	unsigned int flags;
+	int flags_changed;
+};
+
+/**
+ * An entry of the table that maps blob references to the strings and
+ * address lists that have been copied into the intern arena.
+ */
+struct folder_index_file_intern
+{
+	unsigned int ref; /* the blob reference, FOLDER_INDEX_FILE_NULL for free entries */
+	unsigned int num; /* number of addresses or FOLDER_INDEX_FILE_NULL for strings */
+	void *ptr;
+};
+
+struct folder_index_file
+{
+	void *mem;
+	unsigned long mem_size;
+
+	const struct folder_index_file_header *header;
+	const struct folder_index_file_record *records;
+	const char *blob;
+	unsigned int blob_size;
+	int num_mails;
+
+	/** The mapped journal or NULL */
+	void *journal_mem;
+	unsigned long journal_size;
+
+	/** One entry for each record, only present if there is a journal */
+	struct folder_index_file_change *changes;
+
+	/** The number of unread mails according to the journal, or -1 */
+	int journal_unread_mails;
+
+	/**
+	 * The arena into which the strings and address lists of the last decoded
+	 * mails have been copied. Mails decoded into the same arena share equal
+	 * strings and address lists.
+	 */
+	struct arena *intern_arena;
+	struct folder_index_file_intern *intern;
+	unsigned int intern_size; /* number of entries, a power of two */
+	unsigned int intern_used;
+};
+
+/*****************************************************************************/
+
+/**
+ * Returns the filename of the journal that belongs to the given index file.
+ *
+ * @param filename the name of the index file.
+ * @return the name of the journal that needs to be freed via free().
+ */
+static char *folder_index_file_journal_name(const char *filename)
+{
+	char *journal_name;
+
+	if ((journal_name = (char *)malloc(strlen(filename) + 9)))
+	{
+		strcpy(journal_name, filename);
+		strcat(journal_name, ".journal");
+	}
+	return journal_name;
+}
+
+/*****************************************************************************/
+
+/**
+ * Computes the checksum of the given records.
+ *
+ * @param records the records.
+ * @param num_records number of records.
+ * @return the checksum.
+ */
+static unsigned int folder_index_file_checksum(const struct folder_index_file_record *records, unsigned int num_records)
+{
+	const unsigned int *words = (const unsigned int *)records;
+	unsigned int num_words = num_records * sizeof(*records) / sizeof(*words);
+	unsigned int checksum = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < num_words; i++)
+	{
+		checksum ^= words[i];
+		checksum *= 16777619u;
+	}
+	return checksum;
+}
+
+/*****************************************************************************/
+
+/**
+ * Loads the journal of the already mapped index file and determines the
+ * accumulated changes. A journal that doesn't belong to the index file is
+ * removed.
+ *
+ * @param fif the index file.
+ * @param filename the name of the index file.
+ */
+static void folder_index_file_load_journal(struct folder_index_file *fif, const char *filename)
+{
+	const struct folder_index_file_journal_header *header;
+	char *journal_name;
+	unsigned long offset;
+
+	if (!(journal_name = folder_index_file_journal_name(filename)))
+		return;
+
+	if (!(fif->journal_mem = sm_map_file(journal_name, &fif->journal_size)))
+		goto out;
+
+	header = (const struct folder_index_file_journal_header *)fif->journal_mem;
+	if (fif->journal_size < sizeof(*header) || strncmp("SMFJ", header->magic, 4) != 0 ||
+		header->ver != FOLDER_INDEX_FILE_JOURNAL_VERSION || header->num_records > fif->num_mails ||
+		header->checksum != folder_index_file_checksum(fif->records, header->num_records))
+	{
+		SM_DEBUGF(5, ("Journal \"%s\" doesn't belong to the index file and is removed\n", journal_name));
+		sm_unmap_file(fif->journal_mem, fif->journal_size);
+		fif->journal_mem = NULL;
+		remove(journal_name);
+		goto out;
+	}
+
+	if (!(fif->changes = (struct folder_index_file_change *)malloc(sizeof(*fif->changes) * (fif->num_mails + 1))))
+	{
+		sm_unmap_file(fif->journal_mem, fif->journal_size);
+		fif->journal_mem = NULL;
+		goto out;
+	}
+	memset(fif->changes, 0, sizeof(*fif->changes) * (fif->num_mails + 1));
+
+	/* A truncated last entry is ignored, as is everything that follows an
+	 * invalid entry */
+	offset = sizeof(*header);
+	while (offset + sizeof(struct folder_index_file_journal_entry) <= fif->journal_size)
+	{
+		const struct folder_index_file_journal_entry *entry;
+		const char *entry_filename;
+		unsigned long entry_size;
+
+		entry = (const struct folder_index_file_journal_entry *)((const char *)fif->journal_mem + offset);
+		entry_filename = (const char *)(entry + 1);
+		entry_size = (sizeof(*entry) + entry->filename_len + 3) & ~3UL;
+
+		if (entry->idx >= fif->num_mails || entry->filename_len > fif->journal_size - offset - sizeof(*entry))
+			break;
+		if (entry->filename_len && entry_filename[entry->filename_len - 1])
+			break;
+
+		if (entry->filename_len)
+			fif->changes[entry->idx].filename = entry_filename;
+		fif->changes[entry->idx].flags = entry->flags;
+		fif->changes[entry->idx].flags_changed = 1;
+		fif->journal_unread_mails = entry->unread_mails;
+
+		offset += entry_size;
+	}
+out:
+	free(journal_name);
+}
+
+/*****************************************************************************/
+
+struct folder_index_file *folder_index_file_open(const char *filename)
+{
+	struct folder_index_file *fif;
+	const struct folder_index_file_header *header;
+	unsigned long records_size;
+
+	if (!(fif = (struct folder_index_file *)malloc(sizeof(*fif))))
+		return NULL;
+	memset(fif, 0, sizeof(*fif));
+	fif->journal_unread_mails = -1;
+
+	if (!(fif->mem = sm_map_file(filename, &fif->mem_size)))
+		goto bailout;
+
+	if (fif->mem_size < sizeof(*header))
+		goto bailout;
+
+	header = (const struct folder_index_file_header *)fif->mem;
+	if (strncmp("SMFI", header->magic, 4) != 0)
+		goto bailout;
+	if (header->ver != FOLDER_INDEX_FILE_VERSION)
+		goto bailout;
+	if (header->num_mails < 0 || header->record_size != sizeof(struct folder_index_file_record))
+		goto bailout;
+
+	/* Check the bounds once so that records can be accessed freely later on */
+	records_size = (unsigned long)header->num_mails * header->record_size;
+	if (header->records_offset < sizeof(*header) || header->records_offset % 4)
+		goto bailout;
+	if (header->records_offset + records_size > header->blob_offset)
+		goto bailout;
+	if (header->blob_offset % 4 || header->blob_offset > fif->mem_size)
+		goto bailout;
+	if (header->blob_size > fif->mem_size - header->blob_offset)
+		goto bailout;
+
+	/* The blob must be terminated so that no string can exceed it */
+	if (header->blob_size && ((const char *)fif->mem)[header->blob_offset + header->blob_size - 1])
+		goto bailout;
+
+	fif->header = header;
+	fif->records = (const struct folder_index_file_record *)((const char *)fif->mem + header->records_offset);
+	fif->blob = (const char *)fif->mem + header->blob_offset;
+	fif->blob_size = header->blob_size;
+	fif->num_mails = header->num_mails;
+
+	folder_index_file_load_journal(fif, filename);
+	return fif;
+
+bailout:
+	folder_index_file_close(fif);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+void folder_index_file_close(struct folder_index_file *fif)
+{
+	if (!fif) return;
+	if (fif->journal_mem) sm_unmap_file(fif->journal_mem, fif->journal_size);
+	if (fif->mem) sm_unmap_file(fif->mem, fif->mem_size);
+	free(fif->changes);
+	free(fif->intern);
+	arena_unref(fif->intern_arena);
+	free(fif);
+}
+
+/*****************************************************************************/
+
+int folder_index_file_num_mails(struct folder_index_file *fif)
+{
+	return fif->num_mails;
+}
+
+/*****************************************************************************/
+
+int folder_index_file_unread_mails(struct folder_index_file *fif)
+{
+	if (fif->journal_unread_mails != -1)
+		return fif->journal_unread_mails;
+	return fif->header->unread_mails;
+}
+
+/*****************************************************************************/
+
+time_t folder_index_file_saved(struct folder_index_file *fif)
+{
+	return (time_t)fif->header->saved;
+}
+
+/*****************************************************************************/
+
+/**
+ * Returns the string for the given blob reference.
+ *
+ * @param fif the index file.
+ * @param ref the reference.
+ * @return the string that points into the mapped memory or NULL.
+ */
+static const char *folder_index_file_string(struct folder_index_file *fif, unsigned int ref)
+{
+	if (ref == FOLDER_INDEX_FILE_NULL || ref >= fif->blob_size)
+		return NULL;
+	return fif->blob + ref;
+}
+
+/*****************************************************************************/
+
+const char *folder_index_file_filename(struct folder_index_file *fif, int idx)
+{
+	if (idx < 0 || idx >= fif->num_mails)
+		return NULL;
+	if (fif->changes && fif->changes[idx].filename)
+		return fif->changes[idx].filename;
+	return folder_index_file_string(fif, fif->records[idx].filename);
+}
+
+/*****************************************************************************/
+
+/**
+ * Makes the given arena the intern arena of the index file. The references
+ * that have been interned so far are forgotten if the arena differs from the
+ * current one.
+ *
+ * @param fif the index file.
+ * @param arena the arena.
+ */
+static void folder_index_file_intern_use(struct folder_index_file *fif, struct arena *arena)
+{
+	if (fif->intern_arena == arena)
+		return;
+
+	/* Keep the arena alive as long as its memory is referenced by the table */
+	arena_unref(fif->intern_arena);
+	arena_ref(arena);
+	fif->intern_arena = arena;
+
+	free(fif->intern);
+	fif->intern = NULL;
+	fif->intern_size = fif->intern_used = 0;
+}
+
+/**
+ * Hashes the given blob reference.
+ *
+ * @param ref
+ * @param num
+ * @return the hash value.
+ */
+static unsigned int folder_index_file_intern_hash(unsigned int ref, unsigned int num)
+{
+	unsigned int h = ref * 2654435761u;
+	return h ^ (num * 40503u) ^ (h >> 15);
+}
+
+/**
+ * Looks up the entry for the given blob reference within the intern table.
+ * An entry is created if it doesn't exist yet.
+ *
+ * @param fif the index file.
+ * @param ref the reference.
+ * @param num the number of addresses or FOLDER_INDEX_FILE_NULL for strings.
+ * @return the entry whose ptr is NULL if it was just created or NULL on
+ *  failure.
+ */
+static struct folder_index_file_intern *folder_index_file_intern_lookup(struct folder_index_file *fif, unsigned int ref, unsigned int num)
+{
+	struct folder_index_file_intern *e;
+	unsigned int mask;
+	unsigned int i;
+
+	/* Keep the load factor below one half */
+	if ((fif->intern_used + 1) * 2 > fif->intern_size)
+	{
+		struct folder_index_file_intern *new_intern;
+		unsigned int new_size = fif->intern_size ? fif->intern_size * 2 : 1024;
+
+		if (!(new_intern = (struct folder_index_file_intern *)malloc(new_size * sizeof(*new_intern))))
+			return NULL;
+		for (i = 0; i < new_size; i++)
+			new_intern[i].ref = FOLDER_INDEX_FILE_NULL;
+
+		mask = new_size - 1;
+		for (i = 0; i < fif->intern_size; i++)
+		{
+			unsigned int j;
+
+			if (fif->intern[i].ref == FOLDER_INDEX_FILE_NULL)
+				continue;
+			j = folder_index_file_intern_hash(fif->intern[i].ref, fif->intern[i].num) & mask;
+			while (new_intern[j].ref != FOLDER_INDEX_FILE_NULL)
+				j = (j + 1) & mask;
+			new_intern[j] = fif->intern[i];
+		}
+		free(fif->intern);
+		fif->intern = new_intern;
+		fif->intern_size = new_size;
+	}
+
+	mask = fif->intern_size - 1;
+	i = folder_index_file_intern_hash(ref, num) & mask;
+	while ((e = &fif->intern[i])->ref != FOLDER_INDEX_FILE_NULL)
+	{
+		if (e->ref == ref && e->num == num)
+			return e;
+		i = (i + 1) & mask;
+	}
+
+	e->ref = ref;
+	e->num = num;
+	e->ptr = NULL;
+	fif->intern_used++;
+	return e;
+}
+
+/*****************************************************************************/
+
+/**
+ * Duplicates the string for the given blob reference.
+ *
+ * @param fif the index file.
+ * @param arena the arena from which the duplicate is allocated or NULL.
+ * @param ref the reference.
+ * @param ok will be set to 0 if the string could not be duplicated.
+ * @return the duplicate or NULL.
+ */
+static char *folder_index_file_strdup(struct folder_index_file *fif, struct arena *arena, unsigned int ref, int *ok)
+{
+	const char *str;
+	char *dup;
+
+	if (!(str = folder_index_file_string(fif, ref)))
+		return NULL;
+	if (arena) dup = arena_strdup(arena, str);
+	else dup = mystrdup(str);
+	if (!dup)
+		*ok = 0;
+	return dup;
+}
+
+/**
+ * Returns the copy of the string for the given blob reference within the
+ * intern arena. Equal strings are copied only once.
+ *
+ * @param fif the index file.
+ * @param ref the reference.
+ * @param ok will be set to 0 if the string could not be copied.
+ * @return the copy or NULL.
+ */
+static char *folder_index_file_intern_string(struct folder_index_file *fif, unsigned int ref, int *ok)
+{
+	struct folder_index_file_intern *e;
+	char *dup;
+
+	if (!folder_index_file_string(fif, ref))
+		return NULL;
+
+	if ((e = folder_index_file_intern_lookup(fif, ref, FOLDER_INDEX_FILE_NULL)) && e->ptr)
+		return (char *)e->ptr;
+
+	dup = folder_index_file_strdup(fif, fif->intern_arena, ref, ok);
+	if (e) e->ptr = dup;
+	return dup;
+}
+
+/*****************************************************************************/
+
+/**
+ * Creates the address list that is stored at the given blob reference.
+ *
+ * @param fif the index file.
+ * @param arena the arena from which the list is allocated or NULL.
+ * @param ref the reference of the first realname/email pair.
+ * @param num the number of pairs.
+ * @return the address list or NULL on failure.
+ */
+static struct address_list *folder_index_file_address_list(struct folder_index_file *fif, struct arena *arena, unsigned int ref, unsigned int num)
+{
+	struct address_list *al;
+	const unsigned int *pairs;
+	unsigned int i;
+	int ok = 1;
+
+	if (arena) al = (struct address_list *)arena_alloc(arena, sizeof(*al));
+	else al = (struct address_list *)malloc(sizeof(*al));
+	if (!al)
+		return NULL;
+	list_init(&al->list);
+
+	if (!num)
+		return al;
+
+	if (ref % 4 || ref >= fif->blob_size || num > (fif->blob_size - ref) / 8)
+		return al;
+
+	pairs = (const unsigned int *)(fif->blob + ref);
+	for (i = 0; i < num && ok; i++)
+	{
+		struct address *addr;
+
+		if (arena)
+		{
+			if (!(addr = (struct address *)arena_alloc(arena, sizeof(*addr))))
+				break;
+			addr->realname = folder_index_file_intern_string(fif, pairs[i*2], &ok);
+			addr->email = folder_index_file_intern_string(fif, pairs[i*2+1], &ok);
+		} else
+		{
+			if (!(addr = (struct address *)malloc(sizeof(*addr))))
+				break;
+			addr->realname = folder_index_file_strdup(fif, NULL, pairs[i*2], &ok);
+			addr->email = folder_index_file_strdup(fif, NULL, pairs[i*2+1], &ok);
+		}
+		list_insert_tail(&al->list, &addr->node);
+	}
+	return al;
+}
+
+/**
+ * Returns the address list that is stored at the given blob reference
+ * within the intern arena. Address lists that are stored at the same
+ * reference are shared.
+ *
+ * @param fif the index file.
+ * @param ref the reference of the first realname/email pair.
+ * @param num the number of pairs.
+ * @return the address list or NULL on failure.
+ */
+static struct address_list *folder_index_file_intern_address_list(struct folder_index_file *fif, unsigned int ref, unsigned int num)
+{
+	struct folder_index_file_intern *e;
+	struct address_list *al;
+
+	if ((e = folder_index_file_intern_lookup(fif, ref, num)) && e->ptr)
+		return (struct address_list *)e->ptr;
+
+	al = folder_index_file_address_list(fif, fif->intern_arena, ref, num);
+	if (e) e->ptr = al;
+	return al;
+}
+
+/*****************************************************************************/
+
+struct mail_info *folder_index_file_get_mail(struct folder_index_file *fif, mail_context *mc, struct arena *arena, int idx)
+{
+	const struct folder_index_file_record *rec;
+	const char *pop3;
+	struct mail_info *m;
+	int ok = 1;
+
+	if (idx < 0 || idx >= fif->num_mails)
+		return NULL;
+
+	rec = &fif->records[idx];
+
+	if (arena)
+	{
+		if (!(m = mail_info_create_in_arena(mc, arena)))
+			return NULL;
+		m->tflags |= MAIL_TFLAGS_ARENA_FILENAME | MAIL_TFLAGS_ARENA_MESSAGE_ID;
+
+		folder_index_file_intern_use(fif, arena);
+	} else
+	{
+		if (!(m = mail_info_create(mc)))
+			return NULL;
+	}
+
+	if (fif->changes && fif->changes[idx].filename)
+	{
+		if (arena) m->filename = arena_strdup(arena, fif->changes[idx].filename);
+		else m->filename = mystrdup(fif->changes[idx].filename);
+		if (!m->filename)
+			ok = 0;
+	} else
+	{
+		m->filename = folder_index_file_strdup(fif, arena, rec->filename, &ok);
+	}
+	m->message_id = folder_index_file_strdup(fif, arena, rec->message_id, &ok);
+
+	if (arena)
+	{
+		/* Everything else is immutable and likely to be repeated */
+		m->subject = (utf8 *)folder_index_file_intern_string(fif, rec->subject, &ok);
+		m->from_phrase = (utf8 *)folder_index_file_intern_string(fif, rec->from_phrase, &ok);
+		m->from_addr = folder_index_file_intern_string(fif, rec->from_addr, &ok);
+		m->reply_addr = folder_index_file_intern_string(fif, rec->reply_addr, &ok);
+		m->message_reply_id = folder_index_file_intern_string(fif, rec->message_reply_id, &ok);
+		m->to_list = folder_index_file_intern_address_list(fif, rec->to_addrs, rec->num_to);
+		m->cc_list = folder_index_file_intern_address_list(fif, rec->cc_addrs, rec->num_cc);
+	} else
+	{
+		m->subject = (utf8 *)folder_index_file_strdup(fif, NULL, rec->subject, &ok);
+		m->from_phrase = (utf8 *)folder_index_file_strdup(fif, NULL, rec->from_phrase, &ok);
+		m->from_addr = folder_index_file_strdup(fif, NULL, rec->from_addr, &ok);
+		m->reply_addr = folder_index_file_strdup(fif, NULL, rec->reply_addr, &ok);
+		m->message_reply_id = folder_index_file_strdup(fif, NULL, rec->message_reply_id, &ok);
+		m->to_list = folder_index_file_address_list(fif, NULL, rec->to_addrs, rec->num_to);
+		m->cc_list = folder_index_file_address_list(fif, NULL, rec->cc_addrs, rec->num_cc);
+	}
+
+	if ((pop3 = folder_index_file_string(fif, rec->pop3_server)))
+	{
+		int pop3_id = -1;
+
+		if (m->context)
+			pop3_id = string_pool_ref(m->context->sp, pop3);
+
+		if (pop3_id != -1)
+		{
+			m->pop3_server.id = pop3_id;
+			m->tflags |= MAIL_TFLAGS_POP3_ID;
+		} else
+		{
+			if (!(m->pop3_server.str = mystrdup(pop3)))
+				ok = 0;
+		}
+	}
+
+	m->size = rec->size;
+	m->seconds = rec->seconds;
+	m->received = rec->received;
+	m->flags = rec->flags;
+	if (fif->changes && fif->changes[idx].flags_changed)
+		m->flags = fif->changes[idx].flags;
+
+	if (!ok || !m->filename || !m->to_list || !m->cc_list)
+	{
+		mail_info_free(m);
+		return NULL;
+	}
+	return m;
+}
+
+/*****************************************************************************/
+
+/**
+ * Context for writing the blob of an index file.
+ */
+struct folder_index_file_writer
+{
+	FILE *fh;
+
+	/** The offset of the next string relative to the start of the blob */
+	unsigned int blob_size;
+
+	/** Maps already written strings to their offsets */
+	struct hash_table strings;
+	int strings_initialized;
+
+	/** Maps the contents of already written address arrays to their offsets */
+	struct hash_table addresses;
+	int addresses_initialized;
+
+	/** Whether the last byte of the blob is a zero byte */
+	int blob_terminated;
+};
+
+/**
+ * Remembers that the given string is stored at the given reference, unless
+ * an equal string is known already.
+ *
+ * @param w the writer.
+ * @param str the string.
+ * @param ref the reference of the string.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_index_file_writer_known_string(struct folder_index_file_writer *w, const char *str, unsigned int ref)
+{
+	char *dup;
+
+	if (hash_table_lookup(&w->strings, str))
+		return 1;
+
+	if (!(dup = mystrdup(str)))
+		return 0;
+	if (!hash_table_insert(&w->strings, dup, ref))
+	{
+		free(dup);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Returns the key under which an array of address pairs is known to the
+ * writer.
+ *
+ * @param pairs the references of the strings of the addresses.
+ * @param n the number of addresses.
+ * @return the key that needs to be freed with free() or NULL on failure.
+ */
+static char *folder_index_file_writer_addresses_key(const unsigned int *pairs, unsigned int n)
+{
+	unsigned int i;
+	char *key;
+
+	if (!(key = (char *)malloc(n * 18 + 1)))
+		return NULL;
+	key[0] = 0;
+	for (i = 0; i < n; i++)
+		sprintf(key + strlen(key), "%x.%x,", pairs[i*2], pairs[i*2+1]);
+	return key;
+}
+
+/**
+ * Writes the given string into the blob unless an equal string has been
+ * written already.
+ *
+ * @param w the writer.
+ * @param str the string to write. May be NULL.
+ * @param ref where the reference of the string is stored.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_index_file_writer_put_string(struct folder_index_file_writer *w, const char *str, unsigned int *ref)
+{
+	struct hash_entry *entry;
+	char *dup;
+	size_t len;
+
+	if (!str)
+	{
+		*ref = FOLDER_INDEX_FILE_NULL;
+		return 1;
+	}
+
+	if ((entry = hash_table_lookup(&w->strings, str)))
+	{
+		*ref = entry->data;
+		return 1;
+	}
+
+	len = strlen(str) + 1;
+	if (fwrite(str, 1, len, w->fh) != len)
+		return 0;
+
+	if (!(dup = mystrdup(str)))
+		return 0;
+	if (!hash_table_insert(&w->strings, dup, w->blob_size))
+	{
+		free(dup);
+		return 0;
+	}
+
+	*ref = w->blob_size;
+	w->blob_size += len;
+	w->blob_terminated = 1;
+	return 1;
+}
+
+/**
+ * Writes the given address list into the blob. The strings of the
+ * addresses must have been written before.
+ *
+ * @param w the writer.
+ * @param al the address list. May be NULL.
+ * @param refs the references of the strings of the addresses, two per address.
+ * @param ref where the reference of the array is stored.
+ * @param num where the number of addresses is stored.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_index_file_writer_put_addresses(struct folder_index_file_writer *w, struct address_list *al, unsigned int *ref, unsigned int *num)
+{
+	struct address *addr;
+	struct hash_entry *entry;
+	unsigned int n = 0;
+	unsigned int *pairs;
+	char *key = NULL;
+	int rc = 0;
+	static const char zeros[4];
+
+	*ref = FOLDER_INDEX_FILE_NULL;
+	*num = 0;
+
+	if (!al || !(addr = address_list_first(al)))
+		return 1;
+
+	if (!(pairs = (unsigned int *)malloc(address_list_length(al) * 2 * sizeof(*pairs))))
+		return 0;
+
+	/* Write the strings first */
+	while (addr)
+	{
+		if (!folder_index_file_writer_put_string(w, addr->realname, &pairs[n*2]))
+			goto out;
+		if (!folder_index_file_writer_put_string(w, addr->email, &pairs[n*2+1]))
+			goto out;
+		n++;
+		addr = address_next(addr);
+	}
+
+	/* Equal arrays are stored only once, so they can be shared when loaded */
+	if (!(key = folder_index_file_writer_addresses_key(pairs, n)))
+		goto out;
+
+	if ((entry = hash_table_lookup(&w->addresses, key)))
+	{
+		*ref = entry->data;
+		*num = n;
+		rc = 1;
+		goto out;
+	}
+
+	/* Align the array */
+	if (w->blob_size % 4)
+	{
+		unsigned int pad = 4 - w->blob_size % 4;
+		if (fwrite(zeros, 1, pad, w->fh) != pad)
+			goto out;
+		w->blob_size += pad;
+	}
+
+	if (fwrite(pairs, 1, n * 2 * sizeof(*pairs), w->fh) != n * 2 * sizeof(*pairs))
+		goto out;
+
+	if (!hash_table_insert(&w->addresses, key, w->blob_size))
+		goto out;
+	key = NULL; /* now owned by the hash table */
+
+	*ref = w->blob_size;
+	*num = n;
+	w->blob_size += n * 2 * sizeof(*pairs);
+	w->blob_terminated = !((unsigned char *)pairs)[n * 2 * sizeof(*pairs) - 1];
+	rc = 1;
+out:
+	free(key);
+	free(pairs);
+	return rc;
+}
+
+/*****************************************************************************/
+
+/**
+ * Writes the strings of the given mail into the blob and fills the given
+ * record accordingly.
+ *
+ * @param w the writer.
+ * @param m the mail.
+ * @param rec the record to fill.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_index_file_writer_put_mail(struct folder_index_file_writer *w, struct mail_info *m, struct folder_index_file_record *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+
+	/* Subject and filename are never NULL, see folder_read_mail_info_from_index() */
+	if (!folder_index_file_writer_put_string(w, m->subject?(char*)m->subject:"", &rec->subject)) return 0;
+	if (!folder_index_file_writer_put_string(w, m->filename?m->filename:"", &rec->filename)) return 0;
+	if (!folder_index_file_writer_put_string(w, (char*)m->from_phrase, &rec->from_phrase)) return 0;
+	if (!folder_index_file_writer_put_string(w, m->from_addr, &rec->from_addr)) return 0;
+	if (!folder_index_file_writer_put_string(w, m->reply_addr, &rec->reply_addr)) return 0;
+	if (!folder_index_file_writer_put_string(w, mail_get_pop3_server(m), &rec->pop3_server)) return 0;
+	if (!folder_index_file_writer_put_string(w, m->message_id, &rec->message_id)) return 0;
+	if (!folder_index_file_writer_put_string(w, m->message_reply_id, &rec->message_reply_id)) return 0;
+	if (!folder_index_file_writer_put_addresses(w, m->to_list, &rec->to_addrs, &rec->num_to)) return 0;
+	if (!folder_index_file_writer_put_addresses(w, m->cc_list, &rec->cc_addrs, &rec->num_cc)) return 0;
+
+	rec->size = m->size;
+	rec->seconds = m->seconds;
+	rec->received = m->received;
+	rec->flags = m->flags;
+	return 1;
+}
+
+/**
+ * Makes the strings and address arrays of the blob of the given index file
+ * known to the writer, so they are not written again if the blob is taken
+ * over.
+ *
+ * @param w the writer.
+ * @param base the index file.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_index_file_writer_take_base(struct folder_index_file_writer *w, struct folder_index_file *base)
+{
+	int i;
+
+	for (i = 0; i < base->num_mails; i++)
+	{
+		const struct folder_index_file_record *rec = &base->records[i];
+		const unsigned int refs[] = {rec->subject, rec->filename, rec->from_phrase, rec->from_addr,
+			rec->reply_addr, rec->pop3_server, rec->message_id, rec->message_reply_id};
+		const unsigned int addrs[][2] = {{rec->to_addrs, rec->num_to}, {rec->cc_addrs, rec->num_cc}};
+		int j;
+
+		for (j = 0; j < sizeof(refs)/sizeof(refs[0]); j++)
+		{
+			const char *str;
+
+			if ((str = folder_index_file_string(base, refs[j])))
+			{
+				if (!folder_index_file_writer_known_string(w, str, refs[j]))
+					return 0;
+			}
+		}
+
+		for (j = 0; j < sizeof(addrs)/sizeof(addrs[0]); j++)
+		{
+			unsigned int ref = addrs[j][0];
+			unsigned int num = addrs[j][1];
+			const unsigned int *pairs;
+			unsigned int k;
+			char *key;
+
+			/* Same checks as in folder_index_file_address_list() */
+			if (!num || ref % 4 || ref >= base->blob_size || num > (base->blob_size - ref) / 8)
+				continue;
+
+			pairs = (const unsigned int *)(base->blob + ref);
+			for (k = 0; k < num * 2; k++)
+			{
+				const char *str;
+
+				if ((str = folder_index_file_string(base, pairs[k])))
+				{
+					if (!folder_index_file_writer_known_string(w, str, pairs[k]))
+						return 0;
+				}
+			}
+
+			if (!(key = folder_index_file_writer_addresses_key(pairs, num)))
+				return 0;
+			if (hash_table_lookup(&w->addresses, key))
+			{
+				free(key);
+				continue;
+			}
+			if (!hash_table_insert(&w->addresses, key, ref))
+			{
+				free(key);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+int folder_index_file_save(const char *filename, struct folder_index_file *base, struct mail_info **mails, int num_mails, int unread_mails)
+{
+	struct folder_index_file_writer w;
+	struct folder_index_file_header header;
+	struct folder_index_file_record *records = NULL;
+	struct folder_index_file_record *base_records = NULL;
+	char *tmp_filename;
+	int num_base = 0;
+	int i;
+	int rc = 0;
+
+	memset(&w, 0, sizeof(w));
+
+	if (!(tmp_filename = (char *)malloc(strlen(filename) + 5)))
+		return 0;
+	strcpy(tmp_filename, filename);
+	strcat(tmp_filename, ".new");
+
+	if (base)
+		num_base = base->num_mails;
+
+	if (!(records = (struct folder_index_file_record *)malloc(sizeof(*records) * (num_mails + 1))))
+		goto out;
+
+	if (!hash_table_init(&w.strings, 12, NULL))
+		goto out;
+	w.strings_initialized = 1;
+
+	if (!hash_table_init(&w.addresses, 10, NULL))
+		goto out;
+	w.addresses_initialized = 1;
+
+	if (!(w.fh = fopen(tmp_filename, "wb")))
+		goto out;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "SMFI", 4);
+	header.ver = FOLDER_INDEX_FILE_VERSION;
+	header.num_mails = num_base + num_mails;
+	header.unread_mails = unread_mails;
+	header.saved = (unsigned int)time(NULL);
+	header.record_size = sizeof(struct folder_index_file_record);
+	header.records_offset = sizeof(header);
+	header.blob_offset = header.records_offset + header.num_mails * header.record_size;
+
+	/* The blob follows the records, so skip the records for now. The blob
+	 * of the base is taken over as is, thus the base records are still
+	 * valid. */
+	if (fseek(w.fh, header.blob_offset, SEEK_SET) != 0)
+		goto out;
+
+	if (base && base->blob_size)
+	{
+		if (fwrite(base->blob, 1, base->blob_size, w.fh) != base->blob_size)
+			goto out;
+		w.blob_size = base->blob_size;
+
+		/* The blob of an index file is always terminated */
+		w.blob_terminated = 1;
+
+		/* New mails share the strings of the base */
+		if (!folder_index_file_writer_take_base(&w, base))
+			goto out;
+	}
+
+	/* Fold the journal of the base into the records */
+	if (base && base->changes)
+	{
+		if (!(base_records = (struct folder_index_file_record *)malloc(sizeof(*records) * (num_base + 1))))
+			goto out;
+		memcpy(base_records, base->records, sizeof(*records) * num_base);
+
+		for (i = 0; i < num_base; i++)
+		{
+			if (base->changes[i].filename)
+			{
+				if (!folder_index_file_writer_put_string(&w, base->changes[i].filename, &base_records[i].filename))
+					goto out;
+			}
+			if (base->changes[i].flags_changed)
+				base_records[i].flags = base->changes[i].flags;
+		}
+	}
+
+	for (i = 0; i < num_mails; i++)
+	{
+		if (!folder_index_file_writer_put_mail(&w, mails[i], &records[i]))
+			goto out;
+	}
+
+	/* Terminate the blob unless it already is, see folder_index_file_open() */
+	if (!w.blob_terminated)
+	{
+		if (fputc(0, w.fh) == EOF)
+			goto out;
+		w.blob_size++;
+	}
+	header.blob_size = w.blob_size;
+
+	if (fseek(w.fh, 0, SEEK_SET) != 0)
+		goto out;
+	if (fwrite(&header, 1, sizeof(header), w.fh) != sizeof(header))
+		goto out;
+	if (num_base && fwrite(base_records?base_records:base->records, sizeof(*records), num_base, w.fh) != num_base)
+		goto out;
+	if (num_mails && fwrite(records, sizeof(*records), num_mails, w.fh) != num_mails)
+		goto out;
+
+	if (fclose(w.fh) != 0)
+	{
+		w.fh = NULL;
+		goto out;
+	}
+	w.fh = NULL;
+
+	/* The old file may be mapped but as it is not accessed anymore it is
+	 * safe to remove it */
+	remove(filename);
+	if (rename(tmp_filename, filename) != 0)
+		goto out;
+
+	/* The journal has been folded in */
+	folder_index_file_remove_journal(filename);
+
+	rc = 1;
+out:
+	if (w.fh)
+		fclose(w.fh);
+	if (!rc)
+		remove(tmp_filename);
+	if (w.strings_initialized)
+		hash_table_clean(&w.strings);
+	if (w.addresses_initialized)
+		hash_table_clean(&w.addresses);
+	free(base_records);
+	free(records);
+	free(tmp_filename);
+	return rc;
+}
+
+/*****************************************************************************/
+
+unsigned long folder_index_file_journal_append(const char *filename, int idx, const char *mail_filename, unsigned int flags, int unread_mails)
+{
+	struct folder_index_file_journal_entry entry;
+	static const char zeros[4];
+	char *journal_name;
+	unsigned long size = 0;
+	unsigned int pad;
+	FILE *fh;
+
+	if (idx < 0)
+		return 0;
+
+	if (!(journal_name = folder_index_file_journal_name(filename)))
+		return 0;
+
+	if (!(fh = fopen(journal_name, "ab")))
+		goto out;
+
+	/* The position after opening for appending is implementation-defined,
+	 * it is only guaranteed to be at the end once something is written */
+	if (fseek(fh, 0, SEEK_END) != 0)
+		goto out;
+
+	if (ftell(fh) == 0)
+	{
+		struct folder_index_file *fif;
+		struct folder_index_file_journal_header header;
+		int ok;
+
+		/* This is a new journal, bind it to the current index file */
+		if (!(fif = folder_index_file_open(filename)))
+			goto out;
+
+		memcpy(header.magic, "SMFJ", 4);
+		header.ver = FOLDER_INDEX_FILE_JOURNAL_VERSION;
+		header.num_records = fif->num_mails;
+		header.checksum = folder_index_file_checksum(fif->records, fif->num_mails);
+		ok = idx < fif->num_mails;
+		folder_index_file_close(fif);
+
+		if (!ok || fwrite(&header, 1, sizeof(header), fh) != sizeof(header))
+			goto out;
+	}
+
+	entry.idx = idx;
+	entry.flags = flags;
+	entry.unread_mails = unread_mails;
+	entry.filename_len = mail_filename ? strlen(mail_filename) + 1 : 0;
+	pad = (4 - entry.filename_len % 4) % 4;
+
+	if (fwrite(&entry, 1, sizeof(entry), fh) != sizeof(entry))
+		goto out;
+	if (entry.filename_len && fwrite(mail_filename, 1, entry.filename_len, fh) != entry.filename_len)
+		goto out;
+	if (pad && fwrite(zeros, 1, pad, fh) != pad)
+		goto out;
+
+	size = ftell(fh);
+out:
+	if (fh)
+	{
+		if (fclose(fh) != 0)
+			size = 0;
+	}
+	free(journal_name);
+	return size;
+}
+
+/*****************************************************************************/
+
+void folder_index_file_remove_journal(const char *filename)
+{
+	char *journal_name;
+
+	if ((journal_name = folder_index_file_journal_name(filename)))
+	{
+		remove(journal_name);
+		free(journal_name);
+	}
+}
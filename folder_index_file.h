@@ -0,0 +1,147 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_index_file.h
+ *
+ * Support for the memory-mapped (version 9) folder index files. Such a file
+ * consists of a header, a table of fixed-size records (one per mail) and a
+ * blob that contains all the strings and address arrays referenced by the
+ * records. Equal strings and equal address arrays are stored only once.
+ *
+ * Changes of the filename or the flags of single mails can be recorded in a
+ * journal that accompanies the index file. The journal is taken into account
+ * when the index file is opened and is folded in when the index file is
+ * saved.
+ */
+
+#ifndef SM__FOLDER_INDEX_FILE_H
+#define SM__FOLDER_INDEX_FILE_H
+
+#include <time.h>
+
+#include "mail_context.h"
+
+/** The version of the index files handled by this module */
+#define FOLDER_INDEX_FILE_VERSION 9
+
+struct arena;
+struct mail_info;
+struct folder_index_file;
+
+/**
+ * Maps the index file with the given name. The file must be a version 9
+ * index file.
+ *
+ * @param filename the name of the index file.
+ * @return the mapped index file or NULL on failure.
+ */
+struct folder_index_file *folder_index_file_open(const char *filename);
+
+/**
+ * Unmaps the given index file.
+ *
+ * @param fif the index file to close. May be NULL.
+ */
+void folder_index_file_close(struct folder_index_file *fif);
+
+/**
+ * @param fif the index file.
+ * @return the number of mails that are stored within the index file.
+ */
+int folder_index_file_num_mails(struct folder_index_file *fif);
+
+/**
+ * @param fif the index file.
+ * @return the number of unread mails as recorded in the header or in the
+ *  journal.
+ */
+int folder_index_file_unread_mails(struct folder_index_file *fif);
+
+/**
+ * @param fif the index file.
+ * @return the time at which the index file has been written.
+ */
+time_t folder_index_file_saved(struct folder_index_file *fif);
+
+/**
+ * Returns the filename of the mail that is stored at the given position
+ * without decoding the entire record.
+ *
+ * @param fif the index file.
+ * @param idx the position of the mail.
+ * @return the filename that points into the mapped file or NULL if idx is
+ *  out of bounds. It stays valid until the file is closed.
+ */
+const char *folder_index_file_filename(struct folder_index_file *fif, int idx);
+
+/**
+ * Decodes the mail that is stored at the given position.
+ *
+ * @param fif the index file.
+ * @param mc the mail context to which the new mail is associated.
+ * @param arena the arena from which the mail and its strings are allocated.
+ *  May be NULL in which case they are allocated individually. Mails that are
+ *  decoded into the same arena in a row share equal subjects, senders and
+ *  address lists.
+ * @param idx the position of the mail.
+ * @return the mail info that must be freed with mail_info_free() or NULL on
+ *  failure.
+ */
+struct mail_info *folder_index_file_get_mail(struct folder_index_file *fif, mail_context *mc, struct arena *arena, int idx);
+
+/**
+ * Writes an index file that contains the given mails. The file is written
+ * under a temporary name first and replaces the file with the given name
+ * only if it was completely written.
+ *
+ * @param filename the name of the index file.
+ * @param base an already mapped index file whose records are taken over
+ *  before the given mails are stored. It may refer to the file that is
+ *  replaced. May be NULL.
+ * @param mails the mails to be stored.
+ * @param num_mails number of entries in mails.
+ * @param unread_mails the number of unread mails to be recorded in the header.
+ * @return 1 on success, 0 on failure.
+ * @note the journal of the base is folded into the new index file and the
+ *  journal of the index file with the given name is removed.
+ */
+int folder_index_file_save(const char *filename, struct folder_index_file *base, struct mail_info **mails, int num_mails, int unread_mails);
+
+/**
+ * Records the change of a single mail in the journal of the given index file.
+ *
+ * @param filename the name of the index file.
+ * @param idx the position of the mail in the index file.
+ * @param mail_filename the new filename of the mail or NULL if it hasn't been
+ *  changed.
+ * @param flags the new flags of the mail.
+ * @param unread_mails the number of unread mails after the change.
+ * @return the size of the journal in bytes after the change has been recorded
+ *  or 0 on failure.
+ */
+unsigned long folder_index_file_journal_append(const char *filename, int idx, const char *mail_filename, unsigned int flags, int unread_mails);
+
+/**
+ * Removes the journal of the given index file.
+ *
+ * @param filename the name of the index file.
+ */
+void folder_index_file_remove_journal(const char *filename);
+
+#endif
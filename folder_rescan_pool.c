@@ -0,0 +1,281 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_rescan_pool.c
+ *
+ * The submitted batches are kept in a list. The threads of the pool take
+ * small runs of consecutive mails from the first batch of the list and read
+ * them using full paths, as the current directory is shared by all threads.
+ * The mails are created without a context as the string pool of the context
+ * must not be accessed concurrently.
+ */
+
+#include "folder_rescan_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "mail.h"
+#include "support_indep.h"
+
+#include "subthreads.h"
+#include "support.h"
+
+/** Number of consecutive mails that a thread of the pool takes at once */
+#define FOLDER_RESCAN_POOL_RUN 4
+
+/** The threads of the pool */
+static thread_t rescan_pool_threads[FOLDER_RESCAN_POOL_MAX_THREADS];
+static int rescan_pool_num_threads;
+
+/** The submitted batches with mails that have not been taken, protected by pool_semaphore */
+static struct list rescan_pool_batch_list;
+static semaphore_t pool_semaphore;
+
+/*****************************************************************************/
+
+/**
+ * Locks the pool if it has been set up. Without a semaphore there are no
+ * threads and hence nothing to protect.
+ */
+static void folder_rescan_pool_lock(void)
+{
+	if (pool_semaphore) thread_lock_semaphore(pool_semaphore);
+}
+
+/**
+ * Unlocks the pool.
+ */
+static void folder_rescan_pool_unlock(void)
+{
+	if (pool_semaphore) thread_unlock_semaphore(pool_semaphore);
+}
+
+/*****************************************************************************/
+
+/**
+ * Reads the given mail of the given batch. If the mail couldn't be read,
+ * its filename is kept and the mail stays NULL, so the submitter can try
+ * again.
+ *
+ * @param batch
+ * @param idx
+ */
+static void folder_rescan_pool_read(struct folder_rescan_batch *batch, int idx)
+{
+	struct mail_info *m;
+	char *path;
+
+	if (!(path = mycombinepath(batch->folder_path, batch->filenames[idx])))
+		return;
+
+	m = mail_info_create_from_file(NULL, path);
+	free(path);
+	if (!m)
+		return;
+
+	/* The mail gets the relative name */
+	free(m->filename);
+	m->filename = batch->filenames[idx];
+	batch->filenames[idx] = NULL;
+	batch->mails[idx] = m;
+}
+
+/**
+ * Takes a run of mails of the given batch that have not been taken so far.
+ * The pool must be locked.
+ *
+ * @param batch
+ * @param max_run the maximum number of mails to be taken.
+ * @param end_ptr where the end of the run (exclusive) is stored.
+ * @return the first mail of the run.
+ */
+static int folder_rescan_pool_take(struct folder_rescan_batch *batch, int max_run, int *end_ptr)
+{
+	int first = batch->next;
+
+	batch->next += max_run;
+	if (batch->next >= batch->num_mails)
+	{
+		batch->next = batch->num_mails;
+		if (batch->queued)
+		{
+			node_remove(&batch->node);
+			batch->queued = 0;
+		}
+	}
+	*end_ptr = batch->next;
+	return first;
+}
+
+/**
+ * Takes a run of mails from the first batch and reads it.
+ *
+ * @return whether there was anything to do.
+ */
+static int folder_rescan_pool_process(void)
+{
+	struct folder_rescan_batch *batch;
+	int first, i, end;
+
+	folder_rescan_pool_lock();
+	if (!(batch = (struct folder_rescan_batch*)list_first(&rescan_pool_batch_list)))
+	{
+		folder_rescan_pool_unlock();
+		return 0;
+	}
+	first = folder_rescan_pool_take(batch, FOLDER_RESCAN_POOL_RUN, &end);
+	folder_rescan_pool_unlock();
+
+	/* Once taken, the mails are read even on an abort request as the
+	 * submitter waits for them */
+	for (i = first; i < end; i++)
+		folder_rescan_pool_read(batch, i);
+
+	folder_rescan_pool_lock();
+	batch->completed += end - first;
+	folder_rescan_pool_unlock();
+	return 1;
+}
+
+/**
+ * Entry for the threads of the pool.
+ *
+ * @param user_data
+ * @return
+ */
+static int folder_rescan_pool_entry(void *user_data)
+{
+	thread_parent_task_can_contiue();
+	while (thread_wait(NULL,NULL,NULL,0))
+	{
+		while (!thread_aborted() && folder_rescan_pool_process());
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+int folder_rescan_pool_start(int num_threads)
+{
+	num_threads--; /* The submitting thread is one of them */
+	if (num_threads > FOLDER_RESCAN_POOL_MAX_THREADS)
+		num_threads = FOLDER_RESCAN_POOL_MAX_THREADS;
+
+	if (num_threads <= rescan_pool_num_threads)
+		return 1;
+
+	if (!pool_semaphore)
+	{
+		if (!(pool_semaphore = thread_create_semaphore()))
+			return 0;
+		list_init(&rescan_pool_batch_list);
+	}
+
+	while (rescan_pool_num_threads < num_threads)
+	{
+		thread_t t;
+
+		if (!(t = thread_add("SimpleMail - Rescan worker", folder_rescan_pool_entry, NULL)))
+		{
+			SM_DEBUGF(10, ("Could only start %d rescan threads\n", rescan_pool_num_threads));
+			return 0;
+		}
+		rescan_pool_threads[rescan_pool_num_threads++] = t;
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+void folder_rescan_pool_submit(struct folder_rescan_batch *batch)
+{
+	int i;
+
+	batch->next = 0;
+	batch->completed = 0;
+	batch->queued = 0;
+
+	if (!batch->num_mails || !rescan_pool_num_threads)
+		return;
+
+	folder_rescan_pool_lock();
+	list_insert_tail(&rescan_pool_batch_list, &batch->node);
+	batch->queued = 1;
+	folder_rescan_pool_unlock();
+
+	for (i = 0; i < rescan_pool_num_threads && i * FOLDER_RESCAN_POOL_RUN < batch->num_mails; i++)
+		thread_signal(rescan_pool_threads[i]);
+}
+
+/*****************************************************************************/
+
+int folder_rescan_pool_help(struct folder_rescan_batch *batch)
+{
+	int i, end;
+
+	folder_rescan_pool_lock();
+	if (batch->next == batch->num_mails)
+	{
+		folder_rescan_pool_unlock();
+		return 0;
+	}
+	i = folder_rescan_pool_take(batch, 1, &end);
+	folder_rescan_pool_unlock();
+
+	folder_rescan_pool_read(batch, i);
+
+	folder_rescan_pool_lock();
+	batch->completed++;
+	folder_rescan_pool_unlock();
+	return 1;
+}
+
+/*****************************************************************************/
+
+int folder_rescan_pool_completed(struct folder_rescan_batch *batch)
+{
+	int completed;
+
+	folder_rescan_pool_lock();
+	completed = batch->completed;
+	folder_rescan_pool_unlock();
+	return completed;
+}
+
+/*****************************************************************************/
+
+int folder_rescan_pool_finished(struct folder_rescan_batch *batch)
+{
+	return folder_rescan_pool_completed(batch) == batch->num_mails;
+}
+
+/*****************************************************************************/
+
+void cleanup_folder_rescan_pool(void)
+{
+	rescan_pool_num_threads = 0;
+
+	if (pool_semaphore)
+	{
+		thread_dispose_semaphore(pool_semaphore);
+		pool_semaphore = NULL;
+	}
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_rescan_pool.h
+ *
+ * A pool of threads that read the headers of mail files in parallel. The
+ * files to be read are submitted in batches. The thread that submitted a
+ * batch takes part in the work and collects the results once all files of
+ * the batch have been read.
+ */
+
+#ifndef SM__FOLDER_RESCAN_POOL_H
+#define SM__FOLDER_RESCAN_POOL_H
+
+#ifndef SM__LISTS_H
+#include "lists.h"
+#endif
+
+/** Default number of threads that read the mails during a rescan */
+#define FOLDER_RESCAN_POOL_DEFAULT_THREADS 4
+
+/** Maximum number of threads that read the mails during a rescan */
+#define FOLDER_RESCAN_POOL_MAX_THREADS 16
+
+struct mail_info;
+
+/**
+ * A batch of mail files to be read.
+ */
+struct folder_rescan_batch
+{
+	struct node node; /* embedded node structure, only used by the pool */
+
+	/** The directory in which the files reside */
+	const char *folder_path;
+
+	/**
+	 * The names of the files relative to the folder path. A name is taken
+	 * over by the corresponding mail if the file could be read.
+	 */
+	char **filenames;
+
+	/**
+	 * The mails with a NULL context, one for each file. Entries stay NULL
+	 * if a file couldn't be read.
+	 */
+	struct mail_info **mails;
+
+	int num_mails;
+
+	/* Private, protected by the semaphore of the pool */
+	int next;
+	int completed;
+	int queued;
+};
+
+/**
+ * Starts the threads of the pool if not already done. The pool can be used
+ * even if this fails, all mails are read by the submitting thread then.
+ *
+ * @param num_threads the total number of threads that shall read mails
+ *  including the one that submits the batches. The pool never shrinks.
+ * @return whether the requested number of threads is available.
+ */
+int folder_rescan_pool_start(int num_threads);
+
+/**
+ * Submits the given batch. The mails of the batch must be NULL.
+ *
+ * @param batch the batch, which must stay valid until
+ *  folder_rescan_pool_finished() returns 1.
+ */
+void folder_rescan_pool_submit(struct folder_rescan_batch *batch);
+
+/**
+ * Reads the next mail of the given batch on the context of the calling
+ * thread, if there is any that has not been taken by the pool so far.
+ *
+ * @param batch the submitted batch.
+ * @return 1 if a mail has been read, 0 if there is nothing left to do.
+ */
+int folder_rescan_pool_help(struct folder_rescan_batch *batch);
+
+/**
+ * @param batch the submitted batch.
+ * @return the number of mails of the batch that have been read so far.
+ */
+int folder_rescan_pool_completed(struct folder_rescan_batch *batch);
+
+/**
+ * @param batch the submitted batch.
+ * @return 1 if all mails of the batch have been read.
+ */
+int folder_rescan_pool_finished(struct folder_rescan_batch *batch);
+
+/**
+ * Cleanup resources used by the pool. Must be called after the threads
+ * have been finished.
+ */
+void cleanup_folder_rescan_pool(void);
+
+#endif
@@ -23,8 +23,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "configuration.h"
 #include "filter.h"
 #include "folder.h"
+#include "folder_text_index.h"
+#include "folder_text_index_thread.h"
 #include "mail.h"
 #include "support_indep.h"
 
@@ -50,6 +53,52 @@ static void folder_search_clean_thread(void)
 	search_thread = NULL;
 }
 
+/**
+ * Returns whether the given filter contains a rule that matches the body.
+ *
+ * @param filter the filter to check
+ * @return 1 if the filter has a body rule, else 0.
+ */
+static int folder_search_filter_has_body_rule(struct filter *filter)
+{
+	struct filter_rule *rule = (struct filter_rule*)list_first(&filter->rules_list);
+	while (rule)
+	{
+		if (rule->type == RULE_BODY_MATCH && rule->u.body.body)
+			return 1;
+		rule = (struct filter_rule*)node_next(&rule->node);
+	}
+	return 0;
+}
+
+/**
+ * Hands the mails of the given folder that are not yet covered by the text
+ * index over to the text index thread. They are not indexed here as this
+ * would delay the search, instead they are checked directly this time.
+ *
+ * @param f the folder
+ * @param ti the text index of the folder
+ * @return 0 if the search was aborted, else 1.
+ */
+static int folder_search_catch_up_text_index(struct folder *f, struct folder_text_index *ti)
+{
+	int i;
+
+	for (i=0;i<f->num_mails;i++)
+	{
+		struct mail_info *m;
+
+		if (!(m = f->mail_info_array[i]))
+			break;
+
+		if (!folder_text_index_has_mail(ti,m))
+			folder_text_index_thread_add_mail(f,m);
+
+		if (thread_aborted()) return 0;
+	}
+	return 1;
+}
+
 /**
  * Initial parameters for the search thread.
  */
@@ -59,6 +108,7 @@ struct search_msg
 	int f_array_len;
 	struct folder **f_array;
 	struct search_options *sopt;
+	int use_text_index;
 };
 
 /**
@@ -72,6 +122,7 @@ static void folder_start_search_entry(struct search_msg *msg)
 	int f_array_len;
 	struct filter *filter = NULL;
 	struct search_options *sopt;
+	int text_index_enabled;
 #define NUM_FOUND 100
 	struct mail_info *found_array[NUM_FOUND];
 
@@ -80,6 +131,7 @@ static void folder_start_search_entry(struct search_msg *msg)
 
 	sopt = search_options_duplicate(msg->sopt);
 	f_array_len = msg->f_array_len;
+	text_index_enabled = msg->use_text_index;
 	if ((f_array = (struct folder**)malloc((f_array_len+1)*sizeof(struct folder*))))
 	{
 		int i;
@@ -103,25 +155,43 @@ static void folder_start_search_entry(struct search_msg *msg)
 		{
 			int folder_num = 0;
 			int found_num = 0;
+			int use_text_index;
 			struct mail_info *m;
 			struct folder *f;
+			struct folder_text_index *ti = NULL;
+			struct folder_text_index_candidates cand;
+			int have_cand = 0;
 			char path[512];
 
 			getcwd(path, sizeof(path));
 
 			thread_call_parent_function_sync(NULL,search_enable_search, 0);
 
+			/* Body searches are expensive, so use the text index to rule out
+			 * most of the mails without reading them */
+			use_text_index = text_index_enabled && folder_search_filter_has_body_rule(filter);
+
 			while ((f = f_array[folder_num++]))
 			{
 				int i;
 
 				if (chdir(f->path) == -1) break;
 
+				if (use_text_index && (ti = folder_text_index_thread_acquire(f->path)))
+				{
+					if (!folder_search_catch_up_text_index(f,ti))
+						goto cancel;
+					have_cand = folder_text_index_get_candidates(ti,filter,&cand);
+				}
+
 				for (i=0;i<f->num_mails;i++)
 				{
 					if (!(m = f->mail_info_array[i]))
 						break;
 
+					if (have_cand && !folder_text_index_may_match(ti,&cand,m))
+						continue;
+
 					/* mail_matches_filter() is thread safe as long as no header search is used, like here */
 					if (mail_matches_filter(f,m,filter))
 					{
@@ -139,8 +209,15 @@ static void folder_start_search_entry(struct search_msg *msg)
 
 					if (thread_aborted()) goto cancel;
 				}
+
+				if (have_cand) folder_text_index_candidates_free(&cand);
+				have_cand = 0;
+				folder_text_index_thread_release(ti);
+				ti = NULL;
 			}
 cancel:
+			if (have_cand) folder_text_index_candidates_free(&cand);
+			folder_text_index_thread_release(ti);
 			chdir(path);
 
 			if (found_num)
@@ -178,6 +255,10 @@ void folder_start_search(struct search_options *sopt)
 	if (search_thread)
 		return;
 
+	/* The text indices are shared with the text index thread */
+	if (user.config.text_index)
+		folder_text_index_thread_start();
+
 	if (sopt->folder)
 	{
 		start = folder_find_by_name(sopt->folder);
@@ -226,6 +307,7 @@ void folder_start_search(struct search_options *sopt)
 		msg.sopt = sopt;
 		msg.f_array = array;
 		msg.f_array_len = num;
+		msg.use_text_index = user.config.text_index;
 
 		search_thread = thread_add("SimpleMail - Search Thread",
 				THREAD_FUNCTION(&folder_start_search_entry),&msg);
@@ -0,0 +1,467 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_sort.c
+ *
+ * The mails are sorted in several stable passes, starting with the least
+ * significant criterion (the date) and ending with the primary one. Each
+ * pass computes the key of every mail once. Integer keys are sorted with an
+ * LSD radix sort. String keys are folded to lower case, so they can be
+ * compared with strcmp() by a merge sort.
+ */
+
+#include "folder_sort.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "codesets.h"
+#include "folder.h"
+#include "mail.h"
+#include "mail_support.h"
+
+/** The chunk size of the arena in which the folded strings are stored */
+#define FOLDER_SORT_ARENA_CHUNK_SIZE (64*1024)
+
+/** A mail together with its key for the current pass */
+struct folder_sort_item
+{
+	struct mail_info *mail;
+	const char *str;
+	unsigned int num;
+};
+
+/** The different kinds of keys */
+enum folder_sort_key_type
+{
+	FOLDER_SORT_KEY_NUM,
+	FOLDER_SORT_KEY_UTF8,
+	FOLDER_SORT_KEY_ASCII
+};
+
+/*****************************************************************************/
+
+/**
+ * Folds the given utf8 character to lower case.
+ *
+ * @param str the character, must not point to the terminating 0 byte.
+ * @param dest where the folded character is stored. Must be at least 6
+ *  bytes in size.
+ * @return the number of bytes of the character, which is the same for
+ *  the folded one.
+ */
+static int folder_sort_fold_char(const char *str, char *dest)
+{
+	unsigned char c = *str;
+	int len;
+
+	if (c < 0x80)
+	{
+		*dest = tolower(c);
+		return 1;
+	}
+
+	/* Longer sequences are illegal and truncated ones are taken as they are */
+	if (c >= 0xf8 || (len = utf8tolower(str, dest)) <= 0)
+	{
+		*dest = c;
+		return 1;
+	}
+	return len;
+}
+
+/*****************************************************************************/
+
+int folder_sort_collate(const char *str1, const char *str2)
+{
+	char buf1[8];
+	char buf2[8];
+	int len1 = 0, pos1 = 0;
+	int len2 = 0, pos2 = 0;
+
+	if (!str1) return str2?-1:0;
+	if (!str2) return 1;
+
+	while (1)
+	{
+		unsigned char c1, c2;
+
+		if (pos1 == len1)
+		{
+			pos1 = 0;
+			if (*str1)
+			{
+				len1 = folder_sort_fold_char(str1, buf1);
+				str1 += len1;
+			} else
+			{
+				len1 = 1;
+				buf1[0] = 0;
+			}
+		}
+
+		if (pos2 == len2)
+		{
+			pos2 = 0;
+			if (*str2)
+			{
+				len2 = folder_sort_fold_char(str2, buf2);
+				str2 += len2;
+			} else
+			{
+				len2 = 1;
+				buf2[0] = 0;
+			}
+		}
+
+		c1 = buf1[pos1++];
+		c2 = buf2[pos2++];
+		if (c1 != c2) return c1 - c2;
+		if (!c1) return 0;
+	}
+}
+
+/*****************************************************************************/
+
+/**
+ * Returns the folded version of the given string. The string is only copied
+ * if folding may change it.
+ *
+ * @param str the string to fold. May be NULL.
+ * @param type the kind of folding (FOLDER_SORT_KEY_UTF8 or FOLDER_SORT_KEY_ASCII).
+ * @param arena the arena in which copies are allocated.
+ * @param ok will be set to 0 on failure.
+ * @return the folded string.
+ */
+static const char *folder_sort_fold(const char *str, enum folder_sort_key_type type, struct arena *arena, int *ok)
+{
+	const unsigned char *src;
+	char *folded;
+	char *dest;
+	int len;
+
+	if (!str)
+		return NULL;
+
+	for (src = (const unsigned char *)str; *src; src++)
+	{
+		if (isupper(*src) || *src >= 0x80)
+			break;
+	}
+	if (!*src)
+		return str;
+
+	len = strlen(str);
+	if (!(folded = (char *)arena_alloc(arena, len + 1)))
+	{
+		*ok = 0;
+		return NULL;
+	}
+
+	memcpy(folded, str, src - (const unsigned char *)str);
+	dest = folded + (src - (const unsigned char *)str);
+	str = (const char *)src;
+
+	if (type == FOLDER_SORT_KEY_ASCII)
+	{
+		while (*str)
+			*dest++ = tolower((unsigned char)*str++);
+	} else
+	{
+		while (*str)
+		{
+			char buf[8];
+			int bytes = folder_sort_fold_char(str, buf);
+
+			memcpy(dest, buf, bytes);
+			dest += bytes;
+			str += bytes;
+		}
+	}
+	*dest = 0;
+	return folded;
+}
+
+/*****************************************************************************/
+
+/**
+ * Computes the keys of the given items with respect to the given sort mode.
+ *
+ * @param items the items.
+ * @param num_items the number of items.
+ * @param sort_mode the sort mode.
+ * @param folder_type the type of the folder.
+ * @param arena the arena in which folded strings are allocated.
+ * @param type_ptr where the kind of the keys is stored.
+ * @return 1 on success, 0 on failure.
+ */
+static int folder_sort_compute_keys(struct folder_sort_item *items, int num_items, int sort_mode, int folder_type, struct arena *arena, enum folder_sort_key_type *type_ptr)
+{
+	enum folder_sort_key_type type = FOLDER_SORT_KEY_NUM;
+	int reverse = !!(sort_mode & FOLDER_SORT_REVERSE);
+	int ok = 1;
+	int i;
+
+	for (i = 0; i < num_items && ok; i++)
+	{
+		struct mail_info *m = items[i].mail;
+		const char *str = NULL;
+
+		switch (sort_mode & FOLDER_SORT_MODEMASK)
+		{
+			case	FOLDER_SORT_STATUS:
+					/* New mails come first, the others are ordered by their status */
+					items[i].num = ((m->flags & MAIL_FLAGS_NEW)?0:0x10000) | (m->status & MAIL_STATUS_MASK);
+					break;
+
+			case	FOLDER_SORT_FROMTO:
+					type = FOLDER_SORT_KEY_UTF8;
+					str = (folder_type == FOLDER_TYPE_SEND)?mail_info_get_to(m):mail_info_get_from(m);
+					break;
+
+			case	FOLDER_SORT_SUBJECT:
+					type = FOLDER_SORT_KEY_UTF8;
+					str = mail_get_compare_subject(m->subject);
+					break;
+
+			case	FOLDER_SORT_REPLY:
+					type = FOLDER_SORT_KEY_UTF8;
+					str = m->reply_addr;
+					break;
+
+			case	FOLDER_SORT_DATE: items[i].num = m->seconds; break;
+			case	FOLDER_SORT_SIZE: items[i].num = m->size; break;
+			case	FOLDER_SORT_RECV: items[i].num = m->received; break;
+
+			case	FOLDER_SORT_FILENAME:
+					type = FOLDER_SORT_KEY_ASCII;
+					str = m->filename;
+					break;
+
+			case	FOLDER_SORT_POP3:
+					type = FOLDER_SORT_KEY_ASCII;
+					str = mail_get_pop3_server(m);
+					break;
+		}
+
+		if (type == FOLDER_SORT_KEY_NUM)
+		{
+			/* Reversing the key keeps the sort stable */
+			if (reverse) items[i].num = ~items[i].num;
+		} else
+		{
+			items[i].str = folder_sort_fold(str, type, arena, &ok);
+		}
+	}
+
+	*type_ptr = type;
+	return ok;
+}
+
+/*****************************************************************************/
+
+/**
+ * Sorts the items stably with respect to their integer keys.
+ *
+ * @param items_ptr points to the items. On return, it points to the
+ *  sorted items, which may be the former temporary buffer.
+ * @param tmp_ptr points to a temporary buffer that holds as many items.
+ *  On return, it points to the other buffer.
+ * @param num_items the number of items.
+ */
+static void folder_sort_radix(struct folder_sort_item **items_ptr, struct folder_sort_item **tmp_ptr, int num_items)
+{
+	struct folder_sort_item *src = *items_ptr;
+	struct folder_sort_item *dest = *tmp_ptr;
+	unsigned int count[256];
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8)
+	{
+		struct folder_sort_item *h;
+		unsigned int pos = 0;
+		int i;
+
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < num_items; i++)
+			count[(src[i].num >> shift) & 0xff]++;
+
+		/* Nothing to do if all keys share this digit */
+		if (count[(src[0].num >> shift) & 0xff] == (unsigned int)num_items)
+			continue;
+
+		for (i = 0; i < 256; i++)
+		{
+			unsigned int c = count[i];
+			count[i] = pos;
+			pos += c;
+		}
+
+		for (i = 0; i < num_items; i++)
+			dest[count[(src[i].num >> shift) & 0xff]++] = src[i];
+
+		h = src;
+		src = dest;
+		dest = h;
+	}
+
+	*items_ptr = src;
+	*tmp_ptr = dest;
+}
+
+/*****************************************************************************/
+
+/**
+ * Compares the string keys of two items.
+ *
+ * @param a
+ * @param b
+ * @param reverse negates the result
+ * @return > 0 if the key of a is larger than the one of b
+ */
+static int folder_sort_item_compare(const struct folder_sort_item *a, const struct folder_sort_item *b, int reverse)
+{
+	int rc;
+
+	if (!a->str) rc = b->str?-1:0;
+	else if (!b->str) rc = 1;
+	else rc = strcmp(a->str, b->str);
+	return reverse?-rc:rc;
+}
+
+/**
+ * Sorts the items stably with respect to their string keys.
+ *
+ * @param items_ptr points to the items. On return, it points to the
+ *  sorted items, which may be the former temporary buffer.
+ * @param tmp_ptr points to a temporary buffer that holds as many items.
+ *  On return, it points to the other buffer.
+ * @param num_items the number of items.
+ * @param reverse whether the items shall be sorted in descending order.
+ */
+static void folder_sort_merge(struct folder_sort_item **items_ptr, struct folder_sort_item **tmp_ptr, int num_items, int reverse)
+{
+	struct folder_sort_item *src = *items_ptr;
+	struct folder_sort_item *dest = *tmp_ptr;
+	int width;
+
+	for (width = 1; width < num_items; width *= 2)
+	{
+		struct folder_sort_item *h;
+		int left;
+
+		for (left = 0; left < num_items; left += 2 * width)
+		{
+			int mid = left + width;
+			int right = left + 2 * width;
+			int i, j, k;
+
+			if (mid > num_items) mid = num_items;
+			if (right > num_items) right = num_items;
+
+			i = left;
+			j = mid;
+			k = left;
+
+			while (i < mid && j < right)
+			{
+				/* Take from the left run on equality to keep the sort stable */
+				if (folder_sort_item_compare(&src[j], &src[i], reverse) < 0) dest[k++] = src[j++];
+				else dest[k++] = src[i++];
+			}
+			while (i < mid) dest[k++] = src[i++];
+			while (j < right) dest[k++] = src[j++];
+		}
+
+		h = src;
+		src = dest;
+		dest = h;
+	}
+
+	*items_ptr = src;
+	*tmp_ptr = dest;
+}
+
+/*****************************************************************************/
+
+/**
+ * @param sort_mode
+ * @return whether mails can be sorted with respect to the given sort mode.
+ */
+static int folder_sort_mode_has_key(int sort_mode)
+{
+	return (sort_mode & FOLDER_SORT_MODEMASK) <= FOLDER_SORT_RECV;
+}
+
+/*****************************************************************************/
+
+int folder_sort_mail_array(struct mail_info **mails, int num_mails, int primary_sort, int secondary_sort, int folder_type)
+{
+	struct folder_sort_item *items = NULL;
+	struct folder_sort_item *tmp = NULL;
+	struct arena *arena = NULL;
+	int passes[3];
+	int num_passes = 0;
+	int rc = 0;
+	int i;
+
+	if (num_mails < 2 || !folder_sort_mode_has_key(primary_sort))
+		return 1;
+
+	/* The passes, from the least to the most significant one */
+	if ((primary_sort & FOLDER_SORT_MODEMASK) != FOLDER_SORT_DATE && (secondary_sort & FOLDER_SORT_MODEMASK) != FOLDER_SORT_DATE)
+		passes[num_passes++] = FOLDER_SORT_DATE;
+	if (folder_sort_mode_has_key(secondary_sort) && (secondary_sort & FOLDER_SORT_MODEMASK) != (primary_sort & FOLDER_SORT_MODEMASK))
+		passes[num_passes++] = secondary_sort;
+	passes[num_passes++] = primary_sort;
+
+	if (!(items = (struct folder_sort_item *)malloc(2 * num_mails * sizeof(*items))))
+		goto out;
+	tmp = items + num_mails;
+
+	if (!(arena = arena_create(FOLDER_SORT_ARENA_CHUNK_SIZE)))
+		goto out;
+
+	for (i = 0; i < num_mails; i++)
+		items[i].mail = mails[i];
+
+	for (i = 0; i < num_passes; i++)
+	{
+		enum folder_sort_key_type type;
+
+		if (!folder_sort_compute_keys(items, num_mails, passes[i], folder_type, arena, &type))
+			goto out;
+
+		if (type == FOLDER_SORT_KEY_NUM) folder_sort_radix(&items, &tmp, num_mails);
+		else folder_sort_merge(&items, &tmp, num_mails, !!(passes[i] & FOLDER_SORT_REVERSE));
+	}
+
+	for (i = 0; i < num_mails; i++)
+		mails[i] = items[i].mail;
+
+	rc = 1;
+out:
+	/* Both buffers belong to the same allocation */
+	if (items && tmp < items) items = tmp;
+	free(items);
+	arena_unref(arena);
+	return rc;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_sort.h
+ *
+ * Sorting of mail arrays according to the sort modes of a folder. The sort
+ * keys of the mails are computed once per sort, integer keys are sorted with
+ * a radix sort and string keys with a merge sort.
+ */
+
+#ifndef SM__FOLDER_SORT_H
+#define SM__FOLDER_SORT_H
+
+struct mail_info;
+
+/**
+ * Compares two strings case insensitively. The order is the same in which
+ * the string keys are sorted by folder_sort_mail_array().
+ *
+ * @param str1 the first utf8 string. May be NULL.
+ * @param str2 the second utf8 string. May be NULL.
+ * @return < 0 if str1 is smaller than str2, 0 if they are equal and > 0
+ *  otherwise. NULL is smaller than any string.
+ */
+int folder_sort_collate(const char *str1, const char *str2);
+
+/**
+ * Sorts the given mails with respect to the given sort modes. Mails that are
+ * equal with respect to both modes are ordered by their date. The order is
+ * the same as if the mails were compared one after another with the
+ * corresponding compare functions.
+ *
+ * @param mails the mails to be sorted.
+ * @param num_mails the number of mails.
+ * @param primary_sort the primary sort mode (FOLDER_SORT_xxx). Nothing is
+ *  sorted if it is FOLDER_SORT_THREAD.
+ * @param secondary_sort the secondary sort mode (FOLDER_SORT_xxx).
+ * @param folder_type the type of the folder to which the mails belong.
+ * @return 1 on success, 0 if there was not enough memory, in which case the
+ *  array is left unchanged.
+ */
+int folder_sort_mail_array(struct mail_info **mails, int num_mails, int primary_sort, int secondary_sort, int folder_type);
+
+#endif
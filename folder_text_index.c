@@ -0,0 +1,496 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_text_index.c
+ *
+ * The full-text index of a folder. It contains the body texts of the mails
+ * in the same form as they are matched by mail_matches_filter(), but with
+ * all ASCII letters in lower case. The index is used as a prefilter only,
+ * i.e., it may report mails that do not match but it never drops a mail
+ * that does.
+ *
+ * Mails are identified by their filename without the status suffix, their
+ * size and their receive time. The association to the document ids of the
+ * index is kept in a hash table that is stored next to the index.
+ */
+
+#include "folder_text_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "filter.h"
+#include "hash.h"
+#include "index.h"
+#include "index_trigram.h"
+#include "lists.h"
+#include "mail.h"
+#include "support_indep.h"
+
+#include "support.h"
+
+/** Characters that have a special meaning in patterns */
+#define FOLDER_TEXT_INDEX_PATTERN_CHARS "#?()|~[]%'*"
+
+struct folder_text_index
+{
+	/** The underlying string index */
+	struct index *index;
+
+	/** Maps the mail keys to document ids. The data field holds the next free id */
+	struct hash_table map;
+
+	/** The name of the map file, referenced by map */
+	char *map_filename;
+};
+
+/*****************************************************************************/
+
+/**
+ * Returns the key of the given mail that is used in the map.
+ *
+ * @param m the mail
+ * @param buf the buffer to which the key is written.
+ * @param buf_size the size of the buffer.
+ * @return buf or NULL on failure.
+ */
+static char *folder_text_index_mail_key(struct mail_info *m, char *buf, int buf_size)
+{
+	char *stem;
+
+	if (!m->filename)
+		return NULL;
+
+	/* The status suffix changes during the life time of a mail */
+	if (!(stem = mail_get_status_filename(sm_file_part(m->filename), -1)))
+		return NULL;
+
+	sm_snprintf(buf, buf_size, "%s:%u:%u", stem, m->size, m->received);
+	free(stem);
+	return buf;
+}
+
+/*****************************************************************************/
+
+/**
+ * Removes the given file if it exists.
+ *
+ * @param base
+ * @param suffix
+ */
+static void folder_text_index_remove_file(const char *base, const char *suffix)
+{
+	char buf[380];
+
+	sm_snprintf(buf, sizeof(buf), "%s%s", base, suffix);
+	remove(buf);
+}
+
+/*****************************************************************************/
+
+/**
+ * Returns whether the given file exists.
+ *
+ * @param base
+ * @param suffix
+ * @return
+ */
+static int folder_text_index_file_exists(const char *base, const char *suffix)
+{
+	char buf[380];
+	FILE *fh;
+
+	sm_snprintf(buf, sizeof(buf), "%s%s", base, suffix);
+	if (!(fh = fopen(buf, "rb")))
+		return 0;
+	fclose(fh);
+	return 1;
+}
+
+/*****************************************************************************/
+
+struct folder_text_index *folder_text_index_open(const char *folder_path)
+{
+	struct folder_text_index *ti;
+	char base[380];
+	int have_map;
+
+	if (!(ti = (struct folder_text_index*)malloc(sizeof(*ti))))
+		return NULL;
+	memset(ti, 0, sizeof(*ti));
+
+	sm_snprintf(base, sizeof(base), "%s.textindex", folder_path);
+
+	if (!(ti->map_filename = (char*)malloc(strlen(base) + 5)))
+		goto bailout;
+	sprintf(ti->map_filename, "%s.map", base);
+
+	/* The map is written when the index is closed. If it is missing, the
+	 * index has not been closed properly and is not trusted anymore */
+	have_map = folder_text_index_file_exists(base, ".map");
+	if (!have_map || !folder_text_index_file_exists(base, ".documents"))
+	{
+		folder_text_index_remove_file(base, ".trigrams");
+		folder_text_index_remove_file(base, ".documents");
+		have_map = 0;
+	}
+
+	if (!hash_table_init(&ti->map, 10, have_map?ti->map_filename:NULL))
+		goto bailout;
+	ti->map.filename = ti->map_filename;
+	remove(ti->map_filename);
+
+	/* Document ids start with 1 */
+	if (!ti->map.data)
+		ti->map.data = 1;
+
+	if (!(ti->index = index_create(&index_trigram, base)))
+		goto bailout;
+
+	return ti;
+
+bailout:
+	SM_DEBUGF(5, ("Failed to open text index for \"%s\"\n", folder_path));
+	if (ti->map.table) hash_table_clean(&ti->map);
+	free(ti->map_filename);
+	free(ti);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+void folder_text_index_close(struct folder_text_index *ti)
+{
+	if (!ti) return;
+
+	index_dispose(ti->index);
+
+	/* Store the map only after the index has been written */
+	hash_table_store(&ti->map);
+	hash_table_clean(&ti->map);
+	free(ti->map_filename);
+	free(ti);
+}
+
+/*****************************************************************************/
+
+void folder_text_index_remove_files(const char *folder_path)
+{
+	char base[380];
+
+	sm_snprintf(base, sizeof(base), "%s.textindex", folder_path);
+	folder_text_index_remove_file(base, ".map");
+	folder_text_index_remove_file(base, ".trigrams");
+	folder_text_index_remove_file(base, ".documents");
+}
+
+/*****************************************************************************/
+
+int folder_text_index_has_mail(struct folder_text_index *ti, struct mail_info *m)
+{
+	struct hash_entry *entry;
+	char key[300];
+
+	if (!folder_text_index_mail_key(m, key, sizeof(key)))
+		return 0;
+
+	if (!(entry = hash_table_lookup(&ti->map, key)))
+		return 0;
+	return entry->data != 0;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_put_mail_text(struct folder_text_index *ti, struct mail_info *m, const char *text, int text_len)
+{
+	struct hash_entry *entry;
+	char key[300];
+	char *normalized;
+	unsigned int did;
+	int rc = 0;
+	int i;
+
+	if (!folder_text_index_mail_key(m, key, sizeof(key)))
+		return 0;
+
+	if ((entry = hash_table_lookup(&ti->map, key)) && entry->data)
+		return 1;
+
+	if (!(normalized = (char*)malloc(text_len + 1)))
+		return 0;
+
+	/* Fold case like the pattern matching does for ASCII. Null bytes cannot
+	 * be part of a pattern so they can be replaced as well */
+	for (i = 0; i < text_len; i++)
+	{
+		unsigned char c = text[i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		else if (!c) c = ' ';
+		normalized[i] = c;
+	}
+	normalized[text_len] = 0;
+
+	did = ti->map.data;
+	if (!index_put_document(ti->index, did, normalized))
+		goto out;
+
+	if (!entry)
+	{
+		char *key_copy;
+
+		if (!(key_copy = mystrdup(key)))
+		{
+			index_remove_document(ti->index, did);
+			goto out;
+		}
+
+		if (!(entry = hash_table_insert(&ti->map, key_copy, did)))
+		{
+			free(key_copy);
+			index_remove_document(ti->index, did);
+			goto out;
+		}
+	} else
+	{
+		entry->data = did;
+	}
+	ti->map.data++;
+	rc = 1;
+out:
+	free(normalized);
+	return rc;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_remove_mail(struct folder_text_index *ti, struct mail_info *m)
+{
+	struct hash_entry *entry;
+	char key[300];
+
+	if (!folder_text_index_mail_key(m, key, sizeof(key)))
+		return 0;
+
+	if (!(entry = hash_table_lookup(&ti->map, key)) || !entry->data)
+		return 1;
+
+	if (!index_remove_document(ti->index, entry->data))
+		return 0;
+
+	/* The hash table doesn't support removing, so the entry is kept */
+	entry->data = 0;
+
+	/* Get rid of the texts and postings of removed mails from time to time */
+	if (index_trigram_needs_purge(ti->index))
+	{
+		if (!index_trigram_purge(ti->index))
+			SM_DEBUGF(5, ("Failed to purge the text index\n"));
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_put_mail(struct folder_text_index *ti, const char *folder_path, struct mail_info *m)
+{
+	struct mail_complete *mc;
+	int rc = 0;
+
+	if (!(mc = mail_complete_create(NULL)))
+		return 0;
+	mc->info = m;
+
+	if (mail_read_header_list_if_empty(mc))
+	{
+		struct mail_complete *text_part;
+
+		mail_process_headers(mc);
+		mail_read_contents(folder_path, mc);
+
+		if ((text_part = mail_find_content_type(mc, "text", "plain")))
+		{
+			void *decoded_data;
+			int decoded_data_len;
+
+			mail_decoded_data(text_part, &decoded_data, &decoded_data_len);
+			rc = folder_text_index_put_mail_text(ti, m, (char*)decoded_data, decoded_data_len);
+		} else
+		{
+			/* Mails without a text part never match a body rule */
+			rc = folder_text_index_put_mail_text(ti, m, "", 0);
+		}
+	}
+
+	mc->info = NULL; /* don't free the mail_info! */
+	mail_complete_free(mc);
+	return rc;
+}
+
+/*****************************************************************************/
+
+/**
+ * Marks the document whose id is given.
+ *
+ * @param did
+ * @param userdata the candidates.
+ * @return
+ */
+static int folder_text_index_candidates_callback(int did, void *userdata)
+{
+	struct folder_text_index_candidates *hits = (struct folder_text_index_candidates*)userdata;
+
+	if (did >= 0 && did < hits->num_dids)
+		hits->dids[did] = 1;
+	return 0;
+}
+
+/**
+ * Narrows the candidates to the documents that contain all literal parts of
+ * the given pattern. The literal parts are the runs of ASCII characters as
+ * they are the same in all charsets that the body could be encoded with.
+ *
+ * @param ti the index
+ * @param pattern the pattern of the rule
+ * @param flags the flags of the rule
+ * @param cand the candidates
+ * @param hits temporary candidates of the same size
+ * @return 1 if candidates were narrowed, 0 if the pattern could not be used.
+ */
+static int folder_text_index_narrow_candidates(struct folder_text_index *ti, const char *pattern, int flags,
+		struct folder_text_index_candidates *cand, struct folder_text_index_candidates *hits)
+{
+	char *fragment;
+	int narrowed = 0;
+	int len;
+	int i;
+
+	/* Real patterns could be handled, but they are rarely used for searching */
+	if (!(flags & SM_PATTERN_NOPATT) && strpbrk(pattern, FOLDER_TEXT_INDEX_PATTERN_CHARS))
+		return 0;
+
+	len = strlen(pattern);
+	if (!(fragment = (char*)malloc(len + 1)))
+		return 0;
+
+	while (*pattern)
+	{
+		unsigned int j;
+
+		for (i = 0; pattern[i] && !(pattern[i] & 0x80); i++)
+		{
+			char c = pattern[i];
+			if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+			fragment[i] = c;
+		}
+		fragment[i] = 0;
+
+		if (i)
+		{
+			memset(hits->dids, 0, hits->num_dids);
+			index_find_documents(ti->index, folder_text_index_candidates_callback, hits, 1, fragment);
+
+			for (j = 0; j < cand->num_dids; j++)
+				cand->dids[j] &= hits->dids[j];
+			narrowed = 1;
+		}
+
+		/* Skip the non-ASCII characters */
+		pattern += i;
+		while (*pattern & 0x80)
+			pattern++;
+	}
+
+	free(fragment);
+	return narrowed;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_get_candidates(struct folder_text_index *ti, struct filter *filter, struct folder_text_index_candidates *cand)
+{
+	struct folder_text_index_candidates hits;
+	struct filter_rule *rule;
+	int narrowed = 0;
+
+	/* The body rules are necessary conditions only if all rules need to match
+	 * or if there is no other rule */
+	if (filter->mode && list_length(&filter->rules_list) != 1)
+		return 0;
+
+	cand->num_dids = hits.num_dids = ti->map.data;
+	cand->dids = (unsigned char*)malloc(cand->num_dids);
+	hits.dids = (unsigned char*)malloc(hits.num_dids);
+	if (!cand->dids || !hits.dids)
+		goto bailout;
+	memset(cand->dids, 1, cand->num_dids);
+
+	rule = (struct filter_rule*)list_first(&filter->rules_list);
+	while (rule)
+	{
+		if (rule->type == RULE_BODY_MATCH && rule->u.body.body)
+		{
+			if (folder_text_index_narrow_candidates(ti, rule->u.body.body, rule->flags, cand, &hits))
+				narrowed = 1;
+		}
+		rule = (struct filter_rule*)node_next(&rule->node);
+	}
+
+	if (!narrowed)
+		goto bailout;
+
+	free(hits.dids);
+	return 1;
+
+bailout:
+	free(hits.dids);
+	free(cand->dids);
+	cand->dids = NULL;
+	cand->num_dids = 0;
+	return 0;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_may_match(struct folder_text_index *ti, struct folder_text_index_candidates *cand, struct mail_info *m)
+{
+	struct hash_entry *entry;
+	char key[300];
+
+	if (!folder_text_index_mail_key(m, key, sizeof(key)))
+		return 1;
+
+	if (!(entry = hash_table_lookup(&ti->map, key)) || !entry->data)
+		return 1;
+
+	if (entry->data >= cand->num_dids)
+		return 1;
+
+	return cand->dids[entry->data];
+}
+
+/*****************************************************************************/
+
+void folder_text_index_candidates_free(struct folder_text_index_candidates *cand)
+{
+	free(cand->dids);
+	cand->dids = NULL;
+	cand->num_dids = 0;
+}
@@ -0,0 +1,140 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_text_index.h
+ */
+
+#ifndef SM__FOLDER_TEXT_INDEX_H
+#define SM__FOLDER_TEXT_INDEX_H
+
+struct filter;
+struct mail_info;
+struct folder_text_index;
+
+/**
+ * The result of a prefilter query. Mails that are not described by the
+ * candidates must not be checked any further as they cannot match.
+ */
+struct folder_text_index_candidates
+{
+	/** Non-zero for each document id that may match */
+	unsigned char *dids;
+
+	/** Number of entries in dids */
+	unsigned int num_dids;
+};
+
+/**
+ * Opens the full-text index of the folder with the given path. The index
+ * is created if it doesn't exist yet.
+ *
+ * @param folder_path the path of the folder.
+ * @return the index or NULL on failure.
+ */
+struct folder_text_index *folder_text_index_open(const char *folder_path);
+
+/**
+ * Closes the given full-text index and stores it on disk.
+ *
+ * @param ti the index to close. May be NULL.
+ */
+void folder_text_index_close(struct folder_text_index *ti);
+
+/**
+ * Removes the files of the full-text index of the folder with the given
+ * path. The index must not be open.
+ *
+ * @param folder_path the path of the folder.
+ */
+void folder_text_index_remove_files(const char *folder_path);
+
+/**
+ * Determines whether the given mail has been indexed already.
+ *
+ * @param ti the index.
+ * @param m the mail.
+ * @return 1 if the mail has been indexed, else 0.
+ */
+int folder_text_index_has_mail(struct folder_text_index *ti, struct mail_info *m);
+
+/**
+ * Puts the given text as the contents of the given mail into the index.
+ *
+ * @param ti the index.
+ * @param m the mail.
+ * @param text the text to be indexed. Need not to be null-terminated.
+ * @param text_len the length of the text.
+ * @return 1 on success, else 0.
+ */
+int folder_text_index_put_mail_text(struct folder_text_index *ti, struct mail_info *m, const char *text, int text_len);
+
+/**
+ * Removes the given mail from the index.
+ *
+ * @param ti the index.
+ * @param m the mail.
+ * @return 1 on success (also if the mail was not indexed), else 0.
+ */
+int folder_text_index_remove_mail(struct folder_text_index *ti, struct mail_info *m);
+
+/**
+ * Reads the body of the given mail like mail_matches_filter() does and puts
+ * it into the index. The filename of the mail is taken relative to the
+ * current directory.
+ *
+ * @param ti the index.
+ * @param folder_path the path of the folder of the mail. May be NULL if
+ *  the filename of the mail is a full path.
+ * @param m the mail.
+ * @return 1 on success, else 0.
+ */
+int folder_text_index_put_mail(struct folder_text_index *ti, const char *folder_path, struct mail_info *m);
+
+/**
+ * Determines the candidates of the indexed mails that may match the given
+ * filter. Only the body rules of the filter are considered.
+ *
+ * @param ti the index.
+ * @param filter the filter.
+ * @param cand the candidates that are filled on success. Needs to be freed
+ *  with folder_text_index_candidates_free() in that case.
+ * @return 1 if the index could be used for the filter, 0 if not and all
+ *  mails need to be checked.
+ */
+int folder_text_index_get_candidates(struct folder_text_index *ti, struct filter *filter, struct folder_text_index_candidates *cand);
+
+/**
+ * Determines whether the given mail may match the filter for which the
+ * candidates were determined. This is the case for all unindexed mails.
+ *
+ * @param ti the index.
+ * @param cand the candidates as obtained by folder_text_index_get_candidates().
+ * @param m the mail to check.
+ * @return 1 if the mail may match, 0 if it surely doesn't.
+ */
+int folder_text_index_may_match(struct folder_text_index *ti, struct folder_text_index_candidates *cand, struct mail_info *m);
+
+/**
+ * Frees the resources associated with the given candidates.
+ *
+ * @param cand the candidates to free.
+ */
+void folder_text_index_candidates_free(struct folder_text_index_candidates *cand);
+
+#endif
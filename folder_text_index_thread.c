@@ -0,0 +1,551 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_text_index_thread.c
+ *
+ * Keeps the text indices of the folders in sync with the folder contents.
+ * Changes of the folders are recorded in a bounded queue on the context of
+ * the main task and applied in batches on the context of a separate thread.
+ * If the queue is full, further changes are dropped. This is fine as the
+ * text index is a prefilter only: mails that are not indexed are always
+ * considered as candidates and get indexed on the next search, and stale
+ * entries of removed mails are never reported as these mails are not part
+ * of the folder anymore.
+ *
+ * The text indices are kept open as long as possible and are shared with the
+ * search thread. Only one thread at a time has access to them.
+ */
+
+#include "folder_text_index_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "configuration.h"
+#include "debug.h"
+#include "folder.h"
+#include "folder_text_index.h"
+#include "lists.h"
+#include "mail.h"
+#include "support_indep.h"
+
+#include "subthreads.h"
+#include "support.h"
+
+/** Maximum number of pending changes */
+#define FOLDER_TEXT_INDEX_QUEUE_SIZE 1024
+
+/** Maximum number of text indices that are kept open */
+#define FOLDER_TEXT_INDEX_MAX_OPEN 8
+
+/**
+ * A pending change of a text index.
+ */
+struct text_index_job
+{
+	char *folder_path;
+	char *filename;
+	char *stem; /* filename without the status suffix */
+	unsigned int size;
+	unsigned int received;
+	unsigned int seq; /* the order in which the jobs were queued */
+	int remove;
+	int remove_folder; /* the whole index is removed, filename and stem are NULL */
+};
+
+/**
+ * An open text index.
+ */
+struct open_text_index
+{
+	struct node node;
+	char *folder_path;
+	struct folder_text_index *ti;
+};
+
+/** The thread that applies the changes */
+static thread_t text_index_thread;
+
+/** The ring buffer of the pending changes, protected by queue_semaphore */
+static struct text_index_job text_index_queue[FOLDER_TEXT_INDEX_QUEUE_SIZE];
+static int text_index_queue_first;
+static int text_index_queue_num;
+static unsigned int text_index_queue_seq;
+static unsigned int text_index_queue_dropped;
+static semaphore_t queue_semaphore;
+
+/** The open text indices, most recently used first, protected by index_semaphore */
+static struct list open_text_index_list;
+static semaphore_t index_semaphore;
+
+/*****************************************************************************/
+
+/**
+ * Frees the resources of the given job.
+ *
+ * @param job
+ */
+static void text_index_job_free(struct text_index_job *job)
+{
+	free(job->folder_path);
+	free(job->filename);
+	free(job->stem);
+}
+
+/**
+ * Compares two jobs such that all jobs of a folder and of a mail are
+ * consecutive and ordered by their sequence number.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int text_index_job_compare(const void *a, const void *b)
+{
+	const struct text_index_job *ja = (const struct text_index_job*)a;
+	const struct text_index_job *jb = (const struct text_index_job*)b;
+	int rc;
+
+	if ((rc = strcmp(ja->folder_path, jb->folder_path))) return rc;
+	/* The removal of the index comes before any change of a mail */
+	if (ja->remove_folder != jb->remove_folder) return ja->remove_folder ? -1 : 1;
+	if (ja->remove_folder) return ja->seq < jb->seq ? -1 : (ja->seq > jb->seq);
+	if ((rc = strcmp(ja->stem, jb->stem))) return rc;
+	if (ja->size != jb->size) return ja->size < jb->size ? -1 : 1;
+	if (ja->received != jb->received) return ja->received < jb->received ? -1 : 1;
+	return ja->seq < jb->seq ? -1 : (ja->seq > jb->seq);
+}
+
+/**
+ * Returns whether both jobs refer to the same mail.
+ *
+ * @param ja
+ * @param jb
+ * @return
+ */
+static int text_index_job_same_mail(const struct text_index_job *ja, const struct text_index_job *jb)
+{
+	if (ja->remove_folder || jb->remove_folder) return 0;
+	return !strcmp(ja->folder_path, jb->folder_path) && !strcmp(ja->stem, jb->stem) &&
+		ja->size == jb->size && ja->received == jb->received;
+}
+
+/*****************************************************************************/
+
+struct folder_text_index *folder_text_index_thread_acquire(const char *folder_path)
+{
+	struct open_text_index *oti;
+
+	if (!index_semaphore)
+		return NULL;
+
+	thread_lock_semaphore(index_semaphore);
+
+	oti = (struct open_text_index*)list_first(&open_text_index_list);
+	while (oti)
+	{
+		if (!strcmp(oti->folder_path, folder_path))
+		{
+			node_remove(&oti->node);
+			list_insert(&open_text_index_list, &oti->node, NULL);
+			return oti->ti;
+		}
+		oti = (struct open_text_index*)node_next(&oti->node);
+	}
+
+	if (!(oti = (struct open_text_index*)malloc(sizeof(*oti))))
+		goto bailout;
+	if (!(oti->folder_path = mystrdup(folder_path)))
+	{
+		free(oti);
+		goto bailout;
+	}
+	if (!(oti->ti = folder_text_index_open(folder_path)))
+	{
+		free(oti->folder_path);
+		free(oti);
+		goto bailout;
+	}
+
+	list_insert(&open_text_index_list, &oti->node, NULL);
+
+	/* Close the least recently used index if there are too many */
+	if (list_length(&open_text_index_list) > FOLDER_TEXT_INDEX_MAX_OPEN)
+	{
+		struct open_text_index *lru = (struct open_text_index*)list_remove_tail(&open_text_index_list);
+		folder_text_index_close(lru->ti);
+		free(lru->folder_path);
+		free(lru);
+	}
+
+	return oti->ti;
+
+bailout:
+	thread_unlock_semaphore(index_semaphore);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+void folder_text_index_thread_release(struct folder_text_index *ti)
+{
+	if (!ti) return;
+	thread_unlock_semaphore(index_semaphore);
+}
+
+/*****************************************************************************/
+
+/**
+ * Closes the text index of the folder with the given path if it is open and
+ * removes its files.
+ *
+ * @param folder_path
+ */
+static void folder_text_index_thread_drop(const char *folder_path)
+{
+	struct open_text_index *oti;
+
+	if (index_semaphore)
+	{
+		thread_lock_semaphore(index_semaphore);
+
+		oti = (struct open_text_index*)list_first(&open_text_index_list);
+		while (oti)
+		{
+			if (!strcmp(oti->folder_path, folder_path))
+			{
+				node_remove(&oti->node);
+				folder_text_index_close(oti->ti);
+				free(oti->folder_path);
+				free(oti);
+				break;
+			}
+			oti = (struct open_text_index*)node_next(&oti->node);
+		}
+	}
+
+	folder_text_index_remove_files(folder_path);
+
+	if (index_semaphore)
+		thread_unlock_semaphore(index_semaphore);
+}
+
+/*****************************************************************************/
+
+/**
+ * Applies the given jobs, which are all for the same folder.
+ *
+ * @param jobs
+ * @param num_jobs
+ */
+static void folder_text_index_thread_apply(struct text_index_job *jobs, int num_jobs)
+{
+	struct folder_text_index *ti;
+	char path[512];
+	int i;
+
+	/* There is at most one removal of the index as it purges all older jobs */
+	if (jobs[0].remove_folder)
+	{
+		folder_text_index_thread_drop(jobs[0].folder_path);
+		jobs++;
+		if (!--num_jobs)
+			return;
+	}
+
+	if (!(ti = folder_text_index_thread_acquire(jobs[0].folder_path)))
+		return;
+
+	for (i = 0; i < num_jobs; i++)
+	{
+		struct mail_info m;
+
+		/* Only the last change of a mail matters */
+		if (i + 1 < num_jobs && text_index_job_same_mail(&jobs[i], &jobs[i+1]))
+			continue;
+
+		/* The current directory is shared by all threads so we use full paths */
+		mystrlcpy(path, jobs[i].folder_path, sizeof(path));
+		if (!sm_add_part(path, jobs[i].filename, sizeof(path)))
+			continue;
+
+		memset(&m, 0, sizeof(m));
+		m.filename = path;
+		m.size = jobs[i].size;
+		m.received = jobs[i].received;
+
+		if (jobs[i].remove) folder_text_index_remove_mail(ti, &m);
+		else folder_text_index_put_mail(ti, NULL, &m);
+
+		if (thread_aborted()) break;
+	}
+
+	folder_text_index_thread_release(ti);
+}
+
+/**
+ * Takes the pending jobs from the queue and applies them.
+ *
+ * @return whether there were any jobs.
+ */
+static int folder_text_index_thread_process(void)
+{
+	struct text_index_job *jobs;
+	int num_jobs;
+	int i, j;
+
+	thread_lock_semaphore(queue_semaphore);
+	num_jobs = text_index_queue_num;
+	if (num_jobs && (jobs = (struct text_index_job*)malloc(num_jobs * sizeof(jobs[0]))))
+	{
+		for (i = 0; i < num_jobs; i++)
+			jobs[i] = text_index_queue[(text_index_queue_first + i) % FOLDER_TEXT_INDEX_QUEUE_SIZE];
+		text_index_queue_first = (text_index_queue_first + num_jobs) % FOLDER_TEXT_INDEX_QUEUE_SIZE;
+		text_index_queue_num = 0;
+	} else
+	{
+		num_jobs = 0;
+	}
+	thread_unlock_semaphore(queue_semaphore);
+
+	if (!num_jobs)
+		return 0;
+
+	SM_DEBUGF(20, ("Applying %d text index changes\n", num_jobs));
+
+	/* Coalesce the changes by folder and mail */
+	qsort(jobs, num_jobs, sizeof(jobs[0]), text_index_job_compare);
+
+	for (i = 0; i < num_jobs; i = j)
+	{
+		for (j = i + 1; j < num_jobs; j++)
+		{
+			if (strcmp(jobs[i].folder_path, jobs[j].folder_path))
+				break;
+		}
+		if (!thread_aborted()) folder_text_index_thread_apply(&jobs[i], j - i);
+		else if (jobs[i].remove_folder) folder_text_index_thread_drop(jobs[i].folder_path);
+	}
+
+	for (i = 0; i < num_jobs; i++)
+		text_index_job_free(&jobs[i]);
+	free(jobs);
+	return 1;
+}
+
+/**
+ * Entry for the text index thread.
+ *
+ * @param user_data
+ * @return
+ */
+static int folder_text_index_thread_entry(void *user_data)
+{
+	thread_parent_task_can_contiue();
+	while (thread_wait(NULL,NULL,NULL,0))
+	{
+		while (!thread_aborted() && folder_text_index_thread_process());
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+int folder_text_index_thread_start(void)
+{
+	if (text_index_thread)
+		return 1;
+
+	if (!queue_semaphore)
+	{
+		if (!(queue_semaphore = thread_create_semaphore()))
+			return 0;
+	}
+
+	if (!index_semaphore)
+	{
+		if (!(index_semaphore = thread_create_semaphore()))
+			return 0;
+		list_init(&open_text_index_list);
+	}
+
+	if (!(text_index_thread = thread_add("SimpleMail - Text Indexer", folder_text_index_thread_entry, NULL)))
+		return 0;
+
+	return 1;
+}
+
+/*****************************************************************************/
+
+/**
+ * Queues a change for the text index of the given folder.
+ *
+ * @param f
+ * @param m
+ * @param remove
+ */
+static void folder_text_index_thread_queue(struct folder *f, struct mail_info *m, int remove)
+{
+	struct text_index_job job;
+
+	if (!user.config.text_index)
+		return;
+
+	if (!f->path || !m->filename || f->special == FOLDER_SPECIAL_GROUP)
+		return;
+
+	if (!folder_text_index_thread_start())
+		return;
+
+	memset(&job, 0, sizeof(job));
+	job.folder_path = mystrdup(f->path);
+	job.filename = mystrdup(m->filename);
+	job.stem = mail_get_status_filename(m->filename, -1);
+	job.size = m->size;
+	job.received = m->received;
+	job.remove = remove;
+
+	if (!job.folder_path || !job.filename || !job.stem)
+	{
+		text_index_job_free(&job);
+		return;
+	}
+
+	thread_lock_semaphore(queue_semaphore);
+	if (text_index_queue_num == FOLDER_TEXT_INDEX_QUEUE_SIZE)
+	{
+		text_index_queue_dropped++;
+		thread_unlock_semaphore(queue_semaphore);
+
+		SM_DEBUGF(10, ("Text index queue is full, dropped %u changes so far\n", text_index_queue_dropped));
+		text_index_job_free(&job);
+		return;
+	}
+	job.seq = text_index_queue_seq++;
+	text_index_queue[(text_index_queue_first + text_index_queue_num++) % FOLDER_TEXT_INDEX_QUEUE_SIZE] = job;
+	thread_unlock_semaphore(queue_semaphore);
+
+	thread_signal(text_index_thread);
+}
+
+/*****************************************************************************/
+
+void folder_text_index_thread_remove_folder(struct folder *f)
+{
+	struct text_index_job job;
+	int i, n;
+
+	if (!f->path || f->special == FOLDER_SPECIAL_GROUP)
+		return;
+
+	/* Without the thread the index is not open so we can remove it right away */
+	if (!text_index_thread)
+	{
+		folder_text_index_thread_drop(f->path);
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.remove_folder = 1;
+	if (!(job.folder_path = mystrdup(f->path)))
+	{
+		folder_text_index_thread_drop(f->path);
+		return;
+	}
+
+	thread_lock_semaphore(queue_semaphore);
+
+	/* Pending changes of the folder are obsolete now */
+	for (i = n = 0; i < text_index_queue_num; i++)
+	{
+		struct text_index_job *qjob = &text_index_queue[(text_index_queue_first + i) % FOLDER_TEXT_INDEX_QUEUE_SIZE];
+
+		if (!strcmp(qjob->folder_path, f->path))
+		{
+			text_index_job_free(qjob);
+			continue;
+		}
+		text_index_queue[(text_index_queue_first + n++) % FOLDER_TEXT_INDEX_QUEUE_SIZE] = *qjob;
+	}
+	text_index_queue_num = n;
+
+	if (text_index_queue_num == FOLDER_TEXT_INDEX_QUEUE_SIZE)
+	{
+		/* Unlike other changes this one must not be dropped */
+		thread_unlock_semaphore(queue_semaphore);
+		text_index_job_free(&job);
+		folder_text_index_thread_drop(f->path);
+		return;
+	}
+	job.seq = text_index_queue_seq++;
+	text_index_queue[(text_index_queue_first + text_index_queue_num++) % FOLDER_TEXT_INDEX_QUEUE_SIZE] = job;
+	thread_unlock_semaphore(queue_semaphore);
+
+	thread_signal(text_index_thread);
+}
+
+/*****************************************************************************/
+
+void folder_text_index_thread_add_mail(struct folder *f, struct mail_info *m)
+{
+	folder_text_index_thread_queue(f, m, 0);
+}
+
+/*****************************************************************************/
+
+void folder_text_index_thread_remove_mail(struct folder *f, struct mail_info *m)
+{
+	folder_text_index_thread_queue(f, m, 1);
+}
+
+/*****************************************************************************/
+
+void cleanup_folder_text_index_thread(void)
+{
+	struct open_text_index *oti;
+
+	text_index_thread = NULL;
+
+	if (queue_semaphore)
+	{
+		while (text_index_queue_num)
+		{
+			/* Indices of removed folders must not survive */
+			if (text_index_queue[text_index_queue_first].remove_folder)
+				folder_text_index_thread_drop(text_index_queue[text_index_queue_first].folder_path);
+			text_index_job_free(&text_index_queue[text_index_queue_first]);
+			text_index_queue_first = (text_index_queue_first + 1) % FOLDER_TEXT_INDEX_QUEUE_SIZE;
+			text_index_queue_num--;
+		}
+		thread_dispose_semaphore(queue_semaphore);
+		queue_semaphore = NULL;
+	}
+
+	if (index_semaphore)
+	{
+		while ((oti = (struct open_text_index*)list_remove_tail(&open_text_index_list)))
+		{
+			folder_text_index_close(oti->ti);
+			free(oti->folder_path);
+			free(oti);
+		}
+		thread_dispose_semaphore(index_semaphore);
+		index_semaphore = NULL;
+	}
+}
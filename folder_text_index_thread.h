@@ -0,0 +1,92 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file folder_text_index_thread.h
+ */
+
+#ifndef SM__FOLDER_TEXT_INDEX_THREAD_H
+#define SM__FOLDER_TEXT_INDEX_THREAD_H
+
+struct folder;
+struct folder_text_index;
+struct mail_info;
+
+/**
+ * Starts the text index thread if not already done. Must be called on the
+ * context of the main task.
+ *
+ * @return whether the thread is running.
+ */
+int folder_text_index_thread_start(void);
+
+/**
+ * Requests that the given mail, which has been added to the given folder,
+ * is put into the text index of the folder. Must be called on the context
+ * of the main task or of a task that has locked the folder, e.g., the search
+ * thread, which hands over the mails that are missing in the index.
+ *
+ * @param f the folder
+ * @param m the mail
+ */
+void folder_text_index_thread_add_mail(struct folder *f, struct mail_info *m);
+
+/**
+ * Requests that the given mail, which is going to be removed from the given
+ * folder, is removed from the text index of the folder. Must be called on the
+ * context of the main task.
+ *
+ * @param f the folder
+ * @param m the mail
+ */
+void folder_text_index_thread_remove_mail(struct folder *f, struct mail_info *m);
+
+/**
+ * Requests that the text index of the given folder is closed and its files
+ * are removed, e.g., because the folder has been deleted or emptied. Pending
+ * changes of the folder are discarded. Must be called on the context of the
+ * main task.
+ *
+ * @param f the folder
+ */
+void folder_text_index_thread_remove_folder(struct folder *f);
+
+/**
+ * Obtains exclusive access to the text index of the folder with the given
+ * path. folder_text_index_thread_start() must have been called before.
+ *
+ * @param folder_path the path of the folder.
+ * @return the text index, which must be given back with
+ *  folder_text_index_thread_release(), or NULL on failure.
+ */
+struct folder_text_index *folder_text_index_thread_acquire(const char *folder_path);
+
+/**
+ * Gives back the text index obtained by folder_text_index_thread_acquire().
+ *
+ * @param ti the text index. May be NULL.
+ */
+void folder_text_index_thread_release(struct folder_text_index *ti);
+
+/**
+ * Cleanup resources used by the text index thread. Must be called after
+ * the threads have been finished.
+ */
+void cleanup_folder_text_index_thread(void);
+
+#endif
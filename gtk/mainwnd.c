@@ -529,7 +529,7 @@ static void main_insert_mail_threaded(struct folder *folder, struct mail *mail,
 	struct mail *submail;
 	APTR newnode;
 
-	if ((submail = mail->sub_thread_mail))
+	if ((submail = folder_get_thread_first_child(folder, mail)))
 	{
 		mail_flags = TNF_LIST|TNF_OPEN;
 	}
@@ -540,7 +540,7 @@ static void main_insert_mail_threaded(struct folder *folder, struct mail *mail,
 	while (submail)
 	{
 		main_insert_mail_threaded(folder,submail,newnode);
-		submail = submail->next_thread_mail;
+		submail = folder_get_thread_next_sibling(folder, submail);
 	}
 #endif
 }
@@ -644,7 +644,7 @@ void main_set_folder_mails(struct folder *folder)
 
 			while ((m = folder_next_mail(folder,&handle)))
 			{
-				if (!m->child_mail)
+				if (!folder_get_thread_parent(folder, m))
 					main_insert_mail_threaded(folder,m,(void*)MUIV_NListtree_Insert_ListNode_Root);
 			}
 		}
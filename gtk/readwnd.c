@@ -312,7 +312,8 @@ static void insert_mail(struct Read_Data *data, struct mail *mail)
 
 	for (i=0;i<mail->num_multiparts;i++)
 	{
-		insert_mail(data,mail->multipart_array[i]);
+		struct mail *part = mail_get_part(mail,i);
+		if (part) insert_mail(data,part);
 	}
 }
 
@@ -513,7 +514,7 @@ static int read_window_display_mail(struct Read_Data *data, struct mail *m)
 		mail_read_contents(data->folder_path,data->mail);
 		mail_create_html_header(data->mail, 0);
 
-		if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && !data->mail->multipart_array[0]->num_multiparts))
+		if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && (!mail_get_part(data->mail,0) || !mail_get_part(data->mail,0)->num_multiparts)))
 		{
 			/* mail has only one part */
 			dont_show = 1;
@@ -542,7 +543,7 @@ static int read_window_display_mail(struct Read_Data *data, struct mail *m)
 			mail_read_contents(data->folder_path,data->mail);
 			mail_create_html_header(data->mail);
 
-			if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && !data->mail->multipart_array[0]->num_multiparts))
+			if (!data->mail->num_multiparts || (data->mail->num_multiparts == 1 && (!mail_get_part(data->mail,0) || !mail_get_part(data->mail,0)->num_multiparts)))
 			{
 				/* mail has only one part */
 				set(data->attachments_group, MUIA_ShowMe, FALSE);
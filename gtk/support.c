@@ -24,6 +24,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
@@ -179,6 +181,41 @@ int sm_file_is_in_drawer(const char *filename, const char *path)
 	return 0;
 }
 
+/******************************************************************
+ Maps the given file into memory
+*******************************************************************/
+void *sm_map_file(const char *filename, unsigned long *size_ptr)
+{
+	struct stat st;
+	void *mem;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	*size_ptr = st.st_size;
+	return mem;
+}
+
+/******************************************************************
+ Unmaps a file mapped by sm_map_file()
+*******************************************************************/
+void sm_unmap_file(void *mem, unsigned long size)
+{
+	munmap(mem, size);
+}
+
 /******************************************************************
  Like sprintf() but buffer overrun safe
 *******************************************************************/
@@ -135,6 +135,25 @@ int sm_system(char *command, char *output);
  */
 int sm_file_is_in_drawer(const char *filename, const char *path);
 
+/**
+ * Maps the contents of the given file into memory for reading. Platforms
+ * that don't support memory mapping may read the file into memory instead.
+ *
+ * @param filename the name of the file to map.
+ * @param size_ptr where the size of the mapped file is stored.
+ * @return the address of the mapped contents or NULL on failure, also if
+ *  the file is empty. Unmap via sm_unmap_file().
+ */
+void *sm_map_file(const char *filename, unsigned long *size_ptr);
+
+/**
+ * Unmaps a file that was mapped via sm_map_file().
+ *
+ * @param mem the address as returned by sm_map_file().
+ * @param size the size as returned by sm_map_file().
+ */
+void sm_unmap_file(void *mem, unsigned long size);
+
 /**
  * Checks whether the given paths represent the same resource.
  *
@@ -24,6 +24,7 @@
 #include "index.h"
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "index_private.h"
@@ -57,6 +58,23 @@ int index_put_document(struct index *index, int did, const char *text)
 
 /*****************************************************************************/
 
+int index_put_documents(struct index *index, int num_documents, const int *dids, const char * const *texts)
+{
+	int i;
+
+	if (index->alg->put_documents)
+		return index->alg->put_documents(index,num_documents,dids,texts);
+
+	for (i=0;i<num_documents;i++)
+	{
+		if (!index->alg->put_document(index,dids[i],texts[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
 int index_remove_document(struct index *index, int did)
 {
 	return index->alg->remove_document(index,did);
@@ -76,3 +94,534 @@ int index_find_documents(struct index *index, int (*callback)(int did, void *use
 
 	return rc;
 }
+
+/*****************************************************************************/
+
+enum index_query_type
+{
+	INDEX_QUERY_TERM,
+	INDEX_QUERY_AND,
+	INDEX_QUERY_OR,
+	INDEX_QUERY_NOT
+};
+
+struct index_query
+{
+	enum index_query_type type;
+
+	/** The string for INDEX_QUERY_TERM */
+	char *term;
+
+	/** The operands, right is NULL for INDEX_QUERY_NOT */
+	struct index_query *left;
+	struct index_query *right;
+};
+
+/**
+ * Allocates a new query of the given type with the given operands. The
+ * operands are freed on failure.
+ *
+ * @param type
+ * @param left
+ * @param right
+ * @return
+ */
+static struct index_query *index_query_create(enum index_query_type type, struct index_query *left, struct index_query *right)
+{
+	struct index_query *q;
+
+	if (!(q = (struct index_query*)malloc(sizeof(*q))))
+	{
+		index_query_free(left);
+		index_query_free(right);
+		return NULL;
+	}
+	memset(q, 0, sizeof(*q));
+	q->type = type;
+	q->left = left;
+	q->right = right;
+	return q;
+}
+
+/*****************************************************************************/
+
+struct index_query *index_query_term(const char *term)
+{
+	struct index_query *q;
+
+	if (!(q = index_query_create(INDEX_QUERY_TERM, NULL, NULL)))
+		return NULL;
+	if (!(q->term = strdup(term)))
+	{
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+/*****************************************************************************/
+
+struct index_query *index_query_phrase(int num_words, const char * const *words)
+{
+	struct index_query *q;
+	int len = 0;
+	int i;
+
+	for (i = 0; i < num_words; i++)
+		len += strlen(words[i]) + 1;
+
+	if (!(q = index_query_create(INDEX_QUERY_TERM, NULL, NULL)))
+		return NULL;
+	if (!(q->term = (char*)malloc(len + 1)))
+	{
+		free(q);
+		return NULL;
+	}
+	q->term[0] = 0;
+	for (i = 0; i < num_words; i++)
+	{
+		if (i) strcat(q->term, " ");
+		strcat(q->term, words[i]);
+	}
+	return q;
+}
+
+/*****************************************************************************/
+
+struct index_query *index_query_and(struct index_query *a, struct index_query *b)
+{
+	if (!a || !b)
+	{
+		index_query_free(a);
+		index_query_free(b);
+		return NULL;
+	}
+	return index_query_create(INDEX_QUERY_AND, a, b);
+}
+
+/*****************************************************************************/
+
+struct index_query *index_query_or(struct index_query *a, struct index_query *b)
+{
+	if (!a || !b)
+	{
+		index_query_free(a);
+		index_query_free(b);
+		return NULL;
+	}
+	return index_query_create(INDEX_QUERY_OR, a, b);
+}
+
+/*****************************************************************************/
+
+struct index_query *index_query_not(struct index_query *a)
+{
+	if (!a) return NULL;
+	return index_query_create(INDEX_QUERY_NOT, a, NULL);
+}
+
+/*****************************************************************************/
+
+void index_query_free(struct index_query *query)
+{
+	if (!query) return;
+	index_query_free(query->left);
+	index_query_free(query->right);
+	free(query->term);
+	free(query);
+}
+
+/*****************************************************************************/
+
+void index_cursor_init(struct index_cursor *cursor, int (*skip_to)(struct index_cursor *, int), void (*dispose)(struct index_cursor *))
+{
+	cursor->skip_to = skip_to;
+	cursor->dispose = dispose;
+	cursor->did = -1;
+	cursor->at_end = 0;
+}
+
+/*****************************************************************************/
+
+int index_cursor_skip_to(struct index_cursor *cursor, int did)
+{
+	if (cursor->at_end)
+		return -1;
+	if (cursor->did != -1 && cursor->did >= did)
+		return cursor->did;
+
+	if ((cursor->did = cursor->skip_to(cursor, did)) < 0)
+	{
+		cursor->did = -1;
+		cursor->at_end = 1;
+		return -1;
+	}
+	return cursor->did;
+}
+
+/*****************************************************************************/
+
+int index_cursor_next(struct index_cursor *cursor)
+{
+	return index_cursor_skip_to(cursor, cursor->did + 1);
+}
+
+/*****************************************************************************/
+
+void index_cursor_dispose(struct index_cursor *cursor)
+{
+	if (!cursor) return;
+	cursor->dispose(cursor);
+}
+
+/*****************************************************************************/
+
+/**
+ * A cursor over a sorted array of document ids. Used for algorithms that
+ * don't provide an own cursor for a single term.
+ */
+struct index_array_cursor
+{
+	struct index_cursor cursor;
+
+	int *dids;
+	int num_dids;
+	int allocated_dids;
+
+	/** Position of the next document to be considered */
+	int pos;
+};
+
+static int index_array_cursor_skip_to(struct index_cursor *cursor, int did)
+{
+	struct index_array_cursor *c = (struct index_array_cursor*)cursor;
+
+	while (c->pos < c->num_dids && c->dids[c->pos] < did)
+		c->pos++;
+	if (c->pos == c->num_dids)
+		return -1;
+	return c->dids[c->pos++];
+}
+
+static void index_array_cursor_dispose(struct index_cursor *cursor)
+{
+	struct index_array_cursor *c = (struct index_array_cursor*)cursor;
+
+	free(c->dids);
+	free(c);
+}
+
+static int index_array_cursor_callback(int did, void *userdata)
+{
+	struct index_array_cursor *c = (struct index_array_cursor*)userdata;
+
+	if (c->num_dids == c->allocated_dids)
+	{
+		int *dids;
+		int allocated_dids = c->allocated_dids * 2 + 16;
+
+		if (!(dids = (int*)realloc(c->dids, allocated_dids * sizeof(dids[0]))))
+		{
+			/* Remember the failure but don't abort the search */
+			c->pos = -1;
+			return 0;
+		}
+		c->dids = dids;
+		c->allocated_dids = allocated_dids;
+	}
+	c->dids[c->num_dids++] = did;
+	return 1;
+}
+
+static int index_array_cursor_compare(const void *a, const void *b)
+{
+	int da = *(const int*)a;
+	int db = *(const int*)b;
+
+	if (da < db) return -1;
+	if (da > db) return 1;
+	return 0;
+}
+
+/**
+ * Creates a cursor that iterates over the documents containing the given
+ * term by determining them all at once via find_documents().
+ *
+ * @param index
+ * @param term
+ * @return
+ */
+static struct index_cursor *index_array_cursor_create(struct index *index, const char *term)
+{
+	struct index_array_cursor *c;
+	int i, j;
+
+	if (!(c = (struct index_array_cursor*)malloc(sizeof(*c))))
+		return NULL;
+	memset(c, 0, sizeof(*c));
+	index_cursor_init(&c->cursor, index_array_cursor_skip_to, index_array_cursor_dispose);
+
+	index_find_documents(index, index_array_cursor_callback, c, 1, term);
+	if (c->pos < 0)
+		goto bailout;
+
+	/* The algorithms don't guarantee any order and may report a document more than once */
+	qsort(c->dids, c->num_dids, sizeof(c->dids[0]), index_array_cursor_compare);
+	for (i = 0, j = 0; i < c->num_dids; i++)
+	{
+		if (!j || c->dids[j-1] != c->dids[i])
+			c->dids[j++] = c->dids[i];
+	}
+	c->num_dids = j;
+	return &c->cursor;
+bailout:
+	index_array_cursor_dispose(&c->cursor);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+/**
+ * A cursor that represents the conjunction of several cursors. Documents
+ * that are contained in any of the excluded cursors are skipped.
+ */
+struct index_and_cursor
+{
+	struct index_cursor cursor;
+
+	struct index_cursor **children;
+	int num_children;
+
+	struct index_cursor **excluded;
+	int num_excluded;
+};
+
+static int index_and_cursor_skip_to(struct index_cursor *cursor, int did)
+{
+	struct index_and_cursor *c = (struct index_and_cursor*)cursor;
+	int i;
+
+	for (;;)
+	{
+		int agreed = 1;
+
+		/* Let the children leapfrog until they all agree on a document */
+		for (i = 0; i < c->num_children; i++)
+		{
+			int d = index_cursor_skip_to(c->children[i], did);
+			if (d < 0)
+				return -1;
+			if (d != did)
+			{
+				did = d;
+				agreed = 0;
+			}
+		}
+
+		if (!agreed)
+			continue;
+
+		for (i = 0; i < c->num_excluded; i++)
+		{
+			if (index_cursor_skip_to(c->excluded[i], did) == did)
+				break;
+		}
+
+		if (i == c->num_excluded)
+			return did;
+		did++;
+	}
+}
+
+static void index_and_cursor_dispose(struct index_cursor *cursor)
+{
+	struct index_and_cursor *c = (struct index_and_cursor*)cursor;
+	int i;
+
+	for (i = 0; i < c->num_children; i++)
+		index_cursor_dispose(c->children[i]);
+	for (i = 0; i < c->num_excluded; i++)
+		index_cursor_dispose(c->excluded[i]);
+	free(c->children);
+	free(c->excluded);
+	free(c);
+}
+
+/*****************************************************************************/
+
+/**
+ * A cursor that represents the disjunction of several cursors.
+ */
+struct index_or_cursor
+{
+	struct index_cursor cursor;
+
+	struct index_cursor **children;
+	int num_children;
+};
+
+static int index_or_cursor_skip_to(struct index_cursor *cursor, int did)
+{
+	struct index_or_cursor *c = (struct index_or_cursor*)cursor;
+	int min = -1;
+	int i;
+
+	for (i = 0; i < c->num_children; i++)
+	{
+		int d = index_cursor_skip_to(c->children[i], did);
+		if (d >= 0 && (min < 0 || d < min))
+			min = d;
+	}
+	return min;
+}
+
+static void index_or_cursor_dispose(struct index_cursor *cursor)
+{
+	struct index_or_cursor *c = (struct index_or_cursor*)cursor;
+	int i;
+
+	for (i = 0; i < c->num_children; i++)
+		index_cursor_dispose(c->children[i]);
+	free(c->children);
+	free(c);
+}
+
+/*****************************************************************************/
+
+/**
+ * Counts the operands of the given query when nested operations of the same
+ * type are flattened.
+ *
+ * @param query
+ * @param type
+ * @return
+ */
+static int index_query_count_operands(struct index_query *query, enum index_query_type type)
+{
+	if (query->type != type)
+		return 1;
+	return index_query_count_operands(query->left, type) + index_query_count_operands(query->right, type);
+}
+
+/**
+ * Collects the operands of the given query when nested operations of the
+ * same type are flattened.
+ *
+ * @param query
+ * @param type
+ * @param operands the array to which the operands are written.
+ * @param num_operands the number of operands that are already in the array.
+ * @return the new number of operands in the array.
+ */
+static int index_query_collect_operands(struct index_query *query, enum index_query_type type, struct index_query **operands, int num_operands)
+{
+	if (query->type != type)
+	{
+		operands[num_operands++] = query;
+		return num_operands;
+	}
+	num_operands = index_query_collect_operands(query->left, type, operands, num_operands);
+	return index_query_collect_operands(query->right, type, operands, num_operands);
+}
+
+struct index_cursor *index_query_cursor(struct index *index, struct index_query *query)
+{
+	struct index_query **operands = NULL;
+	int num_operands;
+	int i;
+
+	switch (query->type)
+	{
+		case	INDEX_QUERY_TERM:
+				if (index->alg->open_term)
+					return index->alg->open_term(index, query->term);
+				return index_array_cursor_create(index, query->term);
+
+		case	INDEX_QUERY_AND:
+				{
+					struct index_and_cursor *c;
+
+					num_operands = index_query_count_operands(query, INDEX_QUERY_AND);
+					if (!(operands = (struct index_query**)malloc(num_operands * sizeof(operands[0]))))
+						return NULL;
+					index_query_collect_operands(query, INDEX_QUERY_AND, operands, 0);
+
+					if (!(c = (struct index_and_cursor*)malloc(sizeof(*c))))
+						goto bailout;
+					memset(c, 0, sizeof(*c));
+					index_cursor_init(&c->cursor, index_and_cursor_skip_to, index_and_cursor_dispose);
+
+					if (!(c->children = (struct index_cursor**)malloc(num_operands * sizeof(c->children[0]))))
+						goto and_bailout;
+					if (!(c->excluded = (struct index_cursor**)malloc(num_operands * sizeof(c->excluded[0]))))
+						goto and_bailout;
+
+					for (i = 0; i < num_operands; i++)
+					{
+						struct index_cursor *child;
+
+						if (operands[i]->type == INDEX_QUERY_NOT)
+						{
+							if (!(child = index_query_cursor(index, operands[i]->left)))
+								goto and_bailout;
+							c->excluded[c->num_excluded++] = child;
+						} else
+						{
+							if (!(child = index_query_cursor(index, operands[i])))
+								goto and_bailout;
+							c->children[c->num_children++] = child;
+						}
+					}
+
+					/* A conjunction of negations only would be unbounded */
+					if (!c->num_children)
+						goto and_bailout;
+
+					free(operands);
+					return &c->cursor;
+and_bailout:
+					index_and_cursor_dispose(&c->cursor);
+					goto bailout;
+				}
+
+		case	INDEX_QUERY_OR:
+				{
+					struct index_or_cursor *c;
+
+					num_operands = index_query_count_operands(query, INDEX_QUERY_OR);
+					if (!(operands = (struct index_query**)malloc(num_operands * sizeof(operands[0]))))
+						return NULL;
+					index_query_collect_operands(query, INDEX_QUERY_OR, operands, 0);
+
+					if (!(c = (struct index_or_cursor*)malloc(sizeof(*c))))
+						goto bailout;
+					memset(c, 0, sizeof(*c));
+					index_cursor_init(&c->cursor, index_or_cursor_skip_to, index_or_cursor_dispose);
+
+					if (!(c->children = (struct index_cursor**)malloc(num_operands * sizeof(c->children[0]))))
+						goto or_bailout;
+
+					for (i = 0; i < num_operands; i++)
+					{
+						struct index_cursor *child;
+
+						if (!(child = index_query_cursor(index, operands[i])))
+							goto or_bailout;
+						c->children[c->num_children++] = child;
+					}
+
+					free(operands);
+					return &c->cursor;
+or_bailout:
+					index_or_cursor_dispose(&c->cursor);
+					goto bailout;
+				}
+
+		case	INDEX_QUERY_NOT:
+				/* Negations are only supported as operands of a conjunction */
+				return NULL;
+	}
+bailout:
+	free(operands);
+	return NULL;
+}
@@ -25,6 +25,8 @@
 
 struct index;
 struct index_algorithm;
+struct index_cursor;
+struct index_query;
 
 /**
  * Create an index using the given algorithm and persistence layer
@@ -55,6 +57,18 @@ void index_dispose(struct index *index);
  */
 int index_put_document(struct index *index, int did, const char *text);
 
+/**
+ * Put several documents into the index at once. Depending on the algorithm
+ * this is much faster than putting the documents one by one.
+ *
+ * @param index the index to which the documents are added
+ * @param num_documents the number of documents
+ * @param dids the ids of the documents
+ * @param texts the texts to be indexed
+ * @return success or not.
+ */
+int index_put_documents(struct index *index, int num_documents, const int *dids, const char * const *texts);
+
 /**
  * Remove the document from the index.
  *
@@ -76,4 +90,100 @@ int index_remove_document(struct index *index, int did);
  */
 int index_find_documents(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, ...);
 
+/**
+ * Create a query that matches all documents that contain the given string
+ * as exact substring.
+ *
+ * @param term the string
+ * @return the query or NULL on failure.
+ */
+struct index_query *index_query_term(const char *term);
+
+/**
+ * Create a query that matches all documents that contain the given words
+ * separated by single spaces.
+ *
+ * @param num_words number of words
+ * @param words the words
+ * @return the query or NULL on failure.
+ */
+struct index_query *index_query_phrase(int num_words, const char * const *words);
+
+/**
+ * Create a query that matches all documents that are matched by both of the
+ * given queries. The ownership of the queries is transferred to the new
+ * query, also on failure.
+ *
+ * @param a the first query. May be NULL, in which case NULL is returned.
+ * @param b the second query. May be NULL, in which case NULL is returned.
+ * @return the query or NULL on failure.
+ */
+struct index_query *index_query_and(struct index_query *a, struct index_query *b);
+
+/**
+ * Create a query that matches all documents that are matched by at least one
+ * of the given queries. The ownership of the queries is transferred to the
+ * new query, also on failure.
+ *
+ * @param a the first query. May be NULL, in which case NULL is returned.
+ * @param b the second query. May be NULL, in which case NULL is returned.
+ * @return the query or NULL on failure.
+ */
+struct index_query *index_query_or(struct index_query *a, struct index_query *b);
+
+/**
+ * Create a query that matches all documents that are not matched by the given
+ * query. Such a query can only be evaluated as an operand of
+ * index_query_and() whose other operand is not negated. The ownership of the
+ * query is transferred to the new query, also on failure.
+ *
+ * @param a the query to negate. May be NULL, in which case NULL is returned.
+ * @return the query or NULL on failure.
+ */
+struct index_query *index_query_not(struct index_query *a);
+
+/**
+ * Free the given query including all subqueries.
+ *
+ * @param query the query to free. May be NULL.
+ */
+void index_query_free(struct index_query *query);
+
+/**
+ * Open a cursor that iterates over all documents matching the given query
+ * in ascending document id order. The index must not be modified or disposed
+ * while the cursor is in use.
+ *
+ * @param index the index to query
+ * @param query the query. It can be freed after the call.
+ * @return the cursor or NULL on failure or if the query cannot be evaluated.
+ */
+struct index_cursor *index_query_cursor(struct index *index, struct index_query *query);
+
+/**
+ * Advance the cursor to the next matching document.
+ *
+ * @param cursor the cursor
+ * @return the id of the document or -1 if there are no further documents.
+ */
+int index_cursor_next(struct index_cursor *cursor);
+
+/**
+ * Advance the cursor to the first matching document whose id is not smaller
+ * than the given one. The cursor is never moved backwards, i.e., if the
+ * current document id is larger than the given one, it is returned.
+ *
+ * @param cursor the cursor
+ * @param did the document id to skip to
+ * @return the id of the document or -1 if there are no further documents.
+ */
+int index_cursor_skip_to(struct index_cursor *cursor, int did);
+
+/**
+ * Free all resources associated with the given cursor.
+ *
+ * @param cursor the cursor to dispose. May be NULL.
+ */
+void index_cursor_dispose(struct index_cursor *cursor);
+
 #endif
@@ -25,6 +25,15 @@
  *
  * It is very slow at the moment, in particular as the strings are read multiple
  * times from the external media.
+ *
+ * The first block of the index file is reserved for a superblock that holds
+ * the parameters of the tree (root, block size, number of blocks) and the
+ * size of the document table, which is kept in the offsets file. This allows
+ * to reopen an existing index without the need to rebuild it.
+ *
+ * Nodes and string prefixes that have been read from the external media are
+ * kept in two caches with LRU eviction in order to reduce the number of
+ * accesses to the external media.
  */
 
 #include "index_external.h"
@@ -80,6 +89,106 @@ struct bnode_header
 
 typedef struct bnode_header bnode;
 
+/** Identifies the superblock of an external index */
+#define INDEX_EXTERNAL_MAGIC "SMIE"
+
+/** The current version of the on-disk format */
+#define INDEX_EXTERNAL_VERSION 1
+
+/** The block number of the superblock */
+#define INDEX_EXTERNAL_SUPERBLOCK 0
+
+/** The default number of nodes that are kept in memory */
+#define INDEX_EXTERNAL_DEFAULT_CACHED_NODES 256
+
+/** The default number of string prefixes that are kept in memory */
+#define INDEX_EXTERNAL_DEFAULT_CACHED_STRINGS 16384
+
+/** The default number of suffixes that are sorted in memory during a bulk load */
+#define INDEX_EXTERNAL_DEFAULT_BULK_RUN_SIZE 65536
+
+/** The maximum number of sorted runs that are merged at once */
+#define INDEX_EXTERNAL_BULK_MERGE_FANIN 16
+
+/** The number of suffixes that are buffered for each run during a merge */
+#define INDEX_EXTERNAL_BULK_RUN_BUFFER 256
+
+/**
+ * A bulk load is merged into the existing tree if the tree has at least
+ * that many times more suffixes than the bulk load, otherwise the tree is
+ * rebuilt.
+ */
+#define INDEX_EXTERNAL_BULK_MERGE_RATIO 8
+
+/** The default percentage of removed text at which a compaction is due */
+#define INDEX_EXTERNAL_DEFAULT_COMPACTION_PERCENT 25
+
+/** The default minimum number of bytes of removed text for a compaction */
+#define INDEX_EXTERNAL_DEFAULT_COMPACTION_MIN_GARBAGE 65536
+
+/**
+ * The superblock of the index file. It is stored at the very beginning of
+ * the index file. The remaining part of the first block is unused.
+ */
+struct index_external_superblock
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int block_size;
+	int number_of_blocks;
+	int root_node;
+
+	/** Number of entries in the document table (i.e., the offsets file) */
+	int number_of_documents;
+
+	unsigned int max_substring_len;
+};
+
+/**
+ * An entry of an index_external_cache. The payload directly follows the
+ * entry.
+ */
+struct index_external_cache_entry
+{
+	/** Embedded node for the LRU list */
+	struct node node;
+
+	/** Next entry in the same hash bucket */
+	struct index_external_cache_entry *next;
+
+	/** The key of the entry, e.g., the block number */
+	unsigned int key;
+};
+
+/**
+ * A simple cache that maps keys to payloads of a fixed size. If the cache
+ * is full, the least recently used entry is recycled.
+ */
+struct index_external_cache
+{
+	/** Entries in LRU order. The head is the least recently used entry. */
+	struct list lru_list;
+
+	struct index_external_cache_entry **buckets;
+	unsigned int bucket_mask;
+
+	unsigned int payload_size;
+	int num_entries;
+	int max_entries;
+
+	unsigned int hits;
+	unsigned int misses;
+};
+
+/**
+ * Structure representing an offset/did pair.
+ */
+struct offset_entry
+{
+	int offset;
+	int did;
+};
+
 struct index_external
 {
 	struct index index;
@@ -93,20 +202,272 @@ struct index_external
 	FILE *offset_file;
 	FILE *index_file;
 
-	/** Identifies the block for the root node. TODO: Make this persistent */
+	/** Identifies the block for the root node */
 	int root_node;
 
+	/** Number of entries in the document table */
+	int number_of_documents;
+
+	/** The document table, i.e., the contents of the offsets file */
+	struct offset_entry *documents;
+	int allocated_documents;
+
+	/**
+	 * Open addressing hash table that maps document ids to entries of the
+	 * document table. Slots are -1 if empty. Entries that have been removed
+	 * in the meantime stay until the table is rebuilt.
+	 */
+	int *did_slots;
+	unsigned int did_slots_mask;
+	int num_did_slots_used;
+
+	/** The size of the string file */
+	long strings_size;
+
+	/**
+	 * One bit for each entry of the document table that is set if the
+	 * document has been removed. Suffixes of removed documents stay in the
+	 * tree until the next compaction and are filtered at query time.
+	 */
+	unsigned char *tombstones;
+
+	/** The file in which the tombstones are stored, opened on demand */
+	FILE *tombstone_file;
+
+	/** Number of bytes of the string file that belong to removed documents */
+	long dead_bytes;
+
+	/** The percentage of dead bytes at which a compaction is due */
+	int compaction_percent;
+
+	/** The minimum number of dead bytes for a compaction */
+	long compaction_min_garbage;
+
+	/** The name of the index without any suffix */
+	char *filename;
+
+	/** Maximum number of suffixes that are sorted in memory during a bulk load */
+	int bulk_run_size;
+
 	/**
 	 * Defines the maximum length for which a substring search is accurate.
 	 * Searches with longer substring will shorten the substring to this length.
 	 */
 	unsigned int max_substring_len;
 
+	/** Caches decoded nodes keyed by block number */
+	struct index_external_cache node_cache;
+
+	/** Caches string prefixes keyed by the offset in the string file */
+	struct index_external_cache string_cache;
+
+	/** Used for reading strings if the string cache is disabled */
+	char *string_buf;
+
 	bnode *tmp;
 	bnode *tmp2;
 	bnode *tmp3;
 };
 
+/**
+ * Return the payload of the given cache entry.
+ *
+ * @param e
+ * @return
+ */
+static void *index_external_cache_entry_payload(struct index_external_cache_entry *e)
+{
+	return e + 1;
+}
+
+/**
+ * Initializes the given cache.
+ *
+ * @param c the cache to initialize.
+ * @param max_entries the maximum number of entries. If 0, nothing will be
+ *  cached.
+ * @param payload_size the size of the payload of each entry.
+ * @return 0 on failure, else something different.
+ */
+static int index_external_cache_init(struct index_external_cache *c, int max_entries, unsigned int payload_size)
+{
+	unsigned int num_buckets = 1;
+
+	memset(c, 0, sizeof(*c));
+	list_init(&c->lru_list);
+
+	while (num_buckets < (unsigned int)max_entries)
+		num_buckets <<= 1;
+
+	if (!(c->buckets = (struct index_external_cache_entry **)malloc(num_buckets * sizeof(c->buckets[0]))))
+		return 0;
+	memset(c->buckets, 0, num_buckets * sizeof(c->buckets[0]));
+
+	c->bucket_mask = num_buckets - 1;
+	c->payload_size = payload_size;
+	c->max_entries = max_entries;
+	return 1;
+}
+
+/**
+ * Frees all resources associated with the given cache.
+ *
+ * @param c
+ */
+static void index_external_cache_clean(struct index_external_cache *c)
+{
+	struct index_external_cache_entry *e;
+
+	while ((e = (struct index_external_cache_entry *)list_remove_head(&c->lru_list)))
+		free(e);
+	free(c->buckets);
+	c->buckets = NULL;
+	c->num_entries = 0;
+}
+
+/**
+ * Unlinks the given entry from its hash bucket.
+ *
+ * @param c
+ * @param e
+ */
+static void index_external_cache_unlink(struct index_external_cache *c, struct index_external_cache_entry *e)
+{
+	struct index_external_cache_entry **p = &c->buckets[e->key & c->bucket_mask];
+
+	while (*p)
+	{
+		if (*p == e)
+		{
+			*p = e->next;
+			break;
+		}
+		p = &(*p)->next;
+	}
+}
+
+/**
+ * Find the entry for the given key without affecting the statistics.
+ *
+ * @param c
+ * @param key
+ * @return the entry or NULL.
+ */
+static struct index_external_cache_entry *index_external_cache_find(struct index_external_cache *c, unsigned int key)
+{
+	struct index_external_cache_entry *e;
+
+	if (!c->buckets)
+		return NULL;
+
+	for (e = c->buckets[key & c->bucket_mask]; e; e = e->next)
+	{
+		if (e->key == key)
+			return e;
+	}
+	return NULL;
+}
+
+/**
+ * Lookup the payload for the given key. A successful lookup turns the
+ * entry into the most recently used one.
+ *
+ * @param c
+ * @param key
+ * @return the payload or NULL if the key is not cached.
+ */
+static void *index_external_cache_lookup(struct index_external_cache *c, unsigned int key)
+{
+	struct index_external_cache_entry *e;
+
+	if (!(e = index_external_cache_find(c, key)))
+	{
+		c->misses++;
+		return NULL;
+	}
+
+	c->hits++;
+	node_remove(&e->node);
+	list_insert_tail(&c->lru_list, &e->node);
+	return index_external_cache_entry_payload(e);
+}
+
+/**
+ * Insert an entry for the given key into the cache. If the cache is full,
+ * the least recently used entry is recycled. If there is already an entry
+ * with the given key, that entry is returned.
+ *
+ * @param c
+ * @param key
+ * @return the payload of the entry that must be filled by the caller or
+ *  NULL, if the entry couldn't be inserted.
+ */
+static void *index_external_cache_insert(struct index_external_cache *c, unsigned int key)
+{
+	struct index_external_cache_entry *e;
+
+	if (c->max_entries <= 0)
+		return NULL;
+
+	if ((e = index_external_cache_find(c, key)))
+	{
+		node_remove(&e->node);
+	} else
+	{
+		if (c->num_entries < c->max_entries)
+		{
+			if (!(e = (struct index_external_cache_entry *)malloc(sizeof(*e) + c->payload_size)))
+				return NULL;
+			c->num_entries++;
+		} else
+		{
+			e = (struct index_external_cache_entry *)list_remove_head(&c->lru_list);
+			index_external_cache_unlink(c, e);
+		}
+
+		e->key = key;
+		e->next = c->buckets[key & c->bucket_mask];
+		c->buckets[key & c->bucket_mask] = e;
+	}
+	list_insert_tail(&c->lru_list, &e->node);
+	return index_external_cache_entry_payload(e);
+}
+
+/**
+ * Remove the entry of the given key from the cache.
+ *
+ * @param c
+ * @param key
+ */
+static void index_external_cache_remove(struct index_external_cache *c, unsigned int key)
+{
+	struct index_external_cache_entry *e;
+
+	if (!(e = index_external_cache_find(c, key)))
+		return;
+
+	index_external_cache_unlink(c, e);
+	node_remove(&e->node);
+	free(e);
+	c->num_entries--;
+}
+
+/**
+ * Remove all entries from the cache. The statistics are kept.
+ *
+ * @param c
+ */
+static void index_external_cache_clear(struct index_external_cache *c)
+{
+	struct index_external_cache_entry *e;
+
+	while ((e = (struct index_external_cache_entry *)list_remove_head(&c->lru_list)))
+		free(e);
+	if (c->buckets)
+		memset(c->buckets, 0, (c->bucket_mask + 1) * sizeof(c->buckets[0]));
+	c->num_entries = 0;
+}
+
 /**
  * Create a new node for the given index/btree.
  *
@@ -159,12 +520,20 @@ static struct bnode_element *bnode_get_ith_element_of_node(struct index_external
  */
 static int bnode_write_block(struct index_external *idx, const bnode *node, int address)
 {
+	void *cached;
 	unsigned int offset = address * idx->block_size;
 	if (fseek(idx->index_file, offset, SEEK_SET))
-		return 0;
+		goto bailout;
 	if (fwrite(node, 1, idx->block_size, idx->index_file) != idx->block_size)
-		return 0;
+		goto bailout;
+
+	/* The cache is write-through */
+	if ((cached = index_external_cache_insert(&idx->node_cache, address)))
+		memcpy(cached, node, idx->block_size);
 	return 1;
+bailout:
+	index_external_cache_remove(&idx->node_cache, address);
+	return 0;
 }
 
 /**
@@ -193,36 +562,73 @@ static int bnode_add_block(struct index_external *idx, const bnode *node)
 static int bnode_read_block(struct index_external *idx, bnode *node, int address)
 {
 	size_t rc;
+	void *cached;
 	unsigned int offset = address * idx->block_size;
+
+	if ((cached = index_external_cache_lookup(&idx->node_cache, address)))
+	{
+		memcpy(node, cached, idx->block_size);
+		return 1;
+	}
+
 	if (fseek(idx->index_file, offset, SEEK_SET))
 		return 0;
 	rc = fread(node, 1, idx->block_size, idx->index_file);
 	if (rc != idx->block_size)
 		return 0;
+
+	if ((cached = index_external_cache_insert(&idx->node_cache, address)))
+		memcpy(cached, node, idx->block_size);
 	return 1;
 }
 
 /**
- * Reads the entire string for the given element,
+ * Returns the string for the given element. The string is not longer
+ * than max_substring_len.
  *
  * @param idx
  * @param element
- * @return the string which must be freed with free() when no longer in use.
+ * @return the string or NULL on failure. The string is owned by the index
+ *  and valid only until the next string is requested.
  */
-static char *bnode_read_string(struct index_external *idx, struct bnode_element *element)
+static const char *bnode_get_string(struct index_external *idx, struct bnode_element *element)
 {
 	char *str;
 	unsigned int str_len = element->str_len;
 	if (str_len > idx->max_substring_len)
 		str_len = idx->max_substring_len;
 
-	fseek(idx->string_file, element->str_offset, SEEK_SET);
-	if (!(str = (char *)malloc(str_len + 1)))
-		return 0;
+	if ((str = (char *)index_external_cache_lookup(&idx->string_cache, element->str_offset)))
+		return str;
+
+	if (!(str = (char *)index_external_cache_insert(&idx->string_cache, element->str_offset)))
+		str = idx->string_buf;
+
+	if (fseek(idx->string_file, element->str_offset, SEEK_SET))
+		goto bailout;
 	if (fread(str, 1, str_len, idx->string_file) != str_len)
-		return 0;
+		goto bailout;
 	str[str_len] = 0;
 	return str;
+bailout:
+	index_external_cache_remove(&idx->string_cache, element->str_offset);
+	return NULL;
+}
+
+/**
+ * Reads the entire string for the given element,
+ *
+ * @param idx
+ * @param element
+ * @return the string which must be freed with free() when no longer in use.
+ */
+static char *bnode_read_string(struct index_external *idx, struct bnode_element *element)
+{
+	const char *str;
+
+	if (!(str = bnode_get_string(idx, element)))
+		return NULL;
+	return strdup(str);
 }
 
 /**
@@ -237,11 +643,9 @@ static char *bnode_read_string(struct index_external *idx, struct bnode_element
  */
 static int bnode_compare_string(struct index_external *idx, struct bnode_element *e, const char *text, int *out_cmp)
 {
-	char *str = bnode_read_string(idx, e);
+	const char *str = bnode_get_string(idx, e);
 	if (!str) return 0;
 	*out_cmp = strncmp(str, text, idx->max_substring_len);
-
-	free(str);
 	return 1;
 }
 
@@ -557,7 +961,12 @@ static int count_index_leaves(struct index_external *idx, int block, int level)
 		return -1;
 
 	if (!tmp->leaf)
-		count += count_index(idx, tmp->lchild, level + 1);
+	{
+		int c = count_index_leaves(idx, tmp->lchild, level + 1);
+		if (c == -1)
+			return -1;
+		count += c;
+	}
 
 	for (i=0; i<tmp->num_elements; i++)
 	{
@@ -586,14 +995,15 @@ static int count_index_leaves(struct index_external *idx, int block, int level)
 #endif
 
 /**
- * Inserts the given string into the bnode tree.
+ * Inserts the given leaf element into the bnode tree.
  *
  * @param idx
- * @param did
- * @param txt
- * @return
+ * @param text the string to which the element refers. Only the first
+ *  max_substring_len characters are relevant.
+ * @param element the element to insert.
+ * @return 0 on failure, else something different.
  */
-static int bnode_insert_string(struct index_external *idx, int did, int offset, const char *text)
+static int bnode_insert_element(struct index_external *idx, const char *text, const struct bnode_element *element)
 {
 	int i;
 	int current_level;
@@ -606,9 +1016,7 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 		return 0;
 
 	current_level = path.max_level;
-	new_element.str_offset = offset;
-	new_element.str_len = strlen(text);
-	new_element.leaf.did = did;
+	new_element = *element;
 
 	while (current_level >= 0)
 	{
@@ -617,7 +1025,8 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 		block = path.node[current_level].block;
 		i = path.node[current_level].key_index;
 
-		bnode_read_block(idx, tmp, block);
+		if (!bnode_read_block(idx, tmp, block))
+			return 0;
 
 		if (!tmp->leaf && current_level == path.max_level)
 		{
@@ -646,7 +1055,9 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 			 */
 
 			int median = tmp->num_elements / 2;
-			int start_of_2nd_node = median;
+			/* The separation value of internal nodes moves up, its child
+			 * becomes the lchild of the second node */
+			int start_of_2nd_node = tmp->leaf ? median : median + 1;
 			struct bnode_element *me = bnode_get_ith_element_of_node(idx, tmp, median);
 			struct bnode_element me_copy = *me;
 
@@ -660,12 +1071,14 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 			idx->tmp3->sibling = tmp->sibling;
 			memcpy(bnode_get_ith_element_of_node(idx, idx->tmp3, 0), bnode_get_ith_element_of_node(idx, tmp, start_of_2nd_node), idx->tmp3->num_elements * sizeof(struct bnode_element));
 			bnode_clear_elements(idx, idx->tmp3, idx->tmp3->num_elements);
-			tmp3block = bnode_add_block(idx, idx->tmp3);
+			if ((tmp3block = bnode_add_block(idx, idx->tmp3)) == -1)
+				return 0;
 
 			/* This should be done as late as possible */
 			tmp->sibling = tmp3block;
 			bnode_clear_elements(idx, tmp, median);
-			bnode_write_block(idx, tmp, block);
+			if (!bnode_write_block(idx, tmp, block))
+				return 0;
 
 			if (block == idx->root_node)
 			{
@@ -681,7 +1094,9 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 				me_copy.internal.gchild = tmp3block;
 				*bnode_get_ith_element_of_node(idx, tmp, 0) = me_copy;
 				bnode_clear_elements(idx, tmp, 1);
-				idx->root_node = bnode_add_block(idx, tmp);
+				if ((block = bnode_add_block(idx, tmp)) == -1)
+					return 0;
+				idx->root_node = block;
 				break;
 			}
 
@@ -690,7 +1105,8 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 		} else
 		{
 			/* There was enough space in the block */
-			bnode_write_block(idx, tmp, block);
+			if (!bnode_write_block(idx, tmp, block))
+				return 0;
 			break;
 		}
 		current_level--;
@@ -699,29 +1115,228 @@ static int bnode_insert_string(struct index_external *idx, int did, int offset,
 }
 
 /**
- * The iterator data.
+ * Inserts the given string into the bnode tree.
+ *
+ * @param idx
+ * @param did
+ * @param offset
+ * @param text
+ * @return 0 on failure, else something different.
  */
-struct bnode_string_iter_data
+static int bnode_insert_string(struct index_external *idx, int did, int offset, const char *text)
 {
-	/** Allocated bnode */
-	bnode *node;
+	struct bnode_element new_element;
 
-	/** The current index */
-	int index;
+	memset(&new_element, 0, sizeof(new_element));
+	new_element.str_offset = offset;
+	new_element.str_len = strlen(text);
+	new_element.leaf.did = did;
+	return bnode_insert_element(idx, text, &new_element);
+}
 
-	/** The document id */
-	int did;
-};
+/**
+ * Returns the entry of the document table to which the given offset of the
+ * string file belongs.
+ *
+ * @param idx
+ * @param str_offset
+ * @return the number of the entry or -1 if there is no such entry.
+ */
+static int index_external_find_document(struct index_external *idx, unsigned int str_offset)
+{
+	int l = 0;
+	int h = idx->number_of_documents - 1;
+	int found = -1;
+
+	while (l <= h)
+	{
+		int m = (l + h) / 2;
+		if ((unsigned int)idx->documents[m].offset <= str_offset)
+		{
+			found = m;
+			l = m + 1;
+		} else
+		{
+			h = m - 1;
+		}
+	}
+	return found;
+}
 
 /**
- * The document did to which the iter points.
+ * Determines whether the given entry of the document table has been removed.
  *
- * @param iter
+ * @param idx
+ * @param doc
  * @return
  */
-int bnode_string_iter_data_get_did(struct bnode_string_iter_data *iter)
+static int index_external_is_document_removed(struct index_external *idx, int doc)
 {
-	return iter->did;
+	return (idx->tombstones[doc / 8] >> (doc % 8)) & 1;
+}
+
+/**
+ * Mixes the bits of the given document id for the did table.
+ *
+ * @param did
+ * @return the hash value.
+ */
+static unsigned int index_external_did_hash(unsigned int did)
+{
+	did ^= did >> 16;
+	did *= 0x85ebca6bu;
+	did ^= did >> 13;
+	did *= 0xc2b2ae35u;
+	did ^= did >> 16;
+	return did;
+}
+
+/**
+ * Rebuilds the table that maps document ids to entries of the document
+ * table from the entries that are not removed. It is sized such that the
+ * load factor is at most one quarter.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_external_rebuild_did_slots(struct index_external *idx)
+{
+	unsigned int size = 64;
+	int *did_slots;
+	int num = 0;
+	int i;
+
+	for (i = 0; i < idx->number_of_documents; i++)
+	{
+		if (!index_external_is_document_removed(idx, i))
+			num++;
+	}
+
+	while (size < (unsigned int)num * 4)
+		size *= 2;
+
+	if (!(did_slots = (int*)malloc(size * sizeof(did_slots[0]))))
+		return 0;
+	memset(did_slots, 0xff, size * sizeof(did_slots[0]));
+
+	free(idx->did_slots);
+	idx->did_slots = did_slots;
+	idx->did_slots_mask = size - 1;
+	idx->num_did_slots_used = 0;
+
+	for (i = 0; i < idx->number_of_documents; i++)
+	{
+		unsigned int j;
+
+		if (index_external_is_document_removed(idx, i))
+			continue;
+
+		j = index_external_did_hash(idx->documents[i].did) & idx->did_slots_mask;
+		while (idx->did_slots[j] != -1)
+			j = (j + 1) & idx->did_slots_mask;
+		idx->did_slots[j] = i;
+		idx->num_did_slots_used++;
+	}
+	return 1;
+}
+
+/**
+ * Adds the given entry of the document table to the did table. The entry
+ * may be the one just past the entries that are accounted for.
+ *
+ * @param idx
+ * @param doc
+ * @return 0 on failure, else something different.
+ */
+static int index_external_add_did_slot(struct index_external *idx, int doc)
+{
+	unsigned int j;
+
+	/* Keep the load factor including the stale slots below one half */
+	if (!idx->did_slots || (unsigned int)(idx->num_did_slots_used + 1) * 2 > idx->did_slots_mask + 1)
+	{
+		if (!index_external_rebuild_did_slots(idx))
+			return 0;
+	}
+
+	j = index_external_did_hash(idx->documents[doc].did) & idx->did_slots_mask;
+	while (idx->did_slots[j] != -1)
+	{
+		/* The entry may have been added before by an attempt that failed */
+		if (idx->did_slots[j] == doc)
+			return 1;
+		j = (j + 1) & idx->did_slots_mask;
+	}
+	idx->did_slots[j] = doc;
+	idx->num_did_slots_used++;
+	return 1;
+}
+
+/**
+ * Determines whether the string at the given offset of the string file
+ * belongs to a removed document.
+ *
+ * @param idx
+ * @param str_offset
+ * @return
+ */
+static int index_external_is_removed(struct index_external *idx, unsigned int str_offset)
+{
+	int doc;
+
+	if (!idx->dead_bytes)
+		return 0;
+	if ((doc = index_external_find_document(idx, str_offset)) < 0)
+		return 0;
+	return index_external_is_document_removed(idx, doc);
+}
+
+/**
+ * Returns the length of the text of the given entry of the document table
+ * without the terminating zero byte.
+ *
+ * @param idx
+ * @param doc
+ * @return
+ */
+static long index_external_document_len(struct index_external *idx, int doc)
+{
+	long end;
+
+	if (doc + 1 < idx->number_of_documents)
+		end = idx->documents[doc + 1].offset;
+	else
+		end = idx->strings_size;
+	return end - idx->documents[doc].offset - 1;
+}
+
+/**
+ * The iterator data.
+ */
+struct bnode_string_iter_data
+{
+	/** Allocated bnode */
+	bnode *node;
+
+	/** The current index */
+	int index;
+
+	/** The document id */
+	int did;
+
+	/** The offset of the string in the string file */
+	unsigned int str_offset;
+};
+
+/**
+ * The document did to which the iter points.
+ *
+ * @param iter
+ * @return
+ */
+int bnode_string_iter_data_get_did(struct bnode_string_iter_data *iter)
+{
+	return iter->did;
 }
 
 /**
@@ -782,6 +1397,7 @@ static struct bnode_string_iter_data *bnode_find_string_iter(struct index_extern
 	if (cmp) goto done;
 	iter->index = index;
 	iter->did = be->leaf.did;
+	iter->str_offset = be->str_offset;
 	return iter;
 done:
 	bnode_free(idx, iter->node);
@@ -803,6 +1419,8 @@ static int bnode_find_string(struct index_external *idx, const char *text, int (
 
 	while ((iter = bnode_find_string_iter(idx, text, iter)))
 	{
+		if (index_external_is_removed(idx, iter->str_offset))
+			continue;
 		callback(bnode_string_iter_data_get_did(iter), userdata);
 		nd++;
 	}
@@ -810,6 +1428,62 @@ static int bnode_find_string(struct index_external *idx, const char *text, int (
 }
 
 
+/**
+ * Writes the superblock of the given index.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_external_write_superblock(struct index_external *idx)
+{
+	struct index_external_superblock sb;
+
+	memset(&sb, 0, sizeof(sb));
+	memcpy(sb.magic, INDEX_EXTERNAL_MAGIC, sizeof(sb.magic));
+	sb.version = INDEX_EXTERNAL_VERSION;
+	sb.block_size = idx->block_size;
+	sb.number_of_blocks = idx->number_of_blocks;
+	sb.root_node = idx->root_node;
+	sb.number_of_documents = idx->number_of_documents;
+	sb.max_substring_len = idx->max_substring_len;
+
+	if (fseek(idx->index_file, INDEX_EXTERNAL_SUPERBLOCK, SEEK_SET))
+		return 0;
+	if (fwrite(&sb, 1, sizeof(sb), idx->index_file) != sizeof(sb))
+		return 0;
+	if (fflush(idx->index_file))
+		return 0;
+	return 1;
+}
+
+/**
+ * Reads the superblock from the given file and checks whether it is
+ * plausible.
+ *
+ * @param fh the file from which the superblock is read.
+ * @param sb the superblock that is filled.
+ * @return 0 if the superblock could not be read or is not valid, else
+ *  something different.
+ */
+static int index_external_read_superblock(FILE *fh, struct index_external_superblock *sb)
+{
+	if (fseek(fh, INDEX_EXTERNAL_SUPERBLOCK, SEEK_SET))
+		return 0;
+	if (fread(sb, 1, sizeof(*sb), fh) != sizeof(*sb))
+		return 0;
+	if (memcmp(sb->magic, INDEX_EXTERNAL_MAGIC, sizeof(sb->magic)))
+		return 0;
+	if (sb->version != INDEX_EXTERNAL_VERSION)
+		return 0;
+	if (sb->block_size < sizeof(struct index_external_superblock) ||
+		sb->block_size < sizeof(struct bnode_header) + 4 * sizeof(struct bnode_element))
+		return 0;
+	if (sb->number_of_blocks < 2 || sb->root_node < 1 || sb->root_node >= sb->number_of_blocks)
+		return 0;
+	if (sb->number_of_documents < 0)
+		return 0;
+	return 1;
+}
 
 static void index_external_dispose(struct index *index)
 {
@@ -817,52 +1491,263 @@ static void index_external_dispose(struct index *index)
 
 	idx = (struct index_external*)index;
 
+	if (idx->index_file && idx->root_node > 0)
+		index_external_write_superblock(idx);
+
 	if (idx->offset_file) fclose(idx->offset_file);
 	if (idx->string_file) fclose(idx->string_file);
 	if (idx->index_file) fclose(idx->index_file);
+	if (idx->tombstone_file) fclose(idx->tombstone_file);
 	if (idx->tmp3) bnode_free(idx, idx->tmp3);
 	if (idx->tmp2) bnode_free(idx, idx->tmp2);
 	if (idx->tmp) bnode_free(idx, idx->tmp);
+	index_external_cache_clean(&idx->string_cache);
+	index_external_cache_clean(&idx->node_cache);
+	free(idx->string_buf);
+	free(idx->tombstones);
+	free(idx->did_slots);
+	free(idx->documents);
+	free(idx->filename);
 	free(idx);
 }
 
+/**
+ * Opens the three files that make up the index using the given mode.
+ *
+ * @param idx
+ * @param filename
+ * @param mode
+ * @return 0 on failure, else something different.
+ */
+static int index_external_open_files(struct index_external *idx, const char *filename, const char *mode)
+{
+	char buf[380];
+
+	sm_snprintf(buf, sizeof(buf), "%s.index", filename);
+	if (!(idx->index_file = fopen(buf, mode)))
+		return 0;
+
+	sm_snprintf(buf, sizeof(buf), "%s.strings", filename);
+	if (!(idx->string_file = fopen(buf, mode)))
+		return 0;
+
+	sm_snprintf(buf, sizeof(buf), "%s.offsets", filename);
+	if (!(idx->offset_file = fopen(buf, mode)))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Closes all files of the given index.
+ *
+ * @param idx
+ */
+static void index_external_close_files(struct index_external *idx)
+{
+	if (idx->offset_file) fclose(idx->offset_file);
+	if (idx->string_file) fclose(idx->string_file);
+	if (idx->index_file) fclose(idx->index_file);
+	if (idx->tombstone_file) fclose(idx->tombstone_file);
+	idx->offset_file = idx->string_file = idx->index_file = idx->tombstone_file = NULL;
+}
+
+/**
+ * Makes room for at least the given number of entries in the document table
+ * and the tombstones.
+ *
+ * @param idx
+ * @param num
+ * @return 0 on failure, else something different.
+ */
+static int index_external_ensure_documents(struct index_external *idx, int num)
+{
+	struct offset_entry *documents;
+	unsigned char *tombstones;
+	int allocated;
+
+	if (num <= idx->allocated_documents)
+		return 1;
+
+	allocated = idx->allocated_documents * 2 + 64;
+	if (allocated < num)
+		allocated = num;
+
+	if (!(documents = (struct offset_entry *)realloc(idx->documents, allocated * sizeof(documents[0]))))
+		return 0;
+	idx->documents = documents;
+
+	if (!(tombstones = (unsigned char *)realloc(idx->tombstones, (allocated + 7) / 8)))
+		return 0;
+	memset(tombstones + (idx->allocated_documents + 7) / 8, 0, (allocated + 7) / 8 - (idx->allocated_documents + 7) / 8);
+	idx->tombstones = tombstones;
+
+	idx->allocated_documents = allocated;
+	return 1;
+}
+
+/**
+ * Reads the document table and the tombstones of a reopened index into
+ * memory.
+ *
+ * @param idx
+ * @param filename
+ * @return 0 on failure, else something different.
+ */
+static int index_external_load_documents(struct index_external *idx, const char *filename)
+{
+	char buf[380];
+	FILE *fh;
+	int i;
+
+	if (!index_external_ensure_documents(idx, idx->number_of_documents))
+		return 0;
+
+	if (fseek(idx->offset_file, 0, SEEK_SET))
+		return 0;
+	if (fread(idx->documents, sizeof(idx->documents[0]), idx->number_of_documents, idx->offset_file) != idx->number_of_documents)
+		return 0;
+
+	if (fseek(idx->string_file, 0, SEEK_END))
+		return 0;
+	idx->strings_size = ftell(idx->string_file);
+
+	/* An index without tombstones has no removed documents */
+	sm_snprintf(buf, sizeof(buf), "%s.tombstones", filename);
+	if ((fh = fopen(buf, "rb")))
+	{
+		fread(idx->tombstones, 1, (idx->number_of_documents + 7) / 8, fh);
+		fclose(fh);
+
+		/* The tombstones may contain bits of documents that have not made it
+		 * into the superblock, so get rid of them also on disk */
+		for (i = idx->number_of_documents; i < ((idx->number_of_documents + 7) & ~7); i++)
+			idx->tombstones[i / 8] &= ~(1 << (i % 8));
+		if (!(fh = fopen(buf, "wb")))
+			return 0;
+		fwrite(idx->tombstones, 1, (idx->number_of_documents + 7) / 8, fh);
+		fclose(fh);
+	}
+
+	idx->dead_bytes = 0;
+	for (i = 0; i < idx->number_of_documents; i++)
+	{
+		if (index_external_is_document_removed(idx, i))
+			idx->dead_bytes += index_external_document_len(idx, i) + 1;
+	}
+	return index_external_rebuild_did_slots(idx);
+}
+
+/**
+ * Try to reopen an existing index. On success, the parameters of the tree
+ * are taken from the superblock.
+ *
+ * @param idx
+ * @param filename
+ * @return 0 if there is no usable index, else something different.
+ */
+static int index_external_reopen(struct index_external *idx, const char *filename)
+{
+	struct index_external_superblock sb;
+
+	if (!index_external_open_files(idx, filename, "r+b"))
+		goto bailout;
+
+	if (!index_external_read_superblock(idx->index_file, &sb))
+		goto bailout;
+
+	/* The document table must contain at least the documents that the
+	 * superblock accounts for */
+	if (fseek(idx->offset_file, 0, SEEK_END))
+		goto bailout;
+	if (ftell(idx->offset_file) < (long)(sb.number_of_documents * sizeof(struct offset_entry)))
+		goto bailout;
+
+	idx->block_size = sb.block_size;
+	idx->number_of_blocks = sb.number_of_blocks;
+	idx->root_node = sb.root_node;
+	idx->number_of_documents = sb.number_of_documents;
+	idx->max_substring_len = sb.max_substring_len;
+
+	if (!index_external_load_documents(idx, filename))
+		goto bailout;
+	return 1;
+
+bailout:
+	index_external_close_files(idx);
+	return 0;
+}
+
 static struct index *index_external_create_with_opts(const char *filename, int block_size)
 {
 	struct index_external *idx;
-	char buf[380];
+	int reopened;
 
 	if (!(idx = (struct index_external*)malloc(sizeof(*idx))))
 		return NULL;
 
 	memset(idx,0,sizeof(*idx));
 	list_init(&idx->document_list);
+	list_init(&idx->node_cache.lru_list);
+	list_init(&idx->string_cache.lru_list);
 	idx->block_size = block_size;
+	idx->max_substring_len = 32;
+	idx->bulk_run_size = INDEX_EXTERNAL_DEFAULT_BULK_RUN_SIZE;
+	idx->compaction_percent = INDEX_EXTERNAL_DEFAULT_COMPACTION_PERCENT;
+	idx->compaction_min_garbage = INDEX_EXTERNAL_DEFAULT_COMPACTION_MIN_GARBAGE;
+
+	if (!(idx->filename = strdup(filename)))
+		goto bailout;
+
+	/* Take the existing index if possible, this may alter the block size */
+	if (!(reopened = index_external_reopen(idx, filename)))
+	{
+		char buf[380];
+
+		if (!index_external_open_files(idx, filename, "w+b"))
+			goto bailout;
+
+		/* Tombstones of a previous index must not apply to the new one */
+		sm_snprintf(buf, sizeof(buf), "%s.tombstones", filename);
+		remove(buf);
+		idx->number_of_documents = 0;
+		idx->dead_bytes = 0;
+		if (idx->tombstones)
+			memset(idx->tombstones, 0, (idx->allocated_documents + 7) / 8);
+	}
+
 	idx->max_elements_per_node = (idx->block_size - sizeof(struct bnode_header)) / sizeof(struct bnode_element);
 
-	if (!(idx->tmp = bnode_create(idx)))
+	if (!index_external_cache_init(&idx->node_cache, INDEX_EXTERNAL_DEFAULT_CACHED_NODES, idx->block_size))
 		goto bailout;
 
-	if (!(idx->tmp2 = bnode_create(idx)))
+	if (!index_external_cache_init(&idx->string_cache, INDEX_EXTERNAL_DEFAULT_CACHED_STRINGS, idx->max_substring_len + 1))
 		goto bailout;
 
-	if (!(idx->tmp3 = bnode_create(idx)))
+	if (!(idx->string_buf = (char *)malloc(idx->max_substring_len + 1)))
 		goto bailout;
 
-	sm_snprintf(buf, sizeof(buf), "%s.index", filename);
-	if (!(idx->index_file = fopen(buf, "w+b")))
+	if (!(idx->tmp = bnode_create(idx)))
 		goto bailout;
 
-	sm_snprintf(buf, sizeof(buf), "%s.strings", filename);
-	if (!(idx->string_file = fopen(buf, "w+b")))
+	if (!(idx->tmp2 = bnode_create(idx)))
 		goto bailout;
 
-	sm_snprintf(buf, sizeof(buf), "%s.offsets", filename);
-	if (!(idx->offset_file = fopen(buf, "w+b")))
+	if (!(idx->tmp3 = bnode_create(idx)))
 		goto bailout;
 
-	idx->tmp->leaf = 1;
-	idx->root_node = bnode_add_block(idx, idx->tmp);
-	idx->max_substring_len = 32;
+	if (!reopened)
+	{
+		/* The first block is reserved for the superblock */
+		if (bnode_add_block(idx, idx->tmp) != INDEX_EXTERNAL_SUPERBLOCK)
+			goto bailout;
+
+		idx->tmp->leaf = 1;
+		idx->root_node = bnode_add_block(idx, idx->tmp);
+
+		if (!index_external_write_superblock(idx))
+			goto bailout;
+	}
 
 	return &idx->index;
 bailout:
@@ -885,33 +1770,30 @@ static struct index *index_external_create(const char *filename)
  */
 static int index_external_append_string(struct index_external *idx, const char *text, long *offset)
 {
-	/* Determine position and write text */
-	if (fseek(idx->string_file, 0, SEEK_END) != 0)
+	/* Strings beyond the known size are leftovers of a failed bulk load */
+	if (fseek(idx->string_file, idx->strings_size, SEEK_SET) != 0)
 		return 0;
-	*offset = ftell(idx->string_file);
+	*offset = idx->strings_size;
 	fputs(text, idx->string_file);
 	fputc(0, idx->string_file);
+	idx->strings_size = *offset + strlen(text) + 1;
 
 	return 1;
 }
 
 /**
- * Structure representing an offset/did pair.
- */
-struct offset_entry
-{
-	int offset;
-	int did;
-};
-
-/**
- * Appends the given offset did pair to the offsets file.
+ * Appends the given offset did pair to the offsets file and to the document
+ * table. The caller is responsible for incrementing the number of documents.
  */
 static int index_external_append_offset_did_pair(struct index_external *idx, int offset, int did)
 {
 	struct offset_entry entry;
 
-	if (fseek(idx->offset_file, 0, SEEK_END) != 0)
+	if (!index_external_ensure_documents(idx, idx->number_of_documents + 1))
+		return 0;
+
+	/* Entries beyond the ones accounted for by the superblock are stale */
+	if (fseek(idx->offset_file, idx->number_of_documents * sizeof(entry), SEEK_SET) != 0)
 		return 0;
 
 	entry.offset = offset;
@@ -919,7 +1801,9 @@ static int index_external_append_offset_did_pair(struct index_external *idx, int
 
 	if (fwrite(&entry, 1, sizeof(entry), idx->offset_file) != sizeof(entry))
 		return 0;
-	return 1;
+
+	idx->documents[idx->number_of_documents] = entry;
+	return index_external_add_did_slot(idx, idx->number_of_documents);
 }
 
 int index_external_put_document(struct index *index, int did, const char *text)
@@ -936,6 +1820,7 @@ int index_external_put_document(struct index *index, int did, const char *text)
 
 	if (!index_external_append_offset_did_pair(idx, offset, did))
 		return 0;
+	idx->number_of_documents++;
 
 	for (i=0; i < l; i++)
 	{
@@ -943,15 +1828,1043 @@ int index_external_put_document(struct index *index, int did, const char *text)
 			return 0;
 	}
 
-	return 1;
+	return index_external_write_superblock(idx);
 }
 
-int index_external_remove_document(struct index *index, int did)
+/**
+ * A suffix as it is handled during the bulk load. The record is followed
+ * by the zero-terminated prefix of the suffix, which is not longer than
+ * max_substring_len.
+ */
+struct index_external_suffix
 {
-	return 0;
-}
+	unsigned int str_offset;
+	unsigned int str_len;
+	int did;
+	char prefix[1];
+};
 
-int index_external_find_documents(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, va_list substrings)
+/**
+ * Returns the size of a single suffix record for the given index.
+ *
+ * @param idx
+ * @return
+ */
+static size_t index_external_suffix_size(struct index_external *idx)
+{
+	size_t size = offsetof(struct index_external_suffix, prefix) + idx->max_substring_len + 1;
+	return (size + sizeof(int) - 1) & ~(sizeof(int) - 1);
+}
+
+/**
+ * Compares two suffixes. Suffixes with the same prefix are ordered by their
+ * offset in order to get a deterministic layout.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int index_external_suffix_compare(const void *a, const void *b)
+{
+	const struct index_external_suffix *sa = (const struct index_external_suffix *)a;
+	const struct index_external_suffix *sb = (const struct index_external_suffix *)b;
+	int cmp;
+
+	if ((cmp = strcmp(sa->prefix, sb->prefix)))
+		return cmp;
+	if (sa->str_offset < sb->str_offset) return -1;
+	if (sa->str_offset > sb->str_offset) return 1;
+	return 0;
+}
+
+/**
+ * Reads sorted suffixes either from a run in a file or from memory.
+ */
+struct index_external_run_reader
+{
+	/** The file that contains the run or NULL, if the run is in memory */
+	FILE *fh;
+
+	/** The file position of the next suffix that is not yet buffered */
+	long next_pos;
+
+	/** Number of suffixes of the run that are not yet buffered */
+	long remaining;
+
+	char *buf;
+	int buf_count;
+	int buf_index;
+};
+
+/**
+ * Returns the current suffix of the run or NULL if the run is exhausted.
+ *
+ * @param idx
+ * @param r
+ * @return
+ */
+static struct index_external_suffix *index_external_run_reader_current(struct index_external *idx, struct index_external_run_reader *r)
+{
+	if (r->buf_index >= r->buf_count)
+		return NULL;
+	return (struct index_external_suffix *)(r->buf + r->buf_index * index_external_suffix_size(idx));
+}
+
+/**
+ * Fill the buffer of the given reader if it has been consumed.
+ *
+ * @param idx
+ * @param r
+ * @return 0 on failure, else something different.
+ */
+static int index_external_run_reader_fill(struct index_external *idx, struct index_external_run_reader *r)
+{
+	size_t suffix_size = index_external_suffix_size(idx);
+	long count;
+
+	if (r->buf_index < r->buf_count || !r->remaining || !r->fh)
+		return 1;
+
+	count = r->remaining;
+	if (count > INDEX_EXTERNAL_BULK_RUN_BUFFER)
+		count = INDEX_EXTERNAL_BULK_RUN_BUFFER;
+
+	if (fseek(r->fh, r->next_pos, SEEK_SET))
+		return 0;
+	if (fread(r->buf, suffix_size, count, r->fh) != count)
+		return 0;
+
+	r->next_pos += count * suffix_size;
+	r->remaining -= count;
+	r->buf_count = count;
+	r->buf_index = 0;
+	return 1;
+}
+
+/**
+ * Advances the given reader to the next suffix.
+ *
+ * @param idx
+ * @param r
+ * @return 0 on failure, else something different.
+ */
+static int index_external_run_reader_next(struct index_external *idx, struct index_external_run_reader *r)
+{
+	r->buf_index++;
+	return index_external_run_reader_fill(idx, r);
+}
+
+/**
+ * Reads all suffixes that are referenced by the leaves of the tree in
+ * lexicographical order.
+ */
+struct index_external_leaf_reader
+{
+	bnode *node;
+	int index;
+
+	/** The current suffix or NULL if there are no more suffixes */
+	struct index_external_suffix *current;
+};
+
+/**
+ * Advances the given leaf reader to the next suffix.
+ *
+ * @param idx
+ * @param r
+ * @return 0 on failure, else something different.
+ */
+static int index_external_leaf_reader_next(struct index_external *idx, struct index_external_leaf_reader *r)
+{
+	struct bnode_element *e;
+	const char *str;
+
+	while (r->index >= r->node->num_elements)
+	{
+		if (r->node->sibling == -1)
+		{
+			r->current = NULL;
+			return 1;
+		}
+		if (!bnode_read_block(idx, r->node, r->node->sibling))
+			return 0;
+		r->index = 0;
+	}
+
+	e = bnode_get_ith_element_of_node(idx, r->node, r->index++);
+	if (!(str = bnode_get_string(idx, e)))
+		return 0;
+
+	r->current->str_offset = e->str_offset;
+	r->current->str_len = e->str_len;
+	r->current->did = e->leaf.did;
+	strcpy(r->current->prefix, str);
+	return 1;
+}
+
+/**
+ * Initializes the leaf reader such that it refers to the first suffix of
+ * the tree.
+ *
+ * @param idx
+ * @param r
+ * @param current memory for the current suffix
+ * @return 0 on failure, else something different.
+ */
+static int index_external_leaf_reader_init(struct index_external *idx, struct index_external_leaf_reader *r, struct index_external_suffix *current)
+{
+	int block = idx->root_node;
+
+	r->current = current;
+	r->index = 0;
+	if (!(r->node = bnode_create(idx)))
+		return 0;
+
+	do
+	{
+		if (!bnode_read_block(idx, r->node, block))
+			return 0;
+		block = r->node->lchild;
+	} while (!r->node->leaf);
+
+	return index_external_leaf_reader_next(idx, r);
+}
+
+/**
+ * Builds a tree bottom-up from suffixes that are supplied in lexicographical
+ * order. For each level of the tree, only the rightmost node is kept in
+ * memory.
+ */
+struct bnode_builder
+{
+	struct index_external *idx;
+	FILE *fh;
+	int number_of_blocks;
+	int num_levels;
+
+	struct
+	{
+		bnode *node;
+		int block;
+	} level[BNODE_PATH_MAX_NODES];
+};
+
+/**
+ * Writes the given node into the file of the builder.
+ *
+ * @param b
+ * @param node
+ * @param block
+ * @return 0 on failure, else something different.
+ */
+static int bnode_builder_write(struct bnode_builder *b, bnode *node, int block)
+{
+	if (fseek(b->fh, block * b->idx->block_size, SEEK_SET))
+		return 0;
+	if (fwrite(node, 1, b->idx->block_size, b->fh) != b->idx->block_size)
+		return 0;
+	return 1;
+}
+
+/**
+ * Prepares the node of the given level to receive new elements. The node is
+ * assigned a new block number.
+ *
+ * @param b
+ * @param level
+ * @param leaf
+ * @param lchild the lchild of the node (only for internal nodes)
+ * @return 0 on failure, else something different.
+ */
+static int bnode_builder_start_node(struct bnode_builder *b, int level, int leaf, int lchild)
+{
+	bnode *n;
+
+	if (level >= BNODE_PATH_MAX_NODES)
+		return 0;
+
+	if (level == b->num_levels)
+	{
+		if (!(b->level[level].node = bnode_create(b->idx)))
+			return 0;
+		b->num_levels++;
+	}
+
+	n = b->level[level].node;
+	memset(n, 0, b->idx->block_size);
+	n->leaf = leaf;
+	n->lchild = leaf?0:lchild;
+	n->sibling = -1;
+	b->level[level].block = b->number_of_blocks++;
+	return 1;
+}
+
+/**
+ * Adds an element to the node of the given level. If the node is full, it
+ * is written and a new node is started. The separation key of the new node
+ * is then added to the parent level.
+ *
+ * @param b
+ * @param level
+ * @param e the element to add. For internal nodes, the element refers to
+ *  the child via gchild.
+ * @param child_lchild for internal nodes, the block of the leftmost node of
+ *  the child level.
+ * @return 0 on failure, else something different.
+ */
+static int bnode_builder_add(struct bnode_builder *b, int level, const struct bnode_element *e, int child_lchild)
+{
+	struct index_external *idx = b->idx;
+	struct bnode_element sep;
+	bnode *n;
+	int prev_block;
+
+	if (level == b->num_levels)
+	{
+		if (!bnode_builder_start_node(b, level, level == 0, child_lchild))
+			return 0;
+	}
+
+	n = b->level[level].node;
+
+	/* Nodes are packed such that they contain one element less than the
+	 * maximum, as a node with the maximum number of elements is split */
+	if (n->num_elements < idx->max_elements_per_node - 1)
+	{
+		*bnode_get_ith_element_of_node(idx, n, n->num_elements++) = *e;
+		return 1;
+	}
+
+	prev_block = b->level[level].block;
+	n->sibling = b->number_of_blocks;
+	if (!bnode_builder_write(b, n, prev_block))
+		return 0;
+
+	if (level == 0)
+	{
+		if (!bnode_builder_start_node(b, level, 1, 0))
+			return 0;
+		*bnode_get_ith_element_of_node(idx, n, n->num_elements++) = *e;
+	} else
+	{
+		/* The child that is referenced by the element becomes the lchild
+		 * of the new node */
+		if (!bnode_builder_start_node(b, level, 0, e->internal.gchild))
+			return 0;
+	}
+
+	/* The new node is separated by the first key of its subtree */
+	sep = *e;
+	sep.internal.gchild = b->level[level].block;
+	return bnode_builder_add(b, level + 1, &sep, prev_block);
+}
+
+/**
+ * Adds the given suffix to the tree that is being built.
+ *
+ * @param b
+ * @param suffix
+ * @return 0 on failure, else something different.
+ */
+static int bnode_builder_add_suffix(struct bnode_builder *b, const struct index_external_suffix *suffix)
+{
+	struct bnode_element e;
+
+	memset(&e, 0, sizeof(e));
+	e.str_offset = suffix->str_offset;
+	e.str_len = suffix->str_len;
+	e.leaf.did = suffix->did;
+	return bnode_builder_add(b, 0, &e, 0);
+}
+
+/**
+ * Writes all pending nodes of the builder.
+ *
+ * @param b
+ * @param out_root_node where the block of the root node is stored.
+ * @return 0 on failure, else something different.
+ */
+static int bnode_builder_finish(struct bnode_builder *b, int *out_root_node)
+{
+	int i;
+
+	/* An empty tree consists of an empty leaf */
+	if (!b->num_levels)
+	{
+		if (!bnode_builder_start_node(b, 0, 1, 0))
+			return 0;
+	}
+
+	for (i = 0; i < b->num_levels; i++)
+	{
+		if (!bnode_builder_write(b, b->level[i].node, b->level[i].block))
+			return 0;
+	}
+	*out_root_node = b->level[b->num_levels - 1].block;
+	return 1;
+}
+
+/**
+ * Frees all resources of the given builder.
+ *
+ * @param b
+ */
+static void bnode_builder_clean(struct bnode_builder *b)
+{
+	int i;
+
+	for (i = 0; i < b->num_levels; i++)
+		bnode_free(b->idx, b->level[i].node);
+	b->num_levels = 0;
+}
+
+/**
+ * Sorts suffixes in bounded memory. Suffixes are collected in a buffer that
+ * is sorted and written as a run to a temporary file when it is full.
+ */
+struct index_external_sorter
+{
+	char *buf;
+	int count;
+
+	/** The file with all runs, NULL if no run has been written yet */
+	FILE *runs_file;
+
+	/** Number of suffixes of each run in runs_file */
+	long *run_lengths;
+	int num_runs;
+	int max_runs;
+};
+
+/**
+ * Sorts the buffered suffixes and writes them as a new run.
+ *
+ * @param idx
+ * @param s
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_flush(struct index_external *idx, struct index_external_sorter *s)
+{
+	size_t suffix_size = index_external_suffix_size(idx);
+
+	if (!s->count)
+		return 1;
+
+	qsort(s->buf, s->count, suffix_size, index_external_suffix_compare);
+
+	if (!s->runs_file)
+	{
+		if (!(s->runs_file = tmpfile()))
+			return 0;
+	}
+
+	if (s->num_runs == s->max_runs)
+	{
+		long *new_run_lengths;
+		int new_max_runs = s->max_runs * 2 + 16;
+
+		if (!(new_run_lengths = (long *)realloc(s->run_lengths, new_max_runs * sizeof(long))))
+			return 0;
+		s->run_lengths = new_run_lengths;
+		s->max_runs = new_max_runs;
+	}
+
+	if (fseek(s->runs_file, 0, SEEK_END))
+		return 0;
+	if (fwrite(s->buf, suffix_size, s->count, s->runs_file) != s->count)
+		return 0;
+
+	s->run_lengths[s->num_runs++] = s->count;
+	s->count = 0;
+	return 1;
+}
+
+/**
+ * Adds the given suffix to the sorter.
+ *
+ * @param idx
+ * @param s
+ * @param did
+ * @param str_offset
+ * @param text the suffix
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_add(struct index_external *idx, struct index_external_sorter *s, int did, unsigned int str_offset, const char *text)
+{
+	struct index_external_suffix *suffix;
+	size_t len;
+
+	if (s->count == idx->bulk_run_size)
+	{
+		if (!index_external_sorter_flush(idx, s))
+			return 0;
+	}
+
+	suffix = (struct index_external_suffix *)(s->buf + s->count * index_external_suffix_size(idx));
+	len = strlen(text);
+
+	suffix->str_offset = str_offset;
+	suffix->str_len = len;
+	suffix->did = did;
+	if (len > idx->max_substring_len)
+		len = idx->max_substring_len;
+	memcpy(suffix->prefix, text, len);
+	suffix->prefix[len] = 0;
+
+	s->count++;
+	return 1;
+}
+
+/**
+ * Initializes the run readers for the runs [first, first + num) of the given
+ * sorter. The runs are stored consecutively in the runs file.
+ *
+ * @param idx
+ * @param s
+ * @param first
+ * @param num
+ * @param readers
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_init_readers(struct index_external *idx, struct index_external_sorter *s, int first, int num, struct index_external_run_reader *readers)
+{
+	size_t suffix_size = index_external_suffix_size(idx);
+	long pos = 0;
+	int i;
+
+	for (i = 0; i < first; i++)
+		pos += s->run_lengths[i] * suffix_size;
+
+	for (i = 0; i < num; i++)
+	{
+		struct index_external_run_reader *r = &readers[i];
+
+		memset(r, 0, sizeof(*r));
+		if (!(r->buf = (char *)malloc(INDEX_EXTERNAL_BULK_RUN_BUFFER * suffix_size)))
+			return 0;
+		r->fh = s->runs_file;
+		r->next_pos = pos;
+		r->remaining = s->run_lengths[first + i];
+		if (!index_external_run_reader_fill(idx, r))
+			return 0;
+
+		pos += s->run_lengths[first + i] * suffix_size;
+	}
+	return 1;
+}
+
+/**
+ * Frees the buffers of the given run readers.
+ *
+ * @param readers
+ * @param num
+ */
+static void index_external_run_readers_clean(struct index_external_run_reader *readers, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+	{
+		if (readers[i].fh)
+			free(readers[i].buf);
+		readers[i].buf = NULL;
+	}
+}
+
+/**
+ * Returns the reader whose current suffix is the smallest.
+ *
+ * @param idx
+ * @param readers
+ * @param num
+ * @return the index of the reader or -1 if all readers are exhausted.
+ */
+static int index_external_run_readers_min(struct index_external *idx, struct index_external_run_reader *readers, int num)
+{
+	struct index_external_suffix *min = NULL;
+	int min_index = -1;
+	int i;
+
+	for (i = 0; i < num; i++)
+	{
+		struct index_external_suffix *current = index_external_run_reader_current(idx, &readers[i]);
+		if (!current)
+			continue;
+		if (!min || index_external_suffix_compare(current, min) < 0)
+		{
+			min = current;
+			min_index = i;
+		}
+	}
+	return min_index;
+}
+
+/**
+ * Merges the runs [first, first + num) of the given sorter and appends the
+ * result as a single run to the given file.
+ *
+ * @param idx
+ * @param s
+ * @param first
+ * @param num
+ * @param merged_file
+ * @param out_length where the number of suffixes of the merged run is stored.
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_merge(struct index_external *idx, struct index_external_sorter *s, int first, int num, FILE *merged_file, long *out_length)
+{
+	struct index_external_run_reader readers[INDEX_EXTERNAL_BULK_MERGE_FANIN];
+	size_t suffix_size = index_external_suffix_size(idx);
+	long length = 0;
+	int rc = 0;
+	int i;
+
+	memset(readers, 0, sizeof(readers));
+
+	if (!index_external_sorter_init_readers(idx, s, first, num, readers))
+		goto out;
+
+	if (fseek(merged_file, 0, SEEK_END))
+		goto out;
+
+	while ((i = index_external_run_readers_min(idx, readers, num)) != -1)
+	{
+		if (fwrite(index_external_run_reader_current(idx, &readers[i]), suffix_size, 1, merged_file) != 1)
+			goto out;
+		length++;
+
+		/* The reader may seek in the runs file, which is a different file */
+		if (!index_external_run_reader_next(idx, &readers[i]))
+			goto out;
+	}
+
+	*out_length = length;
+	rc = 1;
+out:
+	index_external_run_readers_clean(readers, num);
+	return rc;
+}
+
+/**
+ * Merges the runs of the sorter until at most INDEX_EXTERNAL_BULK_MERGE_FANIN
+ * runs are left.
+ *
+ * @param idx
+ * @param s
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_reduce(struct index_external *idx, struct index_external_sorter *s)
+{
+	while (s->num_runs > INDEX_EXTERNAL_BULK_MERGE_FANIN)
+	{
+		FILE *merged_file;
+		long *merged_run_lengths;
+		int num_merged_runs = 0;
+		int first;
+
+		if (!(merged_run_lengths = (long *)malloc((s->num_runs / INDEX_EXTERNAL_BULK_MERGE_FANIN + 1) * sizeof(long))))
+			return 0;
+
+		if (!(merged_file = tmpfile()))
+		{
+			free(merged_run_lengths);
+			return 0;
+		}
+
+		for (first = 0; first < s->num_runs; first += INDEX_EXTERNAL_BULK_MERGE_FANIN)
+		{
+			int num = s->num_runs - first;
+
+			if (num > INDEX_EXTERNAL_BULK_MERGE_FANIN)
+				num = INDEX_EXTERNAL_BULK_MERGE_FANIN;
+
+			if (!index_external_sorter_merge(idx, s, first, num, merged_file, &merged_run_lengths[num_merged_runs++]))
+			{
+				free(merged_run_lengths);
+				fclose(merged_file);
+				return 0;
+			}
+		}
+
+		fclose(s->runs_file);
+		free(s->run_lengths);
+		s->runs_file = merged_file;
+		s->run_lengths = merged_run_lengths;
+		s->num_runs = s->max_runs = num_merged_runs;
+	}
+	return 1;
+}
+
+/**
+ * Frees all resources of the given sorter.
+ *
+ * @param s
+ */
+static void index_external_sorter_clean(struct index_external_sorter *s)
+{
+	if (s->runs_file) fclose(s->runs_file);
+	free(s->run_lengths);
+	free(s->buf);
+}
+
+/**
+ * Prepares the readers that deliver the suffixes of the given sorter in
+ * lexicographical order.
+ *
+ * @param idx
+ * @param s
+ * @param readers array of at least INDEX_EXTERNAL_BULK_MERGE_FANIN readers
+ *  that must be cleaned with index_external_run_readers_clean().
+ * @param out_num_readers where the number of readers that are in use is
+ *  stored.
+ * @return 0 on failure, else something different.
+ */
+static int index_external_sorter_open_readers(struct index_external *idx, struct index_external_sorter *s, struct index_external_run_reader *readers, int *out_num_readers)
+{
+	/* The sorted suffixes either are still in memory or in runs */
+	if (s->runs_file)
+	{
+		if (!index_external_sorter_flush(idx, s))
+			return 0;
+		if (!index_external_sorter_reduce(idx, s))
+			return 0;
+		*out_num_readers = s->num_runs;
+		if (!index_external_sorter_init_readers(idx, s, 0, s->num_runs, readers))
+			return 0;
+	} else
+	{
+		qsort(s->buf, s->count, index_external_suffix_size(idx), index_external_suffix_compare);
+		readers[0].buf = s->buf;
+		readers[0].buf_count = s->count;
+		*out_num_readers = 1;
+	}
+	return 1;
+}
+
+/**
+ * Inserts the suffixes of the given sorter into the existing tree. As the
+ * suffixes are inserted in lexicographical order, the nodes along the way
+ * are mostly found in the node cache, so each leaf is usually read and
+ * written only once per batch. On failure, the tree may contain some of the
+ * suffixes.
+ *
+ * @param idx
+ * @param s
+ * @return 0 on failure, else something different.
+ */
+static int index_external_merge_into_tree(struct index_external *idx, struct index_external_sorter *s)
+{
+	struct index_external_run_reader readers[INDEX_EXTERNAL_BULK_MERGE_FANIN];
+	int num_readers = 0;
+	int rc = 0;
+	int i;
+
+	memset(readers, 0, sizeof(readers));
+
+	if (!index_external_sorter_open_readers(idx, s, readers, &num_readers))
+		goto out;
+
+	while ((i = index_external_run_readers_min(idx, readers, num_readers)) != -1)
+	{
+		struct index_external_suffix *suffix = index_external_run_reader_current(idx, &readers[i]);
+		struct bnode_element e;
+
+		memset(&e, 0, sizeof(e));
+		e.str_offset = suffix->str_offset;
+		e.str_len = suffix->str_len;
+		e.leaf.did = suffix->did;
+		if (!bnode_insert_element(idx, suffix->prefix, &e))
+			goto out;
+
+		if (!index_external_run_reader_next(idx, &readers[i]))
+			goto out;
+	}
+
+	rc = index_external_write_superblock(idx);
+out:
+	index_external_run_readers_clean(readers, num_readers);
+	return rc;
+}
+
+/**
+ * Builds a new tree from the existing suffixes of the index and the
+ * suffixes of the given sorter. The new tree replaces the old one, which
+ * stays in use if anything goes wrong.
+ *
+ * @param idx
+ * @param s
+ * @return 0 on failure, else something different.
+ */
+static int index_external_rebuild_tree(struct index_external *idx, struct index_external_sorter *s)
+{
+	struct index_external_run_reader readers[INDEX_EXTERNAL_BULK_MERGE_FANIN + 1];
+	struct index_external_leaf_reader leaf_reader;
+	struct index_external_suffix *leaf_suffix = NULL;
+	struct bnode_builder b;
+	char new_filename[380];
+	char old_filename[380];
+	char filename[380];
+	FILE *old_file;
+	int old_root_node;
+	int old_number_of_blocks;
+	int num_readers = 0;
+	int root_node;
+	int written;
+	int rc = 0;
+	int i;
+
+	memset(&b, 0, sizeof(b));
+	memset(&leaf_reader, 0, sizeof(leaf_reader));
+	memset(readers, 0, sizeof(readers));
+
+	sm_snprintf(filename, sizeof(filename), "%s.index", idx->filename);
+	sm_snprintf(new_filename, sizeof(new_filename), "%s.index.new", idx->filename);
+	sm_snprintf(old_filename, sizeof(old_filename), "%s.index.old", idx->filename);
+
+	if (!index_external_sorter_open_readers(idx, s, readers, &num_readers))
+		goto out;
+
+	/* The suffixes that are already in the tree are merged as well, we put
+	 * them into a reader of its own that is refilled manually */
+	if (!(leaf_suffix = (struct index_external_suffix *)malloc(index_external_suffix_size(idx))))
+		goto out;
+	if (!index_external_leaf_reader_init(idx, &leaf_reader, leaf_suffix))
+		goto out;
+
+	b.idx = idx;
+	b.number_of_blocks = INDEX_EXTERNAL_SUPERBLOCK + 1;
+	if (!(b.fh = fopen(new_filename, "w+b")))
+		goto out;
+
+	while (1)
+	{
+		struct index_external_suffix *suffix;
+
+		i = index_external_run_readers_min(idx, readers, num_readers);
+		suffix = i != -1 ? index_external_run_reader_current(idx, &readers[i]) : NULL;
+
+		if (leaf_reader.current && (!suffix || index_external_suffix_compare(leaf_reader.current, suffix) <= 0))
+		{
+			if (!bnode_builder_add_suffix(&b, leaf_reader.current))
+				goto out;
+			if (!index_external_leaf_reader_next(idx, &leaf_reader))
+				goto out;
+			continue;
+		}
+
+		if (!suffix)
+			break;
+
+		if (!bnode_builder_add_suffix(&b, suffix))
+			goto out;
+		if (!index_external_run_reader_next(idx, &readers[i]))
+			goto out;
+	}
+
+	if (!bnode_builder_finish(&b, &root_node))
+		goto out;
+
+	/* Write the superblock of the new tree. The old tree stays in use until
+	 * the new one is in place */
+	old_file = idx->index_file;
+	old_root_node = idx->root_node;
+	old_number_of_blocks = idx->number_of_blocks;
+	idx->index_file = b.fh;
+	idx->root_node = root_node;
+	idx->number_of_blocks = b.number_of_blocks;
+	written = index_external_write_superblock(idx);
+	idx->index_file = old_file;
+	if (!written)
+		goto restore;
+
+	fclose(b.fh);
+	b.fh = NULL;
+
+	/* Now replace the tree, the old one is moved aside as some systems
+	 * can't rename onto an existing file */
+	fclose(idx->index_file);
+	idx->index_file = NULL;
+	index_external_cache_clear(&idx->node_cache);
+
+	remove(old_filename);
+	if (rename(filename, old_filename))
+		goto reopen;
+	if (rename(new_filename, filename))
+	{
+		rename(old_filename, filename);
+		goto reopen;
+	}
+	if (!(idx->index_file = fopen(filename, "r+b")))
+	{
+		remove(filename);
+		rename(old_filename, filename);
+		goto reopen;
+	}
+	remove(old_filename);
+
+	rc = 1;
+	goto out;
+
+reopen:
+	idx->index_file = fopen(filename, "r+b");
+restore:
+	idx->root_node = old_root_node;
+	idx->number_of_blocks = old_number_of_blocks;
+	remove(new_filename);
+out:
+	if (b.fh) fclose(b.fh);
+	bnode_builder_clean(&b);
+	if (leaf_reader.node) bnode_free(idx, leaf_reader.node);
+	free(leaf_suffix);
+	index_external_run_readers_clean(readers, num_readers);
+	return rc;
+}
+
+/**
+ * Marks the given entry of the document table as removed.
+ *
+ * @param idx
+ * @param doc
+ * @return 0 on failure, else something different.
+ */
+static int index_external_mark_document_removed(struct index_external *idx, int doc)
+{
+	if (!idx->tombstone_file)
+	{
+		char buf[380];
+
+		sm_snprintf(buf, sizeof(buf), "%s.tombstones", idx->filename);
+		if (!(idx->tombstone_file = fopen(buf, "r+b")))
+		{
+			if (!(idx->tombstone_file = fopen(buf, "w+b")))
+				return 0;
+		}
+	}
+
+	/* The suffixes stay in the tree, we only mark the document as removed */
+	idx->tombstones[doc / 8] |= 1 << (doc % 8);
+	idx->dead_bytes += index_external_document_len(idx, doc) + 1;
+
+	if (fseek(idx->tombstone_file, doc / 8, SEEK_SET))
+		return 0;
+	if (fputc(idx->tombstones[doc / 8], idx->tombstone_file) == EOF)
+		return 0;
+	if (fflush(idx->tombstone_file))
+		return 0;
+	return 1;
+}
+
+int index_external_put_documents(struct index *index, int num_documents, const int *dids, const char * const *texts)
+{
+	struct index_external *idx;
+	struct index_external_sorter s;
+	int old_number_of_documents;
+	long old_strings_size;
+	long tree_suffixes;
+	long batch_suffixes = 0;
+	int rc = 0;
+	int i;
+
+	idx = (struct index_external*)index;
+
+	old_number_of_documents = idx->number_of_documents;
+	old_strings_size = idx->strings_size;
+
+	/* Each document contributes its length plus a terminating zero byte to
+	 * the strings, but only its length to the suffixes */
+	tree_suffixes = old_strings_size - old_number_of_documents;
+
+	memset(&s, 0, sizeof(s));
+	if (!(s.buf = (char *)malloc(idx->bulk_run_size * index_external_suffix_size(idx))))
+		return 0;
+
+	for (i = 0; i < num_documents; i++)
+	{
+		const char *text = texts[i];
+		int did = dids[i];
+		int l = strlen(text);
+		long offset;
+		int j;
+
+		if (!index_external_append_string(idx, text, &offset))
+			goto rollback;
+
+		if (!index_external_append_offset_did_pair(idx, offset, did))
+			goto rollback;
+		idx->number_of_documents++;
+
+		for (j = 0; j < l; j++)
+		{
+			if (!index_external_sorter_add(idx, &s, did, offset + j, text + j))
+				goto rollback;
+		}
+		batch_suffixes += l;
+	}
+
+	/* Small batches are merged into the existing leaves, rebuilding the
+	 * tree for each of them would be quadratic in the number of batches */
+	if (batch_suffixes * INDEX_EXTERNAL_BULK_MERGE_RATIO <= tree_suffixes)
+	{
+		if ((rc = index_external_merge_into_tree(idx, &s)))
+			goto out;
+
+		/* Some suffixes may have made it into the tree, so the documents
+		 * must be kept but are marked as removed */
+		for (i = old_number_of_documents; i < idx->number_of_documents; i++)
+			index_external_mark_document_removed(idx, i);
+		index_external_write_superblock(idx);
+		goto out;
+	}
+
+	if ((rc = index_external_rebuild_tree(idx, &s)))
+		goto out;
+
+rollback:
+	/* The tree is unchanged, so forget about the new documents. Their
+	 * strings will be overwritten by the next ones */
+	idx->number_of_documents = old_number_of_documents;
+	idx->strings_size = old_strings_size;
+	index_external_cache_clear(&idx->string_cache);
+out:
+	index_external_sorter_clean(&s);
+	return rc;
+}
+
+int index_external_remove_document(struct index *index, int did)
+{
+	struct index_external *idx;
+	int removed = 0;
+	unsigned int j;
+
+	idx = (struct index_external*)index;
+
+	if (!idx->did_slots)
+		return 0;
+
+	/* A document id may have been put several times, so follow the whole
+	 * chain. Slots beyond the accounted entries are leftovers of a failed
+	 * bulk load */
+	for (j = index_external_did_hash(did) & idx->did_slots_mask; idx->did_slots[j] != -1; j = (j + 1) & idx->did_slots_mask)
+	{
+		int doc = idx->did_slots[j];
+
+		if (doc >= idx->number_of_documents || idx->documents[doc].did != did || index_external_is_document_removed(idx, doc))
+			continue;
+
+		if (!index_external_mark_document_removed(idx, doc))
+			return 0;
+		removed = 1;
+	}
+
+	/* Removing only marks the documents, so get rid of them for real once
+	 * they make up a considerable part of the index. The removal itself
+	 * succeeded even if the compaction fails */
+	if (removed && index_external_needs_compaction(index))
+		index_external_compact(index);
+	return removed;
+}
+
+int index_external_find_documents(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, va_list substrings)
 {
 	int i;
 	int nd = 0;
@@ -983,11 +2896,270 @@ int index_external_find_documents(struct index *index, int (*callback)(int did,
 
 /*****************************************************/
 
+void index_external_set_cache_sizes(struct index *index, int max_cached_nodes, int max_cached_strings)
+{
+	struct index_external *idx = (struct index_external*)index;
+	struct index_external_cache *c;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		struct index_external_cache n;
+		int max_entries;
+
+		if (i == 0)
+		{
+			c = &idx->node_cache;
+			max_entries = max_cached_nodes;
+		} else
+		{
+			c = &idx->string_cache;
+			max_entries = max_cached_strings;
+		}
+
+		if (max_entries < 0)
+			max_entries = 0;
+
+		/* Rebuild the cache with the new size but keep the statistics */
+		if (!index_external_cache_init(&n, max_entries, c->payload_size))
+			continue;
+		n.hits = c->hits;
+		n.misses = c->misses;
+		index_external_cache_clean(c);
+		*c = n;
+	}
+}
+
+/*****************************************************/
+
+void index_external_get_cache_stats(struct index *index, struct index_external_cache_stats *stats)
+{
+	struct index_external *idx = (struct index_external*)index;
+
+	stats->node_hits = idx->node_cache.hits;
+	stats->node_misses = idx->node_cache.misses;
+	stats->cached_nodes = idx->node_cache.num_entries;
+	stats->string_hits = idx->string_cache.hits;
+	stats->string_misses = idx->string_cache.misses;
+	stats->cached_strings = idx->string_cache.num_entries;
+}
+
+/*****************************************************/
+
+void index_external_set_compaction_threshold(struct index *index, int percent, long min_garbage)
+{
+	struct index_external *idx = (struct index_external*)index;
+
+	idx->compaction_percent = percent;
+	idx->compaction_min_garbage = min_garbage;
+}
+
+/*****************************************************/
+
+int index_external_needs_compaction(struct index *index)
+{
+	struct index_external *idx = (struct index_external*)index;
+
+	if (!idx->dead_bytes || idx->dead_bytes < idx->compaction_min_garbage)
+		return 0;
+	return idx->dead_bytes * 100 >= (double)idx->strings_size * idx->compaction_percent;
+}
+
+/*****************************************************/
+
+/**
+ * Removes the files that make up the index of the given name.
+ *
+ * @param filename
+ */
+static void index_external_remove_files(const char *filename)
+{
+	static const char * const suffixes[] = {".index", ".strings", ".offsets", ".tombstones"};
+	char buf[380];
+	int i;
+
+	for (i = 0; i < sizeof(suffixes)/sizeof(suffixes[0]); i++)
+	{
+		sm_snprintf(buf, sizeof(buf), "%s%s", filename, suffixes[i]);
+		remove(buf);
+	}
+}
+
+/**
+ * Puts all documents of the given index that are not removed into the
+ * given new index.
+ *
+ * @param idx
+ * @param nidx
+ * @return 0 on failure, else something different.
+ */
+static int index_external_copy_live_documents(struct index_external *idx, struct index_external *nidx)
+{
+	struct index_external_sorter s;
+	char *text = NULL;
+	int rc = 0;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	if (!(s.buf = (char *)malloc(nidx->bulk_run_size * index_external_suffix_size(nidx))))
+		return 0;
+
+	for (i = 0; i < idx->number_of_documents; i++)
+	{
+		long len;
+		long offset;
+		int did = idx->documents[i].did;
+		int j;
+
+		if (index_external_is_document_removed(idx, i))
+			continue;
+
+		len = index_external_document_len(idx, i);
+		if (!(text = (char *)malloc(len + 1)))
+			goto out;
+		if (fseek(idx->string_file, idx->documents[i].offset, SEEK_SET))
+			goto out;
+		if (fread(text, 1, len, idx->string_file) != len)
+			goto out;
+		text[len] = 0;
+
+		if (!index_external_append_string(nidx, text, &offset))
+			goto out;
+		if (!index_external_append_offset_did_pair(nidx, offset, did))
+			goto out;
+		nidx->number_of_documents++;
+
+		for (j = 0; j < len; j++)
+		{
+			if (!index_external_sorter_add(nidx, &s, did, offset + j, text + j))
+				goto out;
+		}
+
+		free(text);
+		text = NULL;
+	}
+
+	rc = index_external_rebuild_tree(nidx, &s);
+out:
+	free(text);
+	index_external_sorter_clean(&s);
+	return rc;
+}
+
+/**
+ * Renames the files that make up the index of the given name such that they
+ * make up the index of the other name. The files of the target must not
+ * exist. Missing tombstones are fine as an index without removed documents
+ * has none. On failure, all files that have been renamed are renamed back.
+ *
+ * @param from
+ * @param to
+ * @return 0 on failure, else something different.
+ */
+static int index_external_rename_files(const char *from, const char *to)
+{
+	static const char * const suffixes[] = {".index", ".strings", ".offsets", ".tombstones"};
+	char from_buf[380];
+	char to_buf[380];
+	int i;
+
+	for (i = 0; i < sizeof(suffixes)/sizeof(suffixes[0]); i++)
+	{
+		sm_snprintf(from_buf, sizeof(from_buf), "%s%s", from, suffixes[i]);
+		sm_snprintf(to_buf, sizeof(to_buf), "%s%s", to, suffixes[i]);
+		if (rename(from_buf, to_buf))
+		{
+			FILE *fh;
+
+			if (strcmp(suffixes[i], ".tombstones"))
+				goto bailout;
+			if ((fh = fopen(from_buf, "rb")))
+			{
+				fclose(fh);
+				goto bailout;
+			}
+		}
+	}
+	return 1;
+
+bailout:
+	while (i--)
+	{
+		sm_snprintf(from_buf, sizeof(from_buf), "%s%s", from, suffixes[i]);
+		sm_snprintf(to_buf, sizeof(to_buf), "%s%s", to, suffixes[i]);
+		rename(to_buf, from_buf);
+	}
+	return 0;
+}
+
+int index_external_compact(struct index *index)
+{
+	struct index_external *idx = (struct index_external*)index;
+	struct index_external *nidx;
+	char compact_filename[380];
+	char old_filename[380];
+
+	sm_snprintf(compact_filename, sizeof(compact_filename), "%s.compact", idx->filename);
+	sm_snprintf(old_filename, sizeof(old_filename), "%s.old", idx->filename);
+	index_external_remove_files(compact_filename);
+	index_external_remove_files(old_filename);
+
+	/* Build the compacted index next to the current one, which stays
+	 * untouched until the new one is complete */
+	if (!(nidx = (struct index_external*)index_external_create_with_opts(compact_filename, idx->block_size)))
+		return 0;
+	nidx->bulk_run_size = idx->bulk_run_size;
+
+	if (!index_external_copy_live_documents(idx, nidx))
+	{
+		index_external_dispose(&nidx->index);
+		index_external_remove_files(compact_filename);
+		return 0;
+	}
+	index_external_dispose(&nidx->index);
+
+	/* Now replace the files. The current ones are only moved aside, so
+	 * they can be put back if anything goes wrong */
+	index_external_close_files(idx);
+	index_external_cache_clear(&idx->node_cache);
+	index_external_cache_clear(&idx->string_cache);
+
+	if (!index_external_rename_files(idx->filename, old_filename))
+		goto restore;
+
+	if (!index_external_rename_files(compact_filename, idx->filename))
+	{
+		index_external_rename_files(old_filename, idx->filename);
+		goto restore;
+	}
+
+	memset(idx->tombstones, 0, (idx->allocated_documents + 7) / 8);
+	if (!index_external_reopen(idx, idx->filename))
+	{
+		index_external_remove_files(idx->filename);
+		index_external_rename_files(old_filename, idx->filename);
+		index_external_cache_clear(&idx->node_cache);
+		index_external_cache_clear(&idx->string_cache);
+		goto restore;
+	}
+	index_external_remove_files(old_filename);
+	return 1;
+
+restore:
+	index_external_remove_files(compact_filename);
+	index_external_reopen(idx, idx->filename);
+	return 0;
+}
+
+/*****************************************************/
+
 struct index_algorithm index_external =
 {
 		index_external_create,
 		index_external_dispose,
 		index_external_put_document,
 		index_external_remove_document,
-		index_external_find_documents
+		index_external_find_documents,
+		index_external_put_documents,
+		NULL
 };
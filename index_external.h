@@ -21,4 +21,71 @@
 
 extern struct index_algorithm index_external;
 
+struct index;
+
+/**
+ * Statistics of the caches of an external index.
+ */
+struct index_external_cache_stats
+{
+	unsigned int node_hits;
+	unsigned int node_misses;
+	int cached_nodes;
+
+	unsigned int string_hits;
+	unsigned int string_misses;
+	int cached_strings;
+};
+
+/**
+ * Set the maximum number of nodes and string prefixes that are kept in
+ * memory. Already cached entries are discarded. A value of 0 disables the
+ * respective cache.
+ *
+ * @param index the index, which must have been created with index_external.
+ * @param max_cached_nodes maximum number of nodes to be cached.
+ * @param max_cached_strings maximum number of string prefixes to be cached.
+ */
+void index_external_set_cache_sizes(struct index *index, int max_cached_nodes, int max_cached_strings);
+
+/**
+ * Return the statistics of the caches of the given index.
+ *
+ * @param index the index, which must have been created with index_external.
+ * @param stats the structure that is filled with the statistics.
+ */
+void index_external_get_cache_stats(struct index *index, struct index_external_cache_stats *stats);
+
+/**
+ * Set the amount of text of removed documents at which a compaction is due.
+ *
+ * @param index the index, which must have been created with index_external.
+ * @param percent the percentage of the whole text that must belong to
+ *  removed documents.
+ * @param min_garbage the number of bytes that must belong to removed
+ *  documents at least.
+ */
+void index_external_set_compaction_threshold(struct index *index, int percent, long min_garbage);
+
+/**
+ * Determine whether enough documents have been removed from the index that
+ * a compaction is worthwhile.
+ *
+ * @param index the index, which must have been created with index_external.
+ * @return 1 if index_external_compact() should be called, else 0.
+ */
+int index_external_needs_compaction(struct index *index);
+
+/**
+ * Rewrite the index without the documents that have been removed. Removing
+ * documents only marks them as removed, so this should be called at some
+ * point when index_external_needs_compaction() says so, preferably when
+ * the index is idle. The current files stay untouched until the compacted
+ * ones are complete.
+ *
+ * @param index the index, which must have been created with index_external.
+ * @return success or not. On failure the index is left as it was.
+ */
+int index_external_compact(struct index *index);
+
 #endif
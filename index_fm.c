@@ -0,0 +1,1546 @@
+/**
+ * index_fm.c - a FM-index-based string index implementation for SimpleMail.
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file index_fm.c
+ *
+ * This is an implementation of a string index for mostly static document
+ * collections such as archives. All documents are concatenated, each
+ * followed by a zero byte, and the Burrows-Wheeler transform (BWT) of the
+ * concatenation is stored. This allows to count the occurrences of a pattern
+ * via backward search in a number of steps that is linear in the length of
+ * the pattern. The document of an occurrence is determined by walking back
+ * to a row whose document has been sampled. The text itself is not stored,
+ * it can be reconstructed from the BWT.
+ *
+ * The BWT is kept in a Huffman-shaped wavelet tree, i.e., each symbol takes
+ * as many bits as its Huffman code is long, plus some rank directories. This
+ * answers the occurrence counts directly, so no further tables are needed.
+ *
+ * The separators are treated as distinct symbols that are smaller than all
+ * other symbols and ordered by their position. Thus the first rows of the
+ * sorted suffixes are the suffixes that start with the separator of the
+ * respective document.
+ *
+ * New documents are put into a small delta index that is searched naively.
+ * The delta is merged into the FM-index once it gets too large or on
+ * request. Only the suffixes of the delta are sorted for this. Their rows
+ * in the existing BWT are determined by backward search, after which both
+ * are interleaved in a single pass. Large deltas are merged in chunks whose
+ * size is bounded relative to the existing index, which also bounds the
+ * scratch memory for sorting. Removed documents stay in the BWT until they
+ * make up a considerable part of it. Then the remaining documents are merged
+ * into a fresh index chunk by chunk.
+ */
+
+#include "index_fm.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "index_private.h"
+
+#include "support.h"
+
+/* Get va_vopy() with pre-C99 compilers */
+#ifdef __SASC
+#define va_copy(dest,src) ((dest) = (src))
+#elif defined(__GNUC__) && (__GNUC__ < 3)
+#include <varargs.h>
+#endif
+
+/** Identifies the file of a FM index */
+#define INDEX_FM_MAGIC "SMIF"
+
+/** The current version of the file */
+#define INDEX_FM_VERSION 2
+
+/** Number of words of a bit vector that share a rank checkpoint */
+#define INDEX_FM_RANK_WORDS 8
+
+/** Every text position that is a multiple of this value is sampled */
+#define INDEX_FM_SAMPLE_RATE 32
+
+/** The delta is merged automatically if its texts exceed this size */
+#define INDEX_FM_DELTA_MAX_SIZE (4*1024*1024)
+
+/**
+ * A chunk that is merged at once is at most this size or the size of the
+ * static part divided by this value.
+ */
+#define INDEX_FM_MERGE_RATIO 8
+
+/**
+ * Removed documents are dropped from the static part if their texts make
+ * up more than the size of the static part divided by this value.
+ */
+#define INDEX_FM_REMOVED_RATIO 4
+
+/** Maximum length of a Huffman code of the wavelet tree */
+#define INDEX_FM_MAX_CODE_LENGTH 32
+
+/** The maximum length of the BWT */
+#define INDEX_FM_MAX_SIZE 0xffffffffu
+
+/**
+ * A document of the FM-index.
+ */
+struct fm_document
+{
+	int did;
+	int removed;
+	unsigned int length;
+};
+
+/**
+ * A document of the delta index.
+ */
+struct fm_delta_document
+{
+	int did;
+	char *text;
+};
+
+/**
+ * A bit vector with support for rank queries.
+ */
+struct fm_bits
+{
+	unsigned int num_bits;
+
+	/** The bits, num_bits / 32 + 1 words */
+	unsigned int *words;
+
+	/** Number of set bits before each group of INDEX_FM_RANK_WORDS words */
+	unsigned int *ranks;
+};
+
+/**
+ * An inner node of the wavelet tree.
+ */
+struct fm_wavelet_node
+{
+	/** A set bit means that the symbol is in the right subtree */
+	struct fm_bits bits;
+
+	/** The children, either an inner node or -s-1 for the leaf of symbol s */
+	int child[2];
+};
+
+/**
+ * A Huffman-shaped wavelet tree of a sequence of bytes.
+ */
+struct fm_wavelet_tree
+{
+	struct fm_wavelet_node *nodes;
+	int num_nodes;
+
+	/** The root, see fm_wavelet_node.child */
+	int root;
+
+	/** The code of each symbol, the most significant bit is at the root */
+	unsigned int codes[256];
+	int code_lengths[256];
+};
+
+/**
+ * The static part of the index.
+ */
+struct fm_static
+{
+	/** Length of the BWT including the separators */
+	unsigned int n;
+
+	/** Number of symbols in the text that are smaller than the index */
+	unsigned int c[257];
+
+	/** The BWT */
+	struct fm_wavelet_tree bwt;
+
+	/** Marks the rows whose document is sampled */
+	struct fm_bits marks;
+
+	/** The internal document number of each marked row */
+	int *samples;
+	unsigned int num_samples;
+
+	struct fm_document *documents;
+	int num_documents;
+
+	/** The size of the texts of the removed documents including separators */
+	unsigned int removed_size;
+};
+
+struct index_fm
+{
+	struct index index;
+
+	/** The name of the file or NULL if the index is not persistent */
+	char *filename;
+
+	struct fm_static fm;
+
+	struct fm_delta_document *delta;
+	int num_delta;
+	int allocated_delta;
+	unsigned int delta_size;
+};
+
+/*****************************************************/
+
+/**
+ * Counts the bits set in the given word.
+ *
+ * @param x
+ * @return
+ */
+static unsigned int index_fm_popcount(unsigned int x)
+{
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f;
+	return (x * 0x01010101) >> 24;
+}
+
+/**
+ * Allocates a bit vector whose bits are all cleared.
+ *
+ * @param b
+ * @param num_bits
+ * @return 0 on failure, else something different.
+ */
+static int fm_bits_alloc(struct fm_bits *b, unsigned int num_bits)
+{
+	size_t num_words = num_bits / 32 + 1;
+
+	b->num_bits = num_bits;
+	b->words = (unsigned int*)malloc(num_words * sizeof(b->words[0]));
+	b->ranks = (unsigned int*)malloc((num_words / INDEX_FM_RANK_WORDS + 1) * sizeof(b->ranks[0]));
+	if (!b->words || !b->ranks)
+		return 0;
+	memset(b->words, 0, num_words * sizeof(b->words[0]));
+	return 1;
+}
+
+/**
+ * Frees the given bit vector, but not the bit vector itself.
+ *
+ * @param b
+ */
+static void fm_bits_free(struct fm_bits *b)
+{
+	free(b->words);
+	free(b->ranks);
+	b->words = NULL;
+	b->ranks = NULL;
+	b->num_bits = 0;
+}
+
+/**
+ * Computes the rank directory after all bits have been set.
+ *
+ * @param b
+ */
+static void fm_bits_finish(struct fm_bits *b)
+{
+	unsigned int num_words = b->num_bits / 32 + 1;
+	unsigned int count = 0;
+	unsigned int w;
+
+	for (w = 0; w < num_words; w++)
+	{
+		if (!(w % INDEX_FM_RANK_WORDS))
+			b->ranks[w / INDEX_FM_RANK_WORDS] = count;
+		count += index_fm_popcount(b->words[w]);
+	}
+}
+
+static void fm_bits_set(struct fm_bits *b, unsigned int i)
+{
+	b->words[i / 32] |= 1u << (i % 32);
+}
+
+static int fm_bits_get(const struct fm_bits *b, unsigned int i)
+{
+	return (b->words[i / 32] >> (i % 32)) & 1;
+}
+
+/**
+ * Returns the number of set bits in b[0, i).
+ *
+ * @param b
+ * @param i
+ * @return
+ */
+static unsigned int fm_bits_rank(const struct fm_bits *b, unsigned int i)
+{
+	unsigned int w = i / 32;
+	unsigned int k = w - w % INDEX_FM_RANK_WORDS;
+	unsigned int count = b->ranks[w / INDEX_FM_RANK_WORDS];
+
+	for (; k < w; k++)
+		count += index_fm_popcount(b->words[k]);
+	if (i % 32)
+		count += index_fm_popcount(b->words[w] & ((1u << (i % 32)) - 1));
+	return count;
+}
+
+/*****************************************************/
+
+/**
+ * Frees the given wavelet tree, but not the tree itself.
+ *
+ * @param wt
+ */
+static void fm_wt_free(struct fm_wavelet_tree *wt)
+{
+	int i;
+
+	for (i = 0; i < wt->num_nodes; i++)
+		fm_bits_free(&wt->nodes[i].bits);
+	free(wt->nodes);
+	wt->nodes = NULL;
+	wt->num_nodes = 0;
+}
+
+/**
+ * Assigns the codes to the symbols of the given subtree.
+ *
+ * @param wt
+ * @param item the root of the subtree.
+ * @param code the code of the subtree.
+ * @param len the length of the code.
+ * @return the length of the longest code.
+ */
+static int fm_wt_assign_codes(struct fm_wavelet_tree *wt, int item, unsigned int code, int len)
+{
+	int l0, l1;
+
+	if (item < 0)
+	{
+		wt->codes[-item - 1] = code;
+		wt->code_lengths[-item - 1] = len;
+		return len;
+	}
+
+	l0 = fm_wt_assign_codes(wt, wt->nodes[item].child[0], code << 1, len + 1);
+	l1 = fm_wt_assign_codes(wt, wt->nodes[item].child[1], (code << 1) | 1, len + 1);
+	return l0 > l1 ? l0 : l1;
+}
+
+/**
+ * Determines the shape of a wavelet tree for a sequence with the given
+ * symbol counts and allocates the bit vectors. The shape depends on the
+ * counts only.
+ *
+ * @param wt
+ * @param counts
+ * @return 0 on failure, else something different.
+ */
+static int fm_wt_init(struct fm_wavelet_tree *wt, const unsigned int *counts)
+{
+	unsigned int weights[256];
+	unsigned int item_weights[256];
+	int items[256];
+	int num_items;
+	int sigma = 0;
+	int i, s;
+
+	memset(wt, 0, sizeof(*wt));
+
+	for (s = 0; s < 256; s++)
+	{
+		weights[s] = counts[s];
+		if (counts[s])
+			sigma++;
+	}
+
+	if (!sigma)
+		return 1;
+
+	if (!(wt->nodes = (struct fm_wavelet_node*)malloc(sigma * sizeof(wt->nodes[0]))))
+		return 0;
+
+	/* Build the Huffman tree, flatten the weights if the codes get too long */
+	for (;;)
+	{
+		num_items = 0;
+		for (s = 0; s < 256; s++)
+		{
+			if (!counts[s])
+				continue;
+			items[num_items] = -s - 1;
+			item_weights[num_items++] = weights[s];
+		}
+
+		wt->num_nodes = 0;
+		while (num_items > 1)
+		{
+			struct fm_wavelet_node *node = &wt->nodes[wt->num_nodes];
+			int a = 0, b = 1;
+
+			if (item_weights[b] < item_weights[a])
+			{
+				a = 1;
+				b = 0;
+			}
+			for (i = 2; i < num_items; i++)
+			{
+				if (item_weights[i] < item_weights[a])
+				{
+					b = a;
+					a = i;
+				} else if (item_weights[i] < item_weights[b])
+				{
+					b = i;
+				}
+			}
+
+			node->child[0] = items[a];
+			node->child[1] = items[b];
+			items[a] = wt->num_nodes++;
+			item_weights[a] += item_weights[b];
+			items[b] = items[--num_items];
+			item_weights[b] = item_weights[num_items];
+		}
+		wt->root = items[0];
+
+		if (fm_wt_assign_codes(wt, wt->root, 0, 0) <= INDEX_FM_MAX_CODE_LENGTH)
+			break;
+
+		for (s = 0; s < 256; s++)
+			weights[s] = (weights[s] >> 1) | 1;
+	}
+
+	for (i = 0; i < wt->num_nodes; i++)
+		wt->nodes[i].bits.num_bits = 0;
+
+	/* Each node gets a bit for every occurrence of the symbols below it */
+	for (s = 0; s < 256; s++)
+	{
+		int node = wt->root;
+		int l;
+
+		if (!counts[s])
+			continue;
+
+		for (l = wt->code_lengths[s] - 1; l >= 0; l--)
+		{
+			wt->nodes[node].bits.num_bits += counts[s];
+			node = wt->nodes[node].child[(wt->codes[s] >> l) & 1];
+		}
+	}
+
+	for (i = 0; i < wt->num_nodes; i++)
+	{
+		if (!fm_bits_alloc(&wt->nodes[i].bits, wt->nodes[i].bits.num_bits))
+		{
+			/* Free the bit vectors allocated so far */
+			wt->num_nodes = i + 1;
+			fm_wt_free(wt);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Appends a symbol to a wavelet tree that is being filled.
+ *
+ * @param wt
+ * @param fill the number of bits that have been appended to each node so far.
+ * @param c the symbol.
+ */
+static void fm_wt_append(struct fm_wavelet_tree *wt, unsigned int *fill, unsigned char c)
+{
+	int node = wt->root;
+	int l;
+
+	for (l = wt->code_lengths[c] - 1; l >= 0; l--)
+	{
+		int bit = (wt->codes[c] >> l) & 1;
+
+		if (bit)
+			fm_bits_set(&wt->nodes[node].bits, fill[node]);
+		fill[node]++;
+		node = wt->nodes[node].child[bit];
+	}
+}
+
+/**
+ * Computes the rank directories after all symbols have been appended.
+ *
+ * @param wt
+ */
+static void fm_wt_finish(struct fm_wavelet_tree *wt)
+{
+	int i;
+
+	for (i = 0; i < wt->num_nodes; i++)
+		fm_bits_finish(&wt->nodes[i].bits);
+}
+
+/**
+ * Returns the symbol at the given position and its number of occurrences
+ * before that position.
+ *
+ * @param wt
+ * @param i
+ * @param rank
+ * @return
+ */
+static unsigned char fm_wt_access(const struct fm_wavelet_tree *wt, unsigned int i, unsigned int *rank)
+{
+	int node = wt->root;
+
+	while (node >= 0)
+	{
+		const struct fm_bits *b = &wt->nodes[node].bits;
+		unsigned int r = fm_bits_rank(b, i);
+
+		if (fm_bits_get(b, i))
+		{
+			i = r;
+			node = wt->nodes[node].child[1];
+		} else
+		{
+			i -= r;
+			node = wt->nodes[node].child[0];
+		}
+	}
+
+	*rank = i;
+	return -node - 1;
+}
+
+/**
+ * Returns the number of occurrences of the given symbol in [0, i).
+ *
+ * @param wt
+ * @param c the symbol, must be present in the sequence.
+ * @param i
+ * @return
+ */
+static unsigned int fm_wt_rank(const struct fm_wavelet_tree *wt, unsigned char c, unsigned int i)
+{
+	int node = wt->root;
+	int l;
+
+	for (l = wt->code_lengths[c] - 1; l >= 0; l--)
+	{
+		unsigned int r = fm_bits_rank(&wt->nodes[node].bits, i);
+
+		if ((wt->codes[c] >> l) & 1)
+		{
+			i = r;
+			node = wt->nodes[node].child[1];
+		} else
+		{
+			i -= r;
+			node = wt->nodes[node].child[0];
+		}
+	}
+	return i;
+}
+
+/*****************************************************/
+
+/**
+ * Returns the number of occurrences of the given byte in bwt[0, i).
+ *
+ * @param fm
+ * @param c the byte
+ * @param i
+ * @return
+ */
+static unsigned int index_fm_occ(const struct fm_static *fm, unsigned char c, unsigned int i)
+{
+	if (fm->c[c + 1] == fm->c[c])
+		return 0;
+	return fm_wt_rank(&fm->bwt, c, i);
+}
+
+/**
+ * The LF mapping, i.e., returns the row of the suffix that is one character
+ * longer than the suffix of the given row. The result is meaningless for
+ * rows whose BWT symbol is a separator.
+ *
+ * @param fm
+ * @param i
+ * @param c the BWT symbol of the row.
+ * @return
+ */
+static unsigned int index_fm_lf(const struct fm_static *fm, unsigned int i, unsigned char *c)
+{
+	unsigned int rank;
+
+	*c = fm_wt_access(&fm->bwt, i, &rank);
+	return fm->c[*c] + rank;
+}
+
+/**
+ * Returns the internal document number for the given row.
+ *
+ * @param fm
+ * @param i
+ * @return
+ */
+static int index_fm_locate_document(const struct fm_static *fm, unsigned int i)
+{
+	unsigned char c;
+
+	/* Document starts are always marked, so the separator is never crossed */
+	while (!fm_bits_get(&fm->marks, i))
+		i = index_fm_lf(fm, i, &c);
+	return fm->samples[fm_bits_rank(&fm->marks, i)];
+}
+
+/**
+ * Determines the rows of the suffixes that start with the given pattern.
+ *
+ * @param fm
+ * @param pattern
+ * @param out_sp the first row
+ * @param out_ep the row after the last row
+ * @return whether the pattern occurs at all.
+ */
+static int index_fm_backward_search(const struct fm_static *fm, const char *pattern, unsigned int *out_sp, unsigned int *out_ep)
+{
+	unsigned int sp = 0;
+	unsigned int ep = fm->n;
+	int k = strlen(pattern);
+
+	while (k > 0 && sp < ep)
+	{
+		unsigned char c = pattern[--k];
+
+		if (fm->c[c + 1] == fm->c[c])
+			return 0;
+
+		sp = fm->c[c] + index_fm_occ(fm, c, sp);
+		ep = fm->c[c] + index_fm_occ(fm, c, ep);
+	}
+
+	*out_sp = sp;
+	*out_ep = ep;
+	return sp < ep;
+}
+
+/**
+ * Extracts the text of the given internal document.
+ *
+ * @param fm
+ * @param doc
+ * @return the text that must be freed with free() or NULL on failure.
+ */
+static char *index_fm_extract(const struct fm_static *fm, int doc)
+{
+	unsigned int i = doc;
+	int len = fm->documents[doc].length;
+	unsigned char c;
+	char *text;
+
+	if (!(text = (char*)malloc(len + 1)))
+		return NULL;
+
+	/* Row doc is the suffix that starts with the separator of doc */
+	text[len] = 0;
+	while (len)
+	{
+		i = index_fm_lf(fm, i, &c);
+		text[--len] = c;
+	}
+	return text;
+}
+
+/*****************************************************/
+
+/**
+ * Frees the given static part, but not the static part itself.
+ *
+ * @param fm
+ */
+static void index_fm_free_static(struct fm_static *fm)
+{
+	fm_wt_free(&fm->bwt);
+	fm_bits_free(&fm->marks);
+	free(fm->samples);
+	free(fm->documents);
+	memset(fm, 0, sizeof(*fm));
+}
+
+/**
+ * Sorts all suffixes of the given text via prefix doubling. Separators are
+ * distinct symbols and smaller than any other symbol.
+ *
+ * @param text the text, each document is terminated by a zero byte. Also the
+ *  last byte must be zero.
+ * @param n the length of the text.
+ * @param num_separators number of zero bytes in text.
+ * @return the suffix array that must be freed with free() or NULL.
+ */
+static unsigned int *index_fm_suffix_array(const unsigned char *text, unsigned int n, unsigned int num_separators)
+{
+	unsigned int *sa = NULL, *rank = NULL, *tmp = NULL, *count = NULL;
+	unsigned int num_keys = num_separators + 256;
+	unsigned int sep = 0;
+	unsigned int i, k;
+
+	if (num_keys < n)
+		num_keys = n;
+
+	if (!(sa = (unsigned int*)malloc(n * sizeof(sa[0])))) goto bailout;
+	if (!(rank = (unsigned int*)malloc(n * sizeof(rank[0])))) goto bailout;
+	if (!(tmp = (unsigned int*)malloc(n * sizeof(tmp[0])))) goto bailout;
+	if (!(count = (unsigned int*)malloc((num_keys + 1) * sizeof(count[0])))) goto bailout;
+
+	for (i = 0; i < n; i++)
+		rank[i] = text[i]?num_separators + text[i]:sep++;
+
+	/* Initial sort by the first symbol */
+	memset(count, 0, (num_keys + 1) * sizeof(count[0]));
+	for (i = 0; i < n; i++)
+		count[rank[i] + 1]++;
+	for (i = 1; i <= num_keys; i++)
+		count[i] += count[i - 1];
+	for (i = 0; i < n; i++)
+		sa[count[rank[i]]++] = i;
+
+	for (k = 1; ; k *= 2)
+	{
+		unsigned int p = 0;
+		unsigned int r;
+
+		/* Sort by the second key, suffixes without a second key come first.
+		 * Note that because the text ends with a unique separator, these never
+		 * compare equal with respect to the first key. */
+		for (i = n - (k < n?k:n); i < n; i++)
+			tmp[p++] = i;
+		for (i = 0; i < n; i++)
+		{
+			if (sa[i] >= k)
+				tmp[p++] = sa[i] - k;
+		}
+
+		/* Stable sort by the first key */
+		memset(count, 0, (num_keys + 1) * sizeof(count[0]));
+		for (i = 0; i < n; i++)
+			count[rank[i] + 1]++;
+		for (i = 1; i <= num_keys; i++)
+			count[i] += count[i - 1];
+		for (i = 0; i < n; i++)
+			sa[count[rank[tmp[i]]]++] = tmp[i];
+
+		/* Compute the new ranks */
+		tmp[sa[0]] = r = 0;
+		for (i = 1; i < n; i++)
+		{
+			unsigned int a = sa[i - 1];
+			unsigned int b = sa[i];
+
+			if (rank[a] != rank[b] ||
+				(a + k < n?rank[a + k]:0xffffffff) != (b + k < n?rank[b + k]:0xffffffff))
+				r++;
+			tmp[b] = r;
+		}
+		memcpy(rank, tmp, n * sizeof(rank[0]));
+
+		if (r == n - 1)
+			break;
+	}
+
+	free(count);
+	free(tmp);
+	free(rank);
+	return sa;
+
+bailout:
+	free(count);
+	free(tmp);
+	free(rank);
+	free(sa);
+	return NULL;
+}
+
+/**
+ * Returns whether the given position of the text is sampled.
+ *
+ * @param text
+ * @param pos
+ * @return
+ */
+static int index_fm_is_sampled(const unsigned char *text, unsigned int pos)
+{
+	return !(pos % INDEX_FM_SAMPLE_RATE) || !pos || !text[pos - 1];
+}
+
+/**
+ * Merges the given documents into the static part. Only the suffixes of the
+ * new documents are sorted. The rows of the existing BWT that precede them
+ * are found via backward search, then both BWTs are interleaved.
+ *
+ * @param fm
+ * @param docs
+ * @param num_docs
+ * @return 0 on failure, in which case fm is left untouched, else something
+ *  different.
+ */
+static int index_fm_merge_documents(struct fm_static *fm, const struct fm_delta_document *docs, int num_docs)
+{
+	struct fm_static merged;
+	unsigned char *text = NULL;
+	unsigned int *doc_starts = NULL;
+	unsigned int *sa = NULL;
+	unsigned int *rows = NULL;
+	unsigned int *fill = NULL;
+	unsigned int counts[256];
+	unsigned int num_samples = 0;
+	unsigned int m = 0;
+	unsigned int i, j, k;
+	int rc = 0;
+	int d;
+
+	memset(&merged, 0, sizeof(merged));
+
+	for (d = 0; d < num_docs; d++)
+	{
+		unsigned int l = strlen(docs[d].text) + 1;
+
+		/* The positions must fit into 32 bits */
+		if (l > INDEX_FM_MAX_SIZE - fm->n - m)
+			return 0;
+		m += l;
+	}
+
+	if (!m)
+		return 1;
+
+	if (!(merged.documents = (struct fm_document*)malloc((fm->num_documents + num_docs) * sizeof(merged.documents[0]))))
+		goto out;
+	if (fm->num_documents)
+		memcpy(merged.documents, fm->documents, fm->num_documents * sizeof(merged.documents[0]));
+	merged.num_documents = fm->num_documents;
+	merged.removed_size = fm->removed_size;
+
+	/* Concatenate the texts */
+	if (!(text = (unsigned char*)malloc(m))) goto out;
+	if (!(doc_starts = (unsigned int*)malloc(num_docs * sizeof(doc_starts[0])))) goto out;
+
+	for (d = 0, i = 0; d < num_docs; d++)
+	{
+		unsigned int l = strlen(docs[d].text);
+
+		doc_starts[d] = i;
+		memcpy(text + i, docs[d].text, l + 1);
+		i += l + 1;
+
+		merged.documents[merged.num_documents].did = docs[d].did;
+		merged.documents[merged.num_documents].removed = 0;
+		merged.documents[merged.num_documents].length = l;
+		merged.num_documents++;
+	}
+
+	if (!(sa = index_fm_suffix_array(text, m, num_docs)))
+		goto out;
+
+	/* For each suffix of the new text the number of existing suffixes that
+	 * are smaller. The separators of the new documents are larger than the
+	 * existing ones. */
+	if (!(rows = (unsigned int*)malloc(m * sizeof(rows[0]))))
+		goto out;
+	for (d = 0; d < num_docs; d++)
+	{
+		unsigned int p = d + 1 < num_docs ? doc_starts[d + 1] - 1 : m - 1;
+
+		rows[p] = fm->num_documents;
+		for (; p > doc_starts[d]; p--)
+		{
+			unsigned char c = text[p - 1];
+			rows[p - 1] = fm->c[c] + index_fm_occ(fm, c, rows[p]);
+		}
+	}
+
+	/* Statistics of the merged text */
+	for (i = 0; i < 256; i++)
+		counts[i] = fm->c[i + 1] - fm->c[i];
+	for (i = 0; i < m; i++)
+	{
+		counts[text[i]]++;
+		if (index_fm_is_sampled(text, i))
+			num_samples++;
+	}
+	for (i = 0; i < 256; i++)
+		merged.c[i + 1] = merged.c[i] + counts[i];
+	merged.n = fm->n + m;
+
+	if (!fm_wt_init(&merged.bwt, counts))
+		goto out;
+	if (!(fill = (unsigned int*)malloc((merged.bwt.num_nodes + 1) * sizeof(fill[0]))))
+		goto out;
+	memset(fill, 0, (merged.bwt.num_nodes + 1) * sizeof(fill[0]));
+
+	if (!fm_bits_alloc(&merged.marks, merged.n))
+		goto out;
+	if (!(merged.samples = (int*)malloc((fm->num_samples + num_samples) * sizeof(merged.samples[0]))))
+		goto out;
+
+	/* Interleave the rows, i runs over the existing and j over the new ones */
+	for (i = j = k = 0; k < merged.n; k++)
+	{
+		unsigned char c;
+		int sample = -1;
+
+		if (j < m && (i == fm->n || rows[sa[j]] <= i))
+		{
+			unsigned int pos = sa[j++];
+
+			c = pos ? text[pos - 1] : 0;
+			if (index_fm_is_sampled(text, pos))
+			{
+				int l = 0, h = num_docs - 1;
+
+				/* Find the last document that starts at or before pos */
+				while (l < h)
+				{
+					int mid = (l + h + 1) / 2;
+					if (doc_starts[mid] <= pos) l = mid;
+					else h = mid - 1;
+				}
+				sample = fm->num_documents + l;
+			}
+		} else
+		{
+			unsigned int rank;
+
+			c = fm_wt_access(&fm->bwt, i, &rank);
+			if (fm_bits_get(&fm->marks, i))
+				sample = fm->samples[fm_bits_rank(&fm->marks, i)];
+			i++;
+		}
+
+		fm_wt_append(&merged.bwt, fill, c);
+		if (sample >= 0)
+		{
+			fm_bits_set(&merged.marks, k);
+			merged.samples[merged.num_samples++] = sample;
+		}
+	}
+	fm_wt_finish(&merged.bwt);
+	fm_bits_finish(&merged.marks);
+
+	index_fm_free_static(fm);
+	*fm = merged;
+	rc = 1;
+out:
+	free(fill);
+	free(rows);
+	free(sa);
+	free(doc_starts);
+	free(text);
+	if (!rc)
+		index_fm_free_static(&merged);
+	return rc;
+}
+
+/**
+ * Returns the maximum size of the texts that are merged at once into the
+ * given static part.
+ *
+ * @param fm
+ * @return
+ */
+static unsigned int index_fm_merge_limit(const struct fm_static *fm)
+{
+	unsigned int limit = fm->n / INDEX_FM_MERGE_RATIO;
+	return limit > INDEX_FM_DELTA_MAX_SIZE ? limit : INDEX_FM_DELTA_MAX_SIZE;
+}
+
+/**
+ * Rebuilds the static part without the removed documents. The remaining
+ * documents are extracted and merged into a new static part chunk by chunk.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_compact(struct index_fm *idx)
+{
+	struct fm_static compacted;
+	struct fm_delta_document *docs;
+	unsigned int size = 0;
+	int num_docs = 0;
+	int rc = 0;
+	int d;
+
+	memset(&compacted, 0, sizeof(compacted));
+
+	if (!(docs = (struct fm_delta_document*)malloc((idx->fm.num_documents + 1) * sizeof(docs[0]))))
+		return 0;
+
+	for (d = 0; d < idx->fm.num_documents; d++)
+	{
+		if (idx->fm.documents[d].removed)
+			continue;
+
+		if (!(docs[num_docs].text = index_fm_extract(&idx->fm, d)))
+			goto out;
+		docs[num_docs++].did = idx->fm.documents[d].did;
+		size += idx->fm.documents[d].length + 1;
+
+		if (size >= index_fm_merge_limit(&compacted))
+		{
+			if (!index_fm_merge_documents(&compacted, docs, num_docs))
+				goto out;
+			while (num_docs)
+				free(docs[--num_docs].text);
+			size = 0;
+		}
+	}
+
+	if (num_docs && !index_fm_merge_documents(&compacted, docs, num_docs))
+		goto out;
+
+	index_fm_free_static(&idx->fm);
+	idx->fm = compacted;
+	memset(&compacted, 0, sizeof(compacted));
+	rc = 1;
+out:
+	while (num_docs)
+		free(docs[--num_docs].text);
+	free(docs);
+	index_fm_free_static(&compacted);
+	return rc;
+}
+
+/*****************************************************/
+
+/**
+ * Frees the delta of the given index.
+ *
+ * @param idx
+ */
+static void index_fm_free_delta(struct index_fm *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->num_delta; i++)
+		free(idx->delta[i].text);
+	free(idx->delta);
+	idx->delta = NULL;
+	idx->num_delta = idx->allocated_delta = 0;
+	idx->delta_size = 0;
+}
+
+/**
+ * Adds a document to the delta.
+ *
+ * @param idx
+ * @param did
+ * @param text the text, which is taken over by the delta.
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_add_delta(struct index_fm *idx, int did, char *text)
+{
+	if (idx->num_delta == idx->allocated_delta)
+	{
+		struct fm_delta_document *delta;
+		int allocated = idx->allocated_delta * 2 + 16;
+
+		if (!(delta = (struct fm_delta_document*)realloc(idx->delta, allocated * sizeof(delta[0]))))
+			return 0;
+		idx->delta = delta;
+		idx->allocated_delta = allocated;
+	}
+
+	idx->delta[idx->num_delta].did = did;
+	idx->delta[idx->num_delta].text = text;
+	idx->num_delta++;
+	idx->delta_size += strlen(text) + 1;
+	return 1;
+}
+
+int index_fm_merge(struct index *index)
+{
+	struct index_fm *idx = (struct index_fm*)index;
+	int merged = 0;
+	int rc = 1;
+	int i;
+
+	if (idx->fm.removed_size > idx->fm.n / INDEX_FM_REMOVED_RATIO)
+	{
+		if (!index_fm_compact(idx))
+			return 0;
+	}
+
+	while (merged < idx->num_delta)
+	{
+		unsigned int limit = index_fm_merge_limit(&idx->fm);
+		unsigned int size = strlen(idx->delta[merged].text) + 1;
+		int num = 1;
+
+		while (merged + num < idx->num_delta)
+		{
+			unsigned int l = strlen(idx->delta[merged + num].text) + 1;
+			if (size + l > limit)
+				break;
+			size += l;
+			num++;
+		}
+
+		if (!index_fm_merge_documents(&idx->fm, &idx->delta[merged], num))
+		{
+			rc = 0;
+			break;
+		}
+		merged += num;
+	}
+
+	/* Drop the documents that are part of the static part now */
+	for (i = 0; i < merged; i++)
+	{
+		idx->delta_size -= strlen(idx->delta[i].text) + 1;
+		free(idx->delta[i].text);
+	}
+	if (merged)
+	{
+		memmove(idx->delta, &idx->delta[merged], (idx->num_delta - merged) * sizeof(idx->delta[0]));
+		idx->num_delta -= merged;
+	}
+	return rc;
+}
+
+int index_fm_get_num_delta_documents(struct index *index)
+{
+	return ((struct index_fm*)index)->num_delta;
+}
+
+/*****************************************************/
+
+/**
+ * Writes the given array to the file.
+ *
+ * @param fh
+ * @param data
+ * @param size
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_write(FILE *fh, const void *data, size_t size)
+{
+	if (!size)
+		return 1;
+	return fwrite(data, 1, size, fh) == size;
+}
+
+/**
+ * Reads an array of the given size from the file.
+ *
+ * @param fh
+ * @param size
+ * @return the array that must be freed with free() or NULL on failure.
+ */
+static void *index_fm_read(FILE *fh, size_t size)
+{
+	void *data;
+
+	if (!(data = malloc(size + 1)))
+		return NULL;
+	if (size && fread(data, 1, size, fh) != size)
+	{
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+/**
+ * Saves the given index. The shape of the wavelet tree is not stored as it
+ * follows from the symbol counts.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_save(struct index_fm *idx)
+{
+	struct fm_static *fm = &idx->fm;
+	unsigned int version = INDEX_FM_VERSION;
+	int rc = 0;
+	FILE *fh;
+	int i;
+
+	if (!(fh = fopen(idx->filename, "wb")))
+		return 0;
+
+	if (!index_fm_write(fh, INDEX_FM_MAGIC, 4)) goto out;
+	if (!index_fm_write(fh, &version, sizeof(version))) goto out;
+	if (!index_fm_write(fh, &fm->n, sizeof(fm->n))) goto out;
+	if (!index_fm_write(fh, &fm->num_documents, sizeof(fm->num_documents))) goto out;
+	if (!index_fm_write(fh, fm->documents, fm->num_documents * sizeof(fm->documents[0]))) goto out;
+
+	if (fm->n)
+	{
+		if (!index_fm_write(fh, fm->c, sizeof(fm->c))) goto out;
+		if (!index_fm_write(fh, &fm->num_samples, sizeof(fm->num_samples))) goto out;
+		for (i = 0; i < fm->bwt.num_nodes; i++)
+		{
+			struct fm_bits *b = &fm->bwt.nodes[i].bits;
+			if (!index_fm_write(fh, b->words, (b->num_bits / 32 + 1) * sizeof(b->words[0]))) goto out;
+		}
+		if (!index_fm_write(fh, fm->marks.words, (fm->n / 32 + 1) * sizeof(fm->marks.words[0]))) goto out;
+		if (!index_fm_write(fh, fm->samples, fm->num_samples * sizeof(fm->samples[0]))) goto out;
+	}
+
+	/* The delta is stored as plain texts */
+	if (!index_fm_write(fh, &idx->num_delta, sizeof(idx->num_delta))) goto out;
+	for (i = 0; i < idx->num_delta; i++)
+	{
+		unsigned int len = strlen(idx->delta[i].text);
+
+		if (!index_fm_write(fh, &idx->delta[i].did, sizeof(idx->delta[i].did))) goto out;
+		if (!index_fm_write(fh, &len, sizeof(len))) goto out;
+		if (!index_fm_write(fh, idx->delta[i].text, len)) goto out;
+	}
+
+	rc = 1;
+out:
+	if (fclose(fh))
+		rc = 0;
+	return rc;
+}
+
+/**
+ * Reads the words of the given bit vector, which must have been allocated
+ * already, from the file.
+ *
+ * @param fh
+ * @param b
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_read_bits(FILE *fh, struct fm_bits *b)
+{
+	size_t num_words = b->num_bits / 32 + 1;
+
+	if (fread(b->words, sizeof(b->words[0]), num_words, fh) != num_words)
+		return 0;
+	fm_bits_finish(b);
+	return 1;
+}
+
+/**
+ * Loads the index from the file.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_fm_load(struct index_fm *idx)
+{
+	struct fm_static *fm = &idx->fm;
+	unsigned int counts[256];
+	unsigned int version;
+	char magic[4];
+	int num_delta;
+	int rc = 0;
+	FILE *fh;
+	int i;
+
+	if (!(fh = fopen(idx->filename, "rb")))
+		return 0;
+
+	if (fread(magic, 1, 4, fh) != 4 || memcmp(magic, INDEX_FM_MAGIC, 4)) goto out;
+	if (fread(&version, sizeof(version), 1, fh) != 1 || version != INDEX_FM_VERSION) goto out;
+	if (fread(&fm->n, sizeof(fm->n), 1, fh) != 1) goto out;
+	if (fread(&fm->num_documents, sizeof(fm->num_documents), 1, fh) != 1 || fm->num_documents < 0) goto out;
+	if (!(fm->documents = (struct fm_document*)index_fm_read(fh, fm->num_documents * sizeof(fm->documents[0])))) goto out;
+
+	for (i = 0; i < fm->num_documents; i++)
+	{
+		if (fm->documents[i].removed)
+			fm->removed_size += fm->documents[i].length + 1;
+	}
+
+	if (fm->n)
+	{
+		if (fread(fm->c, sizeof(fm->c), 1, fh) != 1 || fm->c[0] || fm->c[256] != fm->n) goto out;
+		if (fread(&fm->num_samples, sizeof(fm->num_samples), 1, fh) != 1 || fm->num_samples > fm->n) goto out;
+
+		for (i = 0; i < 256; i++)
+		{
+			if (fm->c[i + 1] < fm->c[i]) goto out;
+			counts[i] = fm->c[i + 1] - fm->c[i];
+		}
+		if (!fm_wt_init(&fm->bwt, counts)) goto out;
+		for (i = 0; i < fm->bwt.num_nodes; i++)
+		{
+			if (!index_fm_read_bits(fh, &fm->bwt.nodes[i].bits)) goto out;
+		}
+
+		if (!fm_bits_alloc(&fm->marks, fm->n)) goto out;
+		if (!index_fm_read_bits(fh, &fm->marks)) goto out;
+		if (!(fm->samples = (int*)index_fm_read(fh, fm->num_samples * sizeof(fm->samples[0])))) goto out;
+	}
+
+	if (fread(&num_delta, sizeof(num_delta), 1, fh) != 1 || num_delta < 0) goto out;
+	for (i = 0; i < num_delta; i++)
+	{
+		unsigned int len;
+		int did;
+		char *text;
+
+		if (fread(&did, sizeof(did), 1, fh) != 1) goto out;
+		if (fread(&len, sizeof(len), 1, fh) != 1) goto out;
+		if (!(text = (char*)index_fm_read(fh, len))) goto out;
+		text[len] = 0;
+
+		if (!index_fm_add_delta(idx, did, text))
+		{
+			free(text);
+			goto out;
+		}
+	}
+
+	rc = 1;
+out:
+	fclose(fh);
+	if (!rc)
+	{
+		index_fm_free_static(fm);
+		index_fm_free_delta(idx);
+	}
+	return rc;
+}
+
+/*****************************************************/
+
+static void index_fm_dispose(struct index *index)
+{
+	struct index_fm *idx;
+
+	idx = (struct index_fm*)index;
+
+	if (idx->filename)
+		index_fm_save(idx);
+
+	index_fm_free_static(&idx->fm);
+	index_fm_free_delta(idx);
+	free(idx->filename);
+	free(idx);
+}
+
+static struct index *index_fm_create(const char *filename)
+{
+	struct index_fm *idx;
+	char buf[380];
+
+	if (!(idx = (struct index_fm*)malloc(sizeof(*idx))))
+		return NULL;
+
+	memset(idx,0,sizeof(*idx));
+
+	if (filename)
+	{
+		sm_snprintf(buf, sizeof(buf), "%s.fm", filename);
+		if (!(idx->filename = strdup(buf)))
+		{
+			free(idx);
+			return NULL;
+		}
+
+		/* A missing or corrupt index is simply started from scratch */
+		index_fm_load(idx);
+	}
+
+	return &idx->index;
+}
+
+static int index_fm_put_document(struct index *index, int did, const char *text)
+{
+	struct index_fm *idx;
+	char *copy;
+
+	idx = (struct index_fm*)index;
+
+	if (!(copy = strdup(text)))
+		return 0;
+
+	if (!index_fm_add_delta(idx, did, copy))
+	{
+		free(copy);
+		return 0;
+	}
+
+	if (idx->delta_size > INDEX_FM_DELTA_MAX_SIZE)
+		return index_fm_merge(index);
+	return 1;
+}
+
+static int index_fm_put_documents(struct index *index, int num_documents, const int *dids, const char * const *texts)
+{
+	struct index_fm *idx;
+	int i;
+
+	idx = (struct index_fm*)index;
+
+	for (i = 0; i < num_documents; i++)
+	{
+		char *copy;
+
+		if (!(copy = strdup(texts[i])))
+			return 0;
+
+		if (!index_fm_add_delta(idx, dids[i], copy))
+		{
+			free(copy);
+			return 0;
+		}
+	}
+
+	/* Merge only once for all documents and only if this pays off, as the
+	 * merge takes time linear in the size of the static part */
+	if (idx->delta_size > INDEX_FM_DELTA_MAX_SIZE ||
+		idx->delta_size >= idx->fm.n / INDEX_FM_MERGE_RATIO)
+		return index_fm_merge(index);
+	return 1;
+}
+
+static int index_fm_remove_document(struct index *index, int did)
+{
+	struct index_fm *idx;
+	int removed = 0;
+	int i;
+
+	idx = (struct index_fm*)index;
+
+	for (i = 0; i < idx->fm.num_documents; i++)
+	{
+		if (idx->fm.documents[i].did == did && !idx->fm.documents[i].removed)
+		{
+			idx->fm.documents[i].removed = 1;
+			idx->fm.removed_size += idx->fm.documents[i].length + 1;
+			removed = 1;
+		}
+	}
+
+	for (i = 0; i < idx->num_delta; i++)
+	{
+		if (idx->delta[i].did == did)
+		{
+			idx->delta_size -= strlen(idx->delta[i].text) + 1;
+			free(idx->delta[i].text);
+			memmove(&idx->delta[i], &idx->delta[i + 1], (idx->num_delta - i - 1) * sizeof(idx->delta[0]));
+			idx->num_delta--;
+			i--;
+			removed = 1;
+		}
+	}
+
+	return removed;
+}
+
+static int index_fm_find_documents(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, va_list substrings)
+{
+	struct index_fm *idx;
+	va_list substrings_copy;
+	const char **strs;
+	int *matched = NULL;
+	int nd = 0;
+	int i, j;
+
+	idx = (struct index_fm*)index;
+
+	if (!(strs = (const char**)malloc((num_substrings + 1) * sizeof(strs[0]))))
+		return 0;
+
+	va_copy(substrings_copy,substrings);
+	for (i = 0; i < num_substrings; i++)
+		strs[i] = va_arg(substrings_copy, const char *);
+	va_end(substrings_copy);
+
+	/* matched[d] counts the consecutive substrings that document d contains */
+	if (!(matched = (int*)malloc((idx->fm.num_documents + 1) * sizeof(matched[0]))))
+		goto out;
+	memset(matched, 0, (idx->fm.num_documents + 1) * sizeof(matched[0]));
+
+	for (j = 0; j < num_substrings; j++)
+	{
+		unsigned int sp, ep, row;
+
+		if (!*strs[j])
+		{
+			/* The empty string is contained in every document */
+			for (i = 0; i < idx->fm.num_documents; i++)
+			{
+				if (matched[i] == j)
+					matched[i] = j + 1;
+			}
+			continue;
+		}
+
+		if (!idx->fm.n || !index_fm_backward_search(&idx->fm, strs[j], &sp, &ep))
+			break;
+
+		for (row = sp; row < ep; row++)
+		{
+			int d = index_fm_locate_document(&idx->fm, row);
+			if (matched[d] == j)
+				matched[d] = j + 1;
+		}
+	}
+
+	for (i = 0; i < idx->fm.num_documents; i++)
+	{
+		if (matched[i] == num_substrings && !idx->fm.documents[i].removed)
+		{
+			callback(idx->fm.documents[i].did, userdata);
+			nd++;
+		}
+	}
+
+	/* The delta is searched naively */
+	for (i = 0; i < idx->num_delta; i++)
+	{
+		for (j = 0; j < num_substrings; j++)
+		{
+			if (!strstr(idx->delta[i].text, strs[j]))
+				break;
+		}
+
+		if (j == num_substrings)
+		{
+			callback(idx->delta[i].did, userdata);
+			nd++;
+		}
+	}
+
+out:
+	free(matched);
+	free(strs);
+	return nd;
+}
+
+/*****************************************************/
+
+struct index_algorithm index_fm =
+{
+		index_fm_create,
+		index_fm_dispose,
+		index_fm_put_document,
+		index_fm_remove_document,
+		index_fm_find_documents,
+		index_fm_put_documents,
+		NULL
+};
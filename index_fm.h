@@ -0,0 +1,46 @@
+/**
+ * index_fm.h - a FM-index-based string index implementation for SimpleMail.
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM__INDEX_FM_H
+#define SM__INDEX_FM_H
+
+extern struct index_algorithm index_fm;
+
+struct index;
+
+/**
+ * Merge the documents that have been put into the in-memory delta index
+ * of the given index into the static FM-index. Removed documents are
+ * dropped at this occasion if they make up a considerable part of the
+ * static FM-index.
+ *
+ * @param index the index, which must have been created with index_fm.
+ * @return success or not.
+ */
+int index_fm_merge(struct index *index);
+
+/**
+ * Return the number of documents that are contained in the delta index of
+ * the given index, i.e., the documents that have not been merged yet.
+ *
+ * @param index the index, which must have been created with index_fm.
+ * @return the number of documents.
+ */
+int index_fm_get_num_delta_documents(struct index *index);
+
+#endif
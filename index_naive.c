@@ -175,5 +175,7 @@ struct index_algorithm index_naive =
 		index_naive_dispose,
 		index_naive_put_document,
 		index_naive_remove_document,
-		index_naive_find_documents
+		index_naive_find_documents,
+		NULL,
+		NULL
 };
@@ -34,6 +34,38 @@ struct index
 	struct index_algorithm *alg;
 };
 
+/**
+ * Base structure for cursor instance data. The state is maintained by
+ * index_cursor_skip_to() and index_cursor_next(), implementors only need to
+ * provide the functions.
+ */
+struct index_cursor
+{
+	/**
+	 * Advance the cursor to the first document whose id is not smaller than
+	 * the given one. Is only called with ids that are larger than the
+	 * current one.
+	 *
+	 * @param cursor
+	 * @param did
+	 * @return the document id or -1 if there are no further documents.
+	 */
+	int (*skip_to)(struct index_cursor *cursor, int did);
+
+	/**
+	 * Get rid of memory allocated by the cursor.
+	 *
+	 * @param cursor
+	 */
+	void (*dispose)(struct index_cursor *cursor);
+
+	/** The current document id or -1 if the cursor has not been advanced yet */
+	int did;
+
+	/** Whether there are no further documents */
+	int at_end;
+};
+
 /**
  * Defines the common interface for string index algorithms.
  * This is not directly exposed to clients only to
@@ -88,7 +120,39 @@ struct index_algorithm
 	 * @return number of documents for which the callback was called.
 	 */
 	int (*find_documents)(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, va_list substrings);
+
+	/**
+	 * Put several documents into the index at once. May be NULL, in which
+	 * case the documents are put one by one.
+	 *
+	 * @param index
+	 * @param num_documents
+	 * @param dids
+	 * @param texts
+	 * @return
+	 */
+	int (*put_documents)(struct index *index, int num_documents, const int *dids, const char * const *texts);
+
+	/**
+	 * Opens a cursor that iterates over the documents containing the given
+	 * string as exact substring in ascending document id order. May be NULL,
+	 * in which case the documents are determined via find_documents().
+	 *
+	 * @param index
+	 * @param term
+	 * @return the cursor with the skip_to and dispose members initialized.
+	 */
+	struct index_cursor *(*open_term)(struct index *index, const char *term);
 };
 
+/**
+ * Initializes the common part of a freshly allocated cursor.
+ *
+ * @param cursor the cursor to initialize.
+ * @param skip_to the skip_to function.
+ * @param dispose the dispose function.
+ */
+void index_cursor_init(struct index_cursor *cursor, int (*skip_to)(struct index_cursor *, int), void (*dispose)(struct index_cursor *));
+
 
 #endif
@@ -0,0 +1,1194 @@
+/**
+ * index_trigram.c - a trigram-based string index implementation for SimpleMail.
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file index_trigram.c
+ *
+ * This is an implementation of a string index that maps each byte trigram
+ * to a posting list of the documents that contain the trigram. As UTF-8 is
+ * a byte oriented encoding, this works for UTF-8 texts as well.
+ *
+ * Documents are numbered internally in the order of their insertion, so the
+ * posting lists are sorted implicitly. They are stored delta-encoded with
+ * a variable length encoding of 7 bits per byte.
+ *
+ * A query intersects the posting lists of the trigrams of the query strings.
+ * The texts of the remaining candidates are then verified, which is why the
+ * texts are kept in a separate file. Removed documents are only marked as
+ * such, their postings and texts stay until the index is purged, which
+ * rewrites both without the removed documents.
+ */
+
+#include "index_trigram.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "index_private.h"
+
+#include "support.h"
+
+/* Get va_vopy() with pre-C99 compilers */
+#ifdef __SASC
+#define va_copy(dest,src) ((dest) = (src))
+#elif defined(__GNUC__) && (__GNUC__ < 3)
+#include <varargs.h>
+#endif
+
+/** Identifies the postings file of a trigram index */
+#define INDEX_TRIGRAM_MAGIC "SMIT"
+
+/** The current version of the postings file */
+#define INDEX_TRIGRAM_VERSION 1
+
+/**
+ * Only trigrams within this number of leading bytes of a query string are
+ * considered for the intersection. Longer strings are verified anyway.
+ */
+#define INDEX_TRIGRAM_MAX_QUERY_PREFIX 64
+
+/**
+ * The index needs to be purged if the texts of the removed documents take at
+ * least this many bytes and more than the texts of the remaining documents.
+ */
+#define INDEX_TRIGRAM_PURGE_MIN_SIZE (64*1024)
+
+/** Marks a slot of the document id table whose document has been removed */
+#define INDEX_TRIGRAM_SLOT_REMOVED (-2)
+
+/**
+ * A single document of the index.
+ */
+struct trigram_document
+{
+	int did;
+
+	/** Offset of the text in the documents file */
+	unsigned int offset;
+
+	/** Length of the text without the terminating zero byte */
+	unsigned int len;
+
+	/** Whether the document has been removed */
+	int removed;
+};
+
+/**
+ * The posting list of a single trigram.
+ */
+struct trigram_posting
+{
+	/** The trigram, the first byte is the most significant one */
+	unsigned int trigram;
+
+	/** Number of documents in the list */
+	int count;
+
+	/** The internal number of the last document in the list */
+	int last_doc;
+
+	/** Delta-encoded internal document numbers */
+	unsigned char *data;
+	int len;
+	int allocated;
+};
+
+struct index_trigram
+{
+	struct index index;
+
+	/** The name of the postings file or NULL if the index is not persistent */
+	char *postings_filename;
+
+	/** The name of the documents file or NULL if the index is not persistent */
+	char *documents_filename;
+
+	/** Contains the texts of all documents */
+	FILE *documents_file;
+
+	struct trigram_document *documents;
+	int num_documents;
+	int allocated_documents;
+
+	/** Size of the texts of all documents and of the removed ones */
+	unsigned int documents_size;
+	unsigned int removed_size;
+
+	/**
+	 * Open addressing hash table that maps document ids to the internal
+	 * documents that are not removed. Slots are -1 if empty.
+	 */
+	int *doc_slots;
+	unsigned int doc_slots_mask;
+	int num_doc_slots_used;
+
+	/** Open addressing hash table of posting lists */
+	struct trigram_posting *postings;
+	int num_postings;
+	unsigned int postings_mask;
+
+	/** The text of the recently verified document */
+	char *cached_text;
+	int cached_doc;
+};
+
+/*****************************************************/
+
+/**
+ * Hashes the given trigram. The slot is determined by the low bits of the
+ * hash, so all bits of the trigram are mixed into them (the finalizer of
+ * MurmurHash3).
+ *
+ * @param trigram
+ * @return
+ */
+static unsigned int index_trigram_hash(unsigned int trigram)
+{
+	trigram ^= trigram >> 16;
+	trigram *= 0x85ebca6bu;
+	trigram ^= trigram >> 13;
+	trigram *= 0xc2b2ae35u;
+	trigram ^= trigram >> 16;
+	return trigram;
+}
+
+/**
+ * Returns the posting list slot for the given trigram. If the trigram is
+ * not present, the returned slot is empty, i.e., its data is NULL.
+ *
+ * @param idx
+ * @param trigram
+ * @return
+ */
+static struct trigram_posting *index_trigram_slot(struct index_trigram *idx, unsigned int trigram)
+{
+	unsigned int i = index_trigram_hash(trigram) & idx->postings_mask;
+
+	while (idx->postings[i].data && idx->postings[i].trigram != trigram)
+		i = (i + 1) & idx->postings_mask;
+	return &idx->postings[i];
+}
+
+/**
+ * Resizes the hash table of the posting lists such that it can hold
+ * the given number of entries.
+ *
+ * @param idx
+ * @param size the new size, must be a power of two.
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_resize(struct index_trigram *idx, unsigned int size)
+{
+	struct trigram_posting *old_postings = idx->postings;
+	unsigned int old_size = old_postings?idx->postings_mask + 1:0;
+	unsigned int i;
+
+	if (!(idx->postings = (struct trigram_posting*)malloc(size * sizeof(idx->postings[0]))))
+	{
+		idx->postings = old_postings;
+		return 0;
+	}
+	memset(idx->postings, 0, size * sizeof(idx->postings[0]));
+	idx->postings_mask = size - 1;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old_postings[i].data)
+			*index_trigram_slot(idx, old_postings[i].trigram) = old_postings[i];
+	}
+	free(old_postings);
+	return 1;
+}
+
+/**
+ * Returns the posting list for the given trigram. The list is created if it
+ * does not exist yet.
+ *
+ * @param idx
+ * @param trigram
+ * @return the posting list or NULL on failure.
+ */
+static struct trigram_posting *index_trigram_get_posting(struct index_trigram *idx, unsigned int trigram)
+{
+	struct trigram_posting *p = index_trigram_slot(idx, trigram);
+
+	if (p->data)
+		return p;
+
+	/* Keep the load factor below one half */
+	if ((unsigned int)(idx->num_postings + 1) * 2 > idx->postings_mask + 1)
+	{
+		if (!index_trigram_resize(idx, (idx->postings_mask + 1) * 2))
+			return NULL;
+		p = index_trigram_slot(idx, trigram);
+	}
+
+	if (!(p->data = (unsigned char*)malloc(8)))
+		return NULL;
+	p->trigram = trigram;
+	p->allocated = 8;
+	p->len = 0;
+	p->count = 0;
+	p->last_doc = -1;
+	idx->num_postings++;
+	return p;
+}
+
+/**
+ * Appends the given internal document number to the posting list.
+ *
+ * @param p
+ * @param doc must be greater than the last document of the list.
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_posting_append(struct trigram_posting *p, int doc)
+{
+	unsigned int delta = doc - p->last_doc;
+
+	/* A varint of an unsigned int doesn't take more than 5 bytes */
+	if (p->len + 5 > p->allocated)
+	{
+		unsigned char *data;
+		int allocated = p->allocated * 2;
+
+		if (!(data = (unsigned char*)realloc(p->data, allocated)))
+			return 0;
+		p->data = data;
+		p->allocated = allocated;
+	}
+
+	while (delta >= 0x80)
+	{
+		p->data[p->len++] = (delta & 0x7f) | 0x80;
+		delta >>= 7;
+	}
+	p->data[p->len++] = delta;
+
+	p->last_doc = doc;
+	p->count++;
+	return 1;
+}
+
+/**
+ * Decodes the next document number of a posting list.
+ *
+ * @param data the data of the posting list.
+ * @param pos the current position in data, is advanced.
+ * @param doc the previous document number, is replaced by the next one.
+ */
+static void index_trigram_posting_decode(const unsigned char *data, int *pos, int *doc)
+{
+	unsigned int delta = 0;
+	int shift = 0;
+	unsigned char c;
+
+	do
+	{
+		c = data[(*pos)++];
+		delta |= (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*doc += delta;
+}
+
+/*****************************************************/
+
+/**
+ * Rebuilds the table that maps document ids to internal documents. It is
+ * sized such that the load factor is at most one quarter.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_rebuild_doc_slots(struct index_trigram *idx)
+{
+	unsigned int size = 64;
+	int *doc_slots;
+	int num = 0;
+	int i;
+
+	for (i = 0; i < idx->num_documents; i++)
+	{
+		if (!idx->documents[i].removed)
+			num++;
+	}
+
+	while (size < (unsigned int)num * 4)
+		size *= 2;
+
+	if (!(doc_slots = (int*)malloc(size * sizeof(doc_slots[0]))))
+		return 0;
+	memset(doc_slots, 0xff, size * sizeof(doc_slots[0]));
+
+	free(idx->doc_slots);
+	idx->doc_slots = doc_slots;
+	idx->doc_slots_mask = size - 1;
+	idx->num_doc_slots_used = 0;
+
+	for (i = 0; i < idx->num_documents; i++)
+	{
+		unsigned int j;
+
+		if (idx->documents[i].removed)
+			continue;
+
+		j = index_trigram_hash(idx->documents[i].did) & idx->doc_slots_mask;
+		while (idx->doc_slots[j] != -1)
+			j = (j + 1) & idx->doc_slots_mask;
+		idx->doc_slots[j] = i;
+		idx->num_doc_slots_used++;
+	}
+	return 1;
+}
+
+/**
+ * Adds the given internal document to the table of the document ids.
+ *
+ * @param idx
+ * @param doc
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_add_doc_slot(struct index_trigram *idx, int doc)
+{
+	unsigned int j;
+
+	/* Keep the load factor including the removed slots below one half. The
+	 * new document is already part of the documents array */
+	if ((unsigned int)(idx->num_doc_slots_used + 1) * 2 > idx->doc_slots_mask + 1)
+		return index_trigram_rebuild_doc_slots(idx);
+
+	j = index_trigram_hash(idx->documents[doc].did) & idx->doc_slots_mask;
+	while (idx->doc_slots[j] >= 0)
+		j = (j + 1) & idx->doc_slots_mask;
+	if (idx->doc_slots[j] == -1)
+		idx->num_doc_slots_used++;
+	idx->doc_slots[j] = doc;
+	return 1;
+}
+
+/*****************************************************/
+
+/**
+ * Writes the document table and all posting lists to the postings file.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_save(struct index_trigram *idx)
+{
+	unsigned int version = INDEX_TRIGRAM_VERSION;
+	unsigned int i;
+	FILE *fh;
+	int rc = 0;
+
+	if (!(fh = fopen(idx->postings_filename, "wb")))
+		return 0;
+
+	if (fwrite(INDEX_TRIGRAM_MAGIC, 1, 4, fh) != 4) goto out;
+	if (fwrite(&version, sizeof(version), 1, fh) != 1) goto out;
+	if (fwrite(&idx->num_documents, sizeof(idx->num_documents), 1, fh) != 1) goto out;
+	if (idx->num_documents && fwrite(idx->documents, sizeof(idx->documents[0]), idx->num_documents, fh) != idx->num_documents)
+		goto out;
+	if (fwrite(&idx->num_postings, sizeof(idx->num_postings), 1, fh) != 1) goto out;
+
+	for (i = 0; i <= idx->postings_mask; i++)
+	{
+		struct trigram_posting *p = &idx->postings[i];
+
+		if (!p->data)
+			continue;
+
+		if (fwrite(&p->trigram, sizeof(p->trigram), 1, fh) != 1) goto out;
+		if (fwrite(&p->count, sizeof(p->count), 1, fh) != 1) goto out;
+		if (fwrite(&p->last_doc, sizeof(p->last_doc), 1, fh) != 1) goto out;
+		if (fwrite(&p->len, sizeof(p->len), 1, fh) != 1) goto out;
+		if (fwrite(p->data, 1, p->len, fh) != p->len) goto out;
+	}
+	rc = 1;
+out:
+	if (fclose(fh))
+		rc = 0;
+	return rc;
+}
+
+/**
+ * Loads the document table and all posting lists from the postings file.
+ *
+ * @param idx
+ * @return 0 on failure, else something different.
+ */
+static int index_trigram_load(struct index_trigram *idx)
+{
+	unsigned int version;
+	char magic[4];
+	int num_documents;
+	int num_postings;
+	unsigned int size;
+	FILE *fh;
+	int rc = 0;
+	int i;
+
+	if (!(fh = fopen(idx->postings_filename, "rb")))
+		return 0;
+
+	if (fread(magic, 1, 4, fh) != 4 || memcmp(magic, INDEX_TRIGRAM_MAGIC, 4)) goto out;
+	if (fread(&version, sizeof(version), 1, fh) != 1 || version != INDEX_TRIGRAM_VERSION) goto out;
+	if (fread(&num_documents, sizeof(num_documents), 1, fh) != 1 || num_documents < 0) goto out;
+
+	if (num_documents)
+	{
+		if (!(idx->documents = (struct trigram_document*)malloc(num_documents * sizeof(idx->documents[0]))))
+			goto out;
+		idx->allocated_documents = num_documents;
+		if (fread(idx->documents, sizeof(idx->documents[0]), num_documents, fh) != num_documents)
+			goto out;
+	}
+	idx->num_documents = num_documents;
+
+	for (i = 0; i < num_documents; i++)
+	{
+		idx->documents_size += idx->documents[i].len + 1;
+		if (idx->documents[i].removed)
+			idx->removed_size += idx->documents[i].len + 1;
+	}
+	if (!index_trigram_rebuild_doc_slots(idx))
+		goto out;
+
+	if (fread(&num_postings, sizeof(num_postings), 1, fh) != 1 || num_postings < 0) goto out;
+
+	size = 1024;
+	while (size < (unsigned int)num_postings * 2)
+		size *= 2;
+	if (!index_trigram_resize(idx, size))
+		goto out;
+
+	for (i = 0; i < num_postings; i++)
+	{
+		struct trigram_posting *p;
+		unsigned int trigram;
+
+		if (fread(&trigram, sizeof(trigram), 1, fh) != 1) goto out;
+		if (!(p = index_trigram_get_posting(idx, trigram))) goto out;
+		if (fread(&p->count, sizeof(p->count), 1, fh) != 1) goto out;
+		if (fread(&p->last_doc, sizeof(p->last_doc), 1, fh) != 1) goto out;
+		if (fread(&p->len, sizeof(p->len), 1, fh) != 1 || p->len < 0) goto out;
+
+		if (p->len > p->allocated)
+		{
+			unsigned char *data;
+
+			if (!(data = (unsigned char*)realloc(p->data, p->len)))
+				goto out;
+			p->data = data;
+			p->allocated = p->len;
+		}
+		if (fread(p->data, 1, p->len, fh) != p->len) goto out;
+	}
+	rc = 1;
+out:
+	fclose(fh);
+	return rc;
+}
+
+/*****************************************************/
+
+/**
+ * Drops all documents and posting lists of the given index.
+ *
+ * @param idx
+ */
+static void index_trigram_clear(struct index_trigram *idx)
+{
+	unsigned int i;
+
+	if (idx->postings)
+	{
+		for (i = 0; i <= idx->postings_mask; i++)
+			free(idx->postings[i].data);
+		free(idx->postings);
+		idx->postings = NULL;
+	}
+	idx->num_postings = 0;
+
+	free(idx->documents);
+	idx->documents = NULL;
+	idx->num_documents = idx->allocated_documents = 0;
+	idx->documents_size = idx->removed_size = 0;
+
+	free(idx->doc_slots);
+	idx->doc_slots = NULL;
+	idx->doc_slots_mask = 0;
+	idx->num_doc_slots_used = 0;
+}
+
+static void index_trigram_dispose(struct index *index)
+{
+	struct index_trigram *idx;
+
+	idx = (struct index_trigram*)index;
+
+	if (idx->postings_filename && idx->documents_file && idx->postings)
+		index_trigram_save(idx);
+
+	if (idx->documents_file) fclose(idx->documents_file);
+
+	index_trigram_clear(idx);
+	free(idx->cached_text);
+	free(idx->documents_filename);
+	free(idx->postings_filename);
+	free(idx);
+}
+
+static struct index *index_trigram_create(const char *filename)
+{
+	struct index_trigram *idx;
+	char buf[380];
+	int loaded = 0;
+
+	if (!(idx = (struct index_trigram*)malloc(sizeof(*idx))))
+		return NULL;
+
+	memset(idx,0,sizeof(*idx));
+	idx->cached_doc = -1;
+
+	if (!filename)
+	{
+		/* The index is not persistent */
+		if (!(idx->documents_file = tmpfile()))
+			goto bailout;
+	} else
+	{
+		sm_snprintf(buf, sizeof(buf), "%s.trigrams", filename);
+		if (!(idx->postings_filename = strdup(buf)))
+			goto bailout;
+
+		sm_snprintf(buf, sizeof(buf), "%s.documents", filename);
+		if (!(idx->documents_filename = strdup(buf)))
+			goto bailout;
+
+		if ((idx->documents_file = fopen(buf, "r+b")))
+		{
+			if (!(loaded = index_trigram_load(idx)))
+			{
+				fclose(idx->documents_file);
+				idx->documents_file = NULL;
+				index_trigram_clear(idx);
+			}
+		}
+
+		if (!idx->documents_file)
+		{
+			if (!(idx->documents_file = fopen(buf, "w+b")))
+				goto bailout;
+		}
+	}
+
+	if (!loaded)
+	{
+		if (!index_trigram_resize(idx, 1024))
+			goto bailout;
+		if (!index_trigram_rebuild_doc_slots(idx))
+			goto bailout;
+	}
+
+	return &idx->index;
+bailout:
+	index_trigram_dispose(&idx->index);
+	return NULL;
+}
+
+/*****************************************************/
+
+static int index_trigram_put_document(struct index *index, int did, const char *text)
+{
+	struct index_trigram *idx;
+	struct trigram_document *d;
+	int l = strlen(text);
+	int doc;
+	long offset;
+	int i;
+
+	idx = (struct index_trigram*)index;
+
+	if (!idx->documents_file)
+		return 0;
+
+	if (idx->num_documents == idx->allocated_documents)
+	{
+		struct trigram_document *documents;
+		int allocated = idx->allocated_documents * 2 + 16;
+
+		if (!(documents = (struct trigram_document*)realloc(idx->documents, allocated * sizeof(documents[0]))))
+			return 0;
+		idx->documents = documents;
+		idx->allocated_documents = allocated;
+	}
+
+	if (fseek(idx->documents_file, 0, SEEK_END))
+		return 0;
+	offset = ftell(idx->documents_file);
+	if (fwrite(text, 1, l + 1, idx->documents_file) != l + 1)
+		return 0;
+
+	doc = idx->num_documents++;
+	d = &idx->documents[doc];
+	d->did = did;
+	d->offset = offset;
+	d->len = l;
+	d->removed = 0;
+	idx->documents_size += l + 1;
+
+	if (!index_trigram_add_doc_slot(idx, doc))
+		return 0;
+
+	for (i = 0; i + 2 < l; i++)
+	{
+		struct trigram_posting *p;
+		unsigned int trigram;
+
+		trigram = ((unsigned char)text[i] << 16) | ((unsigned char)text[i+1] << 8) | (unsigned char)text[i+2];
+
+		if (!(p = index_trigram_get_posting(idx, trigram)))
+			return 0;
+
+		/* Each document is listed only once */
+		if (p->last_doc == doc)
+			continue;
+
+		if (!index_trigram_posting_append(p, doc))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int index_trigram_remove_document(struct index *index, int did)
+{
+	struct index_trigram *idx;
+	int removed = 0;
+	unsigned int j;
+
+	idx = (struct index_trigram*)index;
+
+	j = index_trigram_hash(did) & idx->doc_slots_mask;
+	while (idx->doc_slots[j] != -1)
+	{
+		int doc = idx->doc_slots[j];
+
+		if (doc >= 0 && idx->documents[doc].did == did)
+		{
+			idx->documents[doc].removed = 1;
+			idx->removed_size += idx->documents[doc].len + 1;
+			idx->doc_slots[j] = INDEX_TRIGRAM_SLOT_REMOVED;
+			removed = 1;
+		}
+		j = (j + 1) & idx->doc_slots_mask;
+	}
+	return removed;
+}
+
+/*****************************************************/
+
+/**
+ * Returns the text of the given internal document.
+ *
+ * @param idx
+ * @param doc
+ * @return the text that is valid until the next call or NULL on failure.
+ */
+static const char *index_trigram_get_text(struct index_trigram *idx, int doc)
+{
+	struct trigram_document *d = &idx->documents[doc];
+	char *text;
+
+	if (idx->cached_doc == doc)
+		return idx->cached_text;
+
+	if (!idx->documents_file)
+		return NULL;
+
+	free(idx->cached_text);
+	idx->cached_text = NULL;
+	idx->cached_doc = -1;
+
+	if (!(text = (char*)malloc(d->len + 1)))
+		return NULL;
+	if (fseek(idx->documents_file, d->offset, SEEK_SET))
+		goto bailout;
+	if (fread(text, 1, d->len, idx->documents_file) != d->len)
+		goto bailout;
+	text[d->len] = 0;
+
+	idx->cached_text = text;
+	idx->cached_doc = doc;
+	return text;
+bailout:
+	free(text);
+	return NULL;
+}
+
+/*****************************************************/
+
+int index_trigram_needs_purge(struct index *index)
+{
+	struct index_trigram *idx = (struct index_trigram*)index;
+
+	return idx->removed_size >= INDEX_TRIGRAM_PURGE_MIN_SIZE &&
+		idx->removed_size > idx->documents_size - idx->removed_size;
+}
+
+int index_trigram_purge(struct index *index)
+{
+	struct index_trigram *idx = (struct index_trigram*)index;
+	struct index_trigram purged;
+	char new_filename[380];
+	char old_filename[380];
+	int i;
+
+	memset(&purged, 0, sizeof(purged));
+	purged.cached_doc = -1;
+
+	/* The remaining documents are put into a new index with a new file */
+	if (idx->documents_filename)
+	{
+		sm_snprintf(new_filename, sizeof(new_filename), "%s.new", idx->documents_filename);
+		sm_snprintf(old_filename, sizeof(old_filename), "%s.old", idx->documents_filename);
+		purged.documents_file = fopen(new_filename, "w+b");
+	} else
+	{
+		purged.documents_file = tmpfile();
+	}
+
+	if (!purged.documents_file)
+		return 0;
+
+	if (!index_trigram_resize(&purged, 1024))
+		goto bailout;
+	if (!index_trigram_rebuild_doc_slots(&purged))
+		goto bailout;
+
+	for (i = 0; i < idx->num_documents; i++)
+	{
+		const char *text;
+
+		if (idx->documents[i].removed)
+			continue;
+		if (!(text = index_trigram_get_text(idx, i)))
+			goto bailout;
+		if (!index_trigram_put_document(&purged.index, idx->documents[i].did, text))
+			goto bailout;
+	}
+
+	if (fflush(purged.documents_file))
+		goto bailout;
+
+	if (idx->documents_filename)
+	{
+		/* Replace the documents file, the old one is kept until the new one
+		 * is in place */
+		fclose(purged.documents_file);
+		purged.documents_file = NULL;
+		fclose(idx->documents_file);
+		idx->documents_file = NULL;
+
+		remove(old_filename);
+		if (rename(idx->documents_filename, old_filename))
+			goto reopen;
+		if (rename(new_filename, idx->documents_filename))
+		{
+			rename(old_filename, idx->documents_filename);
+			goto reopen;
+		}
+		if (!(purged.documents_file = fopen(idx->documents_filename, "r+b")))
+		{
+			remove(idx->documents_filename);
+			rename(old_filename, idx->documents_filename);
+			goto reopen;
+		}
+		remove(old_filename);
+	} else
+	{
+		fclose(idx->documents_file);
+	}
+
+	free(idx->cached_text);
+	idx->cached_text = NULL;
+	idx->cached_doc = -1;
+
+	index_trigram_clear(idx);
+	idx->documents_file = purged.documents_file;
+	idx->documents = purged.documents;
+	idx->num_documents = purged.num_documents;
+	idx->allocated_documents = purged.allocated_documents;
+	idx->documents_size = purged.documents_size;
+	idx->removed_size = 0;
+	idx->doc_slots = purged.doc_slots;
+	idx->doc_slots_mask = purged.doc_slots_mask;
+	idx->num_doc_slots_used = purged.num_doc_slots_used;
+	idx->postings = purged.postings;
+	idx->num_postings = purged.num_postings;
+	idx->postings_mask = purged.postings_mask;
+	return 1;
+
+reopen:
+	idx->documents_file = fopen(idx->documents_filename, "r+b");
+bailout:
+	if (purged.documents_file)
+		fclose(purged.documents_file);
+	if (idx->documents_filename)
+		remove(new_filename);
+	index_trigram_clear(&purged);
+	free(purged.cached_text);
+	return 0;
+}
+
+/*****************************************************/
+
+/**
+ * Intersects the given sorted candidate array with the given posting list.
+ *
+ * @param candidates the candidates, will be reduced.
+ * @param num_candidates the number of candidates.
+ * @param p the posting list.
+ * @return the number of remaining candidates.
+ */
+static int index_trigram_intersect(int *candidates, int num_candidates, const struct trigram_posting *p)
+{
+	int pos = 0;
+	int doc = -1;
+	int remaining = 0;
+	int i = 0;
+
+	if (!num_candidates || !p->count)
+		return 0;
+
+	index_trigram_posting_decode(p->data, &pos, &doc);
+
+	while (i < num_candidates)
+	{
+		if (candidates[i] < doc)
+		{
+			i++;
+		} else if (candidates[i] > doc)
+		{
+			if (pos >= p->len)
+				break;
+			index_trigram_posting_decode(p->data, &pos, &doc);
+		} else
+		{
+			candidates[remaining++] = candidates[i++];
+		}
+	}
+	return remaining;
+}
+
+/**
+ * Compares two posting lists by their number of documents.
+ */
+static int index_trigram_compare_posting_count(const void *a, const void *b)
+{
+	const struct trigram_posting *pa = *(const struct trigram_posting **)a;
+	const struct trigram_posting *pb = *(const struct trigram_posting **)b;
+	return pa->count - pb->count;
+}
+
+/**
+ * Determines the internal documents that contain all trigrams of the given
+ * strings. Removed documents may be contained.
+ *
+ * @param idx
+ * @param strs the strings.
+ * @param num_strs the number of strings.
+ * @param candidates_ptr where the sorted array of the internal documents is
+ *  stored on success. Must be freed with free().
+ * @return the number of candidates or -1 on failure.
+ */
+static int index_trigram_candidates(struct index_trigram *idx, const char **strs, int num_strs, int **candidates_ptr)
+{
+	struct trigram_posting **postings = NULL;
+	int num_postings = 0;
+	int *candidates = NULL;
+	int num_candidates = -1;
+	int i, j;
+
+	if (!(postings = (struct trigram_posting**)malloc((num_strs * INDEX_TRIGRAM_MAX_QUERY_PREFIX + 1) * sizeof(postings[0]))))
+		goto out;
+
+	if (!(candidates = (int*)malloc((idx->num_documents + 1) * sizeof(candidates[0]))))
+		goto out;
+
+	/* Collect the posting lists of the trigrams of all strings */
+	for (i = 0; i < num_strs; i++)
+	{
+		const char *str = strs[i];
+		int l = strlen(str);
+
+		if (l > INDEX_TRIGRAM_MAX_QUERY_PREFIX)
+			l = INDEX_TRIGRAM_MAX_QUERY_PREFIX;
+
+		for (j = 0; j + 2 < l; j++)
+		{
+			struct trigram_posting *p;
+			unsigned int trigram;
+
+			trigram = ((unsigned char)str[j] << 16) | ((unsigned char)str[j+1] << 8) | (unsigned char)str[j+2];
+			p = index_trigram_slot(idx, trigram);
+
+			/* No document contains the trigram */
+			if (!p->data)
+			{
+				num_candidates = 0;
+				goto out;
+			}
+
+			postings[num_postings++] = p;
+		}
+	}
+
+	/* Start with the shortest list, so the candidates shrink quickly */
+	if (num_postings)
+	{
+		int pos = 0;
+		int doc = -1;
+
+		qsort(postings, num_postings, sizeof(postings[0]), index_trigram_compare_posting_count);
+
+		num_candidates = 0;
+		while (pos < postings[0]->len)
+		{
+			index_trigram_posting_decode(postings[0]->data, &pos, &doc);
+			candidates[num_candidates++] = doc;
+		}
+
+		for (i = 1; i < num_postings && num_candidates; i++)
+		{
+			/* The same trigram may occur several times */
+			if (postings[i] == postings[i-1])
+				continue;
+			num_candidates = index_trigram_intersect(candidates, num_candidates, postings[i]);
+		}
+	} else
+	{
+		/* Strings that are shorter than a trigram match potentially everywhere */
+		for (i = 0; i < idx->num_documents; i++)
+			candidates[i] = i;
+		num_candidates = idx->num_documents;
+	}
+
+out:
+	free(postings);
+	if (num_candidates < 0)
+	{
+		free(candidates);
+		candidates = NULL;
+	}
+	*candidates_ptr = candidates;
+	return num_candidates;
+}
+
+static int index_trigram_find_documents(struct index *index, int (*callback)(int did, void *userdata), void *userdata, int num_substrings, va_list substrings)
+{
+	struct index_trigram *idx;
+	int *candidates = NULL;
+	int num_candidates;
+	const char **strs = NULL;
+	va_list substrings_copy;
+	int nd = 0;
+	int i, j;
+
+	idx = (struct index_trigram*)index;
+
+	if (!(strs = (const char**)malloc((num_substrings + 1) * sizeof(strs[0]))))
+		return 0;
+
+	va_copy(substrings_copy,substrings);
+	for (i = 0; i < num_substrings; i++)
+		strs[i] = va_arg(substrings_copy, const char *);
+	va_end(substrings_copy);
+
+	if ((num_candidates = index_trigram_candidates(idx, strs, num_substrings, &candidates)) < 0)
+		goto out;
+
+	/* Verify the candidates */
+	for (i = 0; i < num_candidates; i++)
+	{
+		const char *text;
+		int doc = candidates[i];
+
+		if (idx->documents[doc].removed)
+			continue;
+
+		if (!(text = index_trigram_get_text(idx, doc)))
+			continue;
+
+		for (j = 0; j < num_substrings; j++)
+		{
+			if (!strstr(text, strs[j]))
+				break;
+		}
+
+		if (j == num_substrings)
+		{
+			callback(idx->documents[doc].did, userdata);
+			nd++;
+		}
+	}
+
+out:
+	free(candidates);
+	free(strs);
+	return nd;
+}
+
+/*****************************************************/
+
+/**
+ * A candidate of a term cursor.
+ */
+struct trigram_cursor_candidate
+{
+	int did;
+
+	/** The internal document */
+	int doc;
+};
+
+/**
+ * A cursor over the documents that contain a single term. Candidates are
+ * only verified when the cursor reaches them.
+ */
+struct index_trigram_cursor
+{
+	struct index_cursor cursor;
+
+	struct index_trigram *idx;
+	char *term;
+
+	/** Documents that are not removed, sorted by document id */
+	struct trigram_cursor_candidate *candidates;
+	int num_candidates;
+
+	/** Position of the next candidate to be considered */
+	int pos;
+};
+
+static int index_trigram_compare_candidate(const void *a, const void *b)
+{
+	const struct trigram_cursor_candidate *ca = (const struct trigram_cursor_candidate *)a;
+	const struct trigram_cursor_candidate *cb = (const struct trigram_cursor_candidate *)b;
+
+	if (ca->did < cb->did) return -1;
+	if (ca->did > cb->did) return 1;
+	return ca->doc - cb->doc;
+}
+
+static int index_trigram_cursor_skip_to(struct index_cursor *cursor, int did)
+{
+	struct index_trigram_cursor *c = (struct index_trigram_cursor*)cursor;
+
+	while (c->pos < c->num_candidates)
+	{
+		const char *text;
+		struct trigram_cursor_candidate *cand = &c->candidates[c->pos++];
+
+		if (cand->did < did)
+			continue;
+
+		if (!(text = index_trigram_get_text(c->idx, cand->doc)))
+			continue;
+
+		if (!strstr(text, c->term))
+			continue;
+
+		/* Skip further documents of the same id */
+		while (c->pos < c->num_candidates && c->candidates[c->pos].did == cand->did)
+			c->pos++;
+		return cand->did;
+	}
+	return -1;
+}
+
+static void index_trigram_cursor_dispose(struct index_cursor *cursor)
+{
+	struct index_trigram_cursor *c = (struct index_trigram_cursor*)cursor;
+
+	free(c->candidates);
+	free(c->term);
+	free(c);
+}
+
+static struct index_cursor *index_trigram_open_term(struct index *index, const char *term)
+{
+	struct index_trigram *idx;
+	struct index_trigram_cursor *c;
+	int *candidates = NULL;
+	int num_candidates;
+	int i;
+
+	idx = (struct index_trigram*)index;
+
+	if (!(c = (struct index_trigram_cursor*)malloc(sizeof(*c))))
+		return NULL;
+	memset(c, 0, sizeof(*c));
+	index_cursor_init(&c->cursor, index_trigram_cursor_skip_to, index_trigram_cursor_dispose);
+	c->idx = idx;
+
+	if (!(c->term = strdup(term)))
+		goto bailout;
+
+	if ((num_candidates = index_trigram_candidates(idx, &term, 1, &candidates)) < 0)
+		goto bailout;
+
+	if (!(c->candidates = (struct trigram_cursor_candidate*)malloc((num_candidates + 1) * sizeof(c->candidates[0]))))
+		goto bailout;
+
+	for (i = 0; i < num_candidates; i++)
+	{
+		struct trigram_document *d = &idx->documents[candidates[i]];
+
+		if (d->removed)
+			continue;
+		c->candidates[c->num_candidates].did = d->did;
+		c->candidates[c->num_candidates].doc = candidates[i];
+		c->num_candidates++;
+	}
+	free(candidates);
+
+	qsort(c->candidates, c->num_candidates, sizeof(c->candidates[0]), index_trigram_compare_candidate);
+	return &c->cursor;
+bailout:
+	free(candidates);
+	index_trigram_cursor_dispose(&c->cursor);
+	return NULL;
+}
+
+/*****************************************************/
+
+struct index_algorithm index_trigram =
+{
+		index_trigram_create,
+		index_trigram_dispose,
+		index_trigram_put_document,
+		index_trigram_remove_document,
+		index_trigram_find_documents,
+		NULL,
+		index_trigram_open_term
+};
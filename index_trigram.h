@@ -0,0 +1,44 @@
+/**
+ * index_trigram.h - a trigram-based string index implementation for SimpleMail.
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM__INDEX_TRIGRAM_H
+#define SM__INDEX_TRIGRAM_H
+
+extern struct index_algorithm index_trigram;
+
+struct index;
+
+/**
+ * Returns whether so many documents of the given index have been removed
+ * that it should be purged.
+ *
+ * @param index the index, which must have been created with index_trigram.
+ * @return 1 if the index should be purged, else 0.
+ */
+int index_trigram_needs_purge(struct index *index);
+
+/**
+ * Rewrites the texts and the posting lists of the given index without the
+ * removed documents. The index stays as it was on failure.
+ *
+ * @param index the index, which must have been created with index_trigram.
+ * @return success or not.
+ */
+int index_trigram_purge(struct index *index);
+
+#endif
@@ -31,6 +31,8 @@
 #include "account.h"
 #include "addressbook.h"
 #include "addresslist.h"
+#include "arena.h"
+#include "charscan.h"
 #include "codecs.h"
 #include "configuration.h"
 #include "debug.h"
@@ -102,30 +104,18 @@ static int mail_complete_add_header(struct mail_complete *mail, const char *name
 									  char *contents, int contents_len)
 {
 	struct header *header;
-	char *new_name;
-	char *new_contents;
 
-	if (!(header = (struct header*)malloc(sizeof(struct header))))
+	/* The name and the contents are stored right behind the header */
+	if (!(header = (struct header*)malloc(sizeof(struct header) + name_len + 1 + contents_len + 1)))
 		return 0;
 
-	new_name = (char*)malloc(name_len+1);
-	new_contents = (char*)malloc(contents_len+1);
-
-	if (new_name && new_contents)
-	{
-		new_name[mailncpy(new_name,name,name_len)] = 0;
-		new_contents[mailncpy(new_contents,contents,contents_len)] = 0;
+	header->name = (char*)(header + 1);
+	header->name[mailncpy(header->name,name,name_len)] = 0;
+	header->contents = header->name + name_len + 1;
+	header->contents[mailncpy(header->contents,contents,contents_len)] = 0;
+	list_insert_tail(&mail->header_list,&header->node);
 
-		header->name = new_name;
-		header->contents = new_contents;
-		list_insert_tail(&mail->header_list,&header->node);
-
-		return 1;
-	}
-	free(new_name);
-	free(new_contents);
-	free(header);
-	return 0;
+	return 1;
 }
 
 /*****************************************************************************/
@@ -263,7 +253,10 @@ int mail_scan_buffer(struct mail_scan *ms, char *mail_buf, int size)
 				mode = 1;
 			} else
 			{
-				mode = 3; /* the header continues on the next line */
+				/* the header continues on the next line, which may also be the
+				 * first one of this buffer */
+				if (!contents_start) contents_start = buf;
+				mode = 3;
 			}
 		}
 
@@ -298,6 +291,16 @@ int mail_scan_buffer(struct mail_scan *ms, char *mail_buf, int size)
 			}
 		}
 
+		/* Only the end of the line is of interest when reading contents and
+		 * only the colon when reading a name, so skip the rest in one go */
+		if (mode == 3 || mode == 1)
+		{
+			char *next = (char*)(mode == 3 ? charscan_find2(buf + 1, mail_buf_end, 10, 13) : charscan_find2(buf + 1, mail_buf_end, ':', ':'));
+			ms->position += next - buf;
+			buf = next;
+			continue;
+		}
+
 		buf++;
 		ms->position++;
 	}
@@ -341,7 +344,8 @@ struct mail_complete *mail_find_compound_object(struct mail_complete *m, char *i
 			{
 				if (content_id)
 				{
-					if (!mystricmp(id,m->multipart_array[i]->content_id)) return m->multipart_array[i];
+					struct mail_complete *part = mail_get_part(m,i);
+					if (part && !mystricmp(id,part->content_id)) return part;
 				}
 			}
 			return NULL;
@@ -361,8 +365,11 @@ struct mail_complete *mail_find_content_type(struct mail_complete *m, const char
 
 	for (i=0;i < m->num_multiparts; i++)
 	{
-		struct mail_complete *rm = mail_find_content_type(m->multipart_array[i],type,subtype);
-		if (rm) return rm;
+		struct mail_complete *part = mail_get_part(m,i);
+		struct mail_complete *rm;
+
+		if (!part) continue;
+		if ((rm = mail_find_content_type(part,type,subtype))) return rm;
 	}
 
 	return NULL;
@@ -383,7 +390,7 @@ struct mail_complete *mail_find_initial(struct mail_complete *m)
 			if (!mystricmp(m->content_type, "multipart") &&
 				  !mystricmp(m->content_subtype, "alternative")) alter = 1;
 			i = 0;
-			m = m->multipart_array[0];
+			m = mail_get_part(m,0);
 		} else
 		{
 			if (!alter) return m;
@@ -396,7 +403,7 @@ struct mail_complete *mail_find_initial(struct mail_complete *m)
 			}
 			i++;
 			if (i >= m->parent_mail->num_multiparts) return pref;
-			m = m->parent_mail->multipart_array[i];
+			m = mail_get_part(m->parent_mail,i);
 		}
 	}
 	return NULL;
@@ -435,15 +442,15 @@ struct mail_complete *mail_get_next(struct mail_complete *m)
 						if (!parent) return NULL;
 						break;
 					}
-					m = parent->multipart_array[i];
-					while (m->multipart_array) m = m->multipart_array[0];
+					m = mail_get_part(parent,i);
+					while (m && m->multipart_array) m = mail_get_part(m,0);
 					return m;
 				}
 			}
 		}
 	} else
 	{
-		while (m->multipart_array) m = m->multipart_array[0];
+		while (m && m->multipart_array) m = mail_get_part(m,0);
 	}
 
 	return m;
@@ -606,6 +613,22 @@ struct mail_info *mail_info_create(mail_context *mc)
 
 /*****************************************************************************/
 
+struct mail_info *mail_info_create_in_arena(mail_context *mc, struct arena *arena)
+{
+	struct mail_info *m;
+
+	if ((m = (struct mail_info*)arena_alloc(arena, sizeof(struct mail_info))))
+	{
+		memset(m,0,sizeof(*m));
+		m->context = mc;
+		m->arena = arena;
+		arena_ref(arena);
+	}
+	return m;
+}
+
+/*****************************************************************************/
+
 struct mail_complete *mail_complete_create(mail_context *mc)
 {
 	struct mail_complete *m;
@@ -736,6 +759,26 @@ struct mail_info *mail_info_create_from_file(mail_context *mc, const char *filen
 
 /*****************************************************************************/
 
+void mail_info_set_context(struct mail_info *m, mail_context *mc)
+{
+	int id;
+
+	m->context = mc;
+
+	if (!mc || !m->pop3_server.str || (m->tflags & MAIL_TFLAGS_POP3_ID))
+		return;
+
+	/* Move the name of the pop3 server into the string pool of the context */
+	if ((id = string_pool_ref(mc->sp, m->pop3_server.str)) != -1)
+	{
+		free(m->pop3_server.str);
+		m->pop3_server.id = id;
+		m->tflags |= MAIL_TFLAGS_POP3_ID;
+	}
+}
+
+/*****************************************************************************/
+
 struct mail_complete *mail_create_for(char *from, char *to_str_unexpanded, char *replyto, char *subject, char *body)
 {
 	struct mail_complete *mail;
@@ -1514,6 +1557,24 @@ void mail_info_set_excerpt(struct mail_info *mail, utf8 *excerpt)
 	mail->excerpt = excerpt;
 }
 
+/*****************************************************************************/
+
+void mail_info_set_filename(struct mail_info *mail, char *filename)
+{
+	if (!(mail->tflags & MAIL_TFLAGS_ARENA_FILENAME)) free(mail->filename);
+	mail->tflags &= ~MAIL_TFLAGS_ARENA_FILENAME;
+	mail->filename = filename;
+}
+
+/*****************************************************************************/
+
+void mail_info_set_message_id(struct mail_info *mail, char *message_id)
+{
+	if (!(mail->tflags & MAIL_TFLAGS_ARENA_MESSAGE_ID)) free(mail->message_id);
+	mail->tflags &= ~MAIL_TFLAGS_ARENA_MESSAGE_ID;
+	mail->message_id = message_id;
+}
+
 /**
  * Does RFC 2184 stuff.
  *
@@ -2038,17 +2099,18 @@ static void mail_decrypt(struct mail_complete *mail)
 {
 	if (!mystricmp(mail->content_subtype,"encrypted"))
 	{
-		if (mail->num_multiparts==2 &&
+		struct mail_complete *control_mail = mail->num_multiparts==2?mail_get_part(mail,0):NULL;
+		struct mail_complete *encrypt_mail = control_mail?mail_get_part(mail,1):NULL;
+
+		if (encrypt_mail &&
 				!mystricmp(mail_find_content_parameter_value(mail,"protocol"),"application/pgp-encrypted") &&
-			  !mystricmp(mail->multipart_array[0]->content_type,"application") &&
-			  !mystricmp(mail->multipart_array[0]->content_subtype,"pgp-encrypted"))
+			  !mystricmp(control_mail->content_type,"application") &&
+			  !mystricmp(control_mail->content_subtype,"pgp-encrypted"))
 		{
 			static char *saved_passphrase;
 			char *env_passphrase = sm_getenv("PGPPASS");
 			int keep_env = 0;
 
-			struct mail_complete *encrypt_mail = mail->multipart_array[1];
-
 			if (env_passphrase)
 			{
 				free(saved_passphrase);
@@ -2103,6 +2165,8 @@ static void mail_decrypt(struct mail_complete *mail)
 								/* There must be at least two mails allocated */
 								for (i=0;i<mail->num_multiparts;i++)
 									mail_complete_free(mail->multipart_array[i]);
+								free(mail->part_offsets);
+								mail->part_offsets = NULL;
 
 								if ((new_mail = mail->multipart_array[0] = mail_complete_create(NULL)))
 								{
@@ -2127,7 +2191,7 @@ static void mail_decrypt(struct mail_complete *mail)
 								{
 									free(mail->multipart_array);
 									mail->multipart_array = NULL;
-									mail->num_multiparts = 0;
+									mail->multipart_allocated = mail->num_multiparts = 0;
 								}
 							}
 							fclose(fh);
@@ -2159,12 +2223,15 @@ static void mail_decrypt(struct mail_complete *mail)
 			mail->decoded_len = strlen(mail->decoded_data);
 			if (mail->multipart_array)
 			{
-				mail_complete_free(mail->multipart_array[1]);
-				mail_complete_free(mail->multipart_array[0]);
+				int i;
+				for (i=0;i<mail->num_multiparts;i++)
+					mail_complete_free(mail->multipart_array[i]);
 				free(mail->multipart_array);
 				mail->multipart_array = NULL;
 			}
-			mail->num_multiparts = 0;
+			free(mail->part_offsets);
+			mail->part_offsets = NULL;
+			mail->multipart_allocated = mail->num_multiparts = 0;
 		}
 	}
 }
@@ -2221,7 +2288,32 @@ static void mail_resolve_smime(struct mail_complete *mail)
 }
 
 /**
- * Recursively, read the structure of the given mail.
+ * Finds the first occurrence of the given string within the given memory
+ * area. Unlike strstr() the area doesn't need to be null-terminated.
+ *
+ * @param buf the start of the area.
+ * @param buf_end the end of the area.
+ * @param str the string to find.
+ * @param str_len the length of the string.
+ * @return the occurrence or NULL.
+ */
+static char *mail_find_str(char *buf, char *buf_end, const char *str, int str_len)
+{
+	while (buf_end - buf >= str_len)
+	{
+		if (!(buf = (char*)memchr(buf, str[0], buf_end - buf - str_len + 1)))
+			return NULL;
+		if (!memcmp(buf, str, str_len))
+			return buf;
+		buf++;
+	}
+	return NULL;
+}
+
+/**
+ * Reads the structure of the given mail. For multipart mails, only the
+ * boundaries of the parts are located. The parts are created on demand by
+ * mail_get_part(), which then reads their structure.
  *
  * @param mail the mail of which the structure should be read.
  * @return 0 on failure, otherwise some other value.
@@ -2238,24 +2330,29 @@ static int mail_read_structure(struct mail_complete *mail)
 			char *search_str = strdupcat("--",boundary);
 			if (search_str)
 			{
+				/* The text may be mapped, so it is not null-terminated */
+				int search_len = strlen(search_str);
 				char *text = mail->text + mail->text_begin;
-				char *buf = mail->text + mail->text_begin;
+				char *text_end = text + mail->text_len;
+				char *buf = text;
+				struct mail_part_offset *offsets = NULL;
+				int num_offsets = 0;
+				int offsets_allocated = 0;
 
-				if ((buf = strstr(buf,search_str)))
+				if ((buf = mail_find_str(buf,text_end,search_str,search_len)))
 				{
-					buf += strlen(search_str);
+					buf += search_len;
 				}
 
 				if (buf)
 				{
 					/* Skip line endings */
-					if (*buf == '\r') buf++;
-					if (*buf == '\n') buf++;
+					if (buf < text_end && *buf == '\r') buf++;
+					if (buf < text_end && *buf == '\n') buf++;
 
 					while (1)
 					{
-						struct mail_complete *new_mail;
-						char *end_part = strstr(buf,search_str);
+						char *end_part = mail_find_str(buf,text_end,search_str,search_len);
 						int skip = 0;
 						if (!end_part) break;
 
@@ -2277,42 +2374,34 @@ static int mail_read_structure(struct mail_complete *mail)
 							}
 						}
 
-						if ((new_mail = mail_complete_create(NULL)))
+						if (num_offsets == offsets_allocated)
 						{
-							struct mail_scan ms;
+							struct mail_part_offset *new_offsets;
 
-							new_mail->info->size = end_part - buf;
-
-							mail_scan_buffer_start(&ms,new_mail);
-							mail_scan_buffer(&ms, buf, end_part - buf);
-							mail_scan_buffer_end(&ms);
-							mail_process_headers(new_mail);
-
-							new_mail->text = mail->text;
-							new_mail->text_begin += buf - mail->text;
-							/* text_len is set by mail_scan_buffer */
-
-							if (mail->num_multiparts == mail->multipart_allocated)
-							{
-								mail->multipart_allocated += 5;
-								mail->multipart_array = (struct mail_complete **)realloc(mail->multipart_array,sizeof(struct mail*)*mail->multipart_allocated);
-							}
-
-							if (mail->multipart_array)
-							{
-								mail->multipart_array[mail->num_multiparts++] = new_mail;
-							}
-							mail_read_structure(new_mail); /* the recursion */
-							new_mail->parent_mail = mail;
+							offsets_allocated = offsets_allocated ? offsets_allocated * 2 : 8;
+							if (!(new_offsets = (struct mail_part_offset *)realloc(offsets,sizeof(*offsets)*offsets_allocated)))
+								break;
+							offsets = new_offsets;
 						}
 
-						buf = end_part + strlen(search_str) + skip;
+						offsets[num_offsets].begin = buf - mail->text;
+						offsets[num_offsets].len = end_part - buf;
+						num_offsets++;
+
+						buf = end_part + search_len + skip;
 
 						/* Skip line endings */
-						if (*buf == '\r') buf++;
-						if (*buf == '\n') buf++;
+						if (buf < text_end && *buf == '\r') buf++;
+						if (buf < text_end && *buf == '\n') buf++;
 					}
 				}
+
+				if (num_offsets && (mail->multipart_array = (struct mail_complete **)calloc(num_offsets,sizeof(struct mail_complete *))))
+				{
+					mail->part_offsets = offsets;
+					mail->multipart_allocated = mail->num_multiparts = num_offsets;
+				} else free(offsets);
+
 				free(search_str);
 			}
 
@@ -2320,36 +2409,83 @@ static int mail_read_structure(struct mail_complete *mail)
 		}
 	} else if (!mystricmp(mail->content_type,"message") && !mystricmp(mail->content_subtype,"rfc822"))
 	{
-		void *data;
-		int data_len;
+		/* The embedded mail is decoded by mail_get_part() */
+		if (!(mail->multipart_array = (struct mail_complete **)calloc(1,sizeof(struct mail_complete *)))) return 0;
+		mail->multipart_allocated = mail->num_multiparts = 1;
+	} else mail_resolve_smime(mail);
+	return 1;
+}
 
-		struct mail_complete *new_mail;
-		struct mail_scan ms;
+/**
+ * Creates the given part of a multipart mail and reads its structure.
+ *
+ * @param mail the multipart mail.
+ * @param i the index of the part that is not yet created.
+ * @return the part or NULL on failure.
+ */
+static struct mail_complete *mail_read_part(struct mail_complete *mail, int i)
+{
+	struct mail_complete *new_mail;
+	struct mail_scan ms;
+	char *buf;
+	int len;
 
-		if (!(mail->multipart_array = (struct mail_complete **)malloc(sizeof(struct mail*)))) return 0;
-		if (!(new_mail = mail->multipart_array[0] = mail_complete_create(NULL))) return 0;
-		mail->multipart_allocated = mail->num_multiparts = 1;
+	if (mail->part_offsets)
+	{
+		buf = mail->text + mail->part_offsets[i].begin;
+		len = mail->part_offsets[i].len;
+	} else if (!mystricmp(mail->content_type,"message") && !mystricmp(mail->content_subtype,"rfc822"))
+	{
+		void *data;
+		int data_len;
 
 		/* Decode the mail */
 		mail_decode(mail);
 		mail_decoded_data(mail,&data,&data_len);
 
-		/* Must be set befor buffer functions! */
-		new_mail->info->size = data_len;
-		new_mail->text = (char*)data;
-		/* text_begin and text_len will be set by buffer functions */
+		buf = (char*)data;
+		len = data_len;
+	} else return NULL;
 
-		mail_scan_buffer_start(&ms,new_mail);
-		mail_scan_buffer(&ms, (char*)data,data_len);
-		mail_scan_buffer_end(&ms);
-		mail_process_headers(new_mail);
+	if (!buf || !(new_mail = mail_complete_create(NULL)))
+		return NULL;
 
-		mail_read_structure(new_mail);
+	/* Must be set before buffer functions! */
+	new_mail->info->size = len;
 
-		/* so new_mail->text will not be freed */
-		new_mail->parent_mail = mail;
-	} else mail_resolve_smime(mail);
-	return 1;
+	mail_scan_buffer_start(&ms,new_mail);
+	mail_scan_buffer(&ms, buf, len);
+	mail_scan_buffer_end(&ms);
+	mail_process_headers(new_mail);
+
+	if (mail->part_offsets)
+	{
+		new_mail->text = mail->text;
+		new_mail->text_begin += buf - mail->text;
+		/* text_len is set by mail_scan_buffer */
+	} else
+	{
+		new_mail->text = buf;
+		/* text_begin and text_len have been set by buffer functions */
+	}
+
+	mail->multipart_array[i] = new_mail;
+	mail_read_structure(new_mail); /* only the next level */
+
+	/* so new_mail->text will not be freed */
+	new_mail->parent_mail = mail;
+	return new_mail;
+}
+
+/*****************************************************************************/
+
+struct mail_complete *mail_get_part(struct mail_complete *m, int i)
+{
+	if (i < 0 || i >= m->num_multiparts || !m->multipart_array)
+		return NULL;
+	if (m->multipart_array[i])
+		return m->multipart_array[i];
+	return mail_read_part(m,i);
 }
 
 /*****************************************************************************/
@@ -2357,6 +2493,7 @@ static int mail_read_structure(struct mail_complete *mail)
 void mail_read_contents(const char *folder, struct mail_complete *mail)
 {
 	char path[256];
+	unsigned long mapped_size;
 	FILE *fp;
 
 	if (folder)
@@ -2365,17 +2502,34 @@ void mail_read_contents(const char *folder, struct mail_complete *mail)
 		if(chdir(folder) == -1) return;
 	}
 
-	if ((fp = fopen(mail->info->filename,"rb")))
+	/* Map the mail so only the parts that are actually accessed are read.
+	 * The parts of the mail refer to the mapping. */
+	if ((mail->text = (char *)sm_map_file(mail->info->filename, &mapped_size)))
+	{
+		if (mapped_size == mail->info->size)
+		{
+			mail->text_mapped_size = mapped_size;
+		} else
+		{
+			sm_unmap_file(mail->text, mapped_size);
+			mail->text = NULL;
+		}
+	}
+
+	if (!mail->text && (fp = fopen(mail->info->filename,"rb")))
 	{
 		if ((mail->text = (char *)malloc(mail->info->size+1)))
 		{
 			fread(mail->text,1,mail->info->size,fp);
 			mail->text[mail->info->size]=0;
 		}
+		fclose(fp);
+	}
 
+	if (mail->text)
+	{
+		mail->text_owned = 1;
 		mail_read_structure(mail);
-
-		fclose(fp);
 	}
 
 	if (folder) chdir(path);
@@ -2462,6 +2616,50 @@ void *mail_decode_bytes(struct mail_complete *mail, unsigned int *len_ptr)
 	return decoded;
 }
 
+/*****************************************************************************/
+
+int mail_decoded_data_write(struct mail_complete *mail, FILE *fh)
+{
+	unsigned char buf[4096 + TRANSFER_DECODER_PENDING_SIZE];
+	struct transfer_decoder dec;
+	unsigned char *src, *src_end;
+	unsigned int len;
+	int encoding;
+
+	if (!mail->text) return 0;
+
+	if (!mystricmp(mail->content_transfer_encoding,"base64")) encoding = TRANSFER_ENCODING_BASE64;
+	else if (!mystricmp(mail->content_transfer_encoding,"quoted-printable")) encoding = TRANSFER_ENCODING_QUOTED_PRINTABLE;
+	else encoding = 0;
+
+	/* Text that is converted to UTF8 must be decoded as a whole, for all
+	 * others only a small buffer is needed */
+	if (mail->decoded_data || !encoding || (!mystricmp(mail->content_type,"text") && mystricmp(mail->content_subtype, "html") && mystricmp(mail->content_charset,"utf-8")))
+	{
+		void *data;
+		int data_len;
+
+		mail_decoded_data(mail,&data,&data_len);
+		return fwrite(data,1,data_len,fh) == (size_t)data_len;
+	}
+
+	src = (unsigned char*)mail->text + mail->text_begin;
+	src_end = src + mail->text_len;
+
+	transfer_decoder_init(&dec,encoding);
+	while (src < src_end)
+	{
+		unsigned int chunk = src_end - src;
+		if (chunk > 4096) chunk = 4096;
+
+		len = transfer_decoder_feed(&dec,src,chunk,buf);
+		if (fwrite(buf,1,len,fh) != len) return 0;
+		src += chunk;
+	}
+	len = transfer_decoder_finish(&dec,buf);
+	return fwrite(buf,1,len,fh) == len;
+}
+
 /**
  * Free a mail string, either the id or directly.
  *
@@ -2493,19 +2691,28 @@ void mail_info_free(struct mail_info *info)
 		return;
 	}
 
+	mail_free_str(info, &info->pop3_server, !!(info->tflags & MAIL_TFLAGS_POP3_ID));
+	free(info->excerpt);
+
+	if (info->arena)
+	{
+		/* Everything else resides in the arena, except for fields that
+		 * have been replaced */
+		if (!(info->tflags & MAIL_TFLAGS_ARENA_FILENAME)) free(info->filename);
+		if (!(info->tflags & MAIL_TFLAGS_ARENA_MESSAGE_ID)) free(info->message_id);
+		arena_unref(info->arena);
+		return;
+	}
+
 	free(info->subject);
 	free(info->from_phrase);
 	free(info->from_addr);
 	if (info->to_list) address_list_free(info->to_list);
 	if (info->cc_list) address_list_free(info->cc_list);
 	free(info->reply_addr);
-
-	mail_free_str(info, &info->pop3_server, !!(info->tflags & MAIL_TFLAGS_POP3_ID));
-
 	free(info->message_id);
 	free(info->message_reply_id);
 	free(info->filename);
-	free(info->excerpt);
 	free(info);
 }
 
@@ -2522,11 +2729,7 @@ void mail_complete_free(struct mail_complete *mail)
 	if (mail->html_header) free(mail->html_header);
 
 	while ((hdr = (struct header *)list_remove_tail(&mail->header_list)))
-	{
-		free(hdr->name);
-		free(hdr->contents);
 		free(hdr);
-	}
 
 	while ((cp = (struct content_parameter*)list_remove_tail(&mail->content_parameter_list)))
 	{
@@ -2540,6 +2743,7 @@ void mail_complete_free(struct mail_complete *mail)
 		mail_complete_free(mail->multipart_array[i]); /* recursion */
 	}
 	free(mail->multipart_array);
+	free(mail->part_offsets);
 
 	free(mail->extra_text);
 
@@ -2553,8 +2757,13 @@ void mail_complete_free(struct mail_complete *mail)
 
 	free(mail->decoded_data);
 
-	/* TODO: Check if mail->text must be freed even if mail->info == NULL */
-	if (mail->info && mail->info->filename && mail->text) free(mail->text);
+	/* The text belongs to the mail only if it has been read by the mail
+	 * itself, the caller may have detached the mail info before */
+	if (mail->text_owned)
+	{
+		if (mail->text_mapped_size) sm_unmap_file(mail->text, mail->text_mapped_size);
+		else free(mail->text);
+	}
 
 	mail_info_free(mail->info);
 	free(mail);
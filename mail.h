@@ -37,10 +37,12 @@
 #include "mail_context.h"
 #endif
 
+struct arena;
+
 struct header
 {
 	struct node node; /* embedded node structure */
-	char *name;
+	char *name; /* name and contents are allocated together with the header */
 	char *contents;
 };
 
@@ -150,6 +152,7 @@ struct mail_info
 
 	unsigned short reference_count; /* number of additional references to this object */
 	unsigned short tflags; /* transient flags */
+	int folder_position; /* position within the mail array of the folder, maintained by the folder */
 
 #if 0
 	struct mail_info *sub_thread_mail;	/* one more level */
@@ -157,11 +160,30 @@ struct mail_info
 	struct mail_info *next_thread_mail;	/* the same level */
 
 	mail_context *context; /* The context to which this mail is associated, may be NULL */
+
+	/**
+	 * The arena in which the mail info, its strings and its address lists
+	 * reside or NULL. The excerpt and the name of the pop3 server are never
+	 * allocated from the arena.
+	 */
+	struct arena *arena;
 };
 
 /* Only 16 bits in total */
 #define MAIL_TFLAGS_TO_BE_FREED (1<<0)
 #define MAIL_TFLAGS_POP3_ID (1<<1)
+#define MAIL_TFLAGS_ARENA_FILENAME (1<<2) /* filename resides in the arena */
+#define MAIL_TFLAGS_ARENA_MESSAGE_ID (1<<3) /* message_id resides in the arena */
+
+/**
+ * The location of a part of a multipart mail within the text of the
+ * multipart mail.
+ */
+struct mail_part_offset
+{
+	unsigned int begin; /* the beginning of the part, relative to the text */
+	unsigned int len; /* the length of the part including its headers */
+};
 
 struct mail_complete
 {
@@ -184,15 +206,20 @@ struct mail_complete
 
 	unsigned int text_begin; /* the beginning of the mail's text */
 	unsigned int text_len; /* the length of the mails text */
-	char *text; /* the mails text, allocated only for mails with filename */
+	char *text; /* the mails text, allocated or mapped only for mails with filename.
+	               It is not necessarily null-terminated */
+	unsigned long text_mapped_size; /* size of the mapping if text has been mapped via sm_map_file() */
+	int text_owned; /* text has been allocated or mapped by mail_read_contents(), it is freed with the mail */
 	char *extra_text; /* this is extra allocated text, e.g. for decrypted */
 										/* e-Mails, will always be freed if set */
 
 	/* after mail_read_structure() */
-	/* only used in multipart messages */
+	/* only used in multipart messages. The entries of multipart_array are
+	 * created on demand, use mail_get_part() to access them */
 	struct mail_complete **multipart_array;
 	int multipart_allocated;
 	int num_multiparts;
+	struct mail_part_offset *part_offsets; /* where the parts that are not yet created are located */
 
   /* for "childs" of multipart messages */
 	struct mail_complete *parent_mail; /* if NULL, mail is root */
@@ -239,6 +266,20 @@ struct mail_complete
  */
 struct mail_info *mail_info_create(mail_context *mc);
 
+/**
+ * Creates a mail info within the given arena, initialize it to default
+ * values. The mail holds a reference to the arena as long as it exists.
+ * Strings and address lists of such a mail may be allocated from the arena
+ * as well. A filename or message id that has been allocated from the arena
+ * must be marked with MAIL_TFLAGS_ARENA_FILENAME or
+ * MAIL_TFLAGS_ARENA_MESSAGE_ID, respectively.
+ *
+ * @param mc the context to which this mail will be associated. May be NULL.
+ * @param arena the arena.
+ * @return the mail info.
+ */
+struct mail_info *mail_info_create_in_arena(mail_context *mc, struct arena *arena);
+
 /**
  * Frees all memory associated with a mail info.
  *
@@ -287,6 +328,17 @@ struct mail_complete *mail_find_initial(struct mail_complete *m);
  */
 struct mail_complete *mail_get_root(struct mail_complete *m);
 
+/**
+ * Returns the given part of a multipart mail. The part is created when it
+ * is accessed for the first time. Only then, the boundaries of its own parts
+ * are located.
+ *
+ * @param m the multipart mail.
+ * @param i the index of the part, from 0 to m->num_multiparts - 1.
+ * @return the part or NULL if it doesn't exist or couldn't be created.
+ */
+struct mail_complete *mail_get_part(struct mail_complete *m, int i);
+
 /**
  * Returns the next part of the mail (excluding multiparts). Calling this
  * iteratively results in a depth-first order.
@@ -389,6 +441,26 @@ char *mail_get_replyto_address(struct mail_info *mail);
  */
 void mail_info_set_excerpt(struct mail_info *mail, utf8 *excerpt);
 
+/**
+ * Sets the given filename for the given mail. The filename should be
+ * allocated via malloc() and is owned by the mail afterwards. Frees the
+ * previously set filename unless it resides in the arena of the mail.
+ *
+ * @param mail of which the filename should be set
+ * @param filename the new filename
+ */
+void mail_info_set_filename(struct mail_info *mail, char *filename);
+
+/**
+ * Sets the given message id for the given mail. The message id should be
+ * allocated via malloc() and is owned by the mail afterwards. Frees the
+ * previously set message id unless it resides in the arena of the mail.
+ *
+ * @param mail of which the message id should be set
+ * @param message_id the new message id. May be NULL.
+ */
+void mail_info_set_message_id(struct mail_info *mail, char *message_id);
+
 /**
  * Checks whether a mail with the given filename is marked as deleted
  * (on IMAP folders).
@@ -478,6 +550,16 @@ struct mail_complete *mail_create_forward(int num, char **filename_array);
  */
 struct mail_info *mail_info_create_from_file(mail_context *mc, const char *filename);
 
+/**
+ * Associates a mail info that has been created without a context with the
+ * given context. This is useful for mails that have been created on a
+ * different thread than the one that owns the context.
+ *
+ * @param m the mail whose context is NULL.
+ * @param mc the context to which the mail shall be associated.
+ */
+void mail_info_set_context(struct mail_info *m, mail_context *mc);
+
 /**
  * Frees all memory associated with a mail.
  *
@@ -534,6 +616,19 @@ void mail_decode(struct mail_complete *mail);
  */
 void *mail_decode_bytes(struct mail_complete *mail, unsigned int *len_ptr);
 
+/**
+ * Writes the decoded contents of the given mail, i.e., the same data that
+ * mail_decoded_data() provides, to the given file. Unless the contents needs
+ * to be converted to UTF8, it is decoded piece by piece, so the whole
+ * decoded data is never held in memory.
+ *
+ * @param mail the mail whose contents shall be written. The contents must
+ *  have been read via mail_read_contents().
+ * @param fh the file to which the contents is written.
+ * @return 1 on success, 0 on failure.
+ */
+int mail_decoded_data_write(struct mail_complete *mail, FILE *fh);
+
 /**
  * Decodes the given mail to the given buffers.
  *
@@ -0,0 +1,520 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file mail_btree.c
+ *
+ * The mails are stored in the leaves of a B+-tree. Each node knows the
+ * number of mails in its subtree, which allows to descend to a position.
+ * Full nodes are split on the way down when inserting, so an insertion
+ * never fails after the tree has been modified. Nodes that become small
+ * when removing mails are merged with a neighbour if possible.
+ */
+
+#include "mail_btree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** Maximum number of mails in a leaf or children of an inner node */
+#define MAIL_BTREE_ORDER 64
+
+/** Nodes with fewer entries are merged with a neighbour if possible */
+#define MAIL_BTREE_MIN (MAIL_BTREE_ORDER / 4)
+
+/** Number of entries of the nodes created by mail_btree_create_from_array() */
+#define MAIL_BTREE_FILL (MAIL_BTREE_ORDER * 3 / 4)
+
+/** Maximum height of a tree, sufficient for any int number of mails */
+#define MAIL_BTREE_MAX_HEIGHT 32
+
+struct mail_btree_node
+{
+	int leaf; /* 1 if the node holds mails, 0 if it holds other nodes */
+	int num; /* number of entries */
+	int count; /* number of mails in this subtree */
+	union
+	{
+		struct mail_info *mails[MAIL_BTREE_ORDER];
+		struct mail_btree_node *children[MAIL_BTREE_ORDER];
+	} u;
+};
+
+struct mail_btree
+{
+	struct mail_btree_node *root; /* never NULL */
+
+	/* The leaf of the most recent lookup and the position of its first mail */
+	struct mail_btree_node *hint_leaf;
+	int hint_first;
+};
+
+/*****************************************************************************/
+
+/**
+ * Creates an empty node.
+ *
+ * @param leaf whether the node is a leaf.
+ * @return the node or NULL on failure.
+ */
+static struct mail_btree_node *mail_btree_node_create(int leaf)
+{
+	struct mail_btree_node *n;
+
+	if (!(n = (struct mail_btree_node *)malloc(sizeof(*n))))
+		return NULL;
+	n->leaf = leaf;
+	n->num = 0;
+	n->count = 0;
+	return n;
+}
+
+/**
+ * Frees the given node and its subtree.
+ *
+ * @param n
+ */
+static void mail_btree_node_free(struct mail_btree_node *n)
+{
+	int i;
+
+	if (!n->leaf)
+	{
+		for (i = 0; i < n->num; i++)
+			mail_btree_node_free(n->u.children[i]);
+	}
+	free(n);
+}
+
+/*****************************************************************************/
+
+struct mail_btree *mail_btree_create(void)
+{
+	struct mail_btree *tree;
+
+	if (!(tree = (struct mail_btree *)malloc(sizeof(*tree))))
+		return NULL;
+	if (!(tree->root = mail_btree_node_create(1)))
+	{
+		free(tree);
+		return NULL;
+	}
+	tree->hint_leaf = NULL;
+	tree->hint_first = 0;
+	return tree;
+}
+
+/*****************************************************************************/
+
+struct mail_btree *mail_btree_create_from_array(struct mail_info **mails, int num_mails)
+{
+	struct mail_btree *tree;
+	struct mail_btree_node **level;
+	int num_level;
+	int i;
+
+	if (!(tree = mail_btree_create()))
+		return NULL;
+
+	if (num_mails <= MAIL_BTREE_ORDER)
+	{
+		memcpy(tree->root->u.mails, mails, num_mails * sizeof(mails[0]));
+		tree->root->num = tree->root->count = num_mails;
+		return tree;
+	}
+
+	num_level = (num_mails + MAIL_BTREE_FILL - 1) / MAIL_BTREE_FILL;
+	if (!(level = (struct mail_btree_node **)malloc(num_level * sizeof(level[0]))))
+		goto bailout;
+
+	/* Build the leaves */
+	for (i = 0; i < num_level; i++)
+	{
+		int first = i * MAIL_BTREE_FILL;
+		int num = num_mails - first;
+
+		if (num > MAIL_BTREE_FILL) num = MAIL_BTREE_FILL;
+		if (!(level[i] = mail_btree_node_create(1)))
+			goto bailout_level;
+		memcpy(level[i]->u.mails, &mails[first], num * sizeof(mails[0]));
+		level[i]->num = level[i]->count = num;
+	}
+
+	/* Build the inner levels, each one is stored in place of the level below */
+	while (num_level > 1)
+	{
+		int num_upper = (num_level + MAIL_BTREE_FILL - 1) / MAIL_BTREE_FILL;
+
+		for (i = 0; i < num_upper; i++)
+		{
+			struct mail_btree_node *n;
+			int first = i * MAIL_BTREE_FILL;
+			int num = num_level - first;
+			int j;
+
+			if (num > MAIL_BTREE_FILL) num = MAIL_BTREE_FILL;
+			if (!(n = mail_btree_node_create(0)))
+			{
+				/* The nodes of the upper level so far and the remaining ones of
+				 * the current level make up the entire tree */
+				for (j = first; j < num_level; j++)
+					mail_btree_node_free(level[j]);
+				num_level = i;
+				goto bailout_level;
+			}
+			for (j = 0; j < num; j++)
+			{
+				n->u.children[j] = level[first + j];
+				n->count += level[first + j]->count;
+			}
+			n->num = num;
+			level[i] = n;
+		}
+		num_level = num_upper;
+	}
+
+	mail_btree_node_free(tree->root);
+	tree->root = level[0];
+	free(level);
+	return tree;
+
+bailout_level:
+	while (i > 0)
+		mail_btree_node_free(level[--i]);
+	free(level);
+bailout:
+	mail_btree_free(tree);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+void mail_btree_free(struct mail_btree *tree)
+{
+	if (!tree) return;
+	mail_btree_node_free(tree->root);
+	free(tree);
+}
+
+/*****************************************************************************/
+
+int mail_btree_count(struct mail_btree *tree)
+{
+	return tree->root->count;
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_btree_get(struct mail_btree *tree, int pos)
+{
+	struct mail_btree_node *n;
+	int first = 0;
+
+	if (pos < 0 || pos >= tree->root->count)
+		return NULL;
+
+	if (tree->hint_leaf && pos >= tree->hint_first && pos < tree->hint_first + tree->hint_leaf->num)
+		return tree->hint_leaf->u.mails[pos - tree->hint_first];
+
+	n = tree->root;
+	while (!n->leaf)
+	{
+		int i;
+
+		for (i = 0; pos - first >= n->u.children[i]->count; i++)
+			first += n->u.children[i]->count;
+		n = n->u.children[i];
+	}
+
+	tree->hint_leaf = n;
+	tree->hint_first = first;
+	return n->u.mails[pos - first];
+}
+
+/*****************************************************************************/
+
+/**
+ * Splits the given child of the given node into two halves. The node must
+ * not be full.
+ *
+ * @param n the parent node.
+ * @param idx the index of the child to split.
+ * @return 1 on success, 0 on failure.
+ */
+static int mail_btree_split_child(struct mail_btree_node *n, int idx)
+{
+	struct mail_btree_node *child = n->u.children[idx];
+	struct mail_btree_node *sibling;
+	int half = child->num / 2;
+	int i;
+
+	if (!(sibling = mail_btree_node_create(child->leaf)))
+		return 0;
+
+	sibling->num = child->num - half;
+	if (child->leaf)
+	{
+		memcpy(sibling->u.mails, &child->u.mails[half], sibling->num * sizeof(child->u.mails[0]));
+		sibling->count = sibling->num;
+	} else
+	{
+		memcpy(sibling->u.children, &child->u.children[half], sibling->num * sizeof(child->u.children[0]));
+		for (i = 0; i < sibling->num; i++)
+			sibling->count += sibling->u.children[i]->count;
+	}
+	child->num = half;
+	child->count -= sibling->count;
+
+	memmove(&n->u.children[idx + 2], &n->u.children[idx + 1], (n->num - idx - 1) * sizeof(n->u.children[0]));
+	n->u.children[idx + 1] = sibling;
+	n->num++;
+	return 1;
+}
+
+/*****************************************************************************/
+
+int mail_btree_insert_at(struct mail_btree *tree, int pos, struct mail_info *mail)
+{
+	struct mail_btree_node *path[MAIL_BTREE_MAX_HEIGHT];
+	struct mail_btree_node *n;
+	int height = 0;
+	int i;
+
+	if (pos < 0 || pos > tree->root->count)
+		return 0;
+
+	tree->hint_leaf = NULL;
+
+	if (tree->root->num == MAIL_BTREE_ORDER)
+	{
+		struct mail_btree_node *root;
+
+		if (!(root = mail_btree_node_create(0)))
+			return 0;
+		root->u.children[0] = tree->root;
+		root->num = 1;
+		root->count = tree->root->count;
+		if (!mail_btree_split_child(root, 0))
+		{
+			free(root);
+			return 0;
+		}
+		tree->root = root;
+	}
+
+	/* Descend to the leaf, splitting full nodes on the way. The counts are
+	 * adjusted only if nothing can fail anymore. */
+	n = tree->root;
+	while (!n->leaf)
+	{
+		for (i = 0; i < n->num - 1 && pos > n->u.children[i]->count; i++)
+			pos -= n->u.children[i]->count;
+
+		if (n->u.children[i]->num == MAIL_BTREE_ORDER)
+		{
+			if (!mail_btree_split_child(n, i))
+				return 0;
+			if (pos > n->u.children[i]->count)
+			{
+				pos -= n->u.children[i]->count;
+				i++;
+			}
+		}
+		path[height++] = n;
+		n = n->u.children[i];
+	}
+
+	memmove(&n->u.mails[pos + 1], &n->u.mails[pos], (n->num - pos) * sizeof(n->u.mails[0]));
+	n->u.mails[pos] = mail;
+	n->num++;
+	n->count++;
+
+	for (i = 0; i < height; i++)
+		path[i]->count++;
+	return 1;
+}
+
+/*****************************************************************************/
+
+int mail_btree_insert_sorted(struct mail_btree *tree, struct mail_info *mail, mail_btree_compare_t compare)
+{
+	int low = 0;
+	int high = tree->root->count;
+
+	/* Find the first mail that is larger than the given one */
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		struct mail_info *m = mail_btree_get(tree, mid);
+
+		if (compare(&m, &mail) <= 0) low = mid + 1;
+		else high = mid;
+	}
+
+	if (!mail_btree_insert_at(tree, low, mail))
+		return -1;
+	return low;
+}
+
+/*****************************************************************************/
+
+/**
+ * Merges the child at the given index with its right neighbour, if both
+ * fit into a single node.
+ *
+ * @param n the parent node.
+ * @param idx the index of the left child.
+ */
+static void mail_btree_merge_children(struct mail_btree_node *n, int idx)
+{
+	struct mail_btree_node *left = n->u.children[idx];
+	struct mail_btree_node *right = n->u.children[idx + 1];
+
+	if (left->num + right->num > MAIL_BTREE_ORDER)
+		return;
+
+	if (left->leaf) memcpy(&left->u.mails[left->num], right->u.mails, right->num * sizeof(right->u.mails[0]));
+	else memcpy(&left->u.children[left->num], right->u.children, right->num * sizeof(right->u.children[0]));
+	left->num += right->num;
+	left->count += right->count;
+	free(right);
+
+	memmove(&n->u.children[idx + 1], &n->u.children[idx + 2], (n->num - idx - 2) * sizeof(n->u.children[0]));
+	n->num--;
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_btree_remove_at(struct mail_btree *tree, int pos)
+{
+	struct mail_btree_node *path[MAIL_BTREE_MAX_HEIGHT];
+	int path_idx[MAIL_BTREE_MAX_HEIGHT];
+	struct mail_btree_node *n;
+	struct mail_info *mail;
+	int height = 0;
+
+	if (pos < 0 || pos >= tree->root->count)
+		return NULL;
+
+	tree->hint_leaf = NULL;
+
+	n = tree->root;
+	while (!n->leaf)
+	{
+		int i;
+
+		for (i = 0; pos >= n->u.children[i]->count; i++)
+			pos -= n->u.children[i]->count;
+		n->count--;
+		path[height] = n;
+		path_idx[height++] = i;
+		n = n->u.children[i];
+	}
+
+	mail = n->u.mails[pos];
+	memmove(&n->u.mails[pos], &n->u.mails[pos + 1], (n->num - pos - 1) * sizeof(n->u.mails[0]));
+	n->num--;
+	n->count--;
+
+	/* Merge small nodes with a neighbour, from the bottom up */
+	while (height > 0)
+	{
+		struct mail_btree_node *parent = path[--height];
+		int idx = path_idx[height];
+
+		if (parent->u.children[idx]->num >= MAIL_BTREE_MIN || parent->num < 2)
+			break;
+
+		if (idx + 1 < parent->num) mail_btree_merge_children(parent, idx);
+		else mail_btree_merge_children(parent, idx - 1);
+	}
+
+	/* Shrink the tree if the root has only a single child */
+	while (!tree->root->leaf && tree->root->num == 1)
+	{
+		struct mail_btree_node *root = tree->root;
+		tree->root = root->u.children[0];
+		free(root);
+	}
+	return mail;
+}
+
+/*****************************************************************************/
+
+int mail_btree_find_sorted(struct mail_btree *tree, struct mail_info *mail, mail_btree_compare_t compare)
+{
+	int low = 0;
+	int high = tree->root->count;
+	int pos;
+
+	/* Find the first mail that is not smaller than the given one */
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		struct mail_info *m = mail_btree_get(tree, mid);
+
+		if (compare(&m, &mail) < 0) low = mid + 1;
+		else high = mid;
+	}
+
+	for (pos = low; pos < tree->root->count; pos++)
+	{
+		struct mail_info *m = mail_btree_get(tree, pos);
+
+		if (m == mail) return pos;
+		if (compare(&m, &mail) != 0) break;
+	}
+
+	/* The tree is not sorted with respect to this mail anymore */
+	for (pos = 0; pos < tree->root->count; pos++)
+	{
+		if (mail_btree_get(tree, pos) == mail)
+			return pos;
+	}
+	return -1;
+}
+
+/*****************************************************************************/
+
+/**
+ * Copies the mails of the given subtree into the given array.
+ *
+ * @param n the root of the subtree.
+ * @param mails the array.
+ * @return the number of copied mails.
+ */
+static int mail_btree_node_to_array(struct mail_btree_node *n, struct mail_info **mails)
+{
+	int copied = 0;
+	int i;
+
+	if (n->leaf)
+	{
+		memcpy(mails, n->u.mails, n->num * sizeof(mails[0]));
+		return n->num;
+	}
+
+	for (i = 0; i < n->num; i++)
+		copied += mail_btree_node_to_array(n->u.children[i], &mails[copied]);
+	return copied;
+}
+
+void mail_btree_to_array(struct mail_btree *tree, struct mail_info **mails)
+{
+	mail_btree_node_to_array(tree->root, mails);
+}
@@ -0,0 +1,129 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file mail_btree.h
+ *
+ * An order-statistic B-tree that holds a sequence of mails. Mails can be
+ * accessed, inserted and removed by their position in logarithmic time.
+ * Sequential access by increasing positions takes constant time.
+ */
+
+#ifndef SM__MAIL_BTREE_H
+#define SM__MAIL_BTREE_H
+
+struct mail_info;
+struct mail_btree;
+
+/**
+ * The type of the compare functions. The arguments point to pointers to the
+ * mails to be compared like for qsort().
+ */
+typedef int (*mail_btree_compare_t)(const void *arg1, const void *arg2);
+
+/**
+ * Creates an empty tree.
+ *
+ * @return the tree or NULL on failure.
+ */
+struct mail_btree *mail_btree_create(void);
+
+/**
+ * Creates a tree that holds the given mails in the given order.
+ *
+ * @param mails the mails.
+ * @param num_mails the number of mails.
+ * @return the tree or NULL on failure.
+ */
+struct mail_btree *mail_btree_create_from_array(struct mail_info **mails, int num_mails);
+
+/**
+ * Frees the given tree. The mails are not freed.
+ *
+ * @param tree the tree to free. May be NULL.
+ */
+void mail_btree_free(struct mail_btree *tree);
+
+/**
+ * @param tree the tree.
+ * @return the number of mails within the tree.
+ */
+int mail_btree_count(struct mail_btree *tree);
+
+/**
+ * Returns the mail at the given position.
+ *
+ * @param tree the tree.
+ * @param pos the position.
+ * @return the mail or NULL if pos is out of bounds.
+ */
+struct mail_info *mail_btree_get(struct mail_btree *tree, int pos);
+
+/**
+ * Inserts the given mail at the given position.
+ *
+ * @param tree the tree.
+ * @param pos the position, which must be between 0 and the number of mails.
+ * @param mail the mail to insert.
+ * @return 1 on success, 0 on failure.
+ */
+int mail_btree_insert_at(struct mail_btree *tree, int pos, struct mail_info *mail);
+
+/**
+ * Inserts the given mail into a tree whose mails are sorted with respect
+ * to the given compare function. The mail is inserted after all mails that
+ * are equal to it.
+ *
+ * @param tree the tree.
+ * @param mail the mail to insert.
+ * @param compare the compare function.
+ * @return the position of the inserted mail or -1 on failure.
+ */
+int mail_btree_insert_sorted(struct mail_btree *tree, struct mail_info *mail, mail_btree_compare_t compare);
+
+/**
+ * Removes the mail at the given position.
+ *
+ * @param tree the tree.
+ * @param pos the position.
+ * @return the removed mail or NULL if pos is out of bounds.
+ */
+struct mail_info *mail_btree_remove_at(struct mail_btree *tree, int pos);
+
+/**
+ * Determines the position of the given mail within a tree whose mails are
+ * sorted with respect to the given compare function. If the mail cannot be
+ * found by a binary search, for instance because its sort key has been
+ * changed, the entire tree is searched.
+ *
+ * @param tree the tree.
+ * @param mail the mail to look for.
+ * @param compare the compare function.
+ * @return the position or -1 if the mail is not within the tree.
+ */
+int mail_btree_find_sorted(struct mail_btree *tree, struct mail_info *mail, mail_btree_compare_t compare);
+
+/**
+ * Copies the mails of the given tree into the given array.
+ *
+ * @param tree the tree.
+ * @param mails the array that must be large enough to hold all mails.
+ */
+void mail_btree_to_array(struct mail_btree *tree, struct mail_info **mails);
+
+#endif
@@ -0,0 +1,543 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file mail_thread.c
+ *
+ * The threads are built like described by Jamie Zawinski. Each mail is
+ * held by a container. Containers are found by message id via a hash
+ * table, so the container of a mail's parent is found in constant time.
+ * If the parent has not been added yet, an empty container is created as
+ * a placeholder which is filled once the parent is added. An empty
+ * container never has a parent and is freed when it loses its last child.
+ * A second hash table maps the mails to their containers.
+ */
+
+#include "mail_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mail.h"
+#include "support_indep.h"
+
+/** Initial number of buckets of the hash tables, must be a power of two */
+#define MAIL_THREAD_INITIAL_SIZE 64
+
+struct mail_thread_container
+{
+	struct mail_info *mail; /* NULL if this is a placeholder for a missing mail */
+
+	struct mail_thread_container *parent;
+	struct mail_thread_container *first_child;
+	struct mail_thread_container *last_child;
+	struct mail_thread_container *prev; /* previous sibling */
+	struct mail_thread_container *next; /* next sibling */
+
+	struct mail_thread_container *next_by_id; /* next container within the same id bucket */
+	struct mail_thread_container *next_by_mail; /* next container within the same mail bucket */
+
+	unsigned int id_hash;
+	char *id; /* the message id, NULL if the container is not within the id table */
+};
+
+struct mail_thread
+{
+	struct mail_thread_container **ids; /* buckets of the id table */
+	struct mail_thread_container **mails; /* buckets of the mail table */
+	unsigned int size; /* number of buckets of either table */
+	unsigned int num_ids;
+	unsigned int num_mails;
+};
+
+/*****************************************************************************/
+
+/**
+ * Hashes the given message id case insensitively.
+ *
+ * @param id the message id.
+ * @return the hash value.
+ */
+static unsigned int mail_thread_hash_id(const char *id)
+{
+	unsigned int h = 2166136261u;
+	unsigned char c;
+
+	while ((c = (unsigned char)*id++))
+	{
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Hashes the given mail by its address.
+ *
+ * @param mail the mail.
+ * @return the hash value.
+ */
+static unsigned int mail_thread_hash_mail(const struct mail_info *mail)
+{
+	unsigned long p = (unsigned long)mail;
+	return (unsigned int)((p >> 4) ^ (p >> 16)) * 2654435761u;
+}
+
+/*****************************************************************************/
+
+struct mail_thread *mail_thread_create(void)
+{
+	struct mail_thread *thread;
+
+	if (!(thread = (struct mail_thread *)malloc(sizeof(*thread))))
+		return NULL;
+	memset(thread, 0, sizeof(*thread));
+
+	thread->size = MAIL_THREAD_INITIAL_SIZE;
+	thread->ids = (struct mail_thread_container **)calloc(thread->size, sizeof(thread->ids[0]));
+	thread->mails = (struct mail_thread_container **)calloc(thread->size, sizeof(thread->mails[0]));
+	if (!thread->ids || !thread->mails)
+	{
+		mail_thread_free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+/*****************************************************************************/
+
+void mail_thread_free(struct mail_thread *thread)
+{
+	unsigned int i;
+
+	if (!thread) return;
+
+	/* Every container is either within the id table or holds a mail */
+	if (thread->ids && thread->mails)
+	{
+		for (i = 0; i < thread->size; i++)
+		{
+			struct mail_thread_container *c = thread->ids[i];
+			while (c)
+			{
+				struct mail_thread_container *next = c->next_by_id;
+				if (!c->mail) free(c);
+				c = next;
+			}
+		}
+
+		for (i = 0; i < thread->size; i++)
+		{
+			struct mail_thread_container *c = thread->mails[i];
+			while (c)
+			{
+				struct mail_thread_container *next = c->next_by_mail;
+				free(c);
+				c = next;
+			}
+		}
+	}
+	free(thread->ids);
+	free(thread->mails);
+	free(thread);
+}
+
+/*****************************************************************************/
+
+/**
+ * Doubles the number of buckets of the hash tables if they are too full.
+ *
+ * @param thread the threads.
+ * @return 1 on success, 0 on failure. The tables are still valid in case
+ *  of a failure.
+ */
+static int mail_thread_grow(struct mail_thread *thread)
+{
+	struct mail_thread_container **ids;
+	struct mail_thread_container **mails;
+	unsigned int size = thread->size * 2;
+	unsigned int i;
+
+	if (thread->num_ids < thread->size && thread->num_mails < thread->size)
+		return 1;
+
+	ids = (struct mail_thread_container **)calloc(size, sizeof(ids[0]));
+	mails = (struct mail_thread_container **)calloc(size, sizeof(mails[0]));
+	if (!ids || !mails)
+	{
+		free(ids);
+		free(mails);
+		return 0;
+	}
+
+	for (i = 0; i < thread->size; i++)
+	{
+		struct mail_thread_container *c = thread->ids[i];
+		while (c)
+		{
+			struct mail_thread_container *next = c->next_by_id;
+			unsigned int b = c->id_hash & (size - 1);
+			c->next_by_id = ids[b];
+			ids[b] = c;
+			c = next;
+		}
+
+		c = thread->mails[i];
+		while (c)
+		{
+			struct mail_thread_container *next = c->next_by_mail;
+			unsigned int b = mail_thread_hash_mail(c->mail) & (size - 1);
+			c->next_by_mail = mails[b];
+			mails[b] = c;
+			c = next;
+		}
+	}
+
+	free(thread->ids);
+	free(thread->mails);
+	thread->ids = ids;
+	thread->mails = mails;
+	thread->size = size;
+	return 1;
+}
+
+/**
+ * Finds the container with the given message id.
+ *
+ * @param thread the threads.
+ * @param id the message id.
+ * @param hash the hash value of the id.
+ * @return the container or NULL.
+ */
+static struct mail_thread_container *mail_thread_find_id(struct mail_thread *thread, const char *id, unsigned int hash)
+{
+	struct mail_thread_container *c = thread->ids[hash & (thread->size - 1)];
+
+	while (c)
+	{
+		if (c->id_hash == hash && !mystricmp(c->id, id))
+			return c;
+		c = c->next_by_id;
+	}
+	return NULL;
+}
+
+/**
+ * Finds the container of the given mail.
+ *
+ * @param thread the threads.
+ * @param mail the mail.
+ * @return the container or NULL.
+ */
+static struct mail_thread_container *mail_thread_find_mail(struct mail_thread *thread, const struct mail_info *mail)
+{
+	struct mail_thread_container *c = thread->mails[mail_thread_hash_mail(mail) & (thread->size - 1)];
+
+	while (c)
+	{
+		if (c->mail == mail)
+			return c;
+		c = c->next_by_mail;
+	}
+	return NULL;
+}
+
+/**
+ * Creates a new container and puts it into the id table if an id is
+ * given.
+ *
+ * @param thread the threads.
+ * @param id the message id or NULL.
+ * @param hash the hash value of the id.
+ * @return the container or NULL on failure.
+ */
+static struct mail_thread_container *mail_thread_container_create(struct mail_thread *thread, const char *id, unsigned int hash)
+{
+	struct mail_thread_container *c;
+	size_t len = id ? strlen(id) + 1 : 0;
+	unsigned int b;
+
+	/* The id is stored right behind the container */
+	if (!(c = (struct mail_thread_container *)malloc(sizeof(*c) + len)))
+		return NULL;
+	memset(c, 0, sizeof(*c));
+
+	if (id)
+	{
+		c->id = (char *)(c + 1);
+		memcpy(c->id, id, len);
+		c->id_hash = hash;
+
+		b = hash & (thread->size - 1);
+		c->next_by_id = thread->ids[b];
+		thread->ids[b] = c;
+		thread->num_ids++;
+	}
+	return c;
+}
+
+/**
+ * Removes the given container from the id table and frees it if it is
+ * empty and has no children.
+ *
+ * @param thread the threads.
+ * @param c the container.
+ */
+static void mail_thread_container_prune(struct mail_thread *thread, struct mail_thread_container *c)
+{
+	if (c->mail || c->first_child)
+		return;
+
+	if (c->id)
+	{
+		struct mail_thread_container **pc = &thread->ids[c->id_hash & (thread->size - 1)];
+		while (*pc != c)
+			pc = &(*pc)->next_by_id;
+		*pc = c->next_by_id;
+		thread->num_ids--;
+	}
+	free(c);
+}
+
+/**
+ * Appends the given container to the children of the given parent.
+ *
+ * @param parent the parent.
+ * @param c the container without a parent.
+ */
+static void mail_thread_container_link(struct mail_thread_container *parent, struct mail_thread_container *c)
+{
+	c->parent = parent;
+	c->prev = parent->last_child;
+	c->next = NULL;
+	if (parent->last_child) parent->last_child->next = c;
+	else parent->first_child = c;
+	parent->last_child = c;
+}
+
+/**
+ * Removes the given container from the children of its parent.
+ *
+ * @param c the container with a parent.
+ */
+static void mail_thread_container_unlink(struct mail_thread_container *c)
+{
+	struct mail_thread_container *parent = c->parent;
+
+	if (c->prev) c->prev->next = c->next;
+	else parent->first_child = c->next;
+	if (c->next) c->next->prev = c->prev;
+	else parent->last_child = c->prev;
+
+	c->parent = c->prev = c->next = NULL;
+}
+
+/*****************************************************************************/
+
+int mail_thread_add(struct mail_thread *thread, struct mail_info *mail)
+{
+	struct mail_thread_container *c = NULL;
+	struct mail_thread_container *parent = NULL;
+	unsigned int hash = 0;
+	unsigned int b;
+
+	if (mail_thread_find_mail(thread, mail))
+		return 1;
+
+	/* Make room for the mail and a placeholder for its parent */
+	if (!mail_thread_grow(thread))
+		return 0;
+
+	if (mail->message_id)
+	{
+		hash = mail_thread_hash_id(mail->message_id);
+
+		/* Fill the placeholder that has been created for a reply to this mail.
+		 * The container of a mail with a duplicated id is not put into the table. */
+		if ((c = mail_thread_find_id(thread, mail->message_id, hash)) && c->mail)
+			c = mail_thread_container_create(thread, NULL, 0);
+		else if (!c)
+			c = mail_thread_container_create(thread, mail->message_id, hash);
+	} else
+	{
+		c = mail_thread_container_create(thread, NULL, 0);
+	}
+	if (!c) return 0;
+
+	if (mail->message_reply_id)
+	{
+		unsigned int reply_hash = mail_thread_hash_id(mail->message_reply_id);
+
+		if (!(parent = mail_thread_find_id(thread, mail->message_reply_id, reply_hash)))
+		{
+			if (!(parent = mail_thread_container_create(thread, mail->message_reply_id, reply_hash)))
+			{
+				mail_thread_container_prune(thread, c);
+				return 0;
+			}
+		}
+	}
+
+	c->mail = mail;
+	b = mail_thread_hash_mail(mail) & (thread->size - 1);
+	c->next_by_mail = thread->mails[b];
+	thread->mails[b] = c;
+	thread->num_mails++;
+
+	if (parent)
+	{
+		struct mail_thread_container *p;
+
+		/* Don't introduce a loop */
+		for (p = parent; p; p = p->parent)
+			if (p == c) break;
+		if (!p) mail_thread_container_link(parent, c);
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+void mail_thread_remove(struct mail_thread *thread, struct mail_info *mail)
+{
+	struct mail_thread_container **pc;
+	struct mail_thread_container *c;
+
+	pc = &thread->mails[mail_thread_hash_mail(mail) & (thread->size - 1)];
+	while (*pc && (*pc)->mail != mail)
+		pc = &(*pc)->next_by_mail;
+	if (!(c = *pc)) return;
+
+	*pc = c->next_by_mail;
+	c->next_by_mail = NULL;
+	c->mail = NULL;
+	thread->num_mails--;
+
+	/* An empty container never has a parent */
+	if (c->parent)
+	{
+		struct mail_thread_container *parent = c->parent;
+		mail_thread_container_unlink(c);
+		mail_thread_container_prune(thread, parent);
+	}
+
+	/* Keep the container as placeholder if it has children */
+	mail_thread_container_prune(thread, c);
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_thread_lookup(struct mail_thread *thread, const char *message_id)
+{
+	struct mail_thread_container *c;
+
+	if (!message_id) return NULL;
+	if (!(c = mail_thread_find_id(thread, message_id, mail_thread_hash_id(message_id))))
+		return NULL;
+	return c->mail;
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_thread_get_parent(struct mail_thread *thread, struct mail_info *mail)
+{
+	struct mail_thread_container *c;
+
+	if (!(c = mail_thread_find_mail(thread, mail)) || !c->parent)
+		return NULL;
+	return c->parent->mail;
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_thread_get_first_child(struct mail_thread *thread, struct mail_info *mail)
+{
+	struct mail_thread_container *c;
+
+	if (!(c = mail_thread_find_mail(thread, mail)) || !c->first_child)
+		return NULL;
+	return c->first_child->mail;
+}
+
+/*****************************************************************************/
+
+struct mail_info *mail_thread_get_next_sibling(struct mail_thread *thread, struct mail_info *mail)
+{
+	struct mail_thread_container *c;
+
+	/* The children of a placeholder are roots */
+	if (!(c = mail_thread_find_mail(thread, mail)) || !c->parent || !c->parent->mail || !c->next)
+		return NULL;
+	return c->next->mail;
+}
+
+/*****************************************************************************/
+
+int mail_thread_sort(struct mail_thread *thread, struct mail_info **mails, int num_mails)
+{
+	struct mail_info **sorted;
+	int i, num_sorted = 0;
+	int rc = 0;
+
+	if (num_mails != (int)thread->num_mails)
+		return 0;
+
+	if (!(sorted = (struct mail_info **)malloc(num_mails * sizeof(sorted[0]) + 1)))
+		return 0;
+
+	for (i = 0; i < num_mails; i++)
+	{
+		struct mail_thread_container *root;
+		struct mail_thread_container *c;
+
+		if (!(root = mail_thread_find_mail(thread, mails[i])))
+			break;
+
+		/* Replies are visited with the root of their thread */
+		if (root->parent && root->parent->mail)
+			continue;
+
+		/* Visit the subtree without recursion, all children have mails */
+		c = root;
+		while (c)
+		{
+			if (num_sorted == num_mails)
+				goto out;
+			sorted[num_sorted++] = c->mail;
+
+			if (c->first_child)
+			{
+				c = c->first_child;
+				continue;
+			}
+			while (c != root && !c->next)
+				c = c->parent;
+			c = c == root ? NULL : c->next;
+		}
+	}
+
+	/* All mails must have been visited exactly once */
+	if (i == num_mails && num_sorted == num_mails)
+	{
+		memcpy(mails, sorted, num_mails * sizeof(mails[0]));
+		rc = 1;
+	}
+out:
+	free(sorted);
+	return rc;
+}
@@ -0,0 +1,114 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+/**
+ * @file mail_thread.h
+ *
+ * Groups a set of mails into conversation threads. A mail is a reply to
+ * the mail whose message id matches its message reply id. The threads are
+ * updated in constant time when a mail is added or removed.
+ */
+
+#ifndef SM__MAIL_THREAD_H
+#define SM__MAIL_THREAD_H
+
+struct mail_info;
+struct mail_thread;
+
+/**
+ * Creates an empty set of threads.
+ *
+ * @return the threads or NULL on failure.
+ */
+struct mail_thread *mail_thread_create(void);
+
+/**
+ * Frees the given threads. The mails are not freed.
+ *
+ * @param thread the threads to free. May be NULL.
+ */
+void mail_thread_free(struct mail_thread *thread);
+
+/**
+ * Adds the given mail to the threads. The mail is linked to the mail it
+ * replies to and to the mails that reply to it, as far as they have been
+ * added. The message id and the message reply id of the mail must not be
+ * changed until the mail has been removed again.
+ *
+ * @param thread the threads.
+ * @param mail the mail to add.
+ * @return 1 on success, 0 on failure.
+ */
+int mail_thread_add(struct mail_thread *thread, struct mail_info *mail);
+
+/**
+ * Removes the given mail from the threads. The replies to the mail become
+ * roots of their own threads.
+ *
+ * @param thread the threads.
+ * @param mail the mail to remove. Nothing happens if it has not been added.
+ */
+void mail_thread_remove(struct mail_thread *thread, struct mail_info *mail);
+
+/**
+ * Returns the mail with the given message id. The comparison is case
+ * insensitive.
+ *
+ * @param thread the threads.
+ * @param message_id the message id.
+ * @return the mail or NULL if no mail with this message id has been added.
+ */
+struct mail_info *mail_thread_lookup(struct mail_thread *thread, const char *message_id);
+
+/**
+ * @param thread the threads.
+ * @param mail the mail.
+ * @return the mail to which the given mail replies or NULL if the mail
+ *  is the root of a thread.
+ */
+struct mail_info *mail_thread_get_parent(struct mail_thread *thread, struct mail_info *mail);
+
+/**
+ * @param thread the threads.
+ * @param mail the mail.
+ * @return the first reply to the given mail or NULL if there is none.
+ */
+struct mail_info *mail_thread_get_first_child(struct mail_thread *thread, struct mail_info *mail);
+
+/**
+ * @param thread the threads.
+ * @param mail the mail.
+ * @return the next reply to the parent of the given mail or NULL if there
+ *  is none. This is always NULL for the root of a thread.
+ */
+struct mail_info *mail_thread_get_next_sibling(struct mail_thread *thread, struct mail_info *mail);
+
+/**
+ * Arranges the given mails in threaded order. Each root of a thread keeps
+ * its relative position within the array and is followed by its replies
+ * in depth-first order.
+ *
+ * @param thread the threads.
+ * @param mails the mails, which must be exactly the mails that have been
+ *  added.
+ * @param num_mails the number of mails.
+ * @return 1 on success, 0 on failure in which case the array is unchanged.
+ */
+int mail_thread_sort(struct mail_thread *thread, struct mail_info **mails, int num_mails);
+
+#endif
@@ -32,13 +32,17 @@
 #include "account.h"
 #include "addressbook.h"
 #include "atcleanup.h"
+#include "base64.h"
+#include "charscan.h"
 #include "codesets.h"
 #include "configuration.h"
 #include "dbx.h"
 #include "debug.h"
 #include "filter.h"
 #include "folder.h"
+#include "folder_rescan_pool.h"
 #include "folder_search_thread.h"
+#include "folder_text_index_thread.h"
 #include "imap_thread.h" /* imap_thread_xxx() */
 #include "lists.h"
 #include "logging.h"
@@ -2585,6 +2589,8 @@ void simplemail_deinit(void)
 
 	cleanup_threads();
 	cleanup_mailinfo_extractor();
+	cleanup_folder_text_index_thread();
+	cleanup_folder_rescan_pool();
 
 	ssl_cleanup();
 	spam_cleanup();
@@ -2614,6 +2620,10 @@ int simplemail_init(void)
 {
 	logg_options_t logg_opts = {0};
 
+	/* The implementations are selected once before any other task exists */
+	charscan_select(-1);
+	base64_select(-1);
+
 	if (!debug_init())
 		goto out;
 
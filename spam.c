@@ -291,7 +291,8 @@ static void spam_feed_parsed_mail(struct hash_table *ht, struct mail_complete *m
 		int i;
 		for (i = 0;i<mail->num_multiparts;i++)
 		{
-			spam_feed_parsed_mail(ht,mail->multipart_array[i]);
+			struct mail_complete *part = mail_get_part(mail,i);
+			if (part) spam_feed_parsed_mail(ht,part);
 		}
 	}
 }
@@ -471,7 +472,8 @@ static void spam_extract_parsed_mail(struct spam_token_probability *prob, struct
 		int i;
 		for (i = 0;i<mail->num_multiparts;i++)
 		{
-			spam_extract_parsed_mail(prob,mail->multipart_array[i]);
+			struct mail_complete *part = mail_get_part(mail,i);
+			if (part) spam_extract_parsed_mail(prob,part);
 		}
 	}
 }
@@ -0,0 +1,71 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+/*******************************************************/
+
+/* @Test */
+void test_arena_alloc(void)
+{
+	struct arena *a;
+	char *strings[100];
+	char *large;
+	char buf[32];
+	int i;
+
+	a = arena_create(256);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(a);
+	CU_ASSERT_EQUAL(arena_size(a), 0);
+
+	CU_ASSERT_PTR_NULL(arena_strdup(a, NULL));
+
+	for (i = 0; i < 100; i++)
+	{
+		sprintf(buf, "String %d", i);
+		strings[i] = arena_strdup(a, buf);
+		CU_ASSERT_PTR_NOT_NULL(strings[i]);
+		CU_ASSERT((((unsigned long)strings[i]) % sizeof(void*)) == 0);
+	}
+
+	/* Large allocations don't spoil the current chunk */
+	large = (char*)arena_alloc(a, 1000);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(large);
+	memset(large, 'x', 1000);
+
+	for (i = 0; i < 100; i++)
+	{
+		sprintf(buf, "String %d", i);
+		CU_ASSERT_STRING_EQUAL(strings[i], buf);
+	}
+	CU_ASSERT(arena_size(a) >= 1000 + 100 * 8);
+	CU_ASSERT(arena_size(a) < 1000 + 100 * 32);
+
+	/* The memory stays valid until the last reference is gone */
+	arena_ref(a);
+	arena_unref(a);
+	CU_ASSERT_STRING_EQUAL(strings[99], "String 99");
+	arena_unref(a);
+	arena_unref(NULL);
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "charscan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#define TEST_BUF_SIZE 200
+
+/*******************************************************/
+
+static const char *test_charscan_find2_reference(const char *buf, const char *buf_end, char c1, char c2)
+{
+	while (buf < buf_end && *buf != c1 && *buf != c2)
+		buf++;
+	return buf;
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_charscan_find2(void)
+{
+	static const int impls[] = {CHARSCAN_IMPL_SCALAR, CHARSCAN_IMPL_SSE2, CHARSCAN_IMPL_AVX2};
+	char buf[TEST_BUF_SIZE];
+	int i, j, start, len;
+
+	CU_ASSERT(charscan_supported(CHARSCAN_IMPL_SCALAR));
+	CU_ASSERT_FALSE(charscan_supported(42));
+
+	srand(22);
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+	{
+		if (!charscan_supported(impls[i]))
+			continue;
+		CU_ASSERT_EQUAL(charscan_select(impls[i]), impls[i]);
+
+		for (j = 0; j < 2000; j++)
+		{
+			int k;
+
+			/* Sparse occurrences at any position, also near block borders */
+			for (k = 0; k < TEST_BUF_SIZE; k++)
+				buf[k] = rand() % 40 ? 'a' + rand() % 26 : "\r\n:\x80"[rand() % 4];
+
+			start = rand() % 40;
+			len = rand() % (TEST_BUF_SIZE - start);
+
+			CU_ASSERT_PTR_EQUAL(charscan_find2(buf + start, buf + start + len, 10, 13), test_charscan_find2_reference(buf + start, buf + start + len, 10, 13));
+			CU_ASSERT_PTR_EQUAL(charscan_find2(buf + start, buf + start + len, ':', ':'), test_charscan_find2_reference(buf + start, buf + start + len, ':', ':'));
+			CU_ASSERT_PTR_EQUAL(charscan_find2(buf + start, buf + start + len, (char)0x80, 'z'), test_charscan_find2_reference(buf + start, buf + start + len, (char)0x80, 'z'));
+		}
+
+		/* Nothing found */
+		memset(buf, 'x', sizeof(buf));
+		CU_ASSERT_PTR_EQUAL(charscan_find2(buf, buf + TEST_BUF_SIZE, 10, 13), buf + TEST_BUF_SIZE);
+		CU_ASSERT_PTR_EQUAL(charscan_find2(buf, buf, 'x', 'x'), buf);
+	}
+
+	/* The best implementation is selected by default */
+	CU_ASSERT(charscan_supported(charscan_select(-1)));
+}
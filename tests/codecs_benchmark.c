@@ -0,0 +1,326 @@
+/**
+ * codecs_benchmark.c - benchmark for SimpleMail's base64 codecs
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file codecs_benchmark.c
+ *
+ * Measures the throughput of encode_base64() and decode_base64() on random
+ * data, once for each supported base64 implementation. Decoding is measured
+ * for unbroken text and for text that is broken into lines of 76 characters
+ * like attachments are. The results are written to stdout as one JSON object
+ * per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base64.h"
+#include "codecs.h"
+
+/*****************************************************************************/
+
+/**
+ * Describes an implementation that is benchmarked.
+ */
+struct benchmark_implementation
+{
+	const char *name;
+	int impl;
+};
+
+static struct benchmark_implementation benchmark_implementations[] =
+{
+	{"scalar", BASE64_IMPL_SCALAR},
+	{"ssse3", BASE64_IMPL_SSSE3},
+	{"avx2", BASE64_IMPL_AVX2},
+};
+
+#define NUM_BENCHMARK_IMPLEMENTATIONS (sizeof(benchmark_implementations)/sizeof(benchmark_implementations[0]))
+
+/**
+ * The data that is encoded and decoded.
+ */
+struct benchmark_data
+{
+	unsigned char *raw;
+	unsigned int raw_len;
+
+	/** raw encoded without line breaks */
+	char *encoded;
+	unsigned int encoded_len;
+
+	/** raw encoded with CRLF after each 76 characters */
+	char *wrapped;
+	unsigned int wrapped_len;
+};
+
+/*****************************************************************************/
+
+/** State of the pseudo random number generator, fixed for reproducible runs */
+static unsigned int benchmark_random_state = 2463534242U;
+
+/**
+ * Returns a pseudo random number (xorshift).
+ *
+ * @return
+ */
+static unsigned int benchmark_random(void)
+{
+	unsigned int x = benchmark_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return benchmark_random_state = x;
+}
+
+/**
+ * Returns the current time in seconds.
+ *
+ * @return
+ */
+static double benchmark_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************************/
+
+/**
+ * Generates random data of the given size and its encoded forms. The
+ * encoding is done with the scalar implementation, so it serves as
+ * reference for the other implementations.
+ *
+ * @param data the data to fill.
+ * @param len the number of random bytes.
+ * @return 1 on success, 0 otherwise.
+ */
+static int benchmark_data_generate(struct benchmark_data *data, unsigned int len)
+{
+	unsigned int i;
+	char *dest;
+
+	if (!(data->raw = (unsigned char *)malloc(len)))
+		return 0;
+	for (i = 0; i < len; i++)
+		data->raw[i] = benchmark_random() >> 24;
+	data->raw_len = len;
+
+	base64_select(BASE64_IMPL_SCALAR);
+	data->encoded = encode_base64(data->raw, len);
+	base64_select(-1);
+	if (!data->encoded)
+		return 0;
+	data->encoded_len = strlen(data->encoded);
+
+	if (!(data->wrapped = dest = (char *)malloc(data->encoded_len + data->encoded_len / 76 * 2 + 3)))
+		return 0;
+	for (i = 0; i < data->encoded_len; i += 76)
+	{
+		unsigned int line_len = data->encoded_len - i < 76 ? data->encoded_len - i : 76;
+
+		memcpy(dest, data->encoded + i, line_len);
+		dest += line_len;
+		*dest++ = '\r';
+		*dest++ = '\n';
+	}
+	*dest = 0;
+	data->wrapped_len = dest - data->wrapped;
+	return 1;
+}
+
+/**
+ * Frees all resources of the given data, but not the data itself.
+ *
+ * @param data the data to free.
+ */
+static void benchmark_data_free(struct benchmark_data *data)
+{
+	free(data->wrapped);
+	free(data->encoded);
+	free(data->raw);
+}
+
+/*****************************************************************************/
+
+/**
+ * Runs one operation of the benchmark for the given implementation and
+ * prints the result.
+ *
+ * @param bimpl the implementation.
+ * @param data the data.
+ * @param operation the operation, either "encode", "decode" or
+ *  "decode_wrapped".
+ * @param repetitions how often the operation is performed, the fastest run
+ *  counts.
+ * @return 1 if the result matched the reference, 0 otherwise.
+ */
+static int benchmark_run(struct benchmark_implementation *bimpl, struct benchmark_data *data, const char *operation, int repetitions)
+{
+	double best = -1;
+	int ok = 1;
+	int i;
+
+	for (i = 0; i < repetitions; i++)
+	{
+		double start = benchmark_now();
+		double seconds;
+
+		if (!strcmp(operation, "encode"))
+		{
+			char *encoded = encode_base64(data->raw, data->raw_len);
+			seconds = benchmark_now() - start;
+			ok = encoded && !strcmp(encoded, data->encoded);
+			free(encoded);
+		} else
+		{
+			int wrapped = !strcmp(operation, "decode_wrapped");
+			unsigned int decoded_len = data->raw_len;
+			char *decoded;
+
+			decoded = decode_base64((unsigned char *)(wrapped ? data->wrapped : data->encoded),
+				wrapped ? data->wrapped_len : data->encoded_len, &decoded_len);
+			seconds = benchmark_now() - start;
+			ok = decoded && decoded_len == data->raw_len && !memcmp(decoded, data->raw, decoded_len);
+			free(decoded);
+		}
+
+		if (!ok)
+			return 0;
+		if (best < 0 || seconds < best)
+			best = seconds;
+	}
+
+	/* Throughput is always related to the size of the unencoded data */
+	printf("{\"implementation\": \"%s\", \"operation\": \"%s\", \"bytes\": %u, "
+		"\"seconds\": %.6f, \"gb_per_second\": %.2f}\n",
+		bimpl->name, operation, data->raw_len, best, data->raw_len / best / (1024 * 1024 * 1024));
+	fflush(stdout);
+	return 1;
+}
+
+/*****************************************************************************/
+
+static void benchmark_usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-i implementation]... [-s size-in-kb] [-r repetitions]\n"
+		"Implementations:", name);
+	{
+		int i;
+		for (i = 0; i < NUM_BENCHMARK_IMPLEMENTATIONS; i++)
+			fprintf(stderr, " %s", benchmark_implementations[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const char *operations[] = {"encode", "decode", "decode_wrapped"};
+	struct benchmark_data data;
+	int selected[NUM_BENCHMARK_IMPLEMENTATIONS];
+	int num_selected = 0;
+	int size = 16384;
+	int repetitions = 10;
+	int failed = 0;
+	int i, j;
+
+	memset(selected, 0, sizeof(selected));
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' || !arg[1] || arg[2] || !val)
+		{
+			benchmark_usage(argv[0]);
+			return 1;
+		}
+		i++;
+
+		switch (arg[1])
+		{
+			case	'i':
+					for (j = 0; j < NUM_BENCHMARK_IMPLEMENTATIONS; j++)
+					{
+						if (!strcmp(benchmark_implementations[j].name, val))
+							break;
+					}
+					if (j == NUM_BENCHMARK_IMPLEMENTATIONS)
+					{
+						benchmark_usage(argv[0]);
+						return 1;
+					}
+					if (!selected[j]) num_selected++;
+					selected[j] = 1;
+					break;
+
+			case	's': size = atoi(val); break;
+			case	'r': repetitions = atoi(val); break;
+
+			default:
+					benchmark_usage(argv[0]);
+					return 1;
+		}
+	}
+
+	if (size < 1 || size > 1024 * 1024 || repetitions < 1)
+	{
+		benchmark_usage(argv[0]);
+		return 1;
+	}
+
+	memset(&data, 0, sizeof(data));
+	if (!benchmark_data_generate(&data, size * 1024))
+	{
+		fprintf(stderr, "Couldn't generate the data\n");
+		benchmark_data_free(&data);
+		return 1;
+	}
+
+	for (i = 0; i < NUM_BENCHMARK_IMPLEMENTATIONS; i++)
+	{
+		if (num_selected && !selected[i])
+			continue;
+
+		if (!base64_supported(benchmark_implementations[i].impl))
+		{
+			fprintf(stderr, "Implementation %s is not supported\n", benchmark_implementations[i].name);
+			continue;
+		}
+		base64_select(benchmark_implementations[i].impl);
+
+		for (j = 0; j < sizeof(operations) / sizeof(operations[0]); j++)
+		{
+			/* All implementations must reproduce the reference */
+			if (!benchmark_run(&benchmark_implementations[i], &data, operations[j], repetitions))
+			{
+				fprintf(stderr, "Benchmark of %s failed for %s\n", benchmark_implementations[i].name, operations[j]);
+				failed = 1;
+			}
+		}
+	}
+
+	benchmark_data_free(&data);
+	return failed;
+}
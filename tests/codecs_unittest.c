@@ -0,0 +1,283 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "codecs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "base64.h"
+
+#define TEST_DATA_SIZE 3000
+
+/*******************************************************/
+
+/**
+ * Decodes the given string with a transfer decoder that is fed in pieces of
+ * the given size and checks the result.
+ */
+static void test_transfer_decoder_pieces(int encoding, const char *encoded, const char *expected, int piece_size)
+{
+	unsigned char dest[1024];
+	struct transfer_decoder dec;
+	int len = strlen(encoded);
+	unsigned int dest_len = 0;
+	int pos;
+
+	transfer_decoder_init(&dec, encoding);
+	for (pos = 0; pos < len; pos += piece_size)
+	{
+		int piece_len = len - pos < piece_size ? len - pos : piece_size;
+		dest_len += transfer_decoder_feed(&dec, (const unsigned char *)encoded + pos, piece_len, dest + dest_len);
+	}
+	dest_len += transfer_decoder_finish(&dec, dest + dest_len);
+
+	CU_ASSERT_EQUAL(dest_len, strlen(expected));
+	CU_ASSERT(!memcmp(dest, expected, dest_len));
+}
+
+/**
+ * Checks the decoding of the given string as a whole and in pieces of all
+ * sizes.
+ */
+static void test_transfer_decoder(int encoding, const char *encoded, const char *expected)
+{
+	unsigned int len = (unsigned int)-1;
+	char *decoded;
+	int piece_size;
+
+	if (encoding == TRANSFER_ENCODING_BASE64)
+		decoded = decode_base64((unsigned char *)encoded, strlen(encoded), &len);
+	else
+		decoded = decode_quoted_printable((unsigned char *)encoded, strlen(encoded), &len, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+	CU_ASSERT_EQUAL(len, strlen(expected));
+	CU_ASSERT_STRING_EQUAL(decoded, expected);
+	free(decoded);
+
+	for (piece_size = 1; piece_size <= strlen(encoded); piece_size++)
+		test_transfer_decoder_pieces(encoding, encoded, expected, piece_size);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_decode_base64(void)
+{
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "YXR0YWNobWVudAo=", "attachment\n");
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "YQ==", "a");
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "YWI=", "ab");
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "YWJj", "abc");
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "", "");
+
+	/* Line breaks and other foreign characters are skipped anywhere */
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "U2ltc\r\nGxlTW\r\nFpbA==\r\n", "SimpleMail");
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, " U2l\xe4tc GxlT*W\tFpbA", "SimpleMail");
+
+	/* Everything after the padding is ignored */
+	test_transfer_decoder(TRANSFER_ENCODING_BASE64, "YQ==YWJj", "a");
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_decode_base64_limited(void)
+{
+	static const char encoded[] = "U2ltcGxlTWFpbCBTaW1wbGVNYWlsIFNpbXBsZU1haWw=";
+	unsigned int len = 10;
+	char *decoded;
+
+	decoded = decode_base64((unsigned char *)encoded, strlen(encoded), &len);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+	CU_ASSERT_EQUAL(len, 10);
+	CU_ASSERT_STRING_EQUAL(decoded, "SimpleMail");
+	free(decoded);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_decode_quoted_printable(void)
+{
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "Simple=4Dail", "SimpleMail");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "Simple=4dail", "SimpleMail");
+
+	/* CR LF becomes LF, the last line has no line ending */
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "line1\r\nline2\nline3", "line1\nline2\nline3");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "line1\r\n\r\n", "line1\n\n");
+
+	/* Soft line breaks, also followed by white space */
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "Simple=\r\nMail=  \r\n!", "SimpleMail!");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "Simple=\nMail=", "SimpleMail");
+
+	/* Trailing white space is removed, other white space is kept */
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "a b \t \r\n\tc \t", "a b\n\tc");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "a=20 \r\nb", "a \nb");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "a\r \r\nb\rc\r\r\n", "a\r\nb\rc\r\n");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "a\r\nb \r", "a\nb \r");
+
+	/* Invalid escapes are taken literally */
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "a=G1 =4 =4\r\n=A", "a=G1 =4 =4\n=A");
+	test_transfer_decoder(TRANSFER_ENCODING_QUOTED_PRINTABLE, "==41= b=\tc", "=A= b=\tc");
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_decode_quoted_printable_long_white_space(void)
+{
+	char encoded[TRANSFER_DECODER_PENDING_SIZE * 2 + 10];
+	char expected[TRANSFER_DECODER_PENDING_SIZE * 2 + 10];
+
+	/* White space that is followed by other characters is never lost */
+	memset(encoded, ' ', TRANSFER_DECODER_PENDING_SIZE * 2);
+	strcpy(encoded + TRANSFER_DECODER_PENDING_SIZE * 2, "x");
+	test_transfer_decoder_pieces(TRANSFER_ENCODING_QUOTED_PRINTABLE, encoded, encoded, 7);
+
+	memset(encoded, '\t', TRANSFER_DECODER_PENDING_SIZE - 10);
+	strcpy(encoded + TRANSFER_DECODER_PENDING_SIZE - 10, "\r\nx");
+	strcpy(expected, "\nx");
+	test_transfer_decoder_pieces(TRANSFER_ENCODING_QUOTED_PRINTABLE, encoded, expected, 3);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_encode_base64(void)
+{
+	char *encoded;
+
+	encoded = encode_base64((unsigned char *)"attachment\n", 11);
+	CU_ASSERT_STRING_EQUAL(encoded, "YXR0YWNobWVudAo=");
+	free(encoded);
+
+	encoded = encode_base64((unsigned char *)"SimpleMail", 10);
+	CU_ASSERT_STRING_EQUAL(encoded, "U2ltcGxlTWFpbA==");
+	free(encoded);
+
+	encoded = encode_base64((unsigned char *)"SimpleMail, SimpleMail, SimpleMail", 34);
+	CU_ASSERT_STRING_EQUAL(encoded, "U2ltcGxlTWFpbCwgU2ltcGxlTWFpbCwgU2ltcGxlTWFpbA==");
+	free(encoded);
+
+	encoded = encode_base64((unsigned char *)"", 0);
+	CU_ASSERT_STRING_EQUAL(encoded, "");
+	free(encoded);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_encode_body_base64(void)
+{
+	static const char expected[] =
+		"QUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFBQUFB\n"
+		"QUFBQUE=\n";
+	unsigned char buf[62];
+	const char *encoding = "8bit";
+	unsigned int len;
+	char *body;
+
+	memset(buf, 'A', sizeof(buf));
+	body = encode_body(buf, sizeof(buf), "application/octet-stream", &len, &encoding);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(body);
+	CU_ASSERT_STRING_EQUAL(encoding, "base64");
+	CU_ASSERT_STRING_EQUAL(body, expected);
+	CU_ASSERT_EQUAL(len, strlen(expected));
+	free(body);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_base64_implementations(void)
+{
+	static const int impls[] = {BASE64_IMPL_SCALAR, BASE64_IMPL_SSSE3, BASE64_IMPL_AVX2};
+	unsigned char *data = (unsigned char *)malloc(TEST_DATA_SIZE);
+	char *expected_encoded[50];
+	unsigned int expected_len[50];
+	int i, j;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	CU_ASSERT(base64_supported(BASE64_IMPL_SCALAR));
+	CU_ASSERT_FALSE(base64_supported(42));
+
+	srand(24);
+	for (i = 0; i < TEST_DATA_SIZE; i++)
+		data[i] = rand();
+
+	/* The scalar implementation is the reference */
+	base64_select(BASE64_IMPL_SCALAR);
+	for (j = 0; j < 50; j++)
+	{
+		expected_len[j] = j * 59;
+		expected_encoded[j] = encode_base64(data + j, expected_len[j]);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(expected_encoded[j]);
+	}
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+	{
+		if (!base64_supported(impls[i]))
+			continue;
+		CU_ASSERT_EQUAL(base64_select(impls[i]), impls[i]);
+
+		for (j = 0; j < 50; j++)
+		{
+			char *encoded = encode_base64(data + j, expected_len[j]);
+			int encoded_len = strlen(expected_encoded[j]);
+			char *decoded;
+			unsigned int decoded_len = (unsigned int)-1;
+			int k;
+
+			CU_ASSERT_PTR_NOT_NULL_FATAL(encoded);
+			CU_ASSERT_STRING_EQUAL(encoded, expected_encoded[j]);
+
+			decoded = decode_base64((unsigned char *)encoded, encoded_len, &decoded_len);
+			CU_ASSERT_EQUAL(decoded_len, expected_len[j]);
+			CU_ASSERT(!memcmp(decoded, data + j, decoded_len));
+			free(decoded);
+
+			/* Characters outside of the alphabet are skipped wherever they are */
+			for (k = 0; k < 5 && encoded_len; k++)
+			{
+				char *disturbed = (char *)malloc(encoded_len + 2);
+				int pos = rand() % encoded_len;
+
+				CU_ASSERT_PTR_NOT_NULL_FATAL(disturbed);
+				memcpy(disturbed, encoded, pos);
+				disturbed[pos] = "\r\n \t*\x80\xff"[k];
+				memcpy(disturbed + pos + 1, encoded + pos, encoded_len - pos + 1);
+
+				decoded_len = (unsigned int)-1;
+				decoded = decode_base64((unsigned char *)disturbed, encoded_len + 1, &decoded_len);
+				CU_ASSERT_EQUAL(decoded_len, expected_len[j]);
+				CU_ASSERT(!memcmp(decoded, data + j, decoded_len));
+				free(decoded);
+				free(disturbed);
+			}
+			free(encoded);
+		}
+	}
+	base64_select(-1);
+
+	for (j = 0; j < 50; j++)
+		free(expected_encoded[j]);
+	free(data);
+}
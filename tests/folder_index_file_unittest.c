@@ -0,0 +1,428 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "folder_index_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "addresslist.h"
+#include "arena.h"
+#include "lists.h"
+#include "mail.h"
+#include "support_indep.h"
+
+#define TEST_INDEX_FILENAME "/tmp/folder-index-file.index"
+
+/*******************************************************/
+
+static struct mail_info *test_folder_index_file_create_mail(mail_context *mc, int i)
+{
+	struct mail_info *m;
+	char buf[64];
+
+	m = mail_info_create(mc);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+
+	sprintf(buf, "Subject %d", i);
+	m->subject = (utf8 *)mystrdup(buf);
+	sprintf(buf, "0101202%d.%03d", i % 10, i);
+	m->filename = mystrdup(buf);
+	m->from_phrase = (utf8 *)mystrdup("Some Sender");
+	m->from_addr = mystrdup("sender@simplemail.sf.net");
+	m->message_id = i % 2 ? mystrdup("<abc@def>") : NULL;
+	m->to_list = address_list_create("Test <test@simplemail.sf.net>, other@simplemail.sf.net");
+	m->size = 1000 + i;
+	m->seconds = 2000 + i;
+	m->received = 3000 + i;
+	m->flags = MAIL_FLAGS_AUTOSPAM;
+	return m;
+}
+
+/*******************************************************/
+
+static void test_folder_index_file_check_mail(struct mail_info *m, int i)
+{
+	char buf[64];
+	struct address *addr;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+
+	sprintf(buf, "Subject %d", i);
+	CU_ASSERT_STRING_EQUAL(m->subject, buf);
+	sprintf(buf, "0101202%d.%03d", i % 10, i);
+	CU_ASSERT_STRING_EQUAL(m->filename, buf);
+	CU_ASSERT_STRING_EQUAL(m->from_phrase, "Some Sender");
+	CU_ASSERT_STRING_EQUAL(m->from_addr, "sender@simplemail.sf.net");
+	if (i % 2)
+	{
+		CU_ASSERT_STRING_EQUAL(m->message_id, "<abc@def>");
+	} else
+	{
+		CU_ASSERT_PTR_NULL(m->message_id);
+	}
+	CU_ASSERT_PTR_NULL(m->message_reply_id);
+	CU_ASSERT_PTR_NULL(m->reply_addr);
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m->to_list);
+	CU_ASSERT_EQUAL(address_list_length(m->to_list), 2);
+	addr = address_list_first(m->to_list);
+	CU_ASSERT_STRING_EQUAL(addr->realname, "Test");
+	CU_ASSERT_STRING_EQUAL(addr->email, "test@simplemail.sf.net");
+	addr = address_next(addr);
+	CU_ASSERT_PTR_NULL(addr->realname);
+	CU_ASSERT_STRING_EQUAL(addr->email, "other@simplemail.sf.net");
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m->cc_list);
+	CU_ASSERT_EQUAL(address_list_length(m->cc_list), 0);
+
+	CU_ASSERT_EQUAL(m->size, 1000 + i);
+	CU_ASSERT_EQUAL(m->seconds, 2000 + i);
+	CU_ASSERT_EQUAL(m->received, 3000 + i);
+	CU_ASSERT_EQUAL(m->flags, MAIL_FLAGS_AUTOSPAM);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_index_file_save_and_append(void)
+{
+	struct folder_index_file *fif;
+	struct mail_info *mails[10];
+	struct mail_info *arena_mails[10];
+	struct arena *arena;
+	time_t before;
+	int i;
+	int ok;
+
+	remove(TEST_INDEX_FILENAME);
+
+	for (i = 0; i < 10; i++)
+		mails[i] = test_folder_index_file_create_mail(NULL, i);
+
+	CU_ASSERT_PTR_NULL(folder_index_file_open(TEST_INDEX_FILENAME));
+
+	before = time(NULL);
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, NULL, mails, 7, 3);
+	CU_ASSERT(ok != 0);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_num_mails(fif), 7);
+	CU_ASSERT_EQUAL(folder_index_file_unread_mails(fif), 3);
+	CU_ASSERT(folder_index_file_saved(fif) >= before && folder_index_file_saved(fif) <= time(NULL));
+	CU_ASSERT_STRING_EQUAL(folder_index_file_filename(fif, 5), "01012025.005");
+	CU_ASSERT_PTR_NULL(folder_index_file_filename(fif, 7));
+
+	for (i = 0; i < 7; i++)
+	{
+		struct mail_info *m = folder_index_file_get_mail(fif, NULL, NULL, i);
+		test_folder_index_file_check_mail(m, i);
+		mail_info_free(m);
+	}
+	CU_ASSERT_PTR_NULL(folder_index_file_get_mail(fif, NULL, NULL, 7));
+
+	/* Append the remaining mails while the file is mapped */
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, fif, &mails[7], 3, 4);
+	CU_ASSERT(ok != 0);
+	folder_index_file_close(fif);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_num_mails(fif), 10);
+	CU_ASSERT_EQUAL(folder_index_file_unread_mails(fif), 4);
+
+	/* Mails may be allocated from an arena that outlives the index file */
+	arena = arena_create(1024);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(arena);
+	for (i = 0; i < 10; i++)
+	{
+		arena_mails[i] = folder_index_file_get_mail(fif, NULL, arena, i);
+		CU_ASSERT_PTR_NOT_NULL(arena_mails[i]);
+	}
+
+	/* Equal strings and address lists are shared within the arena */
+	CU_ASSERT_PTR_EQUAL(arena_mails[0]->from_addr, arena_mails[1]->from_addr);
+	CU_ASSERT_PTR_EQUAL(arena_mails[0]->from_phrase, arena_mails[1]->from_phrase);
+	CU_ASSERT_PTR_EQUAL(arena_mails[0]->to_list, arena_mails[1]->to_list);
+	CU_ASSERT_PTR_EQUAL(arena_mails[7]->to_list, arena_mails[8]->to_list);
+	CU_ASSERT_PTR_NOT_EQUAL(arena_mails[0]->subject, arena_mails[1]->subject);
+	folder_index_file_close(fif);
+	arena_unref(arena);
+
+	mail_info_set_filename(arena_mails[3], mystrdup("01012025.003.R"));
+	for (i = 0; i < 10; i++)
+	{
+		if (i == 3)
+			CU_ASSERT_STRING_EQUAL(arena_mails[i]->filename, "01012025.003.R");
+		else
+			test_folder_index_file_check_mail(arena_mails[i], i);
+		mail_info_free(arena_mails[i]);
+	}
+
+	for (i = 0; i < 10; i++)
+		mail_info_free(mails[i]);
+
+	remove(TEST_INDEX_FILENAME);
+}
+
+static long test_folder_index_file_size(const char *filename)
+{
+	FILE *fh;
+	long size = -1;
+
+	if ((fh = fopen(filename, "rb")))
+	{
+		if (!fseek(fh, 0, SEEK_END))
+			size = ftell(fh);
+		fclose(fh);
+	}
+	return size;
+}
+
+/* @Test */
+void test_folder_index_file_append_shares_strings(void)
+{
+	struct folder_index_file *fif;
+	struct mail_info *mails[10];
+	struct arena *arena;
+	struct mail_info *m0, *m9;
+	long full_size;
+	int i;
+	int ok;
+
+	remove(TEST_INDEX_FILENAME);
+
+	for (i = 0; i < 10; i++)
+		mails[i] = test_folder_index_file_create_mail(NULL, i);
+
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, NULL, mails, 10, 0);
+	CU_ASSERT(ok != 0);
+	full_size = test_folder_index_file_size(TEST_INDEX_FILENAME);
+	CU_ASSERT(full_size > 0);
+	remove(TEST_INDEX_FILENAME);
+
+	/* Appending twice yields a file of the same size as writing all mails
+	 * at once as the strings and address lists of the base are reused */
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, NULL, mails, 6, 0);
+	CU_ASSERT(ok != 0);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, fif, &mails[6], 2, 0);
+	CU_ASSERT(ok != 0);
+	folder_index_file_close(fif);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, fif, &mails[8], 2, 0);
+	CU_ASSERT(ok != 0);
+	folder_index_file_close(fif);
+
+	CU_ASSERT_EQUAL(test_folder_index_file_size(TEST_INDEX_FILENAME), full_size);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_num_mails(fif), 10);
+	for (i = 0; i < 10; i++)
+	{
+		struct mail_info *m = folder_index_file_get_mail(fif, NULL, NULL, i);
+		test_folder_index_file_check_mail(m, i);
+		mail_info_free(m);
+	}
+
+	/* Mails of different appends share the address lists */
+	arena = arena_create(1024);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(arena);
+	m0 = folder_index_file_get_mail(fif, NULL, arena, 0);
+	m9 = folder_index_file_get_mail(fif, NULL, arena, 9);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m9);
+	CU_ASSERT_PTR_EQUAL(m0->to_list, m9->to_list);
+	CU_ASSERT_PTR_EQUAL(m0->from_addr, m9->from_addr);
+	folder_index_file_close(fif);
+	mail_info_free(m0);
+	mail_info_free(m9);
+	arena_unref(arena);
+
+	for (i = 0; i < 10; i++)
+		mail_info_free(mails[i]);
+
+	remove(TEST_INDEX_FILENAME);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_index_file_rejects_broken_files(void)
+{
+	struct mail_info *m;
+	FILE *fh;
+	char buf[64];
+	long size;
+	int ok;
+
+	m = test_folder_index_file_create_mail(NULL, 1);
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, NULL, &m, 1, 0);
+	CU_ASSERT(ok != 0);
+	mail_info_free(m);
+
+	/* Truncate the file so that the blob is incomplete */
+	fh = fopen(TEST_INDEX_FILENAME, "rb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	fseek(fh, 0, SEEK_END);
+	size = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+	CU_ASSERT(size > sizeof(buf));
+	fread(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+
+	fh = fopen(TEST_INDEX_FILENAME, "wb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	fwrite(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+
+	CU_ASSERT_PTR_NULL(folder_index_file_open(TEST_INDEX_FILENAME));
+
+	/* Legacy files are not supported */
+	buf[4] = 8;
+	fh = fopen(TEST_INDEX_FILENAME, "wb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	fwrite(buf, 1, 20, fh);
+	fclose(fh);
+
+	CU_ASSERT_PTR_NULL(folder_index_file_open(TEST_INDEX_FILENAME));
+
+	remove(TEST_INDEX_FILENAME);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_index_file_journal(void)
+{
+	struct folder_index_file *fif;
+	struct mail_info *mails[10];
+	struct mail_info *m;
+	unsigned long size, size2;
+	FILE *fh;
+	char buf[256];
+	int i;
+	int ok;
+
+	remove(TEST_INDEX_FILENAME);
+	remove(TEST_INDEX_FILENAME ".journal");
+
+	for (i = 0; i < 10; i++)
+		mails[i] = test_folder_index_file_create_mail(NULL, i);
+
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, NULL, mails, 7, 3);
+	CU_ASSERT(ok != 0);
+
+	/* Journal entries are small */
+	size = folder_index_file_journal_append(TEST_INDEX_FILENAME, 2, NULL, MAIL_FLAGS_NEW, 5);
+	CU_ASSERT(size > 0 && size <= 32);
+	size2 = folder_index_file_journal_append(TEST_INDEX_FILENAME, 3, "renamed.003.R", 0, 4);
+	CU_ASSERT(size2 > size && size2 <= size + 32);
+	size = folder_index_file_journal_append(TEST_INDEX_FILENAME, 3, NULL, MAIL_FLAGS_PARTIAL, 6);
+	CU_ASSERT(size > size2);
+
+	/* Positions that are not in the index file are rejected */
+	CU_ASSERT(folder_index_file_journal_append(TEST_INDEX_FILENAME, -1, NULL, 0, 0) == 0);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_num_mails(fif), 7);
+	CU_ASSERT_EQUAL(folder_index_file_unread_mails(fif), 6);
+	CU_ASSERT_STRING_EQUAL(folder_index_file_filename(fif, 3), "renamed.003.R");
+
+	m = folder_index_file_get_mail(fif, NULL, NULL, 2);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	CU_ASSERT_EQUAL(m->flags, MAIL_FLAGS_NEW);
+	CU_ASSERT_STRING_EQUAL(m->filename, "01012022.002");
+	mail_info_free(m);
+
+	m = folder_index_file_get_mail(fif, NULL, NULL, 3);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	CU_ASSERT_EQUAL(m->flags, MAIL_FLAGS_PARTIAL);
+	CU_ASSERT_STRING_EQUAL(m->filename, "renamed.003.R");
+	CU_ASSERT_STRING_EQUAL(m->subject, "Subject 3");
+	mail_info_free(m);
+
+	m = folder_index_file_get_mail(fif, NULL, NULL, 4);
+	test_folder_index_file_check_mail(m, 4);
+	mail_info_free(m);
+
+	/* Keep a copy of the journal */
+	fh = fopen(TEST_INDEX_FILENAME ".journal", "rb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	size2 = fread(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+	CU_ASSERT_EQUAL(size, size2);
+
+	/* Appending folds the journal in */
+	ok = folder_index_file_save(TEST_INDEX_FILENAME, fif, &mails[7], 3, 7);
+	CU_ASSERT(ok != 0);
+	folder_index_file_close(fif);
+
+	fh = fopen(TEST_INDEX_FILENAME ".journal", "rb");
+	CU_ASSERT_PTR_NULL(fh);
+	if (fh) fclose(fh);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_num_mails(fif), 10);
+	CU_ASSERT_EQUAL(folder_index_file_unread_mails(fif), 7);
+	CU_ASSERT_STRING_EQUAL(folder_index_file_filename(fif, 3), "renamed.003.R");
+
+	m = folder_index_file_get_mail(fif, NULL, NULL, 3);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	CU_ASSERT_EQUAL(m->flags, MAIL_FLAGS_PARTIAL);
+	mail_info_free(m);
+
+	for (i = 7; i < 10; i++)
+	{
+		m = folder_index_file_get_mail(fif, NULL, NULL, i);
+		test_folder_index_file_check_mail(m, i);
+		mail_info_free(m);
+	}
+	folder_index_file_close(fif);
+
+	/* A journal that doesn't belong to the index file is ignored and removed */
+	fh = fopen(TEST_INDEX_FILENAME ".journal", "wb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	fwrite(buf, 1, size2, fh);
+	fclose(fh);
+
+	fif = folder_index_file_open(TEST_INDEX_FILENAME);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fif);
+	CU_ASSERT_EQUAL(folder_index_file_unread_mails(fif), 7);
+	folder_index_file_close(fif);
+
+	fh = fopen(TEST_INDEX_FILENAME ".journal", "rb");
+	CU_ASSERT_PTR_NULL(fh);
+	if (fh) fclose(fh);
+
+	for (i = 0; i < 10; i++)
+		mail_info_free(mails[i]);
+
+	remove(TEST_INDEX_FILENAME);
+}
@@ -0,0 +1,199 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "folder_rescan_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <CUnit/Basic.h>
+
+#include "mail.h"
+#include "mail_context.h"
+#include "support_indep.h"
+
+#include "support.h"
+
+#define TEST_FOLDER_PATH "/tmp/folder-rescan-pool"
+
+/*******************************************************/
+
+static void test_folder_rescan_pool_write_mail(const char *name, const char *contents)
+{
+	char path[256];
+	FILE *fh;
+
+	sm_snprintf(path, sizeof(path), "%s/%s", TEST_FOLDER_PATH, name);
+	if ((fh = fopen(path, "wb")))
+	{
+		fputs(contents, fh);
+		fclose(fh);
+	}
+}
+
+static void test_folder_rescan_pool_remove_mail(const char *name)
+{
+	char path[256];
+
+	sm_snprintf(path, sizeof(path), "%s/%s", TEST_FOLDER_PATH, name);
+	remove(path);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_rescan_pool_without_threads(void)
+{
+	struct folder_rescan_batch batch;
+	char *filenames[4];
+	struct mail_info *mails[4];
+	mail_context *mc;
+	int i, num_helped = 0;
+
+	mkdir(TEST_FOLDER_PATH, 0777);
+	test_folder_rescan_pool_write_mail("mail1", "From: Test <test@simplemail.sf.net>\nSubject: First\nX-SimpleMail-POP3: pop.simplemail.sf.net\n\nBody\n");
+	test_folder_rescan_pool_write_mail("mail2", "");
+	test_folder_rescan_pool_write_mail("mail3", "Subject: Third\n\nBody\n");
+
+	filenames[0] = mystrdup("mail1");
+	filenames[1] = mystrdup("mail2");
+	filenames[2] = mystrdup("mail3");
+	filenames[3] = mystrdup("mail4");
+
+	memset(&batch, 0, sizeof(batch));
+	memset(mails, 0, sizeof(mails));
+	batch.folder_path = TEST_FOLDER_PATH;
+	batch.filenames = filenames;
+	batch.mails = mails;
+	batch.num_mails = 4;
+
+	folder_rescan_pool_submit(&batch);
+	CU_ASSERT(folder_rescan_pool_finished(&batch) == 0);
+
+	while (folder_rescan_pool_help(&batch))
+		num_helped++;
+
+	CU_ASSERT(num_helped == 4);
+	CU_ASSERT(folder_rescan_pool_completed(&batch) == 4);
+	CU_ASSERT(folder_rescan_pool_finished(&batch) == 1);
+
+	/* Empty and missing files don't yield a mail and keep their names */
+	CU_ASSERT(mails[0] != NULL);
+	CU_ASSERT(mails[1] == NULL);
+	CU_ASSERT(mails[2] != NULL);
+	CU_ASSERT(mails[3] == NULL);
+	CU_ASSERT(filenames[0] == NULL);
+	CU_ASSERT(filenames[1] != NULL);
+	CU_ASSERT(filenames[2] == NULL);
+	CU_ASSERT(filenames[3] != NULL);
+
+	CU_ASSERT_STRING_EQUAL(mails[0]->filename, "mail1");
+	CU_ASSERT_STRING_EQUAL(mails[0]->subject, "First");
+	CU_ASSERT_STRING_EQUAL(mails[2]->filename, "mail3");
+	CU_ASSERT_STRING_EQUAL(mails[2]->subject, "Third");
+
+	/* The pop3 server moves into the string pool of the context */
+	mc = mail_context_create();
+	CU_ASSERT(mc != NULL);
+	CU_ASSERT(mails[0]->context == NULL);
+	CU_ASSERT(!(mails[0]->tflags & MAIL_TFLAGS_POP3_ID));
+	mail_info_set_context(mails[0], mc);
+	CU_ASSERT(mails[0]->context == mc);
+	CU_ASSERT(mails[0]->tflags & MAIL_TFLAGS_POP3_ID);
+	CU_ASSERT_STRING_EQUAL(mail_get_pop3_server(mails[0]), "pop.simplemail.sf.net");
+
+	for (i = 0; i < 4; i++)
+	{
+		mail_info_free(mails[i]);
+		free(filenames[i]);
+	}
+	mail_context_free(mc);
+
+	test_folder_rescan_pool_remove_mail("mail1");
+	test_folder_rescan_pool_remove_mail("mail2");
+	test_folder_rescan_pool_remove_mail("mail3");
+	rmdir(TEST_FOLDER_PATH);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_rescan_pool_long_path(void)
+{
+	struct folder_rescan_batch batch;
+	char *filenames[1];
+	struct mail_info *mails[1];
+	char component[201];
+	char path[1024];
+	char mail_path[1100];
+	FILE *fh;
+	int i;
+
+	/* A folder path that is longer than any fixed buffer used so far */
+	memset(component, 'd', sizeof(component) - 1);
+	component[sizeof(component) - 1] = 0;
+	mystrlcpy(path, TEST_FOLDER_PATH, sizeof(path));
+	mkdir(path, 0777);
+	for (i = 0; i < 3; i++)
+	{
+		sm_add_part(path, component, sizeof(path));
+		mkdir(path, 0777);
+	}
+	CU_ASSERT(strlen(path) > 600);
+
+	sm_snprintf(mail_path, sizeof(mail_path), "%s/mail1", path);
+	CU_ASSERT((fh = fopen(mail_path, "wb")) != NULL);
+	if (fh)
+	{
+		fputs("Subject: Deep\n\nBody\n", fh);
+		fclose(fh);
+	}
+
+	filenames[0] = mystrdup("mail1");
+	mails[0] = NULL;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.folder_path = path;
+	batch.filenames = filenames;
+	batch.mails = mails;
+	batch.num_mails = 1;
+
+	folder_rescan_pool_submit(&batch);
+	while (folder_rescan_pool_help(&batch));
+	CU_ASSERT(folder_rescan_pool_finished(&batch) == 1);
+
+	CU_ASSERT(mails[0] != NULL);
+	CU_ASSERT(filenames[0] == NULL);
+	if (mails[0])
+	{
+		CU_ASSERT_STRING_EQUAL(mails[0]->filename, "mail1");
+		CU_ASSERT_STRING_EQUAL(mails[0]->subject, "Deep");
+	}
+	mail_info_free(mails[0]);
+	free(filenames[0]);
+
+	remove(mail_path);
+	for (i = 0; i < 3; i++)
+	{
+		rmdir(path);
+		*strrchr(path, '/') = 0;
+	}
+	rmdir(TEST_FOLDER_PATH);
+}
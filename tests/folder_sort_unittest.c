@@ -0,0 +1,150 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "folder_sort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "folder.h"
+#include "mail.h"
+#include "mail_support.h"
+#include "support_indep.h"
+
+#define TEST_NUM_MAILS 300
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_sort_collate(void)
+{
+	CU_ASSERT_EQUAL(folder_sort_collate(NULL, NULL), 0);
+	CU_ASSERT(folder_sort_collate(NULL, "") < 0);
+	CU_ASSERT(folder_sort_collate("", NULL) > 0);
+	CU_ASSERT_EQUAL(folder_sort_collate("SimpleMail", "simplemail"), 0);
+	CU_ASSERT(folder_sort_collate("abc", "ABD") < 0);
+	CU_ASSERT(folder_sort_collate("abc", "ab") > 0);
+	CU_ASSERT(folder_sort_collate("Zebra", "\xc3\xa4pfel") < 0);
+
+	/* Ä and ä */
+	CU_ASSERT_EQUAL(folder_sort_collate("\xc3\x84pfel", "\xc3\xa4PFEL"), 0);
+	CU_ASSERT(folder_sort_collate("\xc3\x84pfel", "\xc3\xa4pfeln") < 0);
+}
+
+/*******************************************************/
+
+static int test_folder_sort_compare_mode(struct mail_info *m1, struct mail_info *m2, int sort_mode)
+{
+	int rc = 0;
+
+	switch (sort_mode & FOLDER_SORT_MODEMASK)
+	{
+		case	FOLDER_SORT_STATUS:
+				if ((m1->flags & MAIL_FLAGS_NEW) != (m2->flags & MAIL_FLAGS_NEW)) rc = (m1->flags & MAIL_FLAGS_NEW)?-1:1;
+				else rc = (m1->status & MAIL_STATUS_MASK) - (m2->status & MAIL_STATUS_MASK);
+				break;
+		case	FOLDER_SORT_FROMTO: rc = folder_sort_collate(mail_info_get_from(m1), mail_info_get_from(m2)); break;
+		case	FOLDER_SORT_SUBJECT: rc = folder_sort_collate(mail_get_compare_subject(m1->subject), mail_get_compare_subject(m2->subject)); break;
+		case	FOLDER_SORT_REPLY: rc = folder_sort_collate(m1->reply_addr, m2->reply_addr); break;
+		case	FOLDER_SORT_DATE: rc = (m1->seconds > m2->seconds) - (m1->seconds < m2->seconds); break;
+		case	FOLDER_SORT_SIZE: rc = (m1->size > m2->size) - (m1->size < m2->size); break;
+		case	FOLDER_SORT_FILENAME: rc = mystricmp(m1->filename, m2->filename); break;
+		case	FOLDER_SORT_RECV: rc = (m1->received > m2->received) - (m1->received < m2->received); break;
+	}
+	if (sort_mode & FOLDER_SORT_REVERSE) rc = -rc;
+	return rc;
+}
+
+static int test_folder_sort_compare(struct mail_info *m1, struct mail_info *m2, int primary_sort, int secondary_sort)
+{
+	int rc = test_folder_sort_compare_mode(m1, m2, primary_sort);
+	if (!rc && (primary_sort & FOLDER_SORT_MODEMASK) != (secondary_sort & FOLDER_SORT_MODEMASK))
+		rc = test_folder_sort_compare_mode(m1, m2, secondary_sort);
+	if (!rc)
+		rc = test_folder_sort_compare_mode(m1, m2, FOLDER_SORT_DATE);
+	return rc;
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_sort_mail_array(void)
+{
+	static const char * const subjects[] = {"Hello", "Re: hello", "Aw: World", "\xc3\x84rger", "\xc3\xa4rger 2", "world", NULL};
+	static const char * const froms[] = {"Sebastian", "sebastian", "Hynek", "\xc3\x9c" "ber", NULL};
+	static const int modes[] = {FOLDER_SORT_STATUS, FOLDER_SORT_FROMTO, FOLDER_SORT_SUBJECT, FOLDER_SORT_REPLY, FOLDER_SORT_DATE, FOLDER_SORT_SIZE, FOLDER_SORT_FILENAME, FOLDER_SORT_RECV};
+	struct mail_info *mails[TEST_NUM_MAILS];
+	struct mail_info *sorted[TEST_NUM_MAILS];
+	int i, p, s;
+
+	srand(12);
+
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		char buf[32];
+
+		mails[i] = mail_info_create(NULL);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(mails[i]);
+
+		mails[i]->subject = (utf8 *)mystrdup(subjects[rand() % 7]);
+		mails[i]->from_phrase = (utf8 *)mystrdup(froms[rand() % 5]);
+		mails[i]->from_addr = mystrdup("sender@simplemail.sf.net");
+		mails[i]->reply_addr = rand() % 2 ? mystrdup("Reply@simplemail.sf.net") : NULL;
+		sprintf(buf, "%c%d.%03d", rand() % 2 ? 'u' : 'U', rand() % 10, i);
+		mails[i]->filename = mystrdup(buf);
+		mails[i]->flags = rand() % 3 ? 0 : MAIL_FLAGS_NEW;
+		mails[i]->status = rand() % 4;
+		mails[i]->seconds = rand() % 50;
+		mails[i]->size = rand() % 2 ? 0xfffffff0 + rand() % 4 : rand() % 100;
+		mails[i]->received = rand() % 20;
+	}
+
+	for (p = 0; p < 16; p++)
+	{
+		for (s = 0; s < 16; s++)
+		{
+			int primary_sort = modes[p % 8] | (p >= 8 ? FOLDER_SORT_REVERSE : 0);
+			int secondary_sort = modes[s % 8] | (s >= 8 ? FOLDER_SORT_REVERSE : 0);
+			int seen[TEST_NUM_MAILS] = {0};
+
+			memcpy(sorted, mails, sizeof(mails));
+			CU_ASSERT(folder_sort_mail_array(sorted, TEST_NUM_MAILS, primary_sort, secondary_sort, FOLDER_TYPE_RECV) != 0);
+
+			for (i = 0; i < TEST_NUM_MAILS; i++)
+			{
+				/* The filenames are unique */
+				seen[atoi(strchr(sorted[i]->filename, '.') + 1)]++;
+				if (i > 0)
+					CU_ASSERT(test_folder_sort_compare(sorted[i-1], sorted[i], primary_sort, secondary_sort) <= 0);
+			}
+			for (i = 0; i < TEST_NUM_MAILS; i++)
+				CU_ASSERT_EQUAL(seen[i], 1);
+		}
+	}
+
+	/* Nothing is sorted when threading */
+	memcpy(sorted, mails, sizeof(mails));
+	CU_ASSERT(folder_sort_mail_array(sorted, TEST_NUM_MAILS, FOLDER_SORT_THREAD, FOLDER_SORT_DATE, FOLDER_TYPE_RECV) != 0);
+	CU_ASSERT(memcmp(sorted, mails, sizeof(mails)) == 0);
+
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+		mail_info_free(mails[i]);
+}
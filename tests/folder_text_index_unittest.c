@@ -0,0 +1,273 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "folder_text_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "filter.h"
+#include "lists.h"
+#include "mail.h"
+
+#include "support.h"
+
+#define TEST_FOLDER_PATH "/tmp/folder-text-index"
+
+/*******************************************************/
+
+static void test_folder_text_index_remove_files(void)
+{
+	remove(TEST_FOLDER_PATH ".textindex.map");
+	remove(TEST_FOLDER_PATH ".textindex.trigrams");
+	remove(TEST_FOLDER_PATH ".textindex.documents");
+}
+
+static void test_folder_text_index_init_mail(struct mail_info *m, char *filename, unsigned int size)
+{
+	memset(m, 0, sizeof(*m));
+	m->filename = filename;
+	m->size = size;
+	m->received = 1000;
+}
+
+/**
+ * Returns the size of the given file of the test index.
+ */
+static long test_folder_text_index_file_size(const char *suffix)
+{
+	char buf[256];
+	FILE *fh;
+	long size;
+
+	sprintf(buf, "%s.textindex%s", TEST_FOLDER_PATH, suffix);
+	if (!(fh = fopen(buf, "rb")))
+		return -1;
+	fseek(fh, 0, SEEK_END);
+	size = ftell(fh);
+	fclose(fh);
+	return size;
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_folder_text_index_candidates(void)
+{
+	struct folder_text_index *ti;
+	struct folder_text_index_candidates cand;
+	struct mail_info m1, m2, m3, m4;
+	struct filter filter;
+	struct filter_rule rule;
+	int ok;
+
+	test_folder_text_index_remove_files();
+
+	test_folder_text_index_init_mail(&m1, "01012026aaaa.001", 100);
+	test_folder_text_index_init_mail(&m2, "01012026aaaa.002.R", 200);
+	test_folder_text_index_init_mail(&m3, "01012026aaaa.003", 300);
+	test_folder_text_index_init_mail(&m4, "01012026aaaa.004", 400);
+
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+
+	ok = folder_text_index_put_mail_text(ti, &m1, "Hello World, how are you?", 25);
+	CU_ASSERT(ok != 0);
+	ok = folder_text_index_put_mail_text(ti, &m2, "Gr\xfc\xdf" "e aus der WELT", 18);
+	CU_ASSERT(ok != 0);
+	ok = folder_text_index_put_mail_text(ti, &m3, "Nothing to see here", 19);
+	CU_ASSERT(ok != 0);
+
+	CU_ASSERT(folder_text_index_has_mail(ti, &m1) == 1);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m4) == 0);
+
+	memset(&filter, 0, sizeof(filter));
+	list_init(&filter.rules_list);
+	memset(&rule, 0, sizeof(rule));
+	rule.type = RULE_BODY_MATCH;
+	rule.flags = SM_PATTERN_SUBSTR|SM_PATTERN_NOCASE;
+	rule.u.body.body = "welt";
+	list_insert_tail(&filter.rules_list, &rule.node);
+
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m1) == 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m2) == 1);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m3) == 0);
+	/* Mails that are not indexed may always match */
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m4) == 1);
+	folder_text_index_candidates_free(&cand);
+
+	/* Non-ASCII characters are not considered */
+	rule.u.body.body = "GR\xc3\x9c\xc3\x9f" "E aus";
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m1) == 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m2) == 1);
+	folder_text_index_candidates_free(&cand);
+
+	/* Patterns cannot be used */
+	rule.u.body.body = "h#?o";
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok == 0);
+
+	folder_text_index_close(ti);
+
+	/* The status of a mail doesn't matter */
+	m1.filename = "01012026aaaa.001.R";
+
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m1) == 1);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m2) == 1);
+
+	/* Another mail with the same name is a different mail */
+	m3.size = 301;
+	CU_ASSERT(folder_text_index_has_mail(ti, &m3) == 0);
+
+	rule.u.body.body = "how are";
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m1) == 1);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m2) == 0);
+	folder_text_index_candidates_free(&cand);
+
+	/* Removed mails are no longer indexed and thus may always match */
+	ok = folder_text_index_remove_mail(ti, &m2);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m2) == 0);
+
+	rule.u.body.body = "welt";
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m1) == 0);
+	folder_text_index_candidates_free(&cand);
+
+	/* Mails can be given with full paths */
+	m1.filename = "/some/path/01012026aaaa.001";
+	CU_ASSERT(folder_text_index_has_mail(ti, &m1) == 1);
+
+	folder_text_index_close(ti);
+
+	/* Nothing is left of a removed index */
+	folder_text_index_remove_files(TEST_FOLDER_PATH);
+	CU_ASSERT(fopen(TEST_FOLDER_PATH ".textindex.map", "rb") == NULL);
+	CU_ASSERT(fopen(TEST_FOLDER_PATH ".textindex.trigrams", "rb") == NULL);
+	CU_ASSERT(fopen(TEST_FOLDER_PATH ".textindex.documents", "rb") == NULL);
+
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m1) == 0);
+	folder_text_index_close(ti);
+	test_folder_text_index_remove_files();
+}
+
+/*******************************************************/
+
+#define TEST_PURGE_MAILS 40
+
+/* @Test */
+void test_folder_text_index_purge(void)
+{
+	struct folder_text_index *ti;
+	struct folder_text_index_candidates cand;
+	struct mail_info m[TEST_PURGE_MAILS];
+	char filenames[TEST_PURGE_MAILS][32];
+	struct filter filter;
+	struct filter_rule rule;
+	long documents_size, trigrams_size;
+	char *text;
+	int ok;
+	int i, j;
+
+	test_folder_text_index_remove_files();
+
+	text = (char*)malloc(3001);
+	CU_ASSERT(text != NULL);
+
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+
+	for (i = 0; i < TEST_PURGE_MAILS; i++)
+	{
+		sprintf(filenames[i], "01012026aaaa.%03d", i);
+		test_folder_text_index_init_mail(&m[i], filenames[i], 3000);
+
+		/* Every mail has its own words */
+		for (j = 0; j < 3000; j++)
+			text[j] = 'a' + (j * 7 + i * 13 + j / 26) % 26;
+		sprintf(text, "mail%03d ", i);
+		text[8] = ' ';
+		text[3000] = 0;
+		ok = folder_text_index_put_mail_text(ti, &m[i], text, 3000);
+		CU_ASSERT(ok != 0);
+	}
+	folder_text_index_close(ti);
+
+	documents_size = test_folder_text_index_file_size(".documents");
+	trigrams_size = test_folder_text_index_file_size(".trigrams");
+	CU_ASSERT(documents_size > TEST_PURGE_MAILS * 3000);
+
+	/* Removing most of the mails purges the index */
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+	for (i = 0; i < TEST_PURGE_MAILS - 10; i++)
+	{
+		ok = folder_text_index_remove_mail(ti, &m[i]);
+		CU_ASSERT(ok != 0);
+	}
+
+	/* The remaining mails are still found */
+	memset(&filter, 0, sizeof(filter));
+	list_init(&filter.rules_list);
+	memset(&rule, 0, sizeof(rule));
+	rule.type = RULE_BODY_MATCH;
+	rule.flags = SM_PATTERN_SUBSTR|SM_PATTERN_NOCASE;
+	rule.u.body.body = "mail035";
+	list_insert_tail(&filter.rules_list, &rule.node);
+
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m[35]) == 1);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m[36]) == 0);
+	folder_text_index_candidates_free(&cand);
+	folder_text_index_close(ti);
+
+	CU_ASSERT(test_folder_text_index_file_size(".documents") < documents_size / 2);
+	CU_ASSERT(test_folder_text_index_file_size(".trigrams") < trigrams_size);
+
+	/* The purged index is restored */
+	ti = folder_text_index_open(TEST_FOLDER_PATH);
+	CU_ASSERT(ti != NULL);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m[0]) == 0);
+	CU_ASSERT(folder_text_index_has_mail(ti, &m[39]) == 1);
+
+	rule.u.body.body = "mail039";
+	ok = folder_text_index_get_candidates(ti, &filter, &cand);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m[39]) == 1);
+	CU_ASSERT(folder_text_index_may_match(ti, &cand, &m[38]) == 0);
+	folder_text_index_candidates_free(&cand);
+	folder_text_index_close(ti);
+
+	test_folder_text_index_remove_files();
+	free(text);
+}
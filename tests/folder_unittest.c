@@ -18,7 +18,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <utime.h>
 #include <sys/time.h>
 
 #include <CUnit/Basic.h>
@@ -162,3 +164,144 @@ void test_folder_many_mails(void)
 	progmon_deinit();
 	debug_deinit();
 }
+
+/*************************************************************/
+
+#define INCREMENTAL_PROFILE "/tmp/sm-incremental-profile"
+
+static void test_folder_incremental_rescan_write_mail(int i)
+{
+	char mail_filename[100];
+	char subject[100];
+	struct composed_mail cm;
+	FILE *fp;
+
+	snprintf(mail_filename, sizeof(mail_filename), INCREMENTAL_PROFILE "/.folders/incoming/mail%06d", i);
+	snprintf(subject, sizeof(subject), "Subject %d", i);
+	composed_mail_init(&cm);
+
+	CU_ASSERT((fp = fopen(mail_filename, "w")) != NULL);
+	cm.from = "Sebastian Bauer <mail@sebastianbauer.info>";
+	cm.subject = subject;
+	cm.text = "Hello\n";
+	private_mail_compose_write(fp, &cm);
+	fclose(fp);
+}
+
+/**
+ * Sets the modification time of the given mail to a minute ago, i.e., well
+ * before any index file is written.
+ */
+static void test_folder_incremental_rescan_backdate_mail(int i)
+{
+	char mail_filename[100];
+	struct utimbuf ut;
+
+	snprintf(mail_filename, sizeof(mail_filename), INCREMENTAL_PROFILE "/.folders/incoming/mail%06d", i);
+	ut.actime = ut.modtime = time(NULL) - 60;
+	CU_ASSERT(utime(mail_filename, &ut) == 0);
+}
+
+/**
+ * Changes the sender of the given mail without changing the size of the
+ * mail.
+ */
+static void test_folder_incremental_rescan_change_mail(int i)
+{
+	char mail_filename[100];
+	char buf[4096];
+	char *from;
+	size_t len;
+	FILE *fp;
+
+	snprintf(mail_filename, sizeof(mail_filename), INCREMENTAL_PROFILE "/.folders/incoming/mail%06d", i);
+	CU_ASSERT((fp = fopen(mail_filename, "r+b")) != NULL);
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	buf[len] = 0;
+	CU_ASSERT((from = strstr(buf, "mail@sebastianbauer.info")) != NULL);
+	if (from)
+	{
+		fseek(fp, from - buf, SEEK_SET);
+		fwrite("post", 1, 4, fp);
+	}
+	fclose(fp);
+}
+
+/* @Test */
+void test_folder_incremental_rescan(void)
+{
+	char index_filename[256];
+	struct utimbuf ut;
+	struct folder *f;
+	void *handle = NULL;
+	struct mail_info *mi;
+	int count = 0;
+	int i;
+
+	system("rm -Rf " INCREMENTAL_PROFILE);
+	config_set_user_profile_directory(INCREMENTAL_PROFILE);
+
+	CU_ASSERT(debug_init() != 0);
+	CU_ASSERT(progmon_init() != 0);
+	CU_ASSERT(init_threads() != 0);
+	CU_ASSERT(load_config() != 0);
+	CU_ASSERT(codesets_init() != 0);
+	CU_ASSERT(init_folders() != 0);
+
+	for (i=0;i<100;i++)
+	{
+		test_folder_incremental_rescan_write_mail(i);
+		test_folder_incremental_rescan_backdate_mail(i);
+	}
+
+	/* Without an index, this is a full rescan */
+	CU_ASSERT(folder_rescan_incremental_async(folder_incoming(), NULL, test_folder_many_mails_rescan_completed, NULL) != 0);
+	thread_wait(NULL, NULL, NULL, 0);
+	CU_ASSERT_EQUAL(folder_incoming()->num_mails, 100);
+	CU_ASSERT(folder_save_index(folder_incoming()) != 0);
+
+	/* Change the folder behind our back */
+	test_folder_incremental_rescan_write_mail(100);
+	test_folder_incremental_rescan_write_mail(101);
+	CU_ASSERT(remove(INCREMENTAL_PROFILE "/.folders/incoming/mail000007") == 0);
+
+	/* A mail that is older than the index and whose size is unchanged is
+	 * taken from the index. Changing its contents behind our back shows
+	 * that the entry of the index has been taken indeed */
+	test_folder_incremental_rescan_change_mail(42);
+	test_folder_incremental_rescan_backdate_mail(42);
+
+	/* A mail that has been changed afterwards is read again even if the
+	 * index file has been touched later, e.g., by setting the pending flag */
+	test_folder_incremental_rescan_change_mail(43);
+	snprintf(index_filename, sizeof(index_filename), "%s.index", folder_incoming()->path);
+	ut.actime = ut.modtime = time(NULL) + 10;
+	CU_ASSERT(utime(index_filename, &ut) == 0);
+
+	CU_ASSERT(folder_rescan_incremental_async(folder_incoming(), NULL, test_folder_many_mails_rescan_completed, NULL) != 0);
+	thread_wait(NULL, NULL, NULL, 0);
+
+	f = folder_incoming();
+	CU_ASSERT_EQUAL(f->num_mails, 101);
+
+	mi = folder_next_mail(f, &handle);
+	while (mi)
+	{
+		CU_ASSERT(strcmp(mi->filename, "mail000007") != 0);
+		if (!strcmp(mi->filename, "mail000043"))
+			CU_ASSERT_STRING_EQUAL(mail_info_get_from_addr(mi), "post@sebastianbauer.info");
+		else
+			CU_ASSERT_STRING_EQUAL(mail_info_get_from_addr(mi), "mail@sebastianbauer.info");
+
+		count++;
+		mi = folder_next_mail(f, &handle);
+	}
+	CU_ASSERT_EQUAL(count, 101);
+
+	del_folders();
+	codesets_cleanup();
+	free_config();
+	cleanup_threads();
+	progmon_deinit();
+	debug_deinit();
+}
@@ -0,0 +1,684 @@
+/**
+ * index_benchmark.c - benchmark for SimpleMail's string index algorithms
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file index_benchmark.c
+ *
+ * Measures insert throughput, query latency, on-disk size and peak memory
+ * usage of the string index algorithms. Each combination of algorithm and
+ * corpus is run in a child process of its own, so the peak memory usage is
+ * not distorted by previous runs. The results are written to stdout as one
+ * JSON object per line.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "index.h"
+#include "index_external.h"
+#include "index_fm.h"
+#include "index_naive.h"
+#include "index_trigram.h"
+
+/*****************************************************************************/
+
+/**
+ * Describes an algorithm that is benchmarked.
+ */
+struct benchmark_algorithm
+{
+	const char *name;
+	struct index_algorithm *alg;
+
+	/** Whether the algorithm needs a filename to work */
+	int persistent;
+};
+
+/* Add new algorithms here */
+static struct benchmark_algorithm benchmark_algorithms[] =
+{
+	{"naive", &index_naive, 0},
+	{"external", &index_external, 1},
+	{"trigram", &index_trigram, 1},
+	{"fm", &index_fm, 1},
+};
+
+#define NUM_BENCHMARK_ALGORITHMS (sizeof(benchmark_algorithms)/sizeof(benchmark_algorithms[0]))
+
+/**
+ * A set of documents.
+ */
+struct benchmark_corpus
+{
+	const char *name;
+
+	char **texts;
+	int *dids;
+	int num_documents;
+
+	/** Sum of the lengths of all texts */
+	long bytes;
+};
+
+/**
+ * The options of a benchmark run.
+ */
+struct benchmark_options
+{
+	/** Name of the uncompressed book */
+	const char *book_filename;
+
+	/** Size of the chunks into which the book is split */
+	int chunk_size;
+
+	/** Number of synthetic mails */
+	int num_mails;
+
+	/** Number of queries */
+	int num_queries;
+
+	/** Directory in which persistent indices are created */
+	const char *directory;
+};
+
+/*****************************************************************************/
+
+/** State of the pseudo random number generator, fixed for reproducible runs */
+static unsigned int benchmark_random_state = 2463534242U;
+
+/**
+ * Returns a pseudo random number (xorshift).
+ *
+ * @return
+ */
+static unsigned int benchmark_random(void)
+{
+	unsigned int x = benchmark_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return benchmark_random_state = x;
+}
+
+/**
+ * Returns the current time in seconds.
+ *
+ * @return
+ */
+static double benchmark_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************************/
+
+/**
+ * Adds the given text to the corpus. The ownership of the text is
+ * transferred to the corpus.
+ *
+ * @param corpus
+ * @param text
+ * @return 0 on failure, else something different.
+ */
+static int benchmark_corpus_add(struct benchmark_corpus *corpus, char *text)
+{
+	char **texts;
+	int *dids;
+
+	if (!(texts = (char **)realloc(corpus->texts, (corpus->num_documents + 1) * sizeof(texts[0]))))
+		return 0;
+	corpus->texts = texts;
+	if (!(dids = (int *)realloc(corpus->dids, (corpus->num_documents + 1) * sizeof(dids[0]))))
+		return 0;
+	corpus->dids = dids;
+
+	corpus->texts[corpus->num_documents] = text;
+	corpus->dids[corpus->num_documents] = corpus->num_documents;
+	corpus->num_documents++;
+	corpus->bytes += strlen(text);
+	return 1;
+}
+
+/**
+ * Frees all resources of the given corpus.
+ *
+ * @param corpus
+ */
+static void benchmark_corpus_free(struct benchmark_corpus *corpus)
+{
+	int i;
+
+	for (i = 0; i < corpus->num_documents; i++)
+		free(corpus->texts[i]);
+	free(corpus->texts);
+	free(corpus->dids);
+	memset(corpus, 0, sizeof(*corpus));
+}
+
+/**
+ * Fills the corpus with chunks of the given book.
+ *
+ * @param corpus
+ * @param filename
+ * @param chunk_size
+ * @return 0 on failure, else something different.
+ */
+static int benchmark_corpus_load_book(struct benchmark_corpus *corpus, const char *filename, int chunk_size)
+{
+	FILE *fh;
+	char *chunk = NULL;
+	size_t len;
+
+	corpus->name = "book";
+
+	if (!(fh = fopen(filename, "rb")))
+	{
+		fprintf(stderr, "Couldn't open \"%s\"\n", filename);
+		return 0;
+	}
+
+	for (;;)
+	{
+		if (!(chunk = (char *)malloc(chunk_size + 1)))
+			goto bailout;
+		if (!(len = fread(chunk, 1, chunk_size, fh)))
+			break;
+		/* Embedded zero bytes simply shorten the chunk */
+		chunk[len] = 0;
+		if (!benchmark_corpus_add(corpus, chunk))
+			goto bailout;
+	}
+	free(chunk);
+	fclose(fh);
+	return 1;
+bailout:
+	free(chunk);
+	fclose(fh);
+	return 0;
+}
+
+/**
+ * Returns a random word of the synthetic vocabulary. The distribution of
+ * the words is skewed so that a few words are very common like in real
+ * texts.
+ *
+ * @param buf where the word is stored, must be at least 16 bytes.
+ */
+static void benchmark_random_word(char *buf)
+{
+	static const char * const syllables[] =
+	{
+		"ba", "be", "bi", "bo", "da", "de", "di", "do", "ka", "ke", "ki", "ko",
+		"la", "le", "li", "lo", "ma", "me", "mi", "mo", "na", "ne", "ni", "no",
+		"ra", "re", "ri", "ro", "sa", "se", "si", "so", "ta", "te", "ti", "to"
+	};
+	unsigned int num_syllables = sizeof(syllables)/sizeof(syllables[0]);
+	unsigned int r = benchmark_random() % 4096;
+	unsigned int word;
+	int i;
+
+	/* Cubing the random number skews the distribution towards small words */
+	word = (unsigned int)(((unsigned long long)r * r * r) >> 24);
+
+	buf[0] = 0;
+	for (i = 0; i < 4; i++)
+	{
+		strcat(buf, syllables[word % num_syllables]);
+		word /= num_syllables;
+		if (!word) break;
+	}
+}
+
+/**
+ * Fills the corpus with synthetic mails.
+ *
+ * @param corpus
+ * @param num_mails
+ * @return 0 on failure, else something different.
+ */
+static int benchmark_corpus_generate_mails(struct benchmark_corpus *corpus, int num_mails)
+{
+	int i;
+
+	corpus->name = "mail";
+
+	for (i = 0; i < num_mails; i++)
+	{
+		char word[16];
+		char *text;
+		int num_words = 20 + benchmark_random() % 400;
+		int size = num_words * 16 + 1024;
+		int len;
+		int line_len;
+		int j;
+
+		if (!(text = (char *)malloc(size)))
+			return 0;
+
+		benchmark_random_word(word);
+		len = sprintf(text, "From: %s <%s@example%u.com>\nTo: user%u@example.org\nSubject:",
+				word, word, benchmark_random() % 100, benchmark_random() % 50);
+		for (j = 3 + benchmark_random() % 5; j; j--)
+		{
+			benchmark_random_word(word);
+			len += sprintf(text + len, " %s", word);
+		}
+		len += sprintf(text + len, "\nDate: %u %s 2026 %02u:%02u:%02u +0100\nMessage-ID: <%u.%u@example.com>\n\n",
+				1 + benchmark_random() % 28, "Jan", benchmark_random() % 24, benchmark_random() % 60, benchmark_random() % 60,
+				benchmark_random(), i);
+
+		line_len = 0;
+		for (j = 0; j < num_words; j++)
+		{
+			int l;
+
+			benchmark_random_word(word);
+			l = strlen(word);
+			if (line_len + l > 72)
+			{
+				text[len++] = '\n';
+				line_len = 0;
+			} else if (line_len)
+			{
+				text[len++] = ' ';
+				line_len++;
+			}
+			strcpy(text + len, word);
+			len += l;
+			line_len += l;
+		}
+		text[len++] = '\n';
+		text[len] = 0;
+
+		if (!benchmark_corpus_add(corpus, text))
+		{
+			free(text);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*****************************************************************************/
+
+/**
+ * Returns the size of all files in the given directory whose names start
+ * with the given prefix.
+ *
+ * @param directory
+ * @param prefix
+ * @return
+ */
+static long long benchmark_disk_size(const char *directory, const char *prefix)
+{
+	struct dirent *de;
+	long long size = 0;
+	DIR *dir;
+
+	if (!(dir = opendir(directory)))
+		return 0;
+
+	while ((de = readdir(dir)))
+	{
+		char path[512];
+		struct stat st;
+
+		if (strncmp(de->d_name, prefix, strlen(prefix)))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", directory, de->d_name);
+		if (!stat(path, &st))
+			size += st.st_size;
+	}
+	closedir(dir);
+	return size;
+}
+
+/**
+ * Removes all files in the given directory whose names start with the given
+ * prefix.
+ *
+ * @param directory
+ * @param prefix
+ */
+static void benchmark_remove_files(const char *directory, const char *prefix)
+{
+	struct dirent *de;
+	DIR *dir;
+
+	if (!(dir = opendir(directory)))
+		return;
+
+	while ((de = readdir(dir)))
+	{
+		char path[512];
+
+		if (strncmp(de->d_name, prefix, strlen(prefix)))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", directory, de->d_name);
+		remove(path);
+	}
+	closedir(dir);
+}
+
+static int benchmark_compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	if (da < db) return -1;
+	if (da > db) return 1;
+	return 0;
+}
+
+/**
+ * Returns the given percentile of the sorted values.
+ *
+ * @param values
+ * @param num_values
+ * @param percentile
+ * @return
+ */
+static double benchmark_percentile(const double *values, int num_values, int percentile)
+{
+	int i;
+
+	if (!num_values)
+		return 0;
+
+	i = (num_values * percentile + 99) / 100 - 1;
+	if (i < 0) i = 0;
+	if (i >= num_values) i = num_values - 1;
+	return values[i];
+}
+
+static int benchmark_query_callback(int did, void *userdata)
+{
+	(*(int *)userdata)++;
+	return 0;
+}
+
+/**
+ * Runs the benchmark for the given algorithm and corpus and prints the
+ * results.
+ *
+ * @param balg
+ * @param corpus
+ * @param opts
+ * @return 0 on failure, else something different.
+ */
+static int benchmark_run(struct benchmark_algorithm *balg, struct benchmark_corpus *corpus, struct benchmark_options *opts)
+{
+	struct index *index;
+	struct rusage usage;
+	char prefix[128];
+	char filename[512];
+	double *latencies = NULL;
+	double start, insert_seconds, query_seconds;
+	long long disk_size;
+	long hits = 0;
+	int rc = 0;
+	int i;
+
+	snprintf(prefix, sizeof(prefix), "%s-%s", balg->name, corpus->name);
+	snprintf(filename, sizeof(filename), "%s/%s", opts->directory, prefix);
+	benchmark_remove_files(opts->directory, prefix);
+
+	if (!(latencies = (double *)malloc((opts->num_queries + 1) * sizeof(latencies[0]))))
+		return 0;
+
+	if (!(index = index_create(balg->alg, balg->persistent ? filename : NULL)))
+	{
+		fprintf(stderr, "Couldn't create index \"%s\"\n", filename);
+		goto out;
+	}
+
+	start = benchmark_now();
+	if (!index_put_documents(index, corpus->num_documents, corpus->dids, (const char * const *)corpus->texts))
+	{
+		fprintf(stderr, "Couldn't put documents into index \"%s\"\n", filename);
+		index_dispose(index);
+		goto out;
+	}
+	insert_seconds = benchmark_now() - start;
+
+	/* Queries are substrings of the documents, so each has at least one hit */
+	query_seconds = 0;
+	for (i = 0; i < opts->num_queries; i++)
+	{
+		char query[20];
+		const char *text = corpus->texts[benchmark_random() % corpus->num_documents];
+		int text_len = strlen(text);
+		int len = 4 + benchmark_random() % 13;
+		int found = 0;
+		int offset;
+
+		if (len > text_len)
+			len = text_len;
+		offset = text_len > len ? benchmark_random() % (text_len - len) : 0;
+		memcpy(query, text + offset, len);
+		query[len] = 0;
+
+		start = benchmark_now();
+		index_find_documents(index, benchmark_query_callback, &found, 1, query);
+		latencies[i] = benchmark_now() - start;
+		query_seconds += latencies[i];
+		hits += found;
+	}
+	qsort(latencies, opts->num_queries, sizeof(latencies[0]), benchmark_compare_double);
+
+	index_dispose(index);
+
+	disk_size = benchmark_disk_size(opts->directory, prefix);
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("{\"algorithm\": \"%s\", \"corpus\": \"%s\", \"documents\": %d, \"bytes\": %ld, "
+		"\"insert_seconds\": %.6f, \"insert_docs_per_second\": %.1f, \"insert_mb_per_second\": %.3f, "
+		"\"queries\": %d, \"query_hits\": %ld, \"query_seconds\": %.6f, "
+		"\"query_p50_us\": %.1f, \"query_p90_us\": %.1f, \"query_p99_us\": %.1f, \"query_max_us\": %.1f, "
+		"\"disk_bytes\": %lld, \"peak_rss_kb\": %ld}\n",
+		balg->name, corpus->name, corpus->num_documents, corpus->bytes,
+		insert_seconds, insert_seconds > 0 ? corpus->num_documents / insert_seconds : 0.0,
+		insert_seconds > 0 ? corpus->bytes / insert_seconds / (1024 * 1024) : 0.0,
+		opts->num_queries, hits, query_seconds,
+		benchmark_percentile(latencies, opts->num_queries, 50) * 1e6,
+		benchmark_percentile(latencies, opts->num_queries, 90) * 1e6,
+		benchmark_percentile(latencies, opts->num_queries, 99) * 1e6,
+		opts->num_queries ? latencies[opts->num_queries - 1] * 1e6 : 0.0,
+		disk_size, (long)usage.ru_maxrss);
+	fflush(stdout);
+
+	benchmark_remove_files(opts->directory, prefix);
+	rc = 1;
+out:
+	free(latencies);
+	return rc;
+}
+
+/**
+ * Builds the corpus of the given name and runs the benchmark for the given
+ * algorithm in a child process.
+ *
+ * @param balg
+ * @param corpus_name
+ * @param opts
+ * @return 0 on failure, else something different.
+ */
+static int benchmark_run_in_child(struct benchmark_algorithm *balg, const char *corpus_name, struct benchmark_options *opts)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+
+	if ((pid = fork()) < 0)
+		return 0;
+
+	if (!pid)
+	{
+		struct benchmark_corpus corpus;
+		int rc;
+
+		memset(&corpus, 0, sizeof(corpus));
+
+		if (!strcmp(corpus_name, "book"))
+			rc = benchmark_corpus_load_book(&corpus, opts->book_filename, opts->chunk_size);
+		else
+			rc = benchmark_corpus_generate_mails(&corpus, opts->num_mails);
+
+		if (rc && corpus.num_documents)
+			rc = benchmark_run(balg, &corpus, opts);
+		benchmark_corpus_free(&corpus);
+		exit(rc ? 0 : 1);
+	}
+
+	if (waitpid(pid, &status, 0) != pid)
+		return 0;
+	return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+/*****************************************************************************/
+
+static void benchmark_usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-a algorithm]... [-c book|mail]... [-b book] [-s chunk-size]\n"
+		"       [-m number-of-mails] [-q number-of-queries] [-d directory]\n"
+		"Algorithms:", name);
+	{
+		int i;
+		for (i = 0; i < NUM_BENCHMARK_ALGORITHMS; i++)
+			fprintf(stderr, " %s", benchmark_algorithms[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const all_corpora[] = {"book", "mail"};
+	struct benchmark_options opts;
+	const char *corpora[2];
+	int num_corpora = 0;
+	int selected[NUM_BENCHMARK_ALGORITHMS];
+	int num_selected = 0;
+	int failed = 0;
+	int i, j;
+
+	opts.book_filename = "of-human-bondage.txt";
+	opts.chunk_size = 4096;
+	opts.num_mails = 2000;
+	opts.num_queries = 1000;
+	opts.directory = "/tmp";
+
+	memset(selected, 0, sizeof(selected));
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' || !arg[1] || arg[2] || !val)
+		{
+			benchmark_usage(argv[0]);
+			return 1;
+		}
+		i++;
+
+		switch (arg[1])
+		{
+			case	'a':
+					for (j = 0; j < NUM_BENCHMARK_ALGORITHMS; j++)
+					{
+						if (!strcmp(benchmark_algorithms[j].name, val))
+							break;
+					}
+					if (j == NUM_BENCHMARK_ALGORITHMS)
+					{
+						benchmark_usage(argv[0]);
+						return 1;
+					}
+					if (!selected[j]) num_selected++;
+					selected[j] = 1;
+					break;
+
+			case	'c':
+					if (strcmp(val, "book") && strcmp(val, "mail"))
+					{
+						benchmark_usage(argv[0]);
+						return 1;
+					}
+					if (num_corpora < 2)
+						corpora[num_corpora++] = !strcmp(val, "book") ? all_corpora[0] : all_corpora[1];
+					break;
+
+			case	'b': opts.book_filename = val; break;
+			case	's': opts.chunk_size = atoi(val); break;
+			case	'm': opts.num_mails = atoi(val); break;
+			case	'q': opts.num_queries = atoi(val); break;
+			case	'd': opts.directory = val; break;
+
+			default:
+					benchmark_usage(argv[0]);
+					return 1;
+		}
+	}
+
+	if (opts.chunk_size < 1 || opts.num_mails < 1 || opts.num_queries < 0)
+	{
+		benchmark_usage(argv[0]);
+		return 1;
+	}
+
+	if (!num_corpora)
+	{
+		corpora[0] = all_corpora[0];
+		corpora[1] = all_corpora[1];
+		num_corpora = 2;
+	}
+
+	mkdir(opts.directory, 0755);
+
+	for (i = 0; i < num_corpora; i++)
+	{
+		for (j = 0; j < NUM_BENCHMARK_ALGORITHMS; j++)
+		{
+			if (num_selected && !selected[j])
+				continue;
+
+			if (!benchmark_run_in_child(&benchmark_algorithms[j], corpora[i], &opts))
+			{
+				fprintf(stderr, "Benchmark of %s on %s failed\n", benchmark_algorithms[j].name, corpora[i]);
+				failed = 1;
+			}
+		}
+	}
+	return failed;
+}
@@ -20,6 +20,9 @@
  * @file index_external_unittest.c
  */
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <CUnit/Basic.h>
 
 #define DEBUG_FUNCTIONS
@@ -27,6 +30,26 @@
 
 /*******************************************************/
 
+/**
+ * Remove all files that belong to the index of the given name.
+ *
+ * @param filename
+ */
+static void remove_index_files(const char *filename)
+{
+	static const char * const suffixes[] = {".index", ".strings", ".offsets", ".tombstones"};
+	char buf[380];
+	int i;
+
+	for (i=0; i < sizeof(suffixes)/sizeof(suffixes[0]); i++)
+	{
+		snprintf(buf, sizeof(buf), "%s%s", filename, suffixes[i]);
+		remove(buf);
+	}
+}
+
+/*******************************************************/
+
 /* @Test */
 void test_number_of_leaves_match_inserted_strings(void)
 {
@@ -35,6 +58,8 @@ void test_number_of_leaves_match_inserted_strings(void)
 	int i;
 	int number_of_distinct_strings;
 
+	remove_index_files("/tmp/index_external_unittest_index.dat");
+
 	idx = (struct index_external *)index_external_create_with_opts("/tmp/index_external_unittest_index.dat", 512);
 	CU_ASSERT(idx != NULL);
 
@@ -138,3 +163,630 @@ void test_number_of_leaves_match_inserted_strings(void)
 }
 
 /*******************************************************/
+
+static int test_index_can_be_reopened_callback(int did, void *userdata)
+{
+	(*(int*)userdata) = did;
+	return 0;
+}
+
+/* @Test */
+void test_index_can_be_reopened(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_reopen.dat";
+	struct index_external *idx;
+	int number_of_blocks;
+	int root_node;
+	int did;
+	int rc;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+	CU_ASSERT(idx->root_node == 1);
+
+	rc = index_external_put_document(&idx->index, 1, "Hello, this is the first document");
+	CU_ASSERT(rc != 0);
+	rc = index_external_put_document(&idx->index, 2, "And this is the second document");
+	CU_ASSERT(rc != 0);
+
+	number_of_blocks = idx->number_of_blocks;
+	root_node = idx->root_node;
+	CU_ASSERT(number_of_blocks > 2);
+	index_external_dispose(&idx->index);
+
+	/* The block size of the reopened index is taken from the superblock */
+	idx = (struct index_external *)index_external_create_with_opts(filename, 16384);
+	CU_ASSERT(idx != NULL);
+	CU_ASSERT(idx->block_size == 512);
+	CU_ASSERT(idx->number_of_blocks == number_of_blocks);
+	CU_ASSERT(idx->root_node == root_node);
+	CU_ASSERT(idx->number_of_documents == 2);
+
+	did = 0;
+	rc = bnode_find_string(idx, "And this is the second document", test_index_can_be_reopened_callback, &did);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(did == 2);
+
+	/* Documents can still be added after the index has been reopened */
+	rc = index_external_put_document(&idx->index, 3, "Third document");
+	CU_ASSERT(rc != 0);
+	CU_ASSERT(idx->number_of_documents == 3);
+
+	did = 0;
+	rc = bnode_find_string(idx, "Third document", test_index_can_be_reopened_callback, &did);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(did == 3);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_caches(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_cache.dat";
+	struct index_external_cache_stats stats;
+	struct index *index;
+	unsigned int misses;
+	int did;
+	int rc;
+	int i;
+
+	remove_index_files(filename);
+
+	index = index_external_create_with_opts(filename, 512);
+	CU_ASSERT(index != NULL);
+
+	for (i = 0; i < 20; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		rc = index_external_put_document(index, i, buf);
+		CU_ASSERT(rc != 0);
+	}
+
+	/* Repeated queries should be served from the caches */
+	did = -1;
+	rc = bnode_find_string((struct index_external *)index, "document number 17", test_index_can_be_reopened_callback, &did);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(did == 17);
+
+	index_external_get_cache_stats(index, &stats);
+	misses = stats.node_misses + stats.string_misses;
+
+	did = -1;
+	rc = bnode_find_string((struct index_external *)index, "document number 17", test_index_can_be_reopened_callback, &did);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(did == 17);
+
+	index_external_get_cache_stats(index, &stats);
+	CU_ASSERT(stats.node_misses + stats.string_misses == misses);
+	CU_ASSERT(stats.node_hits > 0);
+	CU_ASSERT(stats.string_hits > 0);
+	CU_ASSERT(stats.cached_nodes > 0);
+	CU_ASSERT(stats.cached_strings > 0);
+
+	/* Disabling the caches must not affect the results */
+	index_external_set_cache_sizes(index, 0, 0);
+	index_external_get_cache_stats(index, &stats);
+	CU_ASSERT(stats.cached_nodes == 0);
+	CU_ASSERT(stats.cached_strings == 0);
+
+	did = -1;
+	rc = bnode_find_string((struct index_external *)index, "document number 3", test_index_can_be_reopened_callback, &did);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(did == 3);
+
+	/* Small caches force evictions */
+	index_external_set_cache_sizes(index, 2, 4);
+	for (i = 0; i < 20; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		did = -1;
+		rc = bnode_find_string((struct index_external *)index, buf, test_index_can_be_reopened_callback, &did);
+		CU_ASSERT(rc == 1);
+		CU_ASSERT(did == i);
+	}
+	index_external_get_cache_stats(index, &stats);
+	CU_ASSERT(stats.cached_nodes <= 2);
+	CU_ASSERT(stats.cached_strings <= 4);
+
+	index_external_dispose(index);
+	remove_index_files(filename);
+}
+
+/*******************************************************/
+
+static int test_bulk_load_callback(int did, void *userdata)
+{
+	((int*)userdata)[did]++;
+	return 0;
+}
+
+/* @Test */
+void test_bulk_load(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_bulk.dat";
+	static const char *words[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+	struct index_external *idx;
+	char *texts[64];
+	int dids[64];
+	int found[64 + 2];
+	int rc;
+	int i, j;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	/* Force many runs and thus multiple merge passes */
+	idx->bulk_run_size = 7;
+
+	/* A document that is inserted incrementally before the bulk load */
+	rc = index_external_put_document(&idx->index, 64, "an incrementally inserted document");
+	CU_ASSERT(rc != 0);
+
+	for (i = 0; i < 64; i++)
+	{
+		char buf[128];
+
+		buf[0] = 0;
+		for (j = 0; j < 4; j++)
+		{
+			strcat(buf, words[(i + j * 3) % 8]);
+			strcat(buf, " ");
+		}
+		sprintf(buf + strlen(buf), "%02d", i);
+		texts[i] = strdup(buf);
+		dids[i] = i;
+	}
+
+	rc = index_external_put_documents(&idx->index, 64, dids, (const char * const *)texts);
+	CU_ASSERT(rc != 0);
+	CU_ASSERT(idx->number_of_documents == 65);
+
+	verify_index(idx, idx->root_node, 0);
+
+	/* All suffixes of all documents must be in the leaves */
+	{
+		int total = strlen("an incrementally inserted document");
+		for (i = 0; i < 64; i++)
+			total += strlen(texts[i]);
+		CU_ASSERT(count_index_leaves(idx, idx->root_node, 0) == total);
+	}
+
+	for (i = 0; i < 64; i++)
+	{
+		memset(found, 0, sizeof(found));
+		rc = bnode_find_string(idx, texts[i], test_bulk_load_callback, found);
+		CU_ASSERT(rc == 1);
+		CU_ASSERT(found[i] == 1);
+
+		/* Also a suffix */
+		memset(found, 0, sizeof(found));
+		rc = bnode_find_string(idx, texts[i] + 3, test_bulk_load_callback, found);
+		CU_ASSERT(rc >= 1);
+		CU_ASSERT(found[i] == 1);
+	}
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "an incrementally inserted document", test_bulk_load_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[64] == 1);
+
+	/* Incremental insertions into a bulk loaded tree */
+	rc = index_external_put_document(&idx->index, 65, "yet another document");
+	CU_ASSERT(rc != 0);
+	verify_index(idx, idx->root_node, 0);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "yet another document", test_bulk_load_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[65] == 1);
+
+	/* And the bulk loaded tree survives a reopen */
+	index_external_dispose(&idx->index);
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, texts[42], test_bulk_load_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[42] == 1);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+
+	for (i = 0; i < 64; i++)
+		free(texts[i]);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_bulk_load_small_batches(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_batches.dat";
+	struct index_external *idx;
+	char *texts[200];
+	int dids[200];
+	int found[200];
+	int blocks;
+	int total = 0;
+	int rc;
+	int i;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	for (i = 0; i < 200; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "Batch document %03d with some text", i);
+		texts[i] = strdup(buf);
+		dids[i] = i;
+		total += strlen(buf);
+	}
+
+	/* The first batch builds the tree */
+	rc = index_external_put_documents(&idx->index, 100, dids, (const char * const *)texts);
+	CU_ASSERT(rc != 0);
+	blocks = idx->number_of_blocks;
+
+	/* Small batches are merged into the existing tree, which thus grows
+	 * only by the split nodes */
+	for (i = 100; i < 200; i += 2)
+	{
+		rc = index_external_put_documents(&idx->index, 2, &dids[i], (const char * const *)&texts[i]);
+		CU_ASSERT(rc != 0);
+	}
+	CU_ASSERT(idx->number_of_documents == 200);
+	CU_ASSERT(idx->number_of_blocks < blocks * 3);
+
+	verify_index(idx, idx->root_node, 0);
+	CU_ASSERT(count_index_leaves(idx, idx->root_node, 0) == total);
+
+	for (i = 0; i < 200; i++)
+	{
+		memset(found, 0, sizeof(found));
+		rc = bnode_find_string(idx, texts[i], test_bulk_load_callback, found);
+		CU_ASSERT(rc == 1);
+		CU_ASSERT(found[i] == 1);
+	}
+
+	index_external_dispose(&idx->index);
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+	CU_ASSERT(idx->number_of_documents == 200);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, texts[151], test_bulk_load_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[151] == 1);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+
+	for (i = 0; i < 200; i++)
+		free(texts[i]);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_failed_bulk_load_is_rolled_back(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_rollback.dat";
+	static const char blocker[] = "/tmp/index_external_unittest_rollback.dat.index.new";
+	static const char *texts[] = {"first document", "second document"};
+	static const int dids[] = {1, 2};
+	char blocker_file[400];
+	struct index_external *idx;
+	long strings_size;
+	int found[4];
+	FILE *fh;
+	int rc;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	rc = index_external_put_document(&idx->index, 0, "zeroth");
+	CU_ASSERT(rc != 0);
+	strings_size = idx->strings_size;
+
+	/* A non-empty directory in place of the new tree lets the rebuild fail */
+	mkdir(blocker, 0777);
+	snprintf(blocker_file, sizeof(blocker_file), "%s/file", blocker);
+	if ((fh = fopen(blocker_file, "wb")))
+		fclose(fh);
+
+	rc = index_external_put_documents(&idx->index, 2, dids, texts);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(idx->number_of_documents == 1);
+	CU_ASSERT(idx->strings_size == strings_size);
+	CU_ASSERT(idx->index_file != NULL);
+
+	memset(found, 0, sizeof(found));
+	CU_ASSERT(bnode_find_string(idx, "zeroth", test_bulk_load_callback, found) == 1);
+	CU_ASSERT(bnode_find_string(idx, "document", test_bulk_load_callback, found) == 0);
+
+	remove(blocker_file);
+	rmdir(blocker);
+
+	/* The next attempt takes the place of the failed one */
+	rc = index_external_put_documents(&idx->index, 2, dids, texts);
+	CU_ASSERT(rc != 0);
+	CU_ASSERT(idx->number_of_documents == 3);
+	CU_ASSERT(idx->strings_size == strings_size + strlen(texts[0]) + strlen(texts[1]) + 2);
+
+	memset(found, 0, sizeof(found));
+	CU_ASSERT(bnode_find_string(idx, "second document", test_bulk_load_callback, found) == 1);
+	CU_ASSERT(found[2] == 1);
+	CU_ASSERT(bnode_find_string(idx, "zeroth", test_bulk_load_callback, found) == 1);
+	CU_ASSERT(found[0] == 1);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+}
+
+/*******************************************************/
+
+static int test_remove_and_compact_callback(int did, void *userdata)
+{
+	((int*)userdata)[did]++;
+	return 0;
+}
+
+/* @Test */
+void test_remove_and_compact(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_compact.dat";
+	struct index_external *idx;
+	int found[21];
+	int total;
+	int rc;
+	int i;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	total = 0;
+	for (i = 0; i < 20; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		rc = index_external_put_document(&idx->index, i, buf);
+		CU_ASSERT(rc != 0);
+		if (i != 3 && i != 7)
+			total += strlen(buf);
+	}
+
+	rc = index_external_remove_document(&idx->index, 3);
+	CU_ASSERT(rc != 0);
+	rc = index_external_remove_document(&idx->index, 7);
+	CU_ASSERT(rc != 0);
+
+	/* Documents that are not in the index cannot be removed */
+	rc = index_external_remove_document(&idx->index, 42);
+	CU_ASSERT(rc == 0);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "document number 3", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 0);
+	rc = bnode_find_string(idx, "document number 17", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[17] == 1);
+
+	/* The tree is left untouched */
+	CU_ASSERT(count_index_leaves(idx, idx->root_node, 0) > total);
+
+	/* Not enough garbage for the default threshold */
+	CU_ASSERT(index_external_needs_compaction(&idx->index) == 0);
+	index_external_set_compaction_threshold(&idx->index, 5, 0);
+	CU_ASSERT(index_external_needs_compaction(&idx->index) == 1);
+
+	/* The tombstones survive a reopen */
+	index_external_dispose(&idx->index);
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "document number 7", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 0);
+
+	rc = index_external_compact(&idx->index);
+	CU_ASSERT(rc != 0);
+	CU_ASSERT(idx->number_of_documents == 18);
+	CU_ASSERT(idx->dead_bytes == 0);
+	CU_ASSERT(index_external_needs_compaction(&idx->index) == 0);
+	CU_ASSERT(count_index_leaves(idx, idx->root_node, 0) == total);
+	verify_index(idx, idx->root_node, 0);
+
+	memset(found, 0, sizeof(found));
+	for (i = 0; i < 20; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		bnode_find_string(idx, buf, test_remove_and_compact_callback, found);
+		CU_ASSERT(found[i] == (i != 3 && i != 7));
+	}
+
+	/* A removed document id can be used again */
+	rc = index_external_remove_document(&idx->index, 19);
+	CU_ASSERT(rc != 0);
+	rc = index_external_put_document(&idx->index, 19, "Reused identifier");
+	CU_ASSERT(rc != 0);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "document number 19", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 0);
+	rc = bnode_find_string(idx, "Reused identifier", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[19] == 1);
+
+	/* And the compacted index can be reopened */
+	index_external_dispose(&idx->index);
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+	CU_ASSERT(idx->number_of_documents == 19);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "document number 12", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[12] == 1);
+	rc = bnode_find_string(idx, "Reused identifier", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 1);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_remove_compacts_automatically(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_auto_compact.dat";
+	struct index_external *idx;
+	int found[100];
+	int rc;
+	int i;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+	index_external_set_compaction_threshold(&idx->index, 10, 0);
+
+	for (i = 0; i < 100; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		rc = index_external_put_document(&idx->index, i, buf);
+		CU_ASSERT(rc != 0);
+	}
+
+	/* The same id may be put more than once, all of them are removed */
+	rc = index_external_put_document(&idx->index, 50, "Duplicated identifier");
+	CU_ASSERT(rc != 0);
+
+	for (i = 40; i < 60; i++)
+	{
+		rc = index_external_remove_document(&idx->index, i);
+		CU_ASSERT(rc != 0);
+
+		/* The garbage never exceeds the threshold */
+		CU_ASSERT(index_external_needs_compaction(&idx->index) == 0);
+	}
+
+	/* At least one compaction must have happened */
+	CU_ASSERT(idx->number_of_documents < 101);
+	CU_ASSERT(idx->dead_bytes * 100 < idx->strings_size * 10);
+
+	rc = index_external_remove_document(&idx->index, 50);
+	CU_ASSERT(rc == 0);
+
+	memset(found, 0, sizeof(found));
+	for (i = 0; i < 100; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		bnode_find_string(idx, buf, test_remove_and_compact_callback, found);
+		CU_ASSERT(found[i] == (i < 40 || i >= 60));
+	}
+	rc = bnode_find_string(idx, "Duplicated identifier", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 0);
+	verify_index(idx, idx->root_node, 0);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_failed_compaction_keeps_index(void)
+{
+	static const char filename[] = "/tmp/index_external_unittest_failed_compact.dat";
+	static const char blocker[] = "/tmp/index_external_unittest_failed_compact.dat.old.strings";
+	char blocker_file[400];
+	struct index_external *idx;
+	FILE *fh;
+	int found[10];
+	int dead_bytes;
+	int rc;
+	int i;
+
+	remove_index_files(filename);
+
+	idx = (struct index_external *)index_external_create_with_opts(filename, 512);
+	CU_ASSERT(idx != NULL);
+
+	for (i = 0; i < 10; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		rc = index_external_put_document(&idx->index, i, buf);
+		CU_ASSERT(rc != 0);
+	}
+	rc = index_external_remove_document(&idx->index, 4);
+	CU_ASSERT(rc != 0);
+	dead_bytes = idx->dead_bytes;
+	CU_ASSERT(dead_bytes != 0);
+
+	/* A non-empty directory in the way of moving the current strings aside
+	 * lets the replacement of the files fail */
+	mkdir(blocker, 0777);
+	snprintf(blocker_file, sizeof(blocker_file), "%s/file", blocker);
+	if ((fh = fopen(blocker_file, "wb")))
+		fclose(fh);
+
+	rc = index_external_compact(&idx->index);
+	CU_ASSERT(rc == 0);
+
+	/* The old index is still complete and usable */
+	CU_ASSERT(idx->index_file != NULL);
+	CU_ASSERT(idx->string_file != NULL);
+	CU_ASSERT(idx->offset_file != NULL);
+	CU_ASSERT(idx->number_of_documents == 10);
+	CU_ASSERT(idx->dead_bytes == dead_bytes);
+
+	memset(found, 0, sizeof(found));
+	for (i = 0; i < 10; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "This is document number %d", i);
+		bnode_find_string(idx, buf, test_remove_and_compact_callback, found);
+		CU_ASSERT(found[i] == (i != 4));
+	}
+
+	rc = index_external_put_document(&idx->index, 4, "Still writable");
+	CU_ASSERT(rc != 0);
+
+	/* Once the obstacle is gone, the compaction succeeds */
+	remove(blocker_file);
+	rmdir(blocker);
+	rc = index_external_compact(&idx->index);
+	CU_ASSERT(rc != 0);
+	CU_ASSERT(idx->dead_bytes == 0);
+
+	memset(found, 0, sizeof(found));
+	rc = bnode_find_string(idx, "Still writable", test_remove_and_compact_callback, found);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(found[4] == 1);
+
+	index_external_dispose(&idx->index);
+	remove_index_files(filename);
+}
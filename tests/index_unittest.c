@@ -25,6 +25,8 @@
 #include "index.h"
 #include "index_naive.h"
 #include "index_external.h"
+#include "index_fm.h"
+#include "index_trigram.h"
 
 static const char zauberlehrling[] =
 	"Hat der alte Hexenmeister\n"
@@ -272,5 +274,400 @@ void test_index_naive(void)
 /* @Test */
 void test_index_external(void)
 {
+	/* Start with a fresh index as the external index is persistent */
+	remove("/tmp/external-index.dat.index");
+	remove("/tmp/external-index.dat.strings");
+	remove("/tmp/external-index.dat.offsets");
+
 	test_index_for_algorithm(&index_external, "/tmp/external-index.dat");
 }
+
+/*******************************************************/
+
+static int test_index_put_documents_callback(int did, void *userdata)
+{
+	((int*)userdata)[did]++;
+	return 0;
+}
+
+static void test_index_put_documents_for_algorithm(struct index_algorithm *alg, const char *name)
+{
+	static const char * const texts[] = {
+		"This is a very long text.",
+		"This is a short text.",
+		zauberlehrling
+	};
+	static const int dids[] = {0, 1, 2};
+	struct index *index;
+	int found[3];
+	int nd;
+	int ok;
+
+	index = index_create(alg, name);
+	CU_ASSERT(index != NULL);
+
+	ok = index_put_documents(index, 3, dids, texts);
+	CU_ASSERT(ok != 0);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "This is a short text.");
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[1] == 1);
+
+	test_index_contains_all_suffixes(index, zauberlehrling, 2);
+
+	index_dispose(index);
+}
+
+/* @Test */
+void test_index_put_documents(void)
+{
+	remove("/tmp/external-index-bulk.dat.index");
+	remove("/tmp/external-index-bulk.dat.strings");
+	remove("/tmp/external-index-bulk.dat.offsets");
+
+	test_index_put_documents_for_algorithm(&index_naive, "naive-index-bulk.dat");
+	test_index_put_documents_for_algorithm(&index_external, "/tmp/external-index-bulk.dat");
+	test_index_put_documents_for_algorithm(&index_trigram, NULL);
+	test_index_put_documents_for_algorithm(&index_fm, NULL);
+}
+
+/*******************************************************/
+
+/**
+ * Collects all documents of the given cursor into the given array.
+ *
+ * @return the number of documents.
+ */
+static int test_index_query_collect(struct index_cursor *cursor, int *dids, int max_dids)
+{
+	int n = 0;
+	int did;
+
+	while ((did = index_cursor_next(cursor)) >= 0 && n < max_dids)
+		dids[n++] = did;
+	return n;
+}
+
+static void test_index_query_for_algorithm(struct index_algorithm *alg, const char *name)
+{
+	static const char * const texts[] = {
+		"the quick brown fox",
+		"the lazy dog",
+		"a quick dog",
+		"brown bread",
+		"quick brown dog"
+	};
+	static const int dids[] = {8, 2, 3, 5, 1};
+	static const char * const phrase[] = {"brown", "dog"};
+	struct index *index;
+	struct index_query *q;
+	struct index_cursor *c;
+	int found[8];
+	int n;
+	int ok;
+
+	index = index_create(alg, name);
+	CU_ASSERT(index != NULL);
+
+	ok = index_put_documents(index, 5, dids, texts);
+	CU_ASSERT(ok != 0);
+
+	/* A single term in ascending order with skip to */
+	q = index_query_term("quick");
+	c = index_query_cursor(index, q);
+	CU_ASSERT(c != NULL);
+	CU_ASSERT(index_cursor_skip_to(c, 2) == 3);
+	CU_ASSERT(index_cursor_skip_to(c, 2) == 3);
+	CU_ASSERT(index_cursor_next(c) == 8);
+	CU_ASSERT(index_cursor_next(c) == -1);
+	CU_ASSERT(index_cursor_next(c) == -1);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	q = index_query_and(index_query_term("quick"), index_query_term("dog"));
+	c = index_query_cursor(index, q);
+	n = test_index_query_collect(c, found, 8);
+	CU_ASSERT(n == 2);
+	CU_ASSERT(found[0] == 1);
+	CU_ASSERT(found[1] == 3);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	q = index_query_or(index_query_term("lazy"), index_query_term("bread"));
+	c = index_query_cursor(index, q);
+	n = test_index_query_collect(c, found, 8);
+	CU_ASSERT(n == 2);
+	CU_ASSERT(found[0] == 2);
+	CU_ASSERT(found[1] == 5);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	q = index_query_and(index_query_term("quick"), index_query_not(index_query_term("dog")));
+	c = index_query_cursor(index, q);
+	n = test_index_query_collect(c, found, 8);
+	CU_ASSERT(n == 1);
+	CU_ASSERT(found[0] == 8);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	q = index_query_and(index_query_or(index_query_term("brown"), index_query_term("lazy")), index_query_not(index_query_term("fox")));
+	c = index_query_cursor(index, q);
+	n = test_index_query_collect(c, found, 8);
+	CU_ASSERT(n == 3);
+	CU_ASSERT(found[0] == 1);
+	CU_ASSERT(found[1] == 2);
+	CU_ASSERT(found[2] == 5);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	q = index_query_phrase(2, phrase);
+	c = index_query_cursor(index, q);
+	n = test_index_query_collect(c, found, 8);
+	CU_ASSERT(n == 1);
+	CU_ASSERT(found[0] == 1);
+	index_cursor_dispose(c);
+	index_query_free(q);
+
+	/* Pure negations cannot be evaluated */
+	q = index_query_not(index_query_term("dog"));
+	c = index_query_cursor(index, q);
+	CU_ASSERT(c == NULL);
+	index_query_free(q);
+
+	index_dispose(index);
+}
+
+/* @Test */
+void test_index_query(void)
+{
+	/* The external index is not considered as it doesn't find every substring yet (see test_index_external()) */
+	test_index_query_for_algorithm(&index_naive, "naive-index-query.dat");
+	test_index_query_for_algorithm(&index_trigram, NULL);
+	test_index_query_for_algorithm(&index_fm, NULL);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_trigram(void)
+{
+	remove("/tmp/trigram-index.dat.trigrams");
+	remove("/tmp/trigram-index.dat.documents");
+
+	test_index_for_algorithm(&index_trigram, "/tmp/trigram-index.dat");
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_trigram_reopen(void)
+{
+	struct index *index;
+	int found[3];
+	int nd;
+	int ok;
+
+	remove("/tmp/trigram-index-reopen.dat.trigrams");
+	remove("/tmp/trigram-index-reopen.dat.documents");
+
+	index = index_create(&index_trigram, "/tmp/trigram-index-reopen.dat");
+	CU_ASSERT(index != NULL);
+
+	ok = index_put_document(index, 1, "This is a very long text.");
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 2, "This is a short text.");
+	CU_ASSERT(ok != 0);
+	index_dispose(index);
+
+	index = index_create(&index_trigram, "/tmp/trigram-index-reopen.dat");
+	CU_ASSERT(index != NULL);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 2, "This", "short");
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[2] == 1);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "is");
+	CU_ASSERT(nd == 2);
+	CU_ASSERT(found[1] == 1);
+	CU_ASSERT(found[2] == 1);
+
+	index_dispose(index);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_fm(void)
+{
+	remove("/tmp/fm-index.dat.fm");
+	test_index_for_algorithm(&index_fm, "/tmp/fm-index.dat");
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_fm_merge(void)
+{
+	struct index *index;
+	char *text;
+	int found[40];
+	int nd;
+	int ok;
+
+	remove("/tmp/fm-index-merge.dat.fm");
+
+	index = index_create(&index_fm, "/tmp/fm-index-merge.dat");
+	CU_ASSERT(index != NULL);
+
+	ok = index_put_document(index, 4, "This is a very long text.");
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 12, "This is a short text.");
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 20, zauberlehrling);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 3);
+
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 0);
+
+	test_index_contains_all_suffixes(index, "This is a very long text.", 4);
+	test_index_contains_all_suffixes(index, zauberlehrling, 20);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 2, "This is", "text.");
+	CU_ASSERT(nd == 2);
+	CU_ASSERT(found[4] == 1);
+	CU_ASSERT(found[12] == 1);
+
+	/* A document in the delta and one in the static part */
+	text = read_file_contents("of-human-bondage.txt");
+	CU_ASSERT(text != NULL);
+	ok = index_put_document(index, 32, text);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 1);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "ist");
+	CU_ASSERT(found[20] == 1);
+	CU_ASSERT(found[32] == 1);
+	CU_ASSERT(nd == 2);
+
+	ok = index_remove_document(index, 4);
+	CU_ASSERT(ok != 0);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "very long");
+	CU_ASSERT(nd == 0);
+
+	/* The merge drops the removed document and keeps the others */
+	index_dispose(index);
+	index = index_create(&index_fm, "/tmp/fm-index-merge.dat");
+	CU_ASSERT(index != NULL);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 1);
+
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+
+	test_index_contains_all_suffixes(index, zauberlehrling, 20);
+
+	/* Checking all suffixes of the long text would take too long */
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 2, text + 1000, text + 150000);
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[32] == 1);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "This is a short");
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[12] == 1);
+
+	index_dispose(index);
+	free(text);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_index_fm_incremental_merge(void)
+{
+	struct index *index;
+	int found[40];
+	int nd;
+	int ok;
+
+	remove("/tmp/fm-index-incremental.dat.fm");
+
+	index = index_create(&index_fm, "/tmp/fm-index-incremental.dat");
+	CU_ASSERT(index != NULL);
+
+	/* Every merge inserts the delta into the existing BWT */
+	ok = index_put_document(index, 4, "This is a very long text.");
+	CU_ASSERT(ok != 0);
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 12, zauberlehrling);
+	CU_ASSERT(ok != 0);
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 20, "This is a short text.");
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 28, "A text that is very short");
+	CU_ASSERT(ok != 0);
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 0);
+
+	test_index_contains_all_suffixes(index, "This is a very long text.", 4);
+	test_index_contains_all_suffixes(index, zauberlehrling, 12);
+	test_index_contains_all_suffixes(index, "A text that is very short", 28);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "very");
+	CU_ASSERT(nd == 2);
+	CU_ASSERT(found[4] == 1);
+	CU_ASSERT(found[28] == 1);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 2, "This is", "text.");
+	CU_ASSERT(nd == 2);
+	CU_ASSERT(found[4] == 1);
+	CU_ASSERT(found[20] == 1);
+
+	/* The merged index is restored */
+	index_dispose(index);
+	index = index_create(&index_fm, "/tmp/fm-index-incremental.dat");
+	CU_ASSERT(index != NULL);
+	CU_ASSERT(index_fm_get_num_delta_documents(index) == 0);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "Walle! walle");
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[12] == 1);
+
+	/* Most of the text is removed now, so the next merge drops it */
+	ok = index_remove_document(index, 12);
+	CU_ASSERT(ok != 0);
+	ok = index_put_document(index, 36, "Walle! walle");
+	CU_ASSERT(ok != 0);
+	ok = index_fm_merge(index);
+	CU_ASSERT(ok != 0);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "alle");
+	CU_ASSERT(nd == 1);
+	CU_ASSERT(found[36] == 1);
+
+	memset(found, 0, sizeof(found));
+	nd = index_find_documents(index, test_index_put_documents_callback, found, 1, "very");
+	CU_ASSERT(nd == 2);
+	CU_ASSERT(found[4] == 1);
+	CU_ASSERT(found[28] == 1);
+
+	test_index_contains_all_suffixes(index, "This is a short text.", 20);
+
+	index_dispose(index);
+}
@@ -0,0 +1,205 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "mail_btree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "mail.h"
+
+#define TEST_NUM_MAILS 20000
+
+/*******************************************************/
+
+static int test_mail_btree_compare(const void *arg1, const void *arg2)
+{
+	const struct mail_info *m1 = *(const struct mail_info **)arg1;
+	const struct mail_info *m2 = *(const struct mail_info **)arg2;
+
+	if (m1->size < m2->size) return -1;
+	if (m1->size > m2->size) return 1;
+	return 0;
+}
+
+/*******************************************************/
+
+static void test_mail_btree_check(struct mail_btree *tree, struct mail_info **mails, int num_mails)
+{
+	struct mail_info **array;
+	int i;
+
+	CU_ASSERT_EQUAL_FATAL(mail_btree_count(tree), num_mails);
+	CU_ASSERT_PTR_NULL(mail_btree_get(tree, -1));
+	CU_ASSERT_PTR_NULL(mail_btree_get(tree, num_mails));
+
+	/* Sequentially and from the end */
+	for (i = 0; i < num_mails; i++)
+		CU_ASSERT_PTR_EQUAL(mail_btree_get(tree, i), mails[i]);
+	for (i = num_mails - 1; i >= 0; i -= 7)
+		CU_ASSERT_PTR_EQUAL(mail_btree_get(tree, i), mails[i]);
+
+	array = (struct mail_info **)malloc((num_mails + 1) * sizeof(array[0]));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(array);
+	mail_btree_to_array(tree, array);
+	CU_ASSERT(memcmp(array, mails, num_mails * sizeof(array[0])) == 0);
+	free(array);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_btree_create_from_array(void)
+{
+	static const int sizes[] = {0, 1, 64, 65, 48 * 48, 48 * 48 + 1, TEST_NUM_MAILS};
+	struct mail_info **mails;
+	int i, s;
+
+	mails = (struct mail_info **)malloc(TEST_NUM_MAILS * sizeof(mails[0]));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mails);
+
+	/* The mails are not dereferenced */
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+		mails[i] = (struct mail_info *)(long)(i * 8 + 8);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		struct mail_btree *tree = mail_btree_create_from_array(mails, sizes[s]);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(tree);
+		test_mail_btree_check(tree, mails, sizes[s]);
+		mail_btree_free(tree);
+	}
+
+	free(mails);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_btree_insert_and_remove(void)
+{
+	struct mail_info **mails;
+	struct mail_btree *tree;
+	int num_mails = 0;
+	int i;
+
+	mails = (struct mail_info **)malloc(TEST_NUM_MAILS * sizeof(mails[0]));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mails);
+
+	tree = mail_btree_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(tree);
+
+	srand(1);
+
+	/* Insert at random positions with a few removals in between */
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		struct mail_info *m = (struct mail_info *)(long)(i * 8 + 8);
+		int pos = rand() % (num_mails + 1);
+
+		CU_ASSERT_FATAL(mail_btree_insert_at(tree, pos, m) != 0);
+		memmove(&mails[pos + 1], &mails[pos], (num_mails - pos) * sizeof(mails[0]));
+		mails[pos] = m;
+		num_mails++;
+
+		if (i % 3 == 2)
+		{
+			pos = rand() % num_mails;
+			CU_ASSERT_PTR_EQUAL(mail_btree_remove_at(tree, pos), mails[pos]);
+			memmove(&mails[pos], &mails[pos + 1], (num_mails - pos - 1) * sizeof(mails[0]));
+			num_mails--;
+		}
+	}
+	CU_ASSERT_FALSE(mail_btree_insert_at(tree, num_mails + 1, NULL));
+	test_mail_btree_check(tree, mails, num_mails);
+
+	/* Remove all but a few, mostly from the front */
+	while (num_mails > 3)
+	{
+		int pos = rand() % 4 ? rand() % (num_mails / 4 + 1) : rand() % num_mails;
+
+		CU_ASSERT_PTR_EQUAL_FATAL(mail_btree_remove_at(tree, pos), mails[pos]);
+		memmove(&mails[pos], &mails[pos + 1], (num_mails - pos - 1) * sizeof(mails[0]));
+		num_mails--;
+
+		if (num_mails % 1000 == 0)
+			test_mail_btree_check(tree, mails, num_mails);
+	}
+	CU_ASSERT_PTR_NULL(mail_btree_remove_at(tree, num_mails));
+	test_mail_btree_check(tree, mails, num_mails);
+
+	mail_btree_free(tree);
+	free(mails);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_btree_sorted(void)
+{
+	struct mail_info *mails;
+	struct mail_btree *tree;
+	int i;
+
+	mails = (struct mail_info *)malloc(TEST_NUM_MAILS * sizeof(mails[0]));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mails);
+	memset(mails, 0, TEST_NUM_MAILS * sizeof(mails[0]));
+
+	tree = mail_btree_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(tree);
+
+	srand(2);
+
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		int pos;
+
+		mails[i].size = rand() % 1000;
+		pos = mail_btree_insert_sorted(tree, &mails[i], test_mail_btree_compare);
+		CU_ASSERT_PTR_EQUAL(mail_btree_get(tree, pos), &mails[i]);
+
+		/* Equal mails are kept in the order of insertion */
+		if (pos + 1 < i + 1)
+			CU_ASSERT(mail_btree_get(tree, pos + 1)->size > mails[i].size);
+	}
+
+	for (i = 1; i < TEST_NUM_MAILS; i++)
+		CU_ASSERT(mail_btree_get(tree, i - 1)->size <= mail_btree_get(tree, i)->size);
+
+	for (i = 0; i < TEST_NUM_MAILS; i += 13)
+		CU_ASSERT_PTR_EQUAL(mail_btree_get(tree, mail_btree_find_sorted(tree, &mails[i], test_mail_btree_compare)), &mails[i]);
+
+	/* Mails whose key has been changed are still found */
+	mails[5].size = 5000;
+	CU_ASSERT_PTR_EQUAL(mail_btree_get(tree, mail_btree_find_sorted(tree, &mails[5], test_mail_btree_compare)), &mails[5]);
+
+	/* Remove the mails in a random order */
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		int pos = mail_btree_find_sorted(tree, &mails[(i * 7919) % TEST_NUM_MAILS], test_mail_btree_compare);
+		CU_ASSERT_PTR_EQUAL_FATAL(mail_btree_remove_at(tree, pos), &mails[(i * 7919) % TEST_NUM_MAILS]);
+	}
+	CU_ASSERT_EQUAL(mail_btree_count(tree), 0);
+	CU_ASSERT_EQUAL(mail_btree_find_sorted(tree, &mails[0], test_mail_btree_compare), -1);
+
+	mail_btree_free(tree);
+	free(mails);
+}
@@ -0,0 +1,421 @@
+/**
+ * mail_scan_benchmark.c - benchmark for SimpleMail's header scanner
+ * Copyright (C) 2026  Sebastian Bauer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file mail_scan_benchmark.c
+ *
+ * Measures the throughput of mail_scan_buffer() on synthetic header blocks
+ * with long Received and DKIM-Signature lines, once for each supported
+ * charscan implementation. The headers are fed in chunks of the given size,
+ * like mail_complete_create_from_file() does, and as a whole, like it is
+ * done for mails that are already in memory. The results are written to
+ * stdout as one JSON object per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "charscan.h"
+#include "mail.h"
+
+/*****************************************************************************/
+
+/**
+ * Describes an implementation that is benchmarked.
+ */
+struct benchmark_implementation
+{
+	const char *name;
+	int impl;
+};
+
+static struct benchmark_implementation benchmark_implementations[] =
+{
+	{"scalar", CHARSCAN_IMPL_SCALAR},
+	{"sse2", CHARSCAN_IMPL_SSE2},
+	{"avx2", CHARSCAN_IMPL_AVX2},
+};
+
+#define NUM_BENCHMARK_IMPLEMENTATIONS (sizeof(benchmark_implementations)/sizeof(benchmark_implementations[0]))
+
+/**
+ * A set of synthetic mails.
+ */
+struct benchmark_corpus
+{
+	char **texts;
+	int *lengths;
+	int num_mails;
+
+	/** Sum of the lengths of all texts */
+	long bytes;
+};
+
+/*****************************************************************************/
+
+/** State of the pseudo random number generator, fixed for reproducible runs */
+static unsigned int benchmark_random_state = 2463534242U;
+
+/**
+ * Returns a pseudo random number (xorshift).
+ *
+ * @return
+ */
+static unsigned int benchmark_random(void)
+{
+	unsigned int x = benchmark_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return benchmark_random_state = x;
+}
+
+/**
+ * Returns the current time in seconds.
+ *
+ * @return
+ */
+static double benchmark_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************************/
+
+/**
+ * Appends the given number of random base64 characters to the given buffer,
+ * folded like DKIM signatures usually are.
+ *
+ * @param buf where to append.
+ * @param len the number of characters.
+ * @return the end of the appended characters.
+ */
+static char *benchmark_append_base64(char *buf, int len)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	int i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (i && !(i % 70))
+			buf += sprintf(buf, "\r\n\t ");
+		*buf++ = alphabet[benchmark_random() % 64];
+	}
+	return buf;
+}
+
+/**
+ * Generates a synthetic mail with a header block that resembles the ones
+ * of today's mails.
+ *
+ * @param buf where to write the mail, must be large enough.
+ * @param id a number that identifies the mail.
+ * @return the length of the mail.
+ */
+static int benchmark_generate_mail(char *buf, int id)
+{
+	char *start = buf;
+	int i, num_received = 3 + benchmark_random() % 5;
+
+	for (i = 0; i < num_received; i++)
+	{
+		buf += sprintf(buf,
+			"Received: from mx%u.relay%u.example.org (mx%u.relay%u.example.org [10.%u.%u.%u])\r\n"
+			"\tby mail%u.example.com (Postfix) with ESMTPS id %08X%08X\r\n"
+			"\tfor <user%d@example.com>; Mon, %u Feb 2026 %02u:%02u:%02u +0100 (CET)\r\n",
+			benchmark_random() % 10, benchmark_random() % 100, benchmark_random() % 10, benchmark_random() % 100,
+			benchmark_random() % 256, benchmark_random() % 256, benchmark_random() % 256,
+			benchmark_random() % 10, benchmark_random(), benchmark_random(),
+			id, 1 + benchmark_random() % 28, benchmark_random() % 24, benchmark_random() % 60, benchmark_random() % 60);
+	}
+
+	buf += sprintf(buf,
+		"DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; d=example.org;\r\n"
+		"\ts=selector%u; t=%u; h=from:to:subject:date:message-id:mime-version:content-type;\r\n"
+		"\tbh=", benchmark_random() % 4, benchmark_random());
+	buf = benchmark_append_base64(buf, 44);
+	buf += sprintf(buf, ";\r\n\tb=");
+	buf = benchmark_append_base64(buf, 344);
+	buf += sprintf(buf, "\r\n");
+
+	buf += sprintf(buf,
+		"From: Sender %u <sender%u@example.org>\r\n"
+		"To: User %d <user%d@example.com>\r\n"
+		"Subject: Synthetic mail number %d for benchmarking the header scanner\r\n"
+		"Date: Mon, %u Feb 2026 %02u:%02u:%02u +0100\r\n"
+		"Message-ID: <%08X.%08X@example.org>\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"Content-Transfer-Encoding: 8bit\r\n"
+		"List-Unsubscribe: <https://example.org/unsubscribe?id=%08X%08X%08X>\r\n"
+		"\r\n"
+		"Hello,\r\n\r\nthis is the body of the mail, which is not scanned.\r\n",
+		benchmark_random() % 1000, benchmark_random() % 1000, id, id, id,
+		1 + benchmark_random() % 28, benchmark_random() % 24, benchmark_random() % 60, benchmark_random() % 60,
+		benchmark_random(), benchmark_random(), benchmark_random(), benchmark_random(), benchmark_random());
+
+	return buf - start;
+}
+
+/**
+ * Generates a corpus of the given number of synthetic mails.
+ *
+ * @param corpus the corpus to fill.
+ * @param num_mails the number of mails.
+ * @return 1 on success, 0 otherwise.
+ */
+static int benchmark_corpus_generate(struct benchmark_corpus *corpus, int num_mails)
+{
+	char buf[8192];
+	int i;
+
+	if (!(corpus->texts = (char **)malloc(num_mails * sizeof(corpus->texts[0]))))
+		return 0;
+	if (!(corpus->lengths = (int *)malloc(num_mails * sizeof(corpus->lengths[0]))))
+		return 0;
+
+	for (i = 0; i < num_mails; i++)
+	{
+		int len = benchmark_generate_mail(buf, i);
+
+		if (!(corpus->texts[i] = (char *)malloc(len)))
+			return 0;
+		memcpy(corpus->texts[i], buf, len);
+		corpus->lengths[i] = len;
+		corpus->num_mails++;
+		corpus->bytes += len;
+	}
+	return 1;
+}
+
+/**
+ * Frees all resources of the given corpus, but not the corpus itself.
+ *
+ * @param corpus the corpus to free.
+ */
+static void benchmark_corpus_free(struct benchmark_corpus *corpus)
+{
+	int i;
+
+	for (i = 0; i < corpus->num_mails; i++)
+		free(corpus->texts[i]);
+	free(corpus->lengths);
+	free(corpus->texts);
+}
+
+/*****************************************************************************/
+
+/**
+ * Scans the headers of all mails of the given corpus.
+ *
+ * @param corpus the corpus.
+ * @param chunk_size the size of the chunks that are fed to the scanner or 0
+ *  to feed the mails as a whole.
+ * @return the number of headers that have been found or -1 on failure.
+ */
+static long benchmark_scan(struct benchmark_corpus *corpus, int chunk_size)
+{
+	long num_headers = 0;
+	int i;
+
+	for (i = 0; i < corpus->num_mails; i++)
+	{
+		struct mail_complete *m;
+		struct mail_scan ms;
+		struct header *h;
+		int size = corpus->lengths[i];
+		int step = chunk_size ? chunk_size : size;
+		int pos;
+
+		if (!(m = mail_complete_create(NULL)))
+			return -1;
+		m->info->size = size;
+
+		mail_scan_buffer_start(&ms, m);
+		for (pos = 0; pos < size; pos += step)
+		{
+			if (!mail_scan_buffer(&ms, corpus->texts[i] + pos, size - pos < step ? size - pos : step))
+				break;
+		}
+		mail_scan_buffer_end(&ms);
+
+		for (h = (struct header *)list_first(&m->header_list); h; h = (struct header *)node_next(&h->node))
+			num_headers++;
+
+		mail_complete_free(m);
+	}
+	return num_headers;
+}
+
+/**
+ * Runs the benchmark for the given implementation and chunk size and prints
+ * the result.
+ *
+ * @param bimpl the implementation.
+ * @param corpus the corpus.
+ * @param chunk_size the chunk size, 0 for whole mails.
+ * @param repetitions how often the corpus is scanned, the fastest run counts.
+ * @return the number of headers that have been found or -1 on failure.
+ */
+static long benchmark_run(struct benchmark_implementation *bimpl, struct benchmark_corpus *corpus, int chunk_size, int repetitions)
+{
+	double best = -1;
+	long num_headers = -1;
+	int i;
+
+	charscan_select(bimpl->impl);
+
+	for (i = 0; i < repetitions; i++)
+	{
+		double start = benchmark_now();
+		double seconds;
+
+		if ((num_headers = benchmark_scan(corpus, chunk_size)) < 0)
+			return -1;
+		seconds = benchmark_now() - start;
+		if (best < 0 || seconds < best)
+			best = seconds;
+	}
+
+	printf("{\"implementation\": \"%s\", \"chunk_size\": %d, \"mails\": %d, \"bytes\": %ld, "
+		"\"headers\": %ld, \"seconds\": %.6f, \"mb_per_second\": %.1f}\n",
+		bimpl->name, chunk_size, corpus->num_mails, corpus->bytes,
+		num_headers, best, corpus->bytes / best / (1024 * 1024));
+	fflush(stdout);
+	return num_headers;
+}
+
+/*****************************************************************************/
+
+static void benchmark_usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-i implementation]... [-s chunk-size] [-m number-of-mails]\n"
+		"       [-r repetitions]\n"
+		"Implementations:", name);
+	{
+		int i;
+		for (i = 0; i < NUM_BENCHMARK_IMPLEMENTATIONS; i++)
+			fprintf(stderr, " %s", benchmark_implementations[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct benchmark_corpus corpus;
+	int selected[NUM_BENCHMARK_IMPLEMENTATIONS];
+	int num_selected = 0;
+	int chunk_size = 2048;
+	int num_mails = 5000;
+	int repetitions = 5;
+	long expected_headers = -1;
+	int failed = 0;
+	int i, j;
+
+	memset(selected, 0, sizeof(selected));
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' || !arg[1] || arg[2] || !val)
+		{
+			benchmark_usage(argv[0]);
+			return 1;
+		}
+		i++;
+
+		switch (arg[1])
+		{
+			case	'i':
+					for (j = 0; j < NUM_BENCHMARK_IMPLEMENTATIONS; j++)
+					{
+						if (!strcmp(benchmark_implementations[j].name, val))
+							break;
+					}
+					if (j == NUM_BENCHMARK_IMPLEMENTATIONS)
+					{
+						benchmark_usage(argv[0]);
+						return 1;
+					}
+					if (!selected[j]) num_selected++;
+					selected[j] = 1;
+					break;
+
+			case	's': chunk_size = atoi(val); break;
+			case	'm': num_mails = atoi(val); break;
+			case	'r': repetitions = atoi(val); break;
+
+			default:
+					benchmark_usage(argv[0]);
+					return 1;
+		}
+	}
+
+	if (chunk_size < 1 || num_mails < 1 || repetitions < 1)
+	{
+		benchmark_usage(argv[0]);
+		return 1;
+	}
+
+	memset(&corpus, 0, sizeof(corpus));
+	if (!benchmark_corpus_generate(&corpus, num_mails))
+	{
+		fprintf(stderr, "Couldn't generate the mails\n");
+		benchmark_corpus_free(&corpus);
+		return 1;
+	}
+
+	for (i = 0; i < NUM_BENCHMARK_IMPLEMENTATIONS; i++)
+	{
+		int k;
+
+		if (num_selected && !selected[i])
+			continue;
+
+		if (!charscan_supported(benchmark_implementations[i].impl))
+		{
+			fprintf(stderr, "Implementation %s is not supported\n", benchmark_implementations[i].name);
+			continue;
+		}
+
+		/* Chunked like files are read and as a whole like mails in memory */
+		for (k = 0; k < 2; k++)
+		{
+			long num_headers = benchmark_run(&benchmark_implementations[i], &corpus, k ? 0 : chunk_size, repetitions);
+
+			/* All implementations must find the same headers */
+			if (num_headers < 0 || (expected_headers >= 0 && num_headers != expected_headers))
+			{
+				fprintf(stderr, "Benchmark of %s failed\n", benchmark_implementations[i].name);
+				failed = 1;
+			}
+			expected_headers = num_headers;
+		}
+	}
+
+	benchmark_corpus_free(&corpus);
+	return failed;
+}
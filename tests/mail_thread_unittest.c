@@ -0,0 +1,257 @@
+/***************************************************************************
+ SimpleMail - Copyright (C) 2000 Hynek Schlawack and Sebastian Bauer
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+***************************************************************************/
+
+#include "mail_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+#include "mail.h"
+#include "support_indep.h"
+
+#define TEST_NUM_MAILS 5000
+
+/*******************************************************/
+
+static struct mail_info *test_mail_thread_create_mail(const char *message_id, const char *message_reply_id)
+{
+	struct mail_info *m = mail_info_create(NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	m->message_id = mystrdup(message_id);
+	m->message_reply_id = mystrdup(message_reply_id);
+	return m;
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_thread_links(void)
+{
+	struct mail_info *a = test_mail_thread_create_mail("a@simplemail", NULL);
+	struct mail_info *b = test_mail_thread_create_mail("b@simplemail", "A@SimpleMail");
+	struct mail_info *c = test_mail_thread_create_mail("c@simplemail", "b@simplemail");
+	struct mail_info *d = test_mail_thread_create_mail("d@simplemail", "a@simplemail");
+	struct mail_info *x = test_mail_thread_create_mail(NULL, NULL);
+	struct mail_info *dup = test_mail_thread_create_mail("a@simplemail", NULL);
+	struct mail_info *mails[6];
+	struct mail_thread *thread;
+
+	thread = mail_thread_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(thread);
+
+	/* Replies are added before the mails they reply to */
+	CU_ASSERT(mail_thread_add(thread, c) != 0);
+	CU_ASSERT(mail_thread_add(thread, b) != 0);
+	CU_ASSERT(mail_thread_add(thread, d) != 0);
+	CU_ASSERT(mail_thread_add(thread, x) != 0);
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, b));
+	CU_ASSERT_PTR_NULL(mail_thread_get_next_sibling(thread, b));
+	CU_ASSERT_PTR_NULL(mail_thread_lookup(thread, "a@simplemail"));
+
+	CU_ASSERT(mail_thread_add(thread, a) != 0);
+	CU_ASSERT_PTR_EQUAL(mail_thread_lookup(thread, "A@SIMPLEMAIL"), a);
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, a));
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_parent(thread, b), a);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_parent(thread, c), b);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_parent(thread, d), a);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_first_child(thread, a), b);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_next_sibling(thread, b), d);
+	CU_ASSERT_PTR_NULL(mail_thread_get_next_sibling(thread, d));
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_first_child(thread, b), c);
+	CU_ASSERT_PTR_NULL(mail_thread_get_first_child(thread, x));
+
+	/* The roots keep their order */
+	mails[0] = d; mails[1] = c; mails[2] = x; mails[3] = a; mails[4] = b;
+	CU_ASSERT(mail_thread_sort(thread, mails, 5) != 0);
+	CU_ASSERT_PTR_EQUAL(mails[0], x);
+	CU_ASSERT_PTR_EQUAL(mails[1], a);
+	CU_ASSERT_PTR_EQUAL(mails[2], b);
+	CU_ASSERT_PTR_EQUAL(mails[3], c);
+	CU_ASSERT_PTR_EQUAL(mails[4], d);
+
+	/* The array must consist of the added mails */
+	mails[0] = d; mails[1] = c; mails[2] = x; mails[3] = a; mails[4] = a;
+	CU_ASSERT_FALSE(mail_thread_sort(thread, mails, 5));
+	CU_ASSERT_PTR_EQUAL(mails[0], d);
+	CU_ASSERT_FALSE(mail_thread_sort(thread, mails, 4));
+
+	/* The reply to a removed mail becomes a root */
+	mail_thread_remove(thread, b);
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, c));
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_first_child(thread, a), d);
+	CU_ASSERT_PTR_NULL(mail_thread_lookup(thread, "b@simplemail"));
+	mails[0] = d; mails[1] = c; mails[2] = x; mails[3] = a;
+	CU_ASSERT(mail_thread_sort(thread, mails, 4) != 0);
+	CU_ASSERT_PTR_EQUAL(mails[0], c);
+	CU_ASSERT_PTR_EQUAL(mails[1], x);
+	CU_ASSERT_PTR_EQUAL(mails[2], a);
+	CU_ASSERT_PTR_EQUAL(mails[3], d);
+
+	/* ...and is linked again if the mail comes back */
+	CU_ASSERT(mail_thread_add(thread, b) != 0);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_parent(thread, c), b);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_next_sibling(thread, d), b);
+
+	/* A mail with a duplicated message id doesn't replace the first one */
+	CU_ASSERT(mail_thread_add(thread, dup) != 0);
+	CU_ASSERT_PTR_EQUAL(mail_thread_lookup(thread, "a@simplemail"), a);
+	mail_thread_remove(thread, dup);
+	mail_thread_remove(thread, dup);
+	CU_ASSERT_PTR_EQUAL(mail_thread_lookup(thread, "a@simplemail"), a);
+
+	mail_thread_remove(thread, a);
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, b));
+	CU_ASSERT_PTR_NULL(mail_thread_get_next_sibling(thread, d));
+
+	mail_thread_free(thread);
+
+	mail_info_free(a);
+	mail_info_free(b);
+	mail_info_free(c);
+	mail_info_free(d);
+	mail_info_free(x);
+	mail_info_free(dup);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_thread_loop(void)
+{
+	struct mail_info *e = test_mail_thread_create_mail("e@simplemail", "f@simplemail");
+	struct mail_info *f = test_mail_thread_create_mail("f@simplemail", "e@simplemail");
+	struct mail_info *g = test_mail_thread_create_mail("g@simplemail", "g@simplemail");
+	struct mail_info *mails[3];
+	struct mail_thread *thread;
+
+	thread = mail_thread_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(thread);
+
+	CU_ASSERT(mail_thread_add(thread, e) != 0);
+	CU_ASSERT(mail_thread_add(thread, f) != 0);
+	CU_ASSERT(mail_thread_add(thread, g) != 0);
+	CU_ASSERT_PTR_EQUAL(mail_thread_get_parent(thread, e), f);
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, f));
+	CU_ASSERT_PTR_NULL(mail_thread_get_parent(thread, g));
+
+	mails[0] = e; mails[1] = f; mails[2] = g;
+	CU_ASSERT(mail_thread_sort(thread, mails, 3) != 0);
+	CU_ASSERT_PTR_EQUAL(mails[0], f);
+	CU_ASSERT_PTR_EQUAL(mails[1], e);
+	CU_ASSERT_PTR_EQUAL(mails[2], g);
+
+	mail_thread_free(thread);
+
+	mail_info_free(e);
+	mail_info_free(f);
+	mail_info_free(g);
+}
+
+/*******************************************************/
+
+/* @Test */
+void test_mail_thread_many(void)
+{
+	struct mail_info **mails;
+	int *parents;
+	int *positions;
+	struct mail_thread *thread;
+	int num_mails = TEST_NUM_MAILS;
+	int i;
+
+	mails = (struct mail_info **)malloc(TEST_NUM_MAILS * sizeof(mails[0]));
+	parents = (int *)malloc(TEST_NUM_MAILS * sizeof(parents[0]));
+	positions = (int *)malloc(TEST_NUM_MAILS * sizeof(positions[0]));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mails);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(parents);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(positions);
+
+	srand(20);
+
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		char id[32], reply_id[32];
+
+		parents[i] = i > 0 && rand() % 4 ? rand() % i : -1;
+		sprintf(id, "%d@simplemail", i);
+		sprintf(reply_id, "%d@simplemail", parents[i]);
+		mails[i] = test_mail_thread_create_mail(id, parents[i] >= 0 ? reply_id : NULL);
+		mails[i]->size = i;
+	}
+
+	thread = mail_thread_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(thread);
+
+	/* Add the mails in a random order */
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+		CU_ASSERT(mail_thread_add(thread, mails[(i * 7919) % TEST_NUM_MAILS]) != 0);
+
+	/* Remove every third mail, the array keeps the order of the others */
+	for (i = 0; i < TEST_NUM_MAILS; i++)
+	{
+		if (i % 3 == 1)
+		{
+			mail_thread_remove(thread, mails[i]);
+			mail_info_free(mails[i]);
+		} else
+			mails[i - i / 3 - (i % 3 == 2)] = mails[i];
+	}
+	num_mails = TEST_NUM_MAILS - (TEST_NUM_MAILS + 1) / 3;
+
+	for (i = 0; i < num_mails; i++)
+	{
+		int p = parents[mails[i]->size];
+		struct mail_info *parent = mail_thread_get_parent(thread, mails[i]);
+
+		if (p >= 0 && p % 3 != 1)
+		{
+			CU_ASSERT_PTR_NOT_NULL(parent);
+			if (parent) CU_ASSERT_EQUAL(parent->size, p);
+		} else
+		{
+			CU_ASSERT_PTR_NULL(parent);
+		}
+	}
+
+	CU_ASSERT_FATAL(mail_thread_sort(thread, mails, num_mails) != 0);
+
+	/* A mail is followed by its first reply and preceded by its parent */
+	for (i = 0; i < num_mails; i++)
+		positions[mails[i]->size] = i;
+	for (i = 0; i < num_mails; i++)
+	{
+		struct mail_info *parent = mail_thread_get_parent(thread, mails[i]);
+		struct mail_info *child = mail_thread_get_first_child(thread, mails[i]);
+
+		if (child)
+			CU_ASSERT_PTR_EQUAL(mails[i + 1], child);
+		if (parent)
+			CU_ASSERT(positions[parent->size] < i);
+	}
+
+	mail_thread_free(thread);
+
+	for (i = 0; i < num_mails; i++)
+		mail_info_free(mails[i]);
+	free(positions);
+	free(parents);
+	free(mails);
+}
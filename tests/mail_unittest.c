@@ -19,11 +19,13 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 
 #include <CUnit/Basic.h>
 
+#include "charscan.h"
 #include "codesets.h"
 #include "mail.h"
 #include "support.h"
@@ -196,6 +198,101 @@ void test_mail_info_create_from_file_with_common_context(void)
 
 /*************************************************************/
 
+static const char test_mail_scan_buffer_mail[] =
+	"Received: from mx.def.ghi (mx.def.ghi [127.0.0.1])\r\n"
+	"\tby pop3.def.ghi with ESMTP id 0123456789abcdef0123456789abcdef\r\n"
+	"\tfor <xyz@localhost>; Thu, 01 Jan 1970 00:00:00 +0000\r\n"
+	"From: Test <abc@def.ghi>\n"
+	"Subject:\r\n"
+	"X-Empty:   \r\n"
+	"DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; d=def.ghi; s=selector;\r\n"
+	" h=from:to:subject:date; bh=AbCdEfGhIjKlMnOpQrStUvWxYz0123456789abcdefg=;\r\n"
+	" b=AbCdEfGhIjKlMnOpQrStUvWxYz0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKL\r\n"
+	"To: xyz@localhost\r\n"
+	"\r\n"
+	"Body: not a header\r\n";
+
+/**
+ * Scans the test mail in chunks of the given size and returns the headers
+ * as a single string.
+ */
+static void test_mail_scan_buffer_chunked(int chunk_size, string *headers, int *text_begin)
+{
+	struct mail_complete *m;
+	struct mail_scan ms;
+	struct header *h;
+	int size = sizeof(test_mail_scan_buffer_mail) - 1;
+	int pos;
+
+	m = mail_complete_create(NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	m->info->size = size;
+
+	mail_scan_buffer_start(&ms, m);
+	for (pos = 0; pos < size; pos += chunk_size)
+	{
+		/* The buffer is modifiable and doesn't continue after the chunk */
+		char chunk[64];
+		int len = size - pos < chunk_size ? size - pos : chunk_size;
+
+		memcpy(chunk, test_mail_scan_buffer_mail + pos, len);
+		if (!mail_scan_buffer(&ms, chunk, len))
+			break;
+	}
+	mail_scan_buffer_end(&ms);
+
+	string_crop(headers, 0, 0);
+	for (h = (struct header*)list_first(&m->header_list); h; h = (struct header*)node_next(&h->node))
+	{
+		string_append(headers, h->name);
+		string_append(headers, "=");
+		string_append(headers, h->contents);
+		string_append(headers, "|");
+	}
+	*text_begin = m->text_begin;
+
+	mail_complete_free(m);
+}
+
+/* @Test */
+void test_mail_scan_buffer_is_independent_of_chunks_and_charscan(void)
+{
+	static const int impls[] = {CHARSCAN_IMPL_SCALAR, CHARSCAN_IMPL_SSE2, CHARSCAN_IMPL_AVX2};
+	string expected, actual;
+	int expected_text_begin, text_begin;
+	int i, chunk_size;
+
+	CU_ASSERT_FATAL(string_initialize(&expected, 100) != 0);
+	CU_ASSERT_FATAL(string_initialize(&actual, 100) != 0);
+
+	charscan_select(CHARSCAN_IMPL_SCALAR);
+	test_mail_scan_buffer_chunked(64, &expected, &expected_text_begin);
+	CU_ASSERT_EQUAL(expected_text_begin, strstr(test_mail_scan_buffer_mail, "Body:") - test_mail_scan_buffer_mail);
+	CU_ASSERT(strstr(expected.str, "Subject=|") != NULL);
+	CU_ASSERT(strstr(expected.str, "|To=xyz@localhost|") != NULL);
+	CU_ASSERT(strstr(expected.str, "Body") == NULL);
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+	{
+		if (!charscan_supported(impls[i]))
+			continue;
+		charscan_select(impls[i]);
+
+		for (chunk_size = 1; chunk_size <= 64; chunk_size++)
+		{
+			test_mail_scan_buffer_chunked(chunk_size, &actual, &text_begin);
+			CU_ASSERT_STRING_EQUAL(actual.str, expected.str);
+			CU_ASSERT_EQUAL(text_begin, expected_text_begin);
+		}
+	}
+	charscan_select(-1);
+
+	free(actual.str);
+	free(expected.str);
+}
+
+/*************************************************************/
+
 static unsigned char *simple_mail_with_attachment_filename = "../attachment.eml";
 
 /* @Test */
@@ -263,6 +360,172 @@ void test_simple_mail_complete_with_attachment(void)
 
 /*************************************************************/
 
+/* @Test */
+void test_simple_mail_complete_with_attachment_write(void)
+{
+	struct mail_complete *m, *m2;
+	char buf[32];
+	FILE *fh;
+	int len;
+
+	m = mail_complete_create_from_file(NULL, simple_mail_with_attachment_filename);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	mail_read_contents(".", m);
+
+	m2 = mail_get_next(mail_get_next(m));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m2);
+
+	fh = tmpfile();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	CU_ASSERT(mail_decoded_data_write(m2, fh) != 0);
+
+	/* The attachment has been decoded while written */
+	CU_ASSERT_PTR_NULL(m2->decoded_data);
+
+	rewind(fh);
+	len = fread(buf, 1, sizeof(buf), fh);
+	CU_ASSERT_EQUAL(len, 11);
+	CU_ASSERT(!memcmp(buf, "attachment\n", 11));
+	fclose(fh);
+
+	mail_complete_free(m);
+}
+
+/*************************************************************/
+
+/* @Test */
+void test_mail_complete_free_frees_text_without_info(void)
+{
+	struct mail_complete *m;
+	struct mail_info *mi;
+
+	m = mail_complete_create_from_file(NULL, simple_mail_with_attachment_filename);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	mail_read_contents(".", m);
+	CU_ASSERT_PTR_NOT_NULL(m->text);
+	CU_ASSERT(m->text_owned);
+
+	/* Like done by users that borrow a mail info, the text must be freed
+	 * nevertheless */
+	mi = m->info;
+	m->info = NULL;
+	mail_complete_free(m);
+	mail_info_free(mi);
+}
+
+/*************************************************************/
+
+static const char test_nested_mail[] =
+	"From: Sebastian Bauer <mail@sebastianbauer.info>\n"
+	"To: Sebastian Bauer <mail@sebastianbauer.info>\n"
+	"Subject: Nested\n"
+	"MIME-Version: 1.0\n"
+	"Content-Type: multipart/mixed; boundary=\"outer\"\n"
+	"\n"
+	"--outer\n"
+	"Content-Type: text/plain\n"
+	"\n"
+	"First\n"
+	"--outer\n"
+	"Content-Type: multipart/alternative; boundary=\"inner\"\n"
+	"\n"
+	"--inner\n"
+	"Content-Type: text/plain\n"
+	"\n"
+	"Plain\n"
+	"--inner\n"
+	"Content-Type: text/html\n"
+	"\n"
+	"<b>Html</b>\n"
+	"--inner--\n"
+	"--outer\n"
+	"Content-Type: message/rfc822\n"
+	"\n"
+	"From: Sebastian Bauer <mail@sebastianbauer.info>\n"
+	"Subject: Embedded\n"
+	"\n"
+	"Embedded\n"
+	"--outer--\n";
+
+/**
+ * Checks whether the decoded data of the given mail is the given string.
+ *
+ * @param m the mail
+ * @param expected the expected contents
+ * @return 1 if the data matches, else 0.
+ */
+static int test_mail_decoded_data_equals(struct mail_complete *m, const char *expected)
+{
+	void *data;
+	int data_len;
+
+	mail_decoded_data(m, &data, &data_len);
+	return data_len == strlen(expected) && !memcmp(data, expected, data_len);
+}
+
+/* @Test */
+void test_mail_parts_are_created_on_demand(void)
+{
+	static const char * const expected_leafs[] = {"First", "Plain", "<b>Html</b>", "Embedded"};
+	struct mail_complete *m, *html, *embedded, *leaf;
+	FILE *fh;
+	int success;
+	int i;
+
+	success = codesets_init();
+	CU_ASSERT(success != 0);
+
+	fh = fopen("nested.eml", "wb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+	fputs(test_nested_mail, fh);
+	fclose(fh);
+
+	m = mail_complete_create_from_file(NULL, "nested.eml");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(m);
+	mail_read_contents(".", m);
+
+	/* Only the boundaries of the first level have been located */
+	CU_ASSERT_EQUAL_FATAL(m->num_multiparts, 3);
+	CU_ASSERT_PTR_NOT_NULL(m->part_offsets);
+	for (i = 0; i < 3; i++)
+		CU_ASSERT_PTR_NULL(m->multipart_array[i]);
+
+	/* Descending creates the parts on the path */
+	html = mail_find_content_type(m, "text", "html");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(html);
+	CU_ASSERT(test_mail_decoded_data_equals(html, "<b>Html</b>"));
+	CU_ASSERT_PTR_EQUAL(html->parent_mail, m->multipart_array[1]);
+	CU_ASSERT_EQUAL(m->multipart_array[1]->num_multiparts, 2);
+	CU_ASSERT_PTR_NULL(m->multipart_array[2]);
+
+	/* The embedded mail is decoded not before it is accessed */
+	embedded = mail_get_part(m, 2);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(embedded);
+	CU_ASSERT_STRING_EQUAL(embedded->content_type, "message");
+	CU_ASSERT_EQUAL(embedded->num_multiparts, 1);
+	CU_ASSERT_PTR_NULL(embedded->multipart_array[0]);
+	CU_ASSERT_PTR_EQUAL(mail_get_part(m, 2), embedded);
+	CU_ASSERT_PTR_NULL(mail_get_part(m, 3));
+	CU_ASSERT_PTR_NULL(mail_get_part(m, -1));
+
+	/* All leafs in depth-first order */
+	leaf = mail_get_next(m);
+	for (i = 0; i < sizeof(expected_leafs)/sizeof(expected_leafs[0]); i++)
+	{
+		CU_ASSERT_PTR_NOT_NULL_FATAL(leaf);
+		CU_ASSERT(test_mail_decoded_data_equals(leaf, expected_leafs[i]));
+		leaf = mail_get_next(leaf);
+	}
+	CU_ASSERT_PTR_NULL(leaf);
+	CU_ASSERT_PTR_EQUAL(mail_get_root(embedded->multipart_array[0]), m);
+
+	mail_complete_free(m);
+
+	codesets_cleanup();
+}
+
+/*************************************************************/
+
 /* @Test */
 void test_mail_compose_new(void)
 {
@@ -378,8 +641,8 @@ void test_mail_compose_new_with_attachment_can_be_read_again(void)
 
 	CU_ASSERT_EQUAL(m->num_multiparts, 2);
 
-	mail_decoded_data(m->multipart_array[0], &m1_data, &m1_data_len);
-	mail_decoded_data(m->multipart_array[1], &m2_data, &m2_data_len);
+	mail_decoded_data(mail_get_part(m, 0), &m1_data, &m1_data_len);
+	mail_decoded_data(mail_get_part(m, 1), &m2_data, &m2_data_len);
 
 	CU_ASSERT(m1_data != NULL);
 	CU_ASSERT(m2_data != NULL);
@@ -531,7 +531,8 @@ static void compose_add_mail(struct Compose_Data *data, struct mail *mail, struc
 
 	for (i=0;i<num_multiparts; i++)
 	{
-		compose_add_mail(data,mail->multipart_array[i],treenode);
+		struct mail *part = mail_get_part(mail,i);
+		if (part) compose_add_mail(data,part,treenode);
 	}
 }
 
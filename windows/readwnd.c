@@ -237,7 +237,8 @@ static void insert_mail(struct Read_Data *data, struct mail *mail)
 
 	for (i=0;i<mail->num_multiparts;i++)
 	{
-		insert_mail(data,mail->multipart_array[i]);
+		struct mail *part = mail_get_part(mail,i);
+		if (part) insert_mail(data,part);
 	}
 }
 